@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Company IDs (Bluetooth SIG) — little endian in manufacturer data bytes
+constexpr uint16_t CID_APPLE   = 0x004C;
+constexpr uint16_t CID_GOOGLE  = 0x00E0;
+constexpr uint16_t CID_SAMSUNG = 0x0075;
+constexpr uint16_t CID_XIAOMI  = 0x038F;
+
+// Service UUIDs for Find My devices
+constexpr uint16_t SVC_GOOGLE_FAST_PAIR  = 0xFEF3; // Google Fast Pair
+constexpr uint16_t SVC_APPLE_FIND_MY     = 0xFD6F; // Apple Find My
+constexpr uint16_t SVC_SAMSUNG_FIND      = 0xFD5A; // Samsung Find
+
+// Advertising report types (advTypeName): legacy PDUs, and one type for
+// every extended advertisement
+constexpr uint8_t ADV_TYPE_ADV_IND  = 0;
+constexpr uint8_t ADV_TYPE_SCAN_IND = 2;
+constexpr uint8_t ADV_TYPE_SCAN_RSP = 4;
+constexpr uint8_t ADV_TYPE_EXT      = 5;
+
+// AdvData of one legacy advertising PDU
+constexpr size_t LEGACY_ADV_DATA_MAX = 31;
+
+// PHYs as in HCI LE extended advertising reports
+constexpr uint8_t BLE_PHY_NONE  = 0;
+constexpr uint8_t BLE_PHY_1M    = 1;
+constexpr uint8_t BLE_PHY_2M    = 2;
+constexpr uint8_t BLE_PHY_CODED = 3;
+
+static inline const char* phyName(uint8_t phy) {
+  switch (phy) {
+    case BLE_PHY_1M:    return "1M";
+    case BLE_PHY_2M:    return "2M";
+    case BLE_PHY_CODED: return "CODED";
+    default:            return "-";
+  }
+}
+
+// AD structure types
+constexpr uint8_t AD_TYPE_SERVICE_DATA16 = 0x16;
+constexpr uint8_t AD_TYPE_MANUFACTURER   = 0xFF;
+
+// Calls fn(type, data, len) for each AD structure [len, type, data...] of an
+// advertising payload until it returns false. A truncated last structure is
+// skipped.
+template <typename Fn>
+static inline void forEachAdStructure(const uint8_t* payload, size_t len, Fn fn) {
+  size_t i = 0;
+  while (i < len) {
+    const size_t adLen = payload[i];
+    if (adLen == 0 || i + 1 + adLen > len) return;
+    if (!fn(payload[i + 1], payload + i + 2, adLen - 1)) return;
+    i += 1 + adLen;
+  }
+}
+
+static inline const char* advTypeName(uint8_t t) {
+  switch (t) {
+    case 0: return  "ADV_IND";
+    case 1: return  "DIR_IND";
+    case 2: return  "SCAN_IND";
+    case 3: return  "NONCONN";
+    case 4: return  "SCAN_RSP";
+    case 5: return  "EXT_ADV";
+    default: return "UNKNOWN";
+  }
+}
+
+static inline const char* companyName(uint16_t cid) {
+  switch (cid) {
+    case CID_APPLE:   return "Apple";
+    case CID_GOOGLE:  return "Google";
+    case CID_SAMSUNG: return "Samsung";
+    case CID_XIAOMI:  return "Xiaomi";
+    default:          return "Other";
+  }
+}
+
+// One-letter vendor code for compact output (Other = any unknown CID)
+static inline char companyCode(uint16_t cid) {
+  switch (cid) {
+    case CID_APPLE:   return 'A';
+    case CID_GOOGLE:  return 'G';
+    case CID_SAMSUNG: return 'S';
+    case CID_XIAOMI:  return 'X';
+    default:          return 'O';
+  }
+}
+
+static inline uint16_t companyFromCode(char code) {
+  switch (code) {
+    case 'A': return CID_APPLE;
+    case 'G': return CID_GOOGLE;
+    case 'S': return CID_SAMSUNG;
+    case 'X': return CID_XIAOMI;
+    default:  return 0xFFFF;
+  }
+}
+
+// Converts Service UUID to Manufacturer
+static inline uint16_t serviceToManufacturer(uint16_t serviceUuid) {
+  switch (serviceUuid) {
+    case SVC_GOOGLE_FAST_PAIR: return CID_GOOGLE;
+    case SVC_APPLE_FIND_MY:    return CID_APPLE;
+    case SVC_SAMSUNG_FIND:     return CID_SAMSUNG;
+    default:                   return 0xFFFF;
+  }
+}
+
+static inline uint16_t manufacturerToService(uint16_t cid) {
+  switch (cid) {
+    case CID_GOOGLE:  return SVC_GOOGLE_FAST_PAIR;
+    case CID_APPLE:   return SVC_APPLE_FIND_MY;
+    case CID_SAMSUNG: return SVC_SAMSUNG_FIND;
+    default:          return 0;
+  }
+}
+
+// Device type from service data (the first byte is the frame type)
+static inline const char* serviceFindMyType(uint16_t serviceUuid, const uint8_t* data, size_t len) {
+  switch (serviceUuid) {
+    case SVC_GOOGLE_FAST_PAIR:
+      if (len >= 1) {
+        switch (data[0]) {
+          case 0x11: return "FastPair/FindDevice";
+          case 0x10: return "FastPair/Generic";
+          default: return   "FastPair/Unknown";
+        }
+      }
+      return "FastPair";
+
+    case SVC_APPLE_FIND_MY:
+      return "FindMy/Service";
+
+    case SVC_SAMSUNG_FIND:
+      return "SmartTag/Service";
+
+    default:
+      return "Service/Unknown";
+  }
+}
+
+// Device type from manufacturer data: [CID_LOW, CID_HIGH, TYPE, ...]
+static inline const char* findMyType(uint16_t cid, const uint8_t* mfd, size_t len) {
+  if (len < 3) return "Unknown";
+
+  uint8_t type = mfd[2];
+
+  switch (cid) {
+    case CID_APPLE:
+      switch (type) {
+        case 0x12: return "FindMy/AirTag";
+        case 0x10: return "FindMy/Offline";
+        default: return "FindMy/Other";
+      }
+
+    case CID_GOOGLE:
+      switch (type) {
+        case 0x06: return "FastPair/FindMy";
+        default: return "FindMy/Other";
+      }
+
+    case CID_SAMSUNG:
+      switch (type) {
+        case 0x01: return "SmartTag";
+        case 0x02: return "SmartTag+";
+        case 0x42: return "SmartTag-Pro";
+        default: return "SmartTag/Other";
+      }
+
+    case CID_XIAOMI:
+      switch (type) {
+        case 0x30: return "Anti-Lost";
+        case 0x23: return "Mi-Tracker";
+        case 0x20: return "Mi-Tag";
+        case 0x10: return "Mi-Device";
+        default: return "FindMy/Other";
+      }
+
+    default:
+      return "Unknown";
+  }
+}
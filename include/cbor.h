@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "output_writer.h"
+
+// Minimal CBOR (RFC 8949) encoder/decoder for the record stream.
+// Only what the records need: unsigned/negative ints, byte and text strings,
+// definite-length maps, tags and the simple values true/false.
+
+namespace cbor {
+
+constexpr uint8_t MAJOR_UINT  = 0;
+constexpr uint8_t MAJOR_NINT  = 1;
+constexpr uint8_t MAJOR_BYTES = 2;
+constexpr uint8_t MAJOR_TEXT  = 3;
+constexpr uint8_t MAJOR_ARRAY = 4;
+constexpr uint8_t MAJOR_MAP   = 5;
+constexpr uint8_t MAJOR_TAG   = 6;
+constexpr uint8_t MAJOR_OTHER = 7;
+
+constexpr uint8_t SIMPLE_FALSE = 20;
+constexpr uint8_t SIMPLE_TRUE  = 21;
+
+// Self-described CBOR (tag 55799): lets tools recognise the stream
+constexpr uint32_t TAG_SELF_DESCRIBE = 55799;
+
+// --------- Encoder ---------
+
+static inline void head(OutWriter& w, uint8_t major, uint64_t v) {
+  const uint8_t m = (uint8_t)(major << 5);
+  if (v < 24) {
+    w.put((char)(m | v));
+  } else if (v <= 0xFF) {
+    w.put((char)(m | 24));
+    w.put((char)v);
+  } else if (v <= 0xFFFF) {
+    w.put((char)(m | 25));
+    w.put((char)(v >> 8));
+    w.put((char)v);
+  } else if (v <= 0xFFFFFFFFull) {
+    w.put((char)(m | 26));
+    for (int s = 24; s >= 0; s -= 8) w.put((char)(v >> s));
+  } else {
+    w.put((char)(m | 27));
+    for (int s = 56; s >= 0; s -= 8) w.put((char)(v >> s));
+  }
+}
+
+static inline void uint(OutWriter& w, uint64_t v) { head(w, MAJOR_UINT, v); }
+
+static inline void sint(OutWriter& w, int64_t v) {
+  if (v < 0) head(w, MAJOR_NINT, (uint64_t)(-1 - v));
+  else head(w, MAJOR_UINT, (uint64_t)v);
+}
+
+static inline void bytes(OutWriter& w, const uint8_t* data, size_t len) {
+  head(w, MAJOR_BYTES, len);
+  w.write(data, len);
+}
+
+static inline void text(OutWriter& w, const char* s, size_t len) {
+  head(w, MAJOR_TEXT, len);
+  w.write(s, len);
+}
+
+static inline void boolean(OutWriter& w, bool v) {
+  w.put((char)((MAJOR_OTHER << 5) | (v ? SIMPLE_TRUE : SIMPLE_FALSE)));
+}
+
+static inline void map(OutWriter& w, size_t pairs) { head(w, MAJOR_MAP, pairs); }
+static inline void tag(OutWriter& w, uint64_t t) { head(w, MAJOR_TAG, t); }
+
+// --------- Decoder ---------
+// Bounds-checked cursor over a buffer. Every read returns false when the
+// item is malformed or incomplete; the caller can then resync.
+struct Reader {
+  const uint8_t* p;
+  const uint8_t* end;
+
+  bool head(uint8_t& major, uint64_t& v) {
+    if (p >= end) return false;
+    const uint8_t ib = *p++;
+    major = ib >> 5;
+    const uint8_t info = ib & 0x1F;
+    if (info < 24) { v = info; return true; }
+    size_t n;
+    switch (info) {
+      case 24: n = 1; break;
+      case 25: n = 2; break;
+      case 26: n = 4; break;
+      case 27: n = 8; break;
+      default: return false;     // indefinite lengths are not used
+    }
+    if ((size_t)(end - p) < n) return false;
+    v = 0;
+    for (size_t i = 0; i < n; ++i) v = (v << 8) | *p++;
+    return true;
+  }
+
+  bool integer(int64_t& out) {
+    uint8_t major;
+    uint64_t v;
+    if (!head(major, v)) return false;
+    if (major == MAJOR_UINT) { out = (int64_t)v; return true; }
+    if (major == MAJOR_NINT) { out = -1 - (int64_t)v; return true; }
+    return false;
+  }
+
+  // Byte or text string, returned in place
+  bool string(uint8_t expectMajor, const uint8_t*& data, size_t& len) {
+    uint8_t major;
+    uint64_t v;
+    if (!head(major, v) || major != expectMajor) return false;
+    if ((uint64_t)(end - p) < v) return false;
+    data = p;
+    len = (size_t)v;
+    p += len;
+    return true;
+  }
+
+  bool boolean(bool& out) {
+    if (p >= end) return false;
+    const uint8_t ib = *p;
+    if (ib == ((MAJOR_OTHER << 5) | SIMPLE_TRUE)) out = true;
+    else if (ib == ((MAJOR_OTHER << 5) | SIMPLE_FALSE)) out = false;
+    else return false;
+    ++p;
+    return true;
+  }
+};
+
+} // namespace cbor
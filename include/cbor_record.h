@@ -0,0 +1,384 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "cbor.h"
+#include "crc16.h"
+#include "device_record.h"
+#include "event_record.h"
+#include "field_mask.h"
+#include "vendor_decode.h"
+
+// CBOR record layout: one definite-length map per record with small integer
+// keys (1 byte each on the wire). The stream starts with the self-describe
+// tag so off-the-shelf tools (cbor2, cbor-diag, ...) recognise it.
+//
+//   { 0: t (epoch ms), 1: cid, 2: tid, 3: "type", 4: h'addr (MSB first)',
+//     5: rssi (negative int), 6: adv, 7: conn, 8: scan, 9: src (0=mfd,1=svc),
+//     10: h'payload', 13: suppressed, 14: rssi min, 15: rssi max,
+//     16: primary PHY, 17: secondary PHY, 18: SID, 19: battery,
+//     20: separated, 21: state, 22: counter, 23: hint, 24: key id,
+//     11: seq, 12: crc }
+// Keys outside the channel's field mask are left out of the map, 16-18
+// only appear for extended advertising and 19-24 only when the vendor's data
+// carries them (vendor_decode.h). The crc
+// (CRC-16 as an unsigned int), always last, covers the record from the map
+// head up to key 12.
+enum CborKey : uint8_t {
+  CBOR_KEY_TIME    = 0,
+  CBOR_KEY_CID     = 1,
+  CBOR_KEY_TID     = 2,
+  CBOR_KEY_TYPE    = 3,
+  CBOR_KEY_ADDR    = 4,
+  CBOR_KEY_RSSI    = 5,
+  CBOR_KEY_ADV     = 6,
+  CBOR_KEY_CONN    = 7,
+  CBOR_KEY_SCAN    = 8,
+  CBOR_KEY_SRC     = 9,
+  CBOR_KEY_DATA    = 10,
+  CBOR_KEY_SEQ     = 11,
+  CBOR_KEY_CRC     = 12,
+  CBOR_KEY_FOLDED  = 13,
+  CBOR_KEY_RSSIMIN = 14,
+  CBOR_KEY_RSSIMAX = 15,
+  CBOR_KEY_PHY     = 16,
+  CBOR_KEY_PHY2    = 17,
+  CBOR_KEY_SID     = 18,
+  CBOR_KEY_BATTERY = 19,
+  CBOR_KEY_SEP     = 20,
+  CBOR_KEY_STATE   = 21,
+  CBOR_KEY_COUNTER = 22,
+  CBOR_KEY_HINT    = 23,
+  CBOR_KEY_KEYID   = 24,
+  CBOR_KEY_COUNT
+};
+
+struct CborFormat {
+  static void header(OutWriter& w) {
+    cbor::tag(w, cbor::TAG_SELF_DESCRIBE);
+  }
+
+  static void write(OutWriter& w, const DeviceRecord& r, uint16_t mask = FIELDS_RECORD, uint32_t seq = 0) {
+    const bool time = mask & FIELD_TIME, vendor = mask & FIELD_VENDOR, type = mask & FIELD_TYPE;
+    const bool addr = mask & FIELD_ADDR, rssi = mask & FIELD_RSSI, adv = mask & FIELD_ADV;
+    const bool conn = mask & FIELD_CONN, scan = mask & FIELD_SCAN, src = mask & FIELD_SOURCE;
+    const bool data = mask & FIELD_DATA, hasSeq = mask & FIELD_SEQ, hasCrc = mask & FIELD_CRC;
+    const bool fold = mask & FIELD_FOLD, phy = (mask & FIELD_PHY) && isExtended(r);
+    const uint8_t decoded = (mask & FIELD_DECODED) ? r.vendor.present : 0;
+    if (hasCrc) w.crcBegin();
+    cbor::map(w, time + vendor + 2 * type + addr + rssi + adv + conn + scan + src + data + 3 * fold +
+                 3 * phy + vendorFieldCount(decoded) + hasSeq + hasCrc);
+
+    if (time) {
+      cbor::uint(w, CBOR_KEY_TIME);
+      cbor::uint(w, (uint64_t)r.time.tv_sec * 1000u + (uint64_t)(r.time.tv_usec / 1000));
+    }
+    if (vendor) {
+      cbor::uint(w, CBOR_KEY_CID);
+      cbor::uint(w, r.manufacturer);
+    }
+    if (type) {
+      cbor::uint(w, CBOR_KEY_TID);
+      cbor::uint(w, r.typeId);
+      cbor::uint(w, CBOR_KEY_TYPE);
+      cbor::text(w, r.deviceType, strlen(r.deviceType));
+    }
+    if (addr) {
+      cbor::uint(w, CBOR_KEY_ADDR);
+      const uint8_t a[6] = { r.addr[5], r.addr[4], r.addr[3], r.addr[2], r.addr[1], r.addr[0] };
+      cbor::bytes(w, a, sizeof(a));
+    }
+    if (rssi) {
+      cbor::uint(w, CBOR_KEY_RSSI);
+      cbor::sint(w, r.rssi);
+    }
+    if (adv) {
+      cbor::uint(w, CBOR_KEY_ADV);
+      cbor::uint(w, r.advType);
+    }
+    if (conn) {
+      cbor::uint(w, CBOR_KEY_CONN);
+      cbor::boolean(w, r.isConnectable);
+    }
+    if (scan) {
+      cbor::uint(w, CBOR_KEY_SCAN);
+      cbor::boolean(w, r.isScannable);
+    }
+    if (src) {
+      cbor::uint(w, CBOR_KEY_SRC);
+      cbor::uint(w, (uint8_t)r.dataType);
+    }
+    if (data) {
+      cbor::uint(w, CBOR_KEY_DATA);
+      cbor::bytes(w, r.data, r.dataLen);
+    }
+    if (fold) {
+      cbor::uint(w, CBOR_KEY_FOLDED);
+      cbor::uint(w, r.suppressed);
+      cbor::uint(w, CBOR_KEY_RSSIMIN);
+      cbor::sint(w, foldedRssiMin(r));
+      cbor::uint(w, CBOR_KEY_RSSIMAX);
+      cbor::sint(w, foldedRssiMax(r));
+    }
+    if (phy) {
+      cbor::uint(w, CBOR_KEY_PHY);
+      cbor::uint(w, r.primaryPhy);
+      cbor::uint(w, CBOR_KEY_PHY2);
+      cbor::uint(w, r.secondaryPhy);
+      cbor::uint(w, CBOR_KEY_SID);
+      cbor::uint(w, r.sid);
+    }
+    if (decoded & VENDOR_BATTERY) {
+      cbor::uint(w, CBOR_KEY_BATTERY);
+      cbor::uint(w, r.vendor.battery);
+    }
+    if (decoded & VENDOR_SEPARATED) {
+      cbor::uint(w, CBOR_KEY_SEP);
+      cbor::uint(w, r.vendor.separated);
+    }
+    if (decoded & VENDOR_STATE) {
+      cbor::uint(w, CBOR_KEY_STATE);
+      cbor::uint(w, r.vendor.state);
+    }
+    if (decoded & VENDOR_COUNTER) {
+      cbor::uint(w, CBOR_KEY_COUNTER);
+      cbor::uint(w, r.vendor.counter);
+    }
+    if (decoded & VENDOR_HINT) {
+      cbor::uint(w, CBOR_KEY_HINT);
+      cbor::uint(w, r.vendor.hint);
+    }
+    if (decoded & VENDOR_KEY_ID) {
+      cbor::uint(w, CBOR_KEY_KEYID);
+      cbor::uint(w, r.vendor.keyId);
+    }
+    if (hasSeq) {
+      cbor::uint(w, CBOR_KEY_SEQ);
+      cbor::uint(w, seq);
+    }
+    if (hasCrc) {
+      const uint16_t crc = w.crcValue();
+      cbor::uint(w, CBOR_KEY_CRC);
+      cbor::uint(w, crc);
+    }
+  }
+};
+
+// Events use text keys so they never collide with device records:
+//   { "ev": "stats", "t": epoch ms, "<key>": int or text, ... }
+static void writeCborEvent(OutWriter& w, const EventRecord& e) {
+  cbor::map(w, 2 + e.count);
+  cbor::text(w, "ev", 2);
+  cbor::text(w, e.kind, strlen(e.kind));
+  cbor::text(w, "t", 1);
+  cbor::uint(w, (uint64_t)e.time.tv_sec * 1000u + (uint64_t)(e.time.tv_usec / 1000));
+  for (size_t i = 0; i < e.count; ++i) {
+    cbor::text(w, e.items[i].key, strlen(e.items[i].key));
+    if (e.items[i].text != nullptr) cbor::text(w, e.items[i].text, strlen(e.items[i].text));
+    else cbor::sint(w, e.items[i].value);
+  }
+}
+
+// Decodes an event map at rd.p. Keys and text values are copied, NUL
+// terminated, into `strings`. Returns false if the map is not an event.
+static inline bool decodeCborEvent(cbor::Reader& rd, EventRecord& out, char* strings, size_t stringsSize) {
+  uint8_t major;
+  uint64_t pairs;
+  if (!rd.head(major, pairs) || major != cbor::MAJOR_MAP || pairs < 2 || pairs > EventRecord::MAX_ITEMS + 2) return false;
+
+  size_t used = 0;
+  auto copyText = [&](const uint8_t* data, size_t len) -> const char* {
+    if (used + len + 1 > stringsSize) return nullptr;
+    char* dst = strings + used;
+    memcpy(dst, data, len);
+    dst[len] = '\0';
+    used += len + 1;
+    return dst;
+  };
+
+  out.count = 0;
+  out.kind = nullptr;
+  out.time = {};
+  for (uint64_t i = 0; i < pairs; ++i) {
+    const uint8_t* data;
+    size_t len;
+    if (!rd.string(cbor::MAJOR_TEXT, data, len)) return false;
+    const char* key = copyText(data, len);
+    if (key == nullptr) return false;
+
+    if (rd.p < rd.end && (*rd.p >> 5) == cbor::MAJOR_TEXT) {
+      if (!rd.string(cbor::MAJOR_TEXT, data, len)) return false;
+      const char* text = copyText(data, len);
+      if (text == nullptr) return false;
+      if (strcmp(key, "ev") == 0) out.kind = text;
+      else out.add(key, text);
+    } else {
+      int64_t v;
+      if (!rd.integer(v)) return false;
+      if (strcmp(key, "t") == 0) {
+        out.time.tv_sec = (time_t)(v / 1000);
+        out.time.tv_usec = (suseconds_t)((v % 1000) * 1000);
+      } else {
+        out.add(key, v);
+      }
+    }
+  }
+  return out.kind != nullptr;
+}
+
+// Decodes one record map at rd.p into `out`. String fields point into the
+// input buffer (deviceType is copied into typeBuf so it can be NUL
+// terminated). Unknown keys with integer values are skipped so the schema
+// can grow; keys left out by a field mask keep their zero value. Returns
+// false on malformed or incomplete input. `check`, if given, receives the
+// seq and crc keys, with the crc verified against the bytes read.
+static inline bool decodeCborRecord(cbor::Reader& rd, DeviceRecord& out,
+                                    char* typeBuf, size_t typeBufSize,
+                                    RecordCheck* check = nullptr) {
+  const uint8_t* start = rd.p;
+  RecordCheck found = {};
+  uint8_t major;
+  uint64_t pairs;
+  if (!rd.head(major, pairs) || major != cbor::MAJOR_MAP || pairs > 32) return false;
+
+  out = DeviceRecord{};
+  out.matched = true;
+  out.deviceType = "";
+  uint32_t seen = 0;
+
+  for (uint64_t i = 0; i < pairs; ++i) {
+    const uint8_t* keyStart = rd.p;
+    int64_t key;
+    if (!rd.integer(key)) return false;
+    int64_t v = 0;
+    const uint8_t* data = nullptr;
+    size_t len = 0;
+    bool flag = false;
+
+    switch (key) {
+      case CBOR_KEY_TIME:
+        if (!rd.integer(v) || v < 0) return false;
+        out.time.tv_sec = (time_t)(v / 1000);
+        out.time.tv_usec = (suseconds_t)((v % 1000) * 1000);
+        break;
+      case CBOR_KEY_CID:
+        if (!rd.integer(v)) return false;
+        out.manufacturer = (uint16_t)v;
+        break;
+      case CBOR_KEY_TID:
+        if (!rd.integer(v)) return false;
+        out.typeId = (uint8_t)v;
+        break;
+      case CBOR_KEY_TYPE:
+        if (!rd.string(cbor::MAJOR_TEXT, data, len) || typeBufSize == 0) return false;
+        if (len >= typeBufSize) len = typeBufSize - 1;
+        memcpy(typeBuf, data, len);
+        typeBuf[len] = '\0';
+        out.deviceType = typeBuf;
+        break;
+      case CBOR_KEY_ADDR:
+        if (!rd.string(cbor::MAJOR_BYTES, data, len) || len != 6) return false;
+        for (size_t b = 0; b < 6; ++b) out.addr[b] = data[5 - b];
+        break;
+      case CBOR_KEY_RSSI:
+        if (!rd.integer(v)) return false;
+        out.rssi = (int)v;
+        break;
+      case CBOR_KEY_ADV:
+        if (!rd.integer(v)) return false;
+        out.advType = (uint8_t)v;
+        break;
+      case CBOR_KEY_CONN:
+        if (!rd.boolean(flag)) return false;
+        out.isConnectable = flag;
+        break;
+      case CBOR_KEY_SCAN:
+        if (!rd.boolean(flag)) return false;
+        out.isScannable = flag;
+        break;
+      case CBOR_KEY_SRC:
+        if (!rd.integer(v)) return false;
+        out.dataType = v == 1 ? DataSource::SERVICE : DataSource::MANUFACTURER;
+        break;
+      case CBOR_KEY_DATA:
+        if (!rd.string(cbor::MAJOR_BYTES, data, len)) return false;
+        out.data = data;
+        out.dataLen = len;
+        break;
+      case CBOR_KEY_FOLDED:
+        if (!rd.integer(v)) return false;
+        out.suppressed = (uint16_t)v;
+        break;
+      case CBOR_KEY_RSSIMIN:
+        if (!rd.integer(v)) return false;
+        out.rssiMin = (int8_t)v;
+        break;
+      case CBOR_KEY_RSSIMAX:
+        if (!rd.integer(v)) return false;
+        out.rssiMax = (int8_t)v;
+        break;
+      case CBOR_KEY_PHY:
+        if (!rd.integer(v)) return false;
+        out.primaryPhy = (uint8_t)v;
+        break;
+      case CBOR_KEY_PHY2:
+        if (!rd.integer(v)) return false;
+        out.secondaryPhy = (uint8_t)v;
+        break;
+      case CBOR_KEY_SID:
+        if (!rd.integer(v)) return false;
+        out.sid = (uint8_t)v;
+        break;
+      case CBOR_KEY_BATTERY:
+        if (!rd.integer(v)) return false;
+        out.vendor.present |= VENDOR_BATTERY;
+        out.vendor.battery = (uint8_t)v;
+        break;
+      case CBOR_KEY_SEP:
+        if (!rd.integer(v)) return false;
+        out.vendor.present |= VENDOR_SEPARATED;
+        out.vendor.separated = (uint8_t)v;
+        break;
+      case CBOR_KEY_STATE:
+        if (!rd.integer(v)) return false;
+        out.vendor.present |= VENDOR_STATE;
+        out.vendor.state = (uint8_t)v;
+        break;
+      case CBOR_KEY_COUNTER:
+        if (!rd.integer(v)) return false;
+        out.vendor.present |= VENDOR_COUNTER;
+        out.vendor.counter = (uint32_t)v;
+        break;
+      case CBOR_KEY_HINT:
+        if (!rd.integer(v)) return false;
+        out.vendor.present |= VENDOR_HINT;
+        out.vendor.hint = (uint32_t)v;
+        break;
+      case CBOR_KEY_KEYID:
+        if (!rd.integer(v)) return false;
+        out.vendor.present |= VENDOR_KEY_ID;
+        out.vendor.keyId = (uint32_t)v;
+        break;
+      case CBOR_KEY_SEQ:
+        if (!rd.integer(v)) return false;
+        found.hasSeq = true;
+        found.seq = (uint32_t)v;
+        break;
+      case CBOR_KEY_CRC:
+        if (!rd.integer(v)) return false;
+        found.hasCrc = true;
+        found.crcOk = crc16(start, (size_t)(keyStart - start)) == (uint16_t)v;
+        break;
+      default:
+        if (!rd.integer(v)) return false;
+        break;
+    }
+    if (key >= 0 && key < 32) seen |= 1u << key;
+  }
+
+  if (check != nullptr) *check = found;
+  // A projected record may omit any key, but never all of them
+  return (seen & ((1u << CBOR_KEY_COUNT) - 1)) != 0;
+}
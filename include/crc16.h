@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), nibble table
+static inline uint16_t crc16Update(uint16_t crc, const uint8_t* data, size_t len) {
+  static const uint16_t table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+  };
+  for (size_t i = 0; i < len; ++i) {
+    crc = (uint16_t)((crc << 4) ^ table[((crc >> 12) ^ (data[i] >> 4)) & 0xF]);
+    crc = (uint16_t)((crc << 4) ^ table[((crc >> 12) ^ (data[i] & 0xF)) & 0xF]);
+  }
+  return crc;
+}
+
+static inline uint16_t crc16(const uint8_t* data, size_t len) {
+  return crc16Update(0xFFFF, data, len);
+}
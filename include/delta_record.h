@@ -0,0 +1,539 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "cbor_record.h"
+#include "device_record.h"
+#include "event_record.h"
+#include "field_mask.h"
+#include "keyed_lru.h"
+#include "output_writer.h"
+#include "vendor_decode.h"
+
+// Delta format: a stateful binary encoding for machine consumers.
+//
+// Each active device gets a one-byte session ID the first time it is seen
+// (a DEFINE record carrying everything). Later sightings carry only the ID,
+// the time since the previous record in the stream, an RSSI delta and, if
+// the payload changed, an XOR of it against the device's previous payload.
+// A device is re-defined every DELTA_KEYFRAME_RECORDS deltas or
+// DELTA_KEYFRAME_MS, so a decoder that joins late (or lost bytes) resyncs.
+//
+//   session  "FMD" 0x02 | checks             (decoder resets its table)
+//   DEFINE   D0 | id | t varint (epoch ms) | cid varint | tid | adv | flags |
+//            [phy | sid] | addr[6] (MSB first) | rssi (int8) | typeLen | type |
+//            len | payload
+//   SAME     D1 | id | dt varint | drssi zigzag varint
+//   XOR      D2 | id | dt varint | drssi zigzag varint | len |
+//            mask[(len+7)/8] (bit i: byte i changed) | changed XOR bytes
+//   EVENT    D4 | CBOR event map (see cbor_record.h)
+//
+// flags: bit0 connectable, bit1 scannable, bit2 service data, bit3 extended,
+// bits 4-5 addrType. Extended advertising (bit3) adds the PHY byte (primary
+// in the low nibble, secondary in the high one) and the advertising SID.
+//
+// A record with sightings folded into it by the rate limiter has tag bit 3
+// set (D8, D9, DA) and carries `suppressed varint | rssiMin | rssiMax (int8)`
+// right after its id. The channel's FIELD_FOLD bit turns this off.
+//
+// checks: bit0 seq, bit1 crc (from the channel's field mask). DEFINE, SAME
+// and XOR then end with the low 16 bits of the record counter (LE16) and the
+// CRC-16 of the record from its tag on (LE16). Version 0x01 streams have no
+// checks byte.
+
+constexpr uint8_t  DELTA_MAGIC[4]         = { 'F', 'M', 'D', 0x02 };
+constexpr uint8_t  DELTA_VERSION_PLAIN    = 0x01;
+constexpr uint8_t  DELTA_TAG_DEFINE       = 0xD0;
+constexpr uint8_t  DELTA_TAG_SAME         = 0xD1;
+constexpr uint8_t  DELTA_TAG_XOR          = 0xD2;
+constexpr uint8_t  DELTA_TAG_EVENT        = 0xD4;
+constexpr uint8_t  DELTA_TAG_FOLDED       = 0x08;   // on DEFINE, SAME and XOR
+constexpr size_t   DELTA_MAX_DEVICES      = 64;     // IDs 0..63
+constexpr size_t   DELTA_MAX_PAYLOAD      = 31;     // legacy advertising data
+constexpr uint8_t  DELTA_KEYFRAME_RECORDS = 32;
+constexpr uint32_t DELTA_KEYFRAME_MS      = 5000;
+
+constexpr uint8_t DELTA_FLAG_CONN    = 0x01;
+constexpr uint8_t DELTA_FLAG_SCAN    = 0x02;
+constexpr uint8_t DELTA_FLAG_SERVICE = 0x04;
+constexpr uint8_t DELTA_FLAG_EXT     = 0x08;
+
+constexpr uint8_t DELTA_CHECK_SEQ = 0x01;
+constexpr uint8_t DELTA_CHECK_CRC = 0x02;
+
+static inline void putVarint(OutWriter& w, uint64_t v) {
+  while (v >= 0x80) {
+    w.put((char)(0x80 | (v & 0x7F)));
+    v >>= 7;
+  }
+  w.put((char)v);
+}
+
+static inline uint64_t zigzag(int64_t v) {
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint8_t deltaFlags(const DeviceRecord& r) {
+  return (uint8_t)((r.isConnectable ? DELTA_FLAG_CONN : 0) |
+                   (r.isScannable ? DELTA_FLAG_SCAN : 0) |
+                   (r.dataType == DataSource::SERVICE ? DELTA_FLAG_SERVICE : 0) |
+                   (isExtended(r) ? DELTA_FLAG_EXT : 0) |
+                   ((r.addrType & 0x3) << 4));
+}
+
+struct DeltaFormat {
+  // What the decoder knows about a device
+  struct Device {
+    const char* deviceType;     // classifier strings are static
+    uint64_t definedMs;
+    uint16_t manufacturer;
+    uint8_t typeId;
+    uint8_t advType;
+    uint8_t flags;
+    uint8_t phy;                // extended only
+    uint8_t sid;
+    int8_t rssi;
+    uint8_t deltas;             // since the last DEFINE
+    uint8_t payloadLen;         // above DELTA_MAX_PAYLOAD: not kept, next is a DEFINE
+    uint8_t payload[DELTA_MAX_PAYLOAD];
+  };
+
+  struct Session {
+    KeyedLru<Device, DELTA_MAX_DEVICES> devices;
+    uint64_t clockMs;           // time of the previous record in the stream
+    uint8_t checks;
+    bool fold;
+  };
+
+  static void header(OutWriter& w, void* session, uint16_t mask = FIELDS_RECORD) {
+    Session& s = *new (session) Session();
+    s.checks = (uint8_t)(((mask & FIELD_SEQ) ? DELTA_CHECK_SEQ : 0) |
+                         ((mask & FIELD_CRC) ? DELTA_CHECK_CRC : 0));
+    s.fold = (mask & FIELD_FOLD) != 0;
+    w.write(DELTA_MAGIC, sizeof(DELTA_MAGIC));
+    w.put((char)s.checks);
+  }
+
+  static void write(OutWriter& w, const DeviceRecord& r, void* session, uint32_t seq = 0) {
+    Session& s = *(Session*)session;
+    if (s.checks & DELTA_CHECK_CRC) w.crcBegin();
+    const uint64_t t = (uint64_t)r.time.tv_sec * 1000u + (uint64_t)(r.time.tv_usec / 1000);
+    const uint8_t flags = deltaFlags(r);
+    const int8_t rssi = (int8_t)(r.rssi < -128 ? -128 : (r.rssi > 127 ? 127 : r.rssi));
+
+    bool inserted;
+    const uint64_t key = addressKey(r.addr, r.addrType) ^ ((uint64_t)flags << 56);
+    Device& d = s.devices.acquire(key, inserted);
+    const uint8_t id = (uint8_t)s.devices.slotOf(d);
+
+    const uint8_t phy = (uint8_t)((r.primaryPhy & 0x0F) | (r.secondaryPhy << 4));
+    const bool define = inserted ||
+                        r.dataLen > DELTA_MAX_PAYLOAD || d.payloadLen > DELTA_MAX_PAYLOAD ||
+                        d.phy != phy || d.sid != r.sid ||
+                        t < s.clockMs ||
+                        d.deltas >= DELTA_KEYFRAME_RECORDS ||
+                        t - d.definedMs >= DELTA_KEYFRAME_MS ||
+                        d.manufacturer != r.manufacturer || d.typeId != r.typeId ||
+                        d.advType != r.advType || d.deviceType != r.deviceType;
+    const uint8_t folded = s.fold && r.suppressed > 0 ? DELTA_TAG_FOLDED : 0;
+
+    if (define) {
+      w.put((char)(DELTA_TAG_DEFINE | folded));
+      w.put((char)id);
+      if (folded) writeFold(w, r);
+      putVarint(w, t);
+      putVarint(w, r.manufacturer);
+      w.put((char)r.typeId);
+      w.put((char)r.advType);
+      w.put((char)flags);
+      if (flags & DELTA_FLAG_EXT) {
+        w.put((char)phy);
+        w.put((char)r.sid);
+      }
+      for (int b = 5; b >= 0; --b) w.put((char)r.addr[b]);
+      w.put((char)rssi);
+      const size_t typeLen = strnlen(r.deviceType, 255);
+      w.put((char)typeLen);
+      w.write(r.deviceType, typeLen);
+      const size_t len = r.dataLen > 255 ? 255 : r.dataLen;
+      w.put((char)len);
+      w.write(r.data, len);
+
+      d.deviceType = r.deviceType;
+      d.definedMs = t;
+      d.manufacturer = r.manufacturer;
+      d.typeId = r.typeId;
+      d.advType = r.advType;
+      d.flags = flags;
+      d.phy = phy;
+      d.sid = r.sid;
+      d.deltas = 0;
+    } else {
+      const bool same = r.dataLen == d.payloadLen && memcmp(r.data, d.payload, r.dataLen) == 0;
+      w.put((char)((same ? DELTA_TAG_SAME : DELTA_TAG_XOR) | folded));
+      w.put((char)id);
+      if (folded) writeFold(w, r);
+      putVarint(w, t - s.clockMs);
+      putVarint(w, zigzag((int64_t)rssi - d.rssi));
+      if (!same) writeXor(w, d, r.data, r.dataLen);
+      ++d.deltas;
+    }
+
+    d.rssi = rssi;
+    d.payloadLen = (uint8_t)(r.dataLen > 255 ? 255 : r.dataLen);
+    if (d.payloadLen <= DELTA_MAX_PAYLOAD) memcpy(d.payload, r.data, d.payloadLen);
+    s.clockMs = t;
+
+    if (s.checks & DELTA_CHECK_SEQ) putLe16(w, (uint16_t)seq);
+    if (s.checks & DELTA_CHECK_CRC) putLe16(w, w.crcValue());
+  }
+
+  static void event(OutWriter& w, const EventRecord& e) {
+    w.put((char)DELTA_TAG_EVENT);
+    writeCborEvent(w, e);
+  }
+
+private:
+  static void writeFold(OutWriter& w, const DeviceRecord& r) {
+    putVarint(w, r.suppressed);
+    w.put((char)r.rssiMin);
+    w.put((char)r.rssiMax);
+  }
+
+  // Payload against the previous one; a length change XORs against zeros
+  static void writeXor(OutWriter& w, const Device& d, const uint8_t* data, size_t len) {
+    uint8_t x[DELTA_MAX_PAYLOAD];
+    uint8_t mask[(DELTA_MAX_PAYLOAD + 7) / 8] = {};
+    for (size_t i = 0; i < len; ++i) {
+      x[i] = data[i] ^ (i < d.payloadLen ? d.payload[i] : 0);
+      if (x[i] != 0) mask[i / 8] |= (uint8_t)(1u << (i % 8));
+    }
+    w.put((char)len);
+    w.write(mask, (len + 7) / 8);
+    for (size_t i = 0; i < len; ++i) {
+      if (x[i] != 0) w.put((char)x[i]);
+    }
+  }
+};
+
+// Host-side reconstruction. feed() takes the stream from the start of a
+// record and reports the bytes consumed in `used`. Records for IDs that were
+// not defined yet (decoder joined mid-stream) are skipped. After malformed
+// input every ID is forgotten and the decoder scans byte by byte until a
+// plausible DEFINE (a keyframe) puts it back in step.
+//
+// With record checks a CRC mismatch counts as malformed input, and a gap in
+// the sequence also forgets every ID: a lost delta would otherwise leave the
+// device's payload silently wrong. A delta whose CRC verifies is enough to
+// resync on (its ID stays unknown until the next DEFINE). check() describes
+// the last record read.
+class DeltaDecoder {
+public:
+  enum class Result { RECORD, EVENT, SESSION, SKIPPED, NEED_MORE, BAD };
+
+  struct Stats {
+    unsigned long defines = 0;
+    unsigned long deltas = 0;
+    unsigned long unknownId = 0;
+    unsigned long events = 0;
+    unsigned long crcErrors = 0;
+    unsigned long gaps = 0;
+  };
+
+  Result feed(const uint8_t* p, size_t n, size_t& used) {
+    used = 0;
+    if (n == 0) return Result::NEED_MORE;
+    Cursor c = { p, p + n };
+
+    if (p[0] == DELTA_MAGIC[0]) {
+      if (n < sizeof(DELTA_MAGIC)) return Result::NEED_MORE;
+      if (memcmp(p, DELTA_MAGIC, 3) != 0) return bad(used);
+      if (p[3] == DELTA_VERSION_PLAIN) {
+        checks_ = 0;
+        used = sizeof(DELTA_MAGIC);
+      } else {
+        if (p[3] != DELTA_MAGIC[3]) return bad(used);
+        if (n < sizeof(DELTA_MAGIC) + 1) return Result::NEED_MORE;
+        if ((p[4] & ~(DELTA_CHECK_SEQ | DELTA_CHECK_CRC)) != 0) return bad(used);
+        checks_ = p[4];
+        used = sizeof(DELTA_MAGIC) + 1;
+      }
+      for (Slot& s : slots_) s.defined = false;
+      synced_ = true;
+      haveSeq_ = false;
+      return Result::SESSION;
+    }
+    // Fold bit only on the three record tags
+    const uint8_t base = (uint8_t)(p[0] & ~DELTA_TAG_FOLDED);
+    const bool folded = p[0] != base && base >= DELTA_TAG_DEFINE && base <= DELTA_TAG_XOR;
+    const uint8_t tag = folded ? base : p[0];
+    // Resync on a keyframe, or on any record whose CRC verifies
+    const bool checkedDelta = (checks_ & DELTA_CHECK_CRC) && (tag == DELTA_TAG_SAME || tag == DELTA_TAG_XOR);
+    if (!synced_ && tag != DELTA_TAG_DEFINE && !checkedDelta) return bad(used);
+
+    c.p++;
+    Result res;
+    if (tag == DELTA_TAG_DEFINE) res = readDefine(c, p, folded);
+    else if (tag == DELTA_TAG_SAME || tag == DELTA_TAG_XOR) res = readDelta(c, p, folded, tag == DELTA_TAG_XOR);
+    else if (tag == DELTA_TAG_EVENT) res = readEvent(c);
+    else return bad(used);
+
+    if (res == Result::NEED_MORE) return res;
+    if (res == Result::BAD) return bad(used);
+    used = (size_t)(c.p - p);
+    return res;
+  }
+
+  const DeviceRecord& record() const { return record_; }
+  const EventRecord& event() const { return event_; }
+  const Stats& stats() const { return stats_; }
+  const RecordCheck& check() const { return check_; }
+
+private:
+  struct Cursor {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool need = false;
+
+    bool byte(uint8_t& v) {
+      if (p >= end) { need = true; return false; }
+      v = *p++;
+      return true;
+    }
+
+    bool varint(uint64_t& v) {
+      v = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b;
+        if (!byte(b)) return false;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) return true;
+      }
+      return false;
+    }
+
+    bool le16(uint16_t& v) {
+      uint8_t lo, hi;
+      if (!byte(lo) || !byte(hi)) return false;
+      v = (uint16_t)(lo | (hi << 8));
+      return true;
+    }
+
+    bool bytes(uint8_t* dst, size_t len) {
+      if ((size_t)(end - p) < len) { need = true; return false; }
+      memcpy(dst, p, len);
+      p += len;
+      return true;
+    }
+  };
+
+  struct Slot {
+    bool defined;
+    DeviceRecord r;
+    char type[64];
+    uint8_t payload[255];
+  };
+
+  Result fail(const Cursor& c) { return c.need ? Result::NEED_MORE : Result::BAD; }
+
+  Result bad(size_t& used) {
+    if (synced_) {
+      for (Slot& s : slots_) s.defined = false;
+      synced_ = false;
+    }
+    haveSeq_ = false;
+    used = 1;
+    return Result::BAD;
+  }
+
+  // Seq and CRC trailer of the record that started at `start`
+  Result readChecks(Cursor& c, const uint8_t* start) {
+    check_ = RecordCheck{};
+    if (checks_ & DELTA_CHECK_SEQ) {
+      uint16_t seq;
+      if (!c.le16(seq)) return fail(c);
+      check_.hasSeq = true;
+      check_.seq = seq;
+    }
+    if (checks_ & DELTA_CHECK_CRC) {
+      const size_t covered = (size_t)(c.p - start);
+      uint16_t crc;
+      if (!c.le16(crc)) return fail(c);
+      check_.hasCrc = true;
+      check_.crcOk = crc16(start, covered) == crc;
+      if (!check_.crcOk) {
+        ++stats_.crcErrors;
+        return Result::BAD;
+      }
+    }
+    return Result::RECORD;
+  }
+
+  Result readFold(Cursor& c, bool folded) {
+    fold_ = Fold{};
+    if (!folded) return Result::RECORD;
+    uint64_t count;
+    uint8_t lo, hi;
+    if (!c.varint(count) || !c.byte(lo) || !c.byte(hi)) return fail(c);
+    if (count == 0 || count > 0xFFFF || (int8_t)lo > (int8_t)hi) return Result::BAD;
+    fold_ = { (uint16_t)count, (int8_t)lo, (int8_t)hi };
+    return Result::RECORD;
+  }
+
+  // False after a gap in the sequence, with every ID forgotten
+  bool inSequence() {
+    if (!check_.hasSeq) return true;
+    const bool gap = haveSeq_ && check_.seq != (uint16_t)(lastSeq_ + 1);
+    haveSeq_ = true;
+    lastSeq_ = (uint16_t)check_.seq;
+    if (!gap) return true;
+    ++stats_.gaps;
+    for (Slot& s : slots_) s.defined = false;
+    return false;
+  }
+
+  Result readDefine(Cursor& c, const uint8_t* start, bool folded) {
+    uint8_t id, tid, adv, flags, phy = 0, sid = 0, rssi, typeLen, len;
+    uint64_t t, cid;
+    uint8_t addr[6];
+    char type[sizeof(Slot::type)];
+    uint8_t payload[sizeof(Slot::payload)];
+    if (!c.byte(id)) return fail(c);
+    const Result fold = readFold(c, folded);
+    if (fold != Result::RECORD) return fold;
+    if (!c.varint(t) || !c.varint(cid) || !c.byte(tid) || !c.byte(adv) || !c.byte(flags)) return fail(c);
+    if ((flags & DELTA_FLAG_EXT) && (!c.byte(phy) || !c.byte(sid))) return fail(c);
+    if (!c.bytes(addr, 6) || !c.byte(rssi) || !c.byte(typeLen)) return fail(c);
+    // Structural checks keep a resync from locking onto payload bytes. The
+    // time is not one of them: it is ms since boot until the clock is set.
+    if (id >= DELTA_MAX_DEVICES || (flags & 0xC0) != 0 || typeLen >= sizeof(Slot::type)) return Result::BAD;
+    if ((flags & DELTA_FLAG_EXT) && ((phy & 0x0F) == 0 || (phy & 0x0F) > 3 || (phy >> 4) > 3)) return Result::BAD;
+    if (!c.bytes((uint8_t*)type, typeLen)) return fail(c);
+    for (uint8_t i = 0; i < typeLen; ++i) {
+      if (type[i] < 0x20 || type[i] > 0x7E) return Result::BAD;
+    }
+    if (!c.byte(len) || !c.bytes(payload, len)) return fail(c);
+    const Result checked = readChecks(c, start);
+    if (checked != Result::RECORD) return checked;
+    inSequence();
+
+    Slot& s = slots_[id];
+    memcpy(s.type, type, typeLen);
+    s.type[typeLen] = '\0';
+    memcpy(s.payload, payload, len);
+
+    DeviceRecord& r = s.r;
+    r = DeviceRecord{};
+    r.matched = true;
+    r.manufacturer = (uint16_t)cid;
+    r.typeId = tid;
+    r.deviceType = s.type;
+    for (int b = 0; b < 6; ++b) r.addr[b] = addr[5 - b];
+    r.addrType = (uint8_t)((flags >> 4) & 0x3);
+    r.rssi = (int8_t)rssi;
+    r.advType = adv;
+    r.primaryPhy = (uint8_t)(phy & 0x0F);
+    r.secondaryPhy = (uint8_t)(phy >> 4);
+    r.sid = sid;
+    r.isConnectable = (flags & DELTA_FLAG_CONN) != 0;
+    r.isScannable = (flags & DELTA_FLAG_SCAN) != 0;
+    r.dataType = (flags & DELTA_FLAG_SERVICE) ? DataSource::SERVICE : DataSource::MANUFACTURER;
+    r.data = s.payload;
+    r.dataLen = len;
+    decodeVendor(r);    // not on the wire; the payload carries it
+    s.defined = true;
+
+    synced_ = true;
+    clockMs_ = t;
+    emit(s.r);
+    ++stats_.defines;
+    return Result::RECORD;
+  }
+
+  Result readDelta(Cursor& c, const uint8_t* start, bool folded, bool hasXor) {
+    uint8_t id;
+    uint64_t dt, drssi;
+    if (!c.byte(id)) return fail(c);
+    const Result fold = readFold(c, folded);
+    if (fold != Result::RECORD) return fold;
+    if (!c.varint(dt) || !c.varint(drssi)) return fail(c);
+    if (id >= DELTA_MAX_DEVICES) return Result::BAD;
+
+    uint8_t len = 0;
+    uint8_t mask[32] = {};
+    uint8_t x[255] = {};
+    if (hasXor) {
+      if (!c.byte(len) || !c.bytes(mask, (len + 7) / 8)) return fail(c);
+      for (size_t i = 0; i < len; ++i) {
+        if ((mask[i / 8] >> (i % 8)) & 1) {
+          if (!c.byte(x[i])) return fail(c);
+        }
+      }
+    }
+    const Result checked = readChecks(c, start);
+    if (checked != Result::RECORD) return checked;
+    synced_ = true;
+
+    clockMs_ += dt;
+    Slot& s = slots_[id];
+    if (!inSequence() || !s.defined) {
+      ++stats_.unknownId;
+      return Result::SKIPPED;
+    }
+    if (hasXor) {
+      for (size_t i = 0; i < len; ++i) s.payload[i] = (i < s.r.dataLen ? s.payload[i] : 0) ^ x[i];
+      s.r.dataLen = len;
+      decodeVendor(s.r);
+    }
+    s.r.rssi += (int)unzigzag(drssi);
+    emit(s.r);
+    ++stats_.deltas;
+    return Result::RECORD;
+  }
+
+  Result readEvent(Cursor& c) {
+    cbor::Reader rd = { c.p, c.end };
+    if (!decodeCborEvent(rd, event_, eventStrings_, sizeof(eventStrings_))) {
+      // An event never exceeds the buffer the caller keeps; treat short input as more
+      return (c.end - c.p) < 1024 ? Result::NEED_MORE : Result::BAD;
+    }
+    c.p = rd.p;
+    ++stats_.events;
+    return Result::EVENT;
+  }
+
+  void emit(const DeviceRecord& r) {
+    record_ = r;
+    record_.time.tv_sec = (time_t)(clockMs_ / 1000);
+    record_.time.tv_usec = (suseconds_t)((clockMs_ % 1000) * 1000);
+    record_.suppressed = fold_.count;
+    record_.rssiMin = fold_.rssiMin;
+    record_.rssiMax = fold_.rssiMax;
+  }
+
+  struct Fold {
+    uint16_t count;
+    int8_t rssiMin;
+    int8_t rssiMax;
+  };
+
+  Slot slots_[DELTA_MAX_DEVICES] = {};
+  Fold fold_ = {};
+  bool synced_ = false;
+  uint8_t checks_ = 0;
+  bool haveSeq_ = false;
+  uint16_t lastSeq_ = 0;
+  RecordCheck check_ = {};
+  uint64_t clockMs_ = 0;
+  DeviceRecord record_ = {};
+  EventRecord event_;
+  char eventStrings_[1024];
+  Stats stats_;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/time.h>
+
+#include "ble_ids.h"
+
+// Where the matched bytes came from
+enum class DataSource : uint8_t {
+  MANUFACTURER,   // manufacturer specific data (CID + type + ...)
+  SERVICE         // 16-bit service data
+};
+
+static inline const char* dataSourceName(DataSource s) {
+  return s == DataSource::SERVICE ? "Service" : "Manufacturer";
+}
+
+// Typed fields a vendor decoder (vendor_decode.h) found in the data;
+// `present` has a VENDOR_* bit for each one that is set
+struct VendorFields {
+  uint8_t present;
+  uint8_t battery;          // 0 = full, 1 = medium, 2 = low, 3 = critical
+  uint8_t separated;        // 1 = away from its owner
+  uint8_t state;            // the vendor's status byte
+  uint32_t counter;         // rotation / aging counter
+  uint32_t hint;            // key hint bytes, first byte most significant
+  uint32_t keyId;           // hash of the advertised public key
+};
+
+// One matched advertisement, as handed to the output formatters.
+// Raw values only: strings such as the address or the hex dump are produced
+// by the formatters while writing, never stored.
+struct DeviceRecord {
+  struct timeval time;
+  bool matched;             // false: raw capture of a non Find My report
+  uint16_t manufacturer;
+  uint8_t typeId;           // vendor type byte (mfd[2] or service data[0])
+  const char* deviceType;
+  uint8_t addr[6];          // NimBLE order (LSB first)
+  uint8_t addrType;         // 0 = public, 1 = random
+  int rssi;
+  uint8_t advType;          // ADV_TYPE_EXT for extended advertising
+  uint8_t primaryPhy;       // extended only (ble_ids.h BLE_PHY_*); legacy is 1M
+  uint8_t secondaryPhy;     // extended only: PHY of the auxiliary packets, 0 = none
+  uint8_t sid;              // extended only: advertising set ID
+  bool isConnectable;
+  bool isScannable;
+  DataSource dataType;
+  const uint8_t* data;      // manufacturer or service data bytes
+  size_t dataLen;
+  VendorFields vendor;      // decoded from data when the record was classified
+  const uint8_t* payload;   // full advertising payload (all AD structures)
+  size_t payloadLen;
+  uint8_t scanRspLen;       // trailing payload bytes from a merged scan response (scan_merge.h)
+  uint16_t suppressed;      // earlier sightings folded into this record (rate_limiter.h)
+  int8_t rssiMin;           // RSSI range over this and the folded sightings
+  int8_t rssiMax;
+};
+
+static inline bool isExtended(const DeviceRecord& r) { return r.advType == ADV_TYPE_EXT; }
+
+// RSSI range of a record; without folded sightings it is the record's own
+static inline int foldedRssiMin(const DeviceRecord& r) { return r.suppressed > 0 ? r.rssiMin : r.rssi; }
+static inline int foldedRssiMax(const DeviceRecord& r) { return r.suppressed > 0 ? r.rssiMax : r.rssi; }
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/time.h>
+
+// Non-device records (periodic stats, status changes, ...): a kind plus a
+// flat list of key/value pairs. Each output format renders it in its own
+// shape, next to the device records.
+struct EventRecord {
+  static constexpr size_t MAX_ITEMS = 64;
+
+  struct Item {
+    const char* key;
+    int64_t value;
+    const char* text;     // non-null: string value instead of `value`
+  };
+
+  struct timeval time;
+  const char* kind;       // lower case, e.g. "stats"
+  Item items[MAX_ITEMS];
+  size_t count = 0;
+
+  void add(const char* key, int64_t value) {
+    if (count < MAX_ITEMS) items[count++] = Item{ key, value, nullptr };
+  }
+
+  void add(const char* key, const char* text) {
+    if (count < MAX_ITEMS) items[count++] = Item{ key, 0, text };
+  }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Field projection: which record columns a channel emits. Formatters skip
+// the columns that are not requested, so their text (hex dumps, names) is
+// never produced.
+enum FieldBit : uint16_t {
+  FIELD_TIME    = 1u << 0,
+  FIELD_VENDOR  = 1u << 1,   // manufacturer / company id
+  FIELD_TYPE    = 1u << 2,   // device type string and type byte
+  FIELD_ADDR    = 1u << 3,
+  FIELD_RSSI    = 1u << 4,
+  FIELD_ADV     = 1u << 5,   // PDU type
+  FIELD_CONN    = 1u << 6,
+  FIELD_SCAN    = 1u << 7,
+  FIELD_SOURCE  = 1u << 8,   // manufacturer vs service data
+  FIELD_DATA    = 1u << 9,   // payload hex
+  FIELD_SEQ     = 1u << 10,  // per-channel record sequence number
+  FIELD_CRC     = 1u << 11,  // CRC-16 over the record's bytes
+  FIELD_FOLD    = 1u << 12,  // sightings folded in by the rate limiter, RSSI range
+  FIELD_PHY     = 1u << 13,  // PHY and advertising set ID of extended advertising
+  FIELD_DECODED = 1u << 14,  // vendor fields decoded from the data (vendor_decode.h)
+};
+
+// Columns that describe the advertisement; seq and crc describe the link
+constexpr uint16_t FIELDS_RECORD = 0x03FF | FIELD_FOLD | FIELD_PHY | FIELD_DECODED;
+constexpr uint16_t FIELDS_ALL    = FIELDS_RECORD | FIELD_SEQ | FIELD_CRC;
+
+struct FieldName {
+  uint16_t bit;
+  const char* name;
+};
+
+static const FieldName FIELD_NAMES[] = {
+  { FIELD_TIME,    "time" },
+  { FIELD_VENDOR,  "vendor" },
+  { FIELD_TYPE,    "type" },
+  { FIELD_ADDR,    "addr" },
+  { FIELD_RSSI,    "rssi" },
+  { FIELD_ADV,     "adv" },
+  { FIELD_CONN,    "conn" },
+  { FIELD_SCAN,    "scan" },
+  { FIELD_SOURCE,  "source" },
+  { FIELD_DATA,    "data" },
+  { FIELD_SEQ,     "seq" },
+  { FIELD_CRC,     "crc" },
+  { FIELD_FOLD,    "fold" },
+  { FIELD_PHY,     "phy" },
+  { FIELD_DECODED, "decoded" },
+};
+
+// What a decoder found in a record's seq and crc columns
+struct RecordCheck {
+  bool hasSeq;
+  bool hasCrc;
+  bool crcOk;
+  uint32_t seq;     // binary formats carry the low 16 bits only
+};
+
+// "time,vendor,addr,rssi" or "all" -> mask. Returns 0 on an unknown name.
+static inline uint16_t parseFieldList(const char* list) {
+  if (strcmp(list, "all") == 0) return FIELDS_ALL;
+  uint16_t mask = 0;
+  const char* p = list;
+  while (*p != '\0') {
+    const char* end = strchr(p, ',');
+    const size_t len = end != nullptr ? (size_t)(end - p) : strlen(p);
+    uint16_t bit = 0;
+    for (const FieldName& f : FIELD_NAMES) {
+      if (strlen(f.name) == len && strncmp(f.name, p, len) == 0) bit = f.bit;
+    }
+    if (bit == 0) return 0;
+    mask |= bit;
+    p += len;
+    if (*p == ',') ++p;
+  }
+  return mask;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ble_ids.h"
+#include "device_record.h"
+#include "vendor_decode.h"
+
+// Find My classification of one advertising report.
+//
+// matchFindMy() walks the AD structures in record.payload (a legacy PDU,
+// an advertisement merged with its scan response, or an extended PDU of up
+// to 255 bytes) and fills in the record's dataType, typeId, deviceType,
+// data, manufacturer and the decoded vendor fields. Service data is checked first (as in nRF Connect
+// log), then the first manufacturer data. Shared by the firmware and the
+// host tools.
+
+static inline uint16_t parseCompanyIdLE(const uint8_t* mfd, size_t len) {
+  if (len < 2) return 0xFFFF;
+  // Manufacturer specific data: First 2 bytes = CompanyID in Little Endian
+  return (uint16_t)(mfd[0] | ((uint16_t)mfd[1] << 8));
+}
+
+// Detects "Find My" based on service data
+static inline bool isFindMyServiceData(uint16_t serviceUuid, size_t serviceDataLen) {
+  switch (serviceUuid) {
+    case SVC_GOOGLE_FAST_PAIR:
+      // Google Fast Pair service data
+      return serviceDataLen >= 3;
+
+    case SVC_APPLE_FIND_MY:
+      // Apple Find My service data
+      return serviceDataLen >= 6;
+
+    case SVC_SAMSUNG_FIND:
+      // Samsung Find service data
+      return serviceDataLen >= 4;
+
+    default:
+      return false;
+  }
+}
+
+// Check if it's a manufacturer-specific "Find My" ad
+static inline bool isFindMyDevice(uint16_t cid, const uint8_t* mfd, size_t len) {
+  if (len < 4) return false;
+
+  switch (cid) {
+    case CID_APPLE:
+      // Apple Find My/AirTag: type 0x12 or 0x10
+      // Format: [CID_LOW, CID_HIGH, TYPE, ...data...]
+      return (len >= 3 && (mfd[2] == 0x12 || mfd[2] == 0x10));
+
+    case CID_GOOGLE:
+      // Google Find My Device/Fast Pair
+      return (len >= 3 && mfd[2] == 0x06);
+
+    case CID_SAMSUNG:
+      // Samsung SmartTag uses specific types of manufacturer data
+      return (len >= 4 && (mfd[2] == 0x01 || mfd[2] == 0x02 || mfd[2] == 0x42));
+
+    case CID_XIAOMI:
+      // Xiaomi devices: multiple ad types
+      return (len >= 3 &&
+              (mfd[2] == 0x30 ||  // Anti-Lost original
+               mfd[2] == 0x23 ||  // Mi-Device/Tracker
+               mfd[2] == 0x20 ||  // Mi-Tag
+               mfd[2] == 0x10));  // Generic Mi-Device
+
+    default:
+      return false;
+  }
+}
+
+// isEnabled(cid) -> bool: the manufacturer filter
+template <typename Enabled>
+static inline bool matchFindMy(DeviceRecord& record, Enabled isEnabled) {
+  bool found = false;
+  uint16_t manufacturer = 0xFFFF;
+
+  forEachAdStructure(record.payload, record.payloadLen, [&](uint8_t type, const uint8_t* ad, size_t len) {
+    if (type != AD_TYPE_SERVICE_DATA16 || len < 2) return true;
+    const uint16_t uuid16 = (uint16_t)(ad[0] | (ad[1] << 8));   // Little endian
+    const uint8_t* serviceData = ad + 2;
+    const size_t serviceDataLen = len - 2;
+
+    // Check if it's a known Find My service
+    if (!isFindMyServiceData(uuid16, serviceDataLen)) return true;
+    manufacturer = serviceToManufacturer(uuid16);
+    if (manufacturer == 0xFFFF || !isEnabled(manufacturer)) return true;
+    found = true;
+    record.dataType = DataSource::SERVICE;
+    record.typeId = serviceDataLen == 0 ? 0 : serviceData[0];
+    record.deviceType = serviceFindMyType(uuid16, serviceData, serviceDataLen);
+    record.data = serviceData;
+    record.dataLen = serviceDataLen;
+    return false; // Use the first service found
+  });
+
+  // If not found via Service Data, check the (first) Manufacturer Data
+  if (!found) {
+    forEachAdStructure(record.payload, record.payloadLen, [&](uint8_t type, const uint8_t* mfd, size_t len) {
+      if (type != AD_TYPE_MANUFACTURER) return true;
+      if (len >= 3) { // Needs at least CID (2 bytes) + type (1 byte)
+        const uint16_t cid = parseCompanyIdLE(mfd, len);
+
+        // Filter only manufacturers of interest
+        if ((cid == CID_APPLE || cid == CID_GOOGLE || cid == CID_SAMSUNG || cid == CID_XIAOMI) &&
+            isEnabled(cid) && isFindMyDevice(cid, mfd, len)) {
+          found = true;
+          manufacturer = cid;
+          record.dataType = DataSource::MANUFACTURER;
+          record.typeId = mfd[2];
+          record.deviceType = findMyType(cid, mfd, len);
+          record.data = mfd;
+          record.dataLen = len;
+        }
+      }
+      return false;
+    });
+  }
+
+  record.matched = found;
+  record.manufacturer = manufacturer;
+  if (found) decodeVendor(record);
+  return found;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "device_record.h"
+#include "keyed_lru.h"
+#include "vendor_decode.h"
+
+// Following-tracker detection.
+//
+// A tag that stays in range for a long time, with few gaps, is travelling
+// with the scanner. Each logical tag keeps the minutes it was heard in as a
+// 64-bit bitmap (bit 0 = the minute it was last heard) and the start of its
+// current session, which a gap of more than `maxGapMinutes` ends. Once a
+// session is `minMinutes` long and the tag was heard in `minCoveragePct` of
+// its minutes (of the last 64 at most), one alert goes out for the session.
+//
+// Optionally a session must also have seen `minOthers` other tags appear:
+// a scanner on the move keeps meeting new devices, one left at home does
+// not. Tags whose own advertisement says they are with their owner (Apple
+// nearby form, SmartTag connected states) are not alerted on unless
+// `nearOwner` is set.
+//
+// The caller chooses the key: deviceKey(), or a logical id from the
+// rotation linker so a tag keeps its history across address changes; when
+// the linker joins two ids, merge() folds one history into the other.
+// An update is one table lookup and a shift. About 56 bytes per tag with
+// the table's index; the least recently heard tag is evicted first, which is
+// never one that keeps following.
+
+constexpr uint32_t FOLLOW_BUCKET_SEC = 60;
+
+struct FollowThresholds {
+  uint16_t minMinutes;        // session length
+  uint8_t minCoveragePct;     // minutes heard, of the session's last 64
+  uint8_t maxGapMinutes;      // a longer gap starts a new session
+  uint16_t minOthers;         // tags first seen during the session; 0 = any
+  bool nearOwner;             // also alert on tags with their owner
+};
+
+struct FollowAlert {
+  uint64_t key;
+  uint8_t addr[6];            // latest address, LSB first
+  uint8_t addrType;
+  uint16_t manufacturer;
+  uint8_t typeId;
+  uint8_t coveragePct;
+  int8_t rssiMin;
+  int8_t rssiMax;
+  uint32_t minutes;           // session length
+  uint32_t sightings;         // in the session, folded ones included
+  uint32_t others;            // tags first seen during the session
+};
+
+template <size_t N>
+class FollowDetector {
+public:
+  explicit FollowDetector(const FollowThresholds& t) : thresholds_(t) {}
+
+  void setThresholds(const FollowThresholds& t) { thresholds_ = t; }
+  const FollowThresholds& thresholds() const { return thresholds_; }
+
+  // One matched record; emit(const FollowAlert&) when its tag crosses the
+  // thresholds
+  template <typename Emit>
+  void observe(uint64_t key, const DeviceRecord& r, Emit emit) {
+    const uint32_t minute = (uint32_t)(r.time.tv_sec / FOLLOW_BUCKET_SEC);
+    bool inserted;
+    Tag& tag = tags_.acquire(key, inserted);
+    if (inserted) {
+      ++tagsSeen_;
+      startSession(tag, minute);
+    } else {
+      advance(tag, minute);
+    }
+    tag.buckets |= 1;
+    const uint32_t sightings = tag.sightings + 1u + r.suppressed;
+    tag.sightings = (uint16_t)(sightings > 0xFFFF ? 0xFFFF : sightings);
+    memcpy(tag.addr, r.addr, sizeof(tag.addr));
+    tag.addrType = r.addrType;
+    tag.manufacturer = r.manufacturer;
+    tag.typeId = r.typeId;
+    if (foldedRssiMin(r) < tag.rssiMin) tag.rssiMin = (int8_t)foldedRssiMin(r);
+    if (foldedRssiMax(r) > tag.rssiMax) tag.rssiMax = (int8_t)foldedRssiMax(r);
+    tag.nearOwner = (r.vendor.present & VENDOR_SEPARATED) != 0 && !r.vendor.separated;
+
+    if (tag.alerted || !following(tag)) return;
+    tag.alerted = true;
+    ++alerts_;
+    emit(alertFor(key, tag));
+  }
+
+  // The rotation linker found that `from` is `into` under a new address:
+  // from's history joins into's
+  void merge(uint64_t from, uint64_t into) {
+    Tag* src = tags_.find(from);
+    if (src == nullptr) return;
+    const Tag moved = *src;
+    tags_.erase(from);
+    Tag* dst = tags_.find(into);
+    if (dst == nullptr) {
+      bool inserted;
+      tags_.acquire(into, inserted) = moved;
+      return;
+    }
+    // Bring into's session up to the first minute of from's, then lay from's
+    // minutes over it
+    if ((int32_t)(moved.sessionBucket - dst->lastBucket) > 0) advance(*dst, moved.sessionBucket);
+    if ((int32_t)(moved.lastBucket - dst->lastBucket) > 0) advance(*dst, moved.lastBucket);
+    const uint32_t shift = dst->lastBucket - moved.lastBucket;
+    if (shift < 64) dst->buckets |= moved.buckets << shift;
+    const uint32_t sightings = (uint32_t)dst->sightings + moved.sightings;
+    dst->sightings = (uint16_t)(sightings > 0xFFFF ? 0xFFFF : sightings);
+    if (moved.lastBucket == dst->lastBucket) {
+      memcpy(dst->addr, moved.addr, sizeof(dst->addr));
+      dst->addrType = moved.addrType;
+    }
+    if (moved.rssiMin < dst->rssiMin) dst->rssiMin = moved.rssiMin;
+    if (moved.rssiMax > dst->rssiMax) dst->rssiMax = moved.rssiMax;
+  }
+
+  // Calls fn(const FollowAlert&) for each tag over the thresholds now,
+  // alerted or not
+  template <typename Fn>
+  void forEachFollowing(Fn fn) {
+    tags_.forEach([&](uint64_t key, Tag& tag) {
+      if (following(tag)) fn(alertFor(key, tag));
+    });
+  }
+
+  void clear() { tags_.clear(); }
+
+  size_t tags() const { return tags_.size(); }
+  uint32_t alerts() const { return alerts_; }
+  uint32_t evictions() const { return tags_.evictions(); }
+  static constexpr size_t memoryBytes() { return sizeof(FollowDetector); }
+
+private:
+  struct Tag {
+    uint64_t buckets;         // minutes heard; bit 0 = lastBucket
+    uint32_t lastBucket;
+    uint32_t sessionBucket;   // first minute of the session
+    uint32_t othersAtStart;   // tagsSeen_ when the session started
+    uint16_t manufacturer;
+    uint16_t sightings;       // saturates
+    uint8_t addr[6];
+    uint8_t addrType;
+    uint8_t typeId;
+    int8_t rssiMin;
+    int8_t rssiMax;
+    bool nearOwner;
+    bool alerted;             // this session
+  };
+
+  void startSession(Tag& tag, uint32_t minute) {
+    tag.buckets = 0;
+    tag.lastBucket = tag.sessionBucket = minute;
+    tag.othersAtStart = tagsSeen_;
+    tag.sightings = 0;
+    tag.rssiMin = 127;
+    tag.rssiMax = -128;
+    tag.alerted = false;
+  }
+
+  // Moves bit 0 to `minute`; a gap over the threshold starts a new session
+  void advance(Tag& tag, uint32_t minute) {
+    const uint32_t shift = minute - tag.lastBucket;
+    if ((int32_t)shift <= 0) return;
+    if (shift > (uint32_t)thresholds_.maxGapMinutes + 1) {
+      startSession(tag, minute);
+      return;
+    }
+    tag.buckets = shift >= 64 ? 0 : tag.buckets << shift;
+    tag.lastBucket = minute;
+  }
+
+  static uint32_t bitCount(uint64_t v) {
+    uint32_t n = 0;
+    for (; v != 0; v &= v - 1) ++n;
+    return n;
+  }
+
+  uint32_t sessionMinutes(const Tag& tag) const { return tag.lastBucket - tag.sessionBucket + 1; }
+
+  uint8_t coveragePct(const Tag& tag) const {
+    const uint32_t span = sessionMinutes(tag) < 64 ? sessionMinutes(tag) : 64;
+    const uint64_t mask = span == 64 ? ~0ull : (1ull << span) - 1;
+    return (uint8_t)(bitCount(tag.buckets & mask) * 100 / span);
+  }
+
+  bool following(const Tag& tag) const {
+    if (sessionMinutes(tag) < thresholds_.minMinutes) return false;
+    if (tag.nearOwner && !thresholds_.nearOwner) return false;
+    if (tagsSeen_ - tag.othersAtStart < thresholds_.minOthers) return false;
+    return coveragePct(tag) >= thresholds_.minCoveragePct;
+  }
+
+  FollowAlert alertFor(uint64_t key, const Tag& tag) const {
+    FollowAlert a;
+    a.key = key;
+    memcpy(a.addr, tag.addr, sizeof(a.addr));
+    a.addrType = tag.addrType;
+    a.manufacturer = tag.manufacturer;
+    a.typeId = tag.typeId;
+    a.coveragePct = coveragePct(tag);
+    a.rssiMin = tag.rssiMin;
+    a.rssiMax = tag.rssiMax;
+    a.minutes = sessionMinutes(tag);
+    a.sightings = tag.sightings;
+    a.others = tagsSeen_ - tag.othersAtStart;
+    return a;
+  }
+
+  FollowThresholds thresholds_;
+  KeyedLru<Tag, N> tags_;
+  uint32_t tagsSeen_ = 0;
+  uint32_t alerts_ = 0;
+};
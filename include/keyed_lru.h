@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-capacity table keyed by a 64-bit key (usually a packed BLE address),
+// with least-recently-used eviction. No heap: N slots plus an open-addressing
+// index (linear probing, backward-shift delete) and an intrusive LRU list.
+// Lookup, insert and eviction are O(1) on average.
+//
+// A slot keeps its index for as long as its entry lives, so callers can use
+// slotOf() as a small stable handle (e.g. a session ID on the wire).
+template <typename Value, size_t N>
+class KeyedLru {
+  static_assert(N > 0 && N < 0x7FFF, "KeyedLru capacity out of range");
+
+public:
+  static constexpr size_t CAPACITY = N;
+
+  KeyedLru() { clear(); }
+
+  void clear() {
+    for (size_t i = 0; i < INDEX_SIZE; ++i) index_[i] = NONE;
+    head_ = tail_ = NONE;
+    size_ = 0;
+    // All slots on the free list
+    for (size_t i = 0; i < N; ++i) next_[i] = (uint16_t)(i + 1 < N ? i + 1 : NONE);
+    free_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  uint32_t evictions() const { return evictions_; }
+
+  // Returns the entry for `key` and marks it most recently used, or nullptr
+  Value* find(uint64_t key) {
+    const uint16_t slot = lookup(key);
+    if (slot == NONE) return nullptr;
+    touch(slot);
+    return &values_[slot];
+  }
+
+  // Returns the entry for `key`, creating it if needed. A new entry is
+  // value-initialised; when the table is full the least recently used entry
+  // is evicted and its slot reused (`inserted` is true in both cases).
+  Value& acquire(uint64_t key, bool& inserted) {
+    uint16_t slot = lookup(key);
+    if (slot != NONE) {
+      inserted = false;
+      touch(slot);
+      return values_[slot];
+    }
+
+    inserted = true;
+    if (free_ == NONE) {
+      // Full: recycle the LRU slot
+      slot = tail_;
+      removeFromIndex(keys_[slot]);
+      unlink(slot);
+      --size_;
+      ++evictions_;
+    } else {
+      slot = free_;
+      free_ = next_[slot];
+    }
+
+    keys_[slot] = key;
+    values_[slot] = Value{};
+    insertIntoIndex(key, slot);
+    pushFront(slot);
+    ++size_;
+    return values_[slot];
+  }
+
+  void erase(uint64_t key) {
+    const uint16_t slot = lookup(key);
+    if (slot == NONE) return;
+    removeFromIndex(key);
+    unlink(slot);
+    next_[slot] = free_;
+    free_ = slot;
+    --size_;
+  }
+
+  uint16_t slotOf(const Value& v) const { return (uint16_t)(&v - values_); }
+  Value& atSlot(uint16_t slot) { return values_[slot]; }
+  uint64_t keyAt(uint16_t slot) const { return keys_[slot]; }
+
+  // Least recently used entry (nullptr when empty); for age-based expiry
+  Value* oldest() { return tail_ == NONE ? nullptr : &values_[tail_]; }
+  uint64_t oldestKey() const { return keys_[tail_]; }
+
+  // Visits entries from most to least recently used
+  template <typename Fn>
+  void forEach(Fn fn) {
+    for (uint16_t s = head_; s != NONE; s = next_[s]) fn(keys_[s], values_[s]);
+  }
+
+  static constexpr size_t memoryBytes() { return sizeof(KeyedLru); }
+
+private:
+  static constexpr uint16_t NONE = 0xFFFF;
+  static constexpr size_t INDEX_SIZE = [] {
+    size_t s = 1;
+    while (s < 2 * N) s <<= 1;
+    return s;
+  }();
+
+  static size_t bucket(uint64_t key) {
+    // Fibonacci hashing; addresses are not uniformly distributed in the low bits
+    return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 40) & (INDEX_SIZE - 1);
+  }
+
+  uint16_t lookup(uint64_t key) const {
+    for (size_t i = bucket(key);; i = (i + 1) & (INDEX_SIZE - 1)) {
+      const uint16_t slot = index_[i];
+      if (slot == NONE) return NONE;
+      if (keys_[slot] == key) return slot;
+    }
+  }
+
+  void insertIntoIndex(uint64_t key, uint16_t slot) {
+    size_t i = bucket(key);
+    while (index_[i] != NONE) i = (i + 1) & (INDEX_SIZE - 1);
+    index_[i] = slot;
+  }
+
+  void removeFromIndex(uint64_t key) {
+    size_t i = bucket(key);
+    while (keys_[index_[i]] != key) i = (i + 1) & (INDEX_SIZE - 1);
+    // Backward-shift the rest of the cluster so lookups never need tombstones
+    size_t j = i;
+    for (;;) {
+      j = (j + 1) & (INDEX_SIZE - 1);
+      if (index_[j] == NONE) break;
+      const size_t home = bucket(keys_[index_[j]]);
+      const bool between = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+      if (between) continue;
+      index_[i] = index_[j];
+      i = j;
+    }
+    index_[i] = NONE;
+  }
+
+  void unlink(uint16_t slot) {
+    if (prev_[slot] != NONE) next_[prev_[slot]] = next_[slot];
+    else head_ = next_[slot];
+    if (next_[slot] != NONE) prev_[next_[slot]] = prev_[slot];
+    else tail_ = prev_[slot];
+  }
+
+  void pushFront(uint16_t slot) {
+    prev_[slot] = NONE;
+    next_[slot] = head_;
+    if (head_ != NONE) prev_[head_] = slot;
+    head_ = slot;
+    if (tail_ == NONE) tail_ = slot;
+  }
+
+  void touch(uint16_t slot) {
+    if (head_ == slot) return;
+    unlink(slot);
+    pushFront(slot);
+  }
+
+  uint64_t keys_[N];
+  Value values_[N];
+  uint16_t prev_[N];
+  uint16_t next_[N];          // LRU list, or free list for unused slots
+  uint16_t index_[INDEX_SIZE];
+  uint16_t head_, tail_, free_;
+  size_t size_ = 0;
+  uint32_t evictions_ = 0;
+};
+
+// Packs a BLE address (LSB first, as in DeviceRecord) and its type into a key
+static inline uint64_t addressKey(const uint8_t addr[6], uint8_t addrType) {
+  uint64_t k = 0;
+  for (int i = 5; i >= 0; --i) k = (k << 8) | addr[i];
+  return k | ((uint64_t)addrType << 48);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "crc16.h"
+#include "device_record.h"
+#include "keyed_lru.h"
+#include "vendor_decode.h"
+
+// Overload control in front of the record queue.
+//
+// The shedding level follows the queue's fill level, with hysteresis so it
+// does not flap. Each level raises the RSSI floor above MIN_RSSI and keeps
+// only one in `keepOneIn` repeat sightings (same address, same payload).
+// A device's first sighting and any payload change always pass: those are
+// the records a survey cannot reconstruct later, while a repeat only
+// refreshes RSSI.
+
+struct ShedLevel {
+  uint8_t enterPct;     // queue fill that raises the level to this one
+  uint8_t leavePct;     // fill below which it drops back
+  int rssiFloor;
+  uint8_t keepOneIn;    // repeat sightings passed: 1 in N
+};
+
+static const ShedLevel SHED_LEVELS[] = {
+  {  0,  0, -200,  1 },   // 0: no shedding
+  { 50, 25,  -90,  2 },   // 1
+  { 75, 50,  -80,  4 },   // 2
+  { 90, 70,  -70, 16 },   // 3
+};
+
+constexpr size_t SHED_LEVEL_COUNT = sizeof(SHED_LEVELS) / sizeof(SHED_LEVELS[0]);
+constexpr size_t SHED_TRACKED_DEVICES = 256;
+
+class LoadShedder {
+public:
+  explicit LoadShedder(int minRssi, bool enabled = true) : minRssi_(minRssi), enabled_(enabled) {}
+
+  // Called from the scan callback with the queue's current fill level
+  bool admit(const DeviceRecord& r, uint8_t fillPct) {
+    const uint8_t level = updateLevel(fillPct);
+
+    const uint8_t* bytes = r.dataLen > 0 ? r.data : r.payload;
+    const uint16_t crc = crc16(bytes, r.dataLen > 0 ? r.dataLen : r.payloadLen);
+    bool inserted;
+    Seen& seen = seen_.acquire(deviceKey(r), inserted);
+    if (inserted || seen.payloadCrc != crc) {
+      seen.payloadCrc = crc;
+      seen.repeats = 0;
+      return true;
+    }
+    ++seen.repeats;
+
+    const ShedLevel& l = SHED_LEVELS[level];
+    if (r.rssi < rssiFloor(l)) {
+      shedRssi_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (seen.repeats % l.keepOneIn != 0) {
+      shedSampled_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  uint8_t level() const { return level_.load(std::memory_order_relaxed); }
+  int rssiFloor() const { return rssiFloor(SHED_LEVELS[level()]); }
+  uint32_t shedRssi() const { return shedRssi_.load(std::memory_order_relaxed); }
+  uint32_t shedSampled() const { return shedSampled_.load(std::memory_order_relaxed); }
+  // Highest level since the previous call (one stats interval)
+  uint8_t takeMaxLevel() { return maxLevel_.exchange(level(), std::memory_order_relaxed); }
+
+private:
+  struct Seen {
+    uint16_t payloadCrc;
+    uint16_t repeats;
+  };
+
+  int rssiFloor(const ShedLevel& l) const { return l.rssiFloor > minRssi_ ? l.rssiFloor : minRssi_; }
+
+  uint8_t updateLevel(uint8_t fillPct) {
+    uint8_t level = level_.load(std::memory_order_relaxed);
+    if (!enabled_) return 0;
+    while ((size_t)level + 1 < SHED_LEVEL_COUNT && fillPct >= SHED_LEVELS[level + 1].enterPct) ++level;
+    while (level > 0 && fillPct < SHED_LEVELS[level].leavePct) --level;
+    level_.store(level, std::memory_order_relaxed);
+    if (level > maxLevel_.load(std::memory_order_relaxed)) maxLevel_.store(level, std::memory_order_relaxed);
+    return level;
+  }
+
+  int minRssi_;
+  bool enabled_;
+  KeyedLru<Seen, SHED_TRACKED_DEVICES> seen_;
+  std::atomic<uint8_t> level_{0};
+  std::atomic<uint8_t> maxLevel_{0};
+  std::atomic<uint32_t> shedRssi_{0};
+  std::atomic<uint32_t> shedSampled_{0};
+};
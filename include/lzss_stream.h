@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "crc16.h"
+
+// Streaming LZSS compression for the serial link.
+//
+// Output is split into frames, one per flush (batch boundary):
+//
+//   FA C3 | flags | rawLen (LE16) | compLen (LE16) | items... | crc16(raw) (LE16)
+//
+// Items come in groups of up to 8 behind a flag byte (bit i set = match).
+// A literal is one byte; a match is two bytes, big endian:
+// (distance - 1) in the upper 10 bits and (length - 3) in the lower 6.
+// The 1 KB window carries over between frames, so repeated names, address
+// strings and hex prefixes from earlier records compress. Every
+// LZSS_RESET_INTERVAL frames the window restarts (LZSS_FLAG_RESET) so a
+// decoder that lost data can resync.
+
+constexpr uint8_t  LZSS_MAGIC0          = 0xFA;
+constexpr uint8_t  LZSS_MAGIC1          = 0xC3;
+constexpr uint8_t  LZSS_FLAG_RESET      = 0x01;
+constexpr size_t   LZSS_FRAME_HEADER    = 7;
+constexpr size_t   LZSS_FRAME_TRAILER   = 2;
+constexpr size_t   LZSS_WINDOW          = 1024;
+constexpr size_t   LZSS_MAX_RAW         = 1024;   // raw bytes per frame
+constexpr size_t   LZSS_MIN_MATCH       = 3;
+constexpr size_t   LZSS_MAX_MATCH       = LZSS_MIN_MATCH + 63;
+constexpr uint16_t LZSS_RESET_INTERVAL  = 32;
+constexpr size_t   LZSS_MAX_COMP        = LZSS_MAX_RAW + (LZSS_MAX_RAW + 7) / 8;
+constexpr size_t   LZSS_MAX_FRAME       = LZSS_FRAME_HEADER + LZSS_MAX_COMP + LZSS_FRAME_TRAILER;
+
+class LzssEncoder {
+public:
+  using SinkFn = void (*)(void* ctx, const uint8_t* data, size_t len);
+  using ClockFn = uint32_t (*)();    // microseconds, for CPU accounting
+
+  LzssEncoder(SinkFn sink, void* ctx, ClockFn clock = nullptr)
+    : sink_(sink), ctx_(ctx), clock_(clock) {
+    reset();
+  }
+
+  void reset() {
+    memset(head_, 0xFF, sizeof(head_));
+    start_ = end_ = 0;
+    framesSinceReset_ = 0;
+  }
+
+  void write(const uint8_t* data, size_t len) {
+    while (len > 0) {
+      size_t room = LZSS_MAX_RAW - (end_ - start_);
+      if (room == 0) {
+        flush();
+        continue;
+      }
+      if (room > len) room = len;
+      memcpy(buf_ + end_, data, room);
+      end_ += room;
+      data += room;
+      len -= room;
+    }
+  }
+
+  // Emits everything buffered so far as one frame
+  void flush() {
+    if (end_ == start_) return;
+    const uint32_t t0 = clock_ != nullptr ? clock_() : 0;
+
+    const bool resetFrame = framesSinceReset_ == 0;
+    if (resetFrame) memset(head_, 0xFF, sizeof(head_));
+    const size_t floor = resetFrame ? start_ : 0;
+    const size_t rawLen = end_ - start_;
+
+    uint8_t* out = frame_ + LZSS_FRAME_HEADER;
+    size_t o = 0;
+    size_t flagPos = 0;
+    uint8_t flagBit = 8;
+
+    size_t i = start_;
+    while (i < end_) {
+      if (flagBit == 8) {
+        flagPos = o++;
+        out[flagPos] = 0;
+        flagBit = 0;
+      }
+
+      size_t bestLen = 0;
+      size_t bestDist = 0;
+      if (end_ - i >= LZSS_MIN_MATCH) {
+        const uint16_t h = hash(buf_ + i);
+        const int16_t cand = head_[h];
+        head_[h] = (int16_t)i;
+        if (cand >= 0 && (size_t)cand >= floor && i - (size_t)cand <= LZSS_WINDOW) {
+          size_t limit = end_ - i;
+          if (limit > LZSS_MAX_MATCH) limit = LZSS_MAX_MATCH;
+          size_t n = 0;
+          while (n < limit && buf_[cand + n] == buf_[i + n]) ++n;
+          if (n >= LZSS_MIN_MATCH) {
+            bestLen = n;
+            bestDist = i - (size_t)cand;
+          }
+        }
+      }
+
+      if (bestLen > 0) {
+        const uint16_t token = (uint16_t)(((bestDist - 1) << 6) | (bestLen - LZSS_MIN_MATCH));
+        out[flagPos] |= (uint8_t)(1u << flagBit);
+        out[o++] = (uint8_t)(token >> 8);
+        out[o++] = (uint8_t)token;
+        for (size_t k = 1; k < bestLen && i + k + LZSS_MIN_MATCH <= end_; ++k) {
+          head_[hash(buf_ + i + k)] = (int16_t)(i + k);
+        }
+        i += bestLen;
+      } else {
+        out[o++] = buf_[i++];
+      }
+      ++flagBit;
+    }
+
+    frame_[0] = LZSS_MAGIC0;
+    frame_[1] = LZSS_MAGIC1;
+    frame_[2] = resetFrame ? LZSS_FLAG_RESET : 0;
+    frame_[3] = (uint8_t)rawLen;
+    frame_[4] = (uint8_t)(rawLen >> 8);
+    frame_[5] = (uint8_t)o;
+    frame_[6] = (uint8_t)(o >> 8);
+    const uint16_t crc = crc16(buf_ + start_, rawLen);
+    out[o++] = (uint8_t)crc;
+    out[o++] = (uint8_t)(crc >> 8);
+
+    const size_t frameLen = LZSS_FRAME_HEADER + o;
+    rawBytes_ += rawLen;
+    compBytes_ += frameLen;
+    if (++framesSinceReset_ >= LZSS_RESET_INTERVAL) framesSinceReset_ = 0;
+
+    slide();
+    if (clock_ != nullptr) cpuUs_ += clock_() - t0;
+    sink_(ctx_, frame_, frameLen);
+  }
+
+  uint64_t rawBytes() const { return rawBytes_; }
+  uint64_t compressedBytes() const { return compBytes_; }
+  uint64_t cpuMicros() const { return cpuUs_; }
+
+private:
+  static uint16_t hash(const uint8_t* p) {
+    return (uint16_t)(((p[0] << 6) ^ (p[1] << 3) ^ p[2]) & (HASH_SIZE - 1));
+  }
+
+  // Keep the last LZSS_WINDOW bytes as history for the next frame
+  void slide() {
+    if (end_ > LZSS_WINDOW) {
+      const size_t shift = end_ - LZSS_WINDOW;
+      memmove(buf_, buf_ + shift, LZSS_WINDOW);
+      for (int16_t& pos : head_) {
+        pos = (pos >= 0 && (size_t)pos >= shift) ? (int16_t)(pos - shift) : (int16_t)-1;
+      }
+      end_ = LZSS_WINDOW;
+    }
+    start_ = end_;
+  }
+
+  static constexpr size_t HASH_SIZE = 1024;
+
+  SinkFn sink_;
+  void* ctx_;
+  ClockFn clock_;
+  uint8_t buf_[LZSS_WINDOW + LZSS_MAX_RAW];
+  uint8_t frame_[LZSS_MAX_FRAME];
+  int16_t head_[HASH_SIZE];
+  size_t start_;
+  size_t end_;
+  uint16_t framesSinceReset_;
+  uint64_t rawBytes_ = 0;
+  uint64_t compBytes_ = 0;
+  uint64_t cpuUs_ = 0;
+};
+
+// Frame decoder (host side). Keeps the window between frames; after a bad
+// frame it waits for the next reset frame before producing output again.
+class LzssDecoder {
+public:
+  enum class Result { OK, NEED_MORE, BAD_FRAME, SKIPPED };
+
+  // `in` must start with the frame magic. On OK/BAD_FRAME/SKIPPED `used` is
+  // the frame length; decoded bytes are in out()/outLen().
+  Result decode(const uint8_t* in, size_t len, size_t& used) {
+    used = 0;
+    outLen_ = 0;
+    if (len < LZSS_FRAME_HEADER) return Result::NEED_MORE;
+    const uint8_t flags = in[2];
+    const size_t rawLen = in[3] | (in[4] << 8);
+    const size_t compLen = in[5] | (in[6] << 8);
+    if (rawLen == 0 || rawLen > LZSS_MAX_RAW || compLen > LZSS_MAX_COMP) {
+      used = 1;
+      return Result::BAD_FRAME;
+    }
+    const size_t frameLen = LZSS_FRAME_HEADER + compLen + LZSS_FRAME_TRAILER;
+    if (len < frameLen) return Result::NEED_MORE;
+
+    const bool reset = (flags & LZSS_FLAG_RESET) != 0;
+    if (reset) {
+      histLen_ = 0;
+      synced_ = true;
+    }
+    if (!synced_) {
+      used = frameLen;
+      return Result::SKIPPED;
+    }
+
+    // Decode behind the carried-over history
+    const uint8_t* p = in + LZSS_FRAME_HEADER;
+    const uint8_t* end = p + compLen;
+    uint8_t* out = hist_ + histLen_;
+    size_t o = 0;
+    bool ok = true;
+    while (p < end && ok && o < rawLen) {
+      const uint8_t flagByte = *p++;
+      for (int bit = 0; bit < 8 && p < end && o < rawLen; ++bit) {
+        if (flagByte & (1u << bit)) {
+          if (end - p < 2) { ok = false; break; }
+          const uint16_t token = (uint16_t)((p[0] << 8) | p[1]);
+          p += 2;
+          const size_t dist = (size_t)(token >> 6) + 1;
+          const size_t n = (size_t)(token & 0x3F) + LZSS_MIN_MATCH;
+          if (dist > histLen_ + o || o + n > rawLen) { ok = false; break; }
+          for (size_t k = 0; k < n; ++k, ++o) out[o] = out[o - dist];
+        } else {
+          out[o++] = *p++;
+        }
+      }
+    }
+
+    const uint16_t crc = (uint16_t)(in[frameLen - 2] | (in[frameLen - 1] << 8));
+    if (!ok || p != end || o != rawLen || crc16(out, rawLen) != crc) {
+      synced_ = false;
+      used = 1;
+      return Result::BAD_FRAME;
+    }
+
+    outLen_ = rawLen;
+    outPtr_ = out;
+    used = frameLen;
+
+    // Keep the window for the next frame
+    histLen_ += rawLen;
+    if (histLen_ > LZSS_WINDOW) {
+      memmove(hist_, hist_ + histLen_ - LZSS_WINDOW, LZSS_WINDOW);
+      outPtr_ = hist_ + LZSS_WINDOW - rawLen;
+      histLen_ = LZSS_WINDOW;
+    }
+    return Result::OK;
+  }
+
+  const uint8_t* out() const { return outPtr_; }
+  size_t outLen() const { return outLen_; }
+
+private:
+  uint8_t hist_[LZSS_WINDOW + LZSS_MAX_RAW];
+  size_t histLen_ = 0;
+  bool synced_ = false;
+  const uint8_t* outPtr_ = nullptr;
+  size_t outLen_ = 0;
+};
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "ble_ids.h"
+#include "crc16.h"
+#include "device_record.h"
+#include "vendor_decode.h"
+
+// User-defined match rules.
+//
+// A rule program replaces the built-in classifier (find_my_match.h) with
+// rules loaded at runtime: over serial, or from NVS at boot. Each rule has a
+// scope, a vendor, a label (the device type it reports) and a list of
+// predicates on the AD structure's data, all of which must hold:
+//
+//   scope  SVC16 <uuid>  service data with that UUID, offsets after the UUID
+//          MFD <cid>     manufacturer data with that company ID, offsets
+//                        from its first byte (the CID included)
+//
+// Matching follows the built-in order: every service data structure in
+// turn, then the first manufacturer data. For each structure the rules of
+// its scope are tried in program order and the first that holds wins, unless
+// its vendor is disabled. The type byte (typeId) is data[0] for service data
+// and data[2] for manufacturer data, as before, and the vendor fields are
+// decoded as for the rule's vendor.
+//
+// The bytecode is compiled on the host (fmsdecode rules compile):
+//
+//   "FMR" version | ruleCount | labelCount | labels: (len, bytes)... |
+//   rules: (scope, key u16, vendor u16, label, codeLen, code)... | crc16
+//
+// Multi-byte values are little endian; crc16 (crc16.h) covers everything
+// before it. load() checks the structure once, so the interpreter only
+// bounds-checks data accesses: a predicate that reads past the data fails.
+
+constexpr uint8_t RULES_MAGIC[3]    = { 'F', 'M', 'R' };
+constexpr uint8_t RULES_VERSION     = 1;
+constexpr size_t  RULES_MAX_BYTES   = 1024;
+constexpr size_t  RULES_MAX_RULES   = 64;
+constexpr size_t  RULES_MAX_LABELS  = 32;
+constexpr size_t  RULES_LABEL_POOL  = 512;
+
+// Labels end up as the device type in every format: printable ASCII only,
+// and none of the CSV separator or the JSON string specials
+static inline bool ruleLabelChar(uint8_t c) {
+  return c >= 0x20 && c <= 0x7E && c != ',' && c != '"' && c != '\\';
+}
+
+enum RuleScope : uint8_t {
+  RULE_SCOPE_SVC16 = 0,
+  RULE_SCOPE_MFD   = 1,
+};
+
+// Opcode, then its operands (one byte each unless noted)
+enum RuleOp : uint8_t {
+  RULE_LEN_GE     = 0x01,   // n                     len >= n
+  RULE_LEN_LE     = 0x02,   // n                     len <= n
+  RULE_EQ         = 0x03,   // off, v                d[off] == v
+  RULE_MASK       = 0x04,   // off, m, v             (d[off] & m) == v
+  RULE_IN         = 0x05,   // off, n, v[n]          d[off] one of v
+  RULE_BYTES      = 0x06,   // off, n, v[n]          d[off..off+n) == v
+  RULE_BYTES_MASK = 0x07,   // off, n, m[n], v[n]    (d[off+i] & m[i]) == v[i]
+};
+
+// Operand bytes after the opcode; 0 if `op` is unknown or the code ends early
+static inline size_t ruleOperandBytes(const uint8_t* op, size_t avail) {
+  switch (op[0]) {
+    case RULE_LEN_GE:
+    case RULE_LEN_LE:     return avail >= 2 ? 1 : 0;
+    case RULE_EQ:         return avail >= 3 ? 2 : 0;
+    case RULE_MASK:       return avail >= 4 ? 3 : 0;
+    case RULE_IN:
+    case RULE_BYTES:      return avail >= 3 && (size_t)op[2] + 3 <= avail ? 2 + op[2] : 0;
+    case RULE_BYTES_MASK: return avail >= 3 && 2 * (size_t)op[2] + 3 <= avail ? 2 + 2 * (size_t)op[2] : 0;
+    default:              return 0;
+  }
+}
+
+// Labels outlive the program that named them: queued records and the delta
+// encoder keep pointers to them. The pool only grows; a label that is
+// already in it is shared, so reloading a program costs nothing.
+template <size_t N>
+class LabelPool {
+public:
+  const char* intern(const uint8_t* s, size_t len) {
+    for (size_t i = 0; i < used_; i += strlen(pool_ + i) + 1) {
+      if (strlen(pool_ + i) == len && memcmp(pool_ + i, s, len) == 0) return pool_ + i;
+    }
+    if (used_ + len + 1 > N) return nullptr;
+    char* out = pool_ + used_;
+    memcpy(out, s, len);
+    out[len] = '\0';
+    used_ += len + 1;
+    return out;
+  }
+
+  size_t used() const { return used_; }
+
+private:
+  char pool_[N] = {};
+  size_t used_ = 0;
+};
+
+class RuleProgram {
+public:
+  // Checks and takes a copy of the bytecode. On false the program is left
+  // empty and `error` says why.
+  template <typename Pool>
+  bool load(const uint8_t* p, size_t n, Pool& labels, const char*& error) {
+    ruleCount_ = 0;
+    if (n > RULES_MAX_BYTES) return fail(error, "too large");
+    if (n < 8 || memcmp(p, RULES_MAGIC, sizeof(RULES_MAGIC)) != 0) return fail(error, "not a rule program");
+    if (p[3] != RULES_VERSION) return fail(error, "unknown version");
+    if (crc16(p, n - 2) != (uint16_t)(p[n - 2] | (p[n - 1] << 8))) return fail(error, "bad crc");
+    const size_t end = n - 2;
+    const uint8_t ruleCount = p[4], labelCount = p[5];
+    if (ruleCount > RULES_MAX_RULES || labelCount > RULES_MAX_LABELS) return fail(error, "too many rules");
+
+    memcpy(code_, p, n);
+    size_t labelAt[RULES_MAX_LABELS];
+    size_t i = 6;
+    for (uint8_t l = 0; l < labelCount; ++l) {
+      if (i >= end || i + 1 + code_[i] > end) return fail(error, "truncated");
+      if (code_[i] == 0) return fail(error, "bad label");
+      for (size_t c = 1; c <= code_[i]; ++c) {
+        if (!ruleLabelChar(code_[i + c])) return fail(error, "bad label");
+      }
+      labelAt[l] = i;
+      i += 1 + code_[i];
+    }
+    for (uint8_t r = 0; r < ruleCount; ++r) {
+      if (i + 7 > end) return fail(error, "truncated");
+      Rule& rule = rules_[r];
+      rule.scope = code_[i];
+      rule.key = (uint16_t)(code_[i + 1] | (code_[i + 2] << 8));
+      rule.vendor = (uint16_t)(code_[i + 3] | (code_[i + 4] << 8));
+      rule.label = code_[i + 5];
+      rule.codeLen = code_[i + 6];
+      rule.code = code_ + i + 7;
+      if (rule.scope > RULE_SCOPE_MFD || rule.label >= labelCount) return fail(error, "bad rule");
+      if (i + 7 + rule.codeLen > end) return fail(error, "truncated");
+      for (size_t c = 0; c < rule.codeLen; c += 1 + ruleOperandBytes(rule.code + c, rule.codeLen - c)) {
+        if (ruleOperandBytes(rule.code + c, rule.codeLen - c) == 0) return fail(error, "bad opcode");
+      }
+      i += 7 + rule.codeLen;
+    }
+    if (i != end) return fail(error, "trailing bytes");
+
+    // Only a program that checked out takes room in the pool
+    for (uint8_t l = 0; l < labelCount; ++l) {
+      labels_[l] = labels.intern(code_ + labelAt[l] + 1, code_[labelAt[l]]);
+      if (labels_[l] == nullptr) return fail(error, "label pool full");
+    }
+    ruleCount_ = ruleCount;
+    bytes_ = n;
+    return true;
+  }
+
+  size_t rules() const { return ruleCount_; }
+  size_t bytes() const { return bytes_; }
+
+  // Same contract as matchFindMy(): fills in the record, true on a match
+  template <typename Enabled>
+  bool match(DeviceRecord& record, Enabled isEnabled) const {
+    const Rule* hit = nullptr;
+    forEachAdStructure(record.payload, record.payloadLen, [&](uint8_t type, const uint8_t* ad, size_t len) {
+      if (type != AD_TYPE_SERVICE_DATA16 || len < 2) return true;
+      hit = find(RULE_SCOPE_SVC16, (uint16_t)(ad[0] | (ad[1] << 8)), ad + 2, len - 2, isEnabled);
+      if (hit == nullptr) return true;
+      record.dataType = DataSource::SERVICE;
+      record.typeId = len == 2 ? 0 : ad[2];
+      record.data = ad + 2;
+      record.dataLen = len - 2;
+      return false;
+    });
+
+    if (hit == nullptr) {
+      forEachAdStructure(record.payload, record.payloadLen, [&](uint8_t type, const uint8_t* mfd, size_t len) {
+        if (type != AD_TYPE_MANUFACTURER) return true;
+        if (len >= 2) hit = find(RULE_SCOPE_MFD, (uint16_t)(mfd[0] | (mfd[1] << 8)), mfd, len, isEnabled);
+        if (hit != nullptr) {
+          record.dataType = DataSource::MANUFACTURER;
+          record.typeId = len >= 3 ? mfd[2] : 0;
+          record.data = mfd;
+          record.dataLen = len;
+        }
+        return false;
+      });
+    }
+
+    record.matched = hit != nullptr;
+    record.manufacturer = hit != nullptr ? hit->vendor : 0xFFFF;
+    if (hit != nullptr) {
+      record.deviceType = labels_[hit->label];
+      decodeVendor(record);
+    }
+    return record.matched;
+  }
+
+private:
+  struct Rule {
+    const uint8_t* code;
+    uint16_t key;
+    uint16_t vendor;
+    uint8_t scope;
+    uint8_t label;
+    uint8_t codeLen;
+  };
+
+  static bool fail(const char*& error, const char* why) {
+    error = why;
+    return false;
+  }
+
+  template <typename Enabled>
+  const Rule* find(uint8_t scope, uint16_t key, const uint8_t* d, size_t len, Enabled& isEnabled) const {
+    for (size_t r = 0; r < ruleCount_; ++r) {
+      const Rule& rule = rules_[r];
+      if (rule.key != key || rule.scope != scope) continue;
+      if (run(rule.code, rule.codeLen, d, len) && isEnabled(rule.vendor)) return &rule;
+    }
+    return nullptr;
+  }
+
+  static bool run(const uint8_t* pc, size_t codeLen, const uint8_t* d, size_t len) {
+    const uint8_t* const end = pc + codeLen;
+    while (pc < end) {
+      switch (pc[0]) {
+        case RULE_LEN_GE:
+          if (len < pc[1]) return false;
+          pc += 2;
+          break;
+        case RULE_LEN_LE:
+          if (len > pc[1]) return false;
+          pc += 2;
+          break;
+        case RULE_EQ:
+          if (pc[1] >= len || d[pc[1]] != pc[2]) return false;
+          pc += 3;
+          break;
+        case RULE_MASK:
+          if (pc[1] >= len || (d[pc[1]] & pc[2]) != pc[3]) return false;
+          pc += 4;
+          break;
+        case RULE_IN:
+          if (pc[1] >= len || memchr(pc + 3, d[pc[1]], pc[2]) == nullptr) return false;
+          pc += 3 + pc[2];
+          break;
+        case RULE_BYTES:
+          if ((size_t)pc[1] + pc[2] > len || memcmp(d + pc[1], pc + 3, pc[2]) != 0) return false;
+          pc += 3 + pc[2];
+          break;
+        case RULE_BYTES_MASK: {
+          const size_t n = pc[2];
+          if ((size_t)pc[1] + n > len) return false;
+          for (size_t i = 0; i < n; ++i) {
+            if ((d[pc[1] + i] & pc[3 + i]) != pc[3 + n + i]) return false;
+          }
+          pc += 3 + 2 * n;
+          break;
+        }
+        default:
+          return false;   // load() lets none through
+      }
+    }
+    return true;
+  }
+
+  uint8_t code_[RULES_MAX_BYTES];
+  Rule rules_[RULES_MAX_RULES];
+  const char* labels_[RULES_MAX_LABELS];
+  size_t ruleCount_ = 0;
+  size_t bytes_ = 0;
+};
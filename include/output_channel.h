@@ -0,0 +1,329 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include "cbor_record.h"
+#include "delta_record.h"
+#include "device_record.h"
+#include "event_record.h"
+#include "field_mask.h"
+#include "lzss_stream.h"
+#include "output_writer.h"
+#include "pcap_record.h"
+#include "record_formats.h"
+
+// Output format options:
+enum class OutputFormat : uint8_t {
+  LOG,   // Human-readable log format (default)
+  CSV,   // Comma-separated values
+  YAML,  // YAML format
+  JSONL, // JSON Lines (one object per line)
+  CBOR,  // Binary CBOR records (RFC 8949), integer keys
+  PCAP,  // libpcap stream of BLE link-layer packets (Wireshark)
+  DELTA, // Stateful binary: per-device session IDs and deltas
+  COMPACT // Short text lines for slow links
+};
+
+// --------- Format registry ---------
+// One entry per format. Channels keep a pointer to the entry chosen for the
+// session, so emitting a record costs a single indirect call.
+// Stateful formats declare `sessionSize`: the channel provides that much
+// storage, header() initialises it and record() updates it. Stateless
+// formats ignore the session pointer (it may be nullptr).
+
+// What a formatter gets from its channel besides the record
+struct FormatContext {
+  uint16_t fields;      // FieldBit mask; LOG, CSV, YAML, JSONL and CBOR honour it,
+                        // the fixed layouts only its seq and crc bits
+  void* session;
+  uint32_t seq;         // the channel's record counter
+};
+
+struct FormatOps {
+  OutputFormat id;
+  const char* name;
+  bool human;                                        // meant to be read by people
+  bool allAdvertisements;                            // also carries unmatched reports
+  void (*header)(OutWriter& out, const FormatContext& ctx);   // session start
+  void (*record)(OutWriter& out, const DeviceRecord& r, const FormatContext& ctx);
+  void (*event)(OutWriter& out, const EventRecord& e); // nullptr: format has no event shape
+  size_t sessionSize;
+};
+
+// Full context for host tools and other one-shot users (no record checks:
+// a re-encoded record has no link sequence of its own)
+constexpr FormatContext FULL_RECORD = { FIELDS_RECORD, nullptr, 0 };
+
+template <typename Format>
+static void writeRecordAs(OutWriter& out, const DeviceRecord& r, const FormatContext& ctx) {
+  Format::write(out, r, ctx.fields, ctx.seq);
+}
+
+template <typename Format>
+static void writeHeaderAs(OutWriter& out, const FormatContext&) {
+  Format::header(out);
+}
+
+template <typename Format>
+static void writeSessionRecordAs(OutWriter& out, const DeviceRecord& r, const FormatContext& ctx) {
+  Format::write(out, r, ctx.session, ctx.seq);
+}
+
+template <typename Format>
+static void writeSessionHeaderAs(OutWriter& out, const FormatContext& ctx) {
+  Format::header(out, ctx.session, ctx.fields);
+}
+
+static void writeNoHeader(OutWriter&, const FormatContext&) {}
+
+static void writeCsvHeader(OutWriter& out, const FormatContext& ctx) {
+  bool first = true;
+  for (const FieldName& c : CSV_COLUMNS) {
+    if ((ctx.fields & c.bit) == 0) continue;
+    if (!first) out.put(',');
+    out.str(c.name);
+    first = false;
+  }
+  out.str("\r\n");
+}
+
+static void writeYamlHeader(OutWriter& out, const FormatContext&) {
+  out.str("---\r\n");
+}
+
+static const FormatOps OUTPUT_FORMATS[] = {
+  { OutputFormat::LOG,     "log",     true,  false, writeNoHeader,                     writeRecordAs<LogFormat>,          writeEventLog,      0 },
+  { OutputFormat::CSV,     "csv",     false, false, writeCsvHeader,                    writeRecordAs<CsvFormat>,          writeEventCsv,      0 },
+  { OutputFormat::YAML,    "yaml",    false, false, writeYamlHeader,                   writeRecordAs<YamlFormat>,         writeEventYaml,     0 },
+  { OutputFormat::JSONL,   "jsonl",   false, false, writeNoHeader,                     writeRecordAs<JsonlFormat>,        writeEventJsonl,    0 },
+  { OutputFormat::CBOR,    "cbor",    false, false, writeHeaderAs<CborFormat>,         writeRecordAs<CborFormat>,         writeCborEvent,     0 },
+  { OutputFormat::PCAP,    "pcap",    false, true,  writeHeaderAs<PcapFormat>,         writeRecordAs<PcapFormat>,         nullptr,            0 },
+  { OutputFormat::DELTA,   "delta",   false, false, writeSessionHeaderAs<DeltaFormat>, writeSessionRecordAs<DeltaFormat>, DeltaFormat::event, sizeof(DeltaFormat::Session) },
+  { OutputFormat::COMPACT, "compact", false, false, writeNoHeader,                     writeRecordAs<CompactFormat>,      writeEventCsv,      0 },
+};
+
+static inline const FormatOps* findFormat(OutputFormat id) {
+  for (const FormatOps& f : OUTPUT_FORMATS) {
+    if (f.id == id) return &f;
+  }
+  return nullptr;
+}
+
+static inline const FormatOps* findFormat(const char* name) {
+  for (const FormatOps& f : OUTPUT_FORMATS) {
+    if (strcmp(f.name, name) == 0) return &f;
+  }
+  return nullptr;
+}
+
+// --------- Sinks ---------
+// Type-erased byte sink (Serial, a second UART, a file on the host, ...)
+struct OutputSink {
+  OutWriter::SinkFn write;
+  void* ctx;
+};
+
+// --------- Channel ---------
+// A format bound to a sink. The format can be changed from another task at any
+// time; the switch takes effect on the next record boundary and starts a new
+// session (header included).
+//
+// Records are numbered per channel from boot (FIELD_SEQ); the counter runs on
+// across format switches, so a host sees a restart as the sequence going back.
+//
+// Optionally the channel compresses its byte stream (lzss_stream.h). Output
+// is then batched: tick() closes a frame every `batchMs`, so latency is
+// bounded while each frame still spans several records.
+class OutputChannel {
+public:
+  using ClockFn = LzssEncoder::ClockFn;
+
+  void begin(const FormatOps* format, OutputSink sink) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sink_ = sink;
+    pending_.store(nullptr);
+    const uint16_t fields = pendingFields_.exchange(0);
+    if (fields != 0) fields_ = fields;
+    format_ = format;
+    if (format_ != nullptr) writeHeader();
+  }
+
+  // nullptr disables the channel
+  void select(const FormatOps* format) {
+    pending_.store(format != nullptr ? format : &DISABLED);
+  }
+
+  // Field projection (FieldBit mask); a change starts a new session so the
+  // CSV header matches the columns
+  void setFields(uint16_t mask) {
+    if (mask != 0) pendingFields_.store(mask);
+  }
+
+  uint16_t fields() const { return fields_; }
+
+  // Turns compression on/off; applied at the next record boundary
+  void setCompression(bool on, uint32_t batchMs = 250, ClockFn clock = nullptr) {
+    batchMs_ = batchMs;
+    clock_ = clock;
+    pendingCompression_.store(on ? COMPRESSION_ON : COMPRESSION_OFF);
+  }
+
+  const FormatOps* format() const { return format_; }
+  bool enabled() const { return format_ != nullptr; }
+  bool wantsAllAdvertisements() const { return format_ != nullptr && format_->allAdvertisements; }
+  bool compressed() const { return encoder_ != nullptr; }
+
+  void emit(const DeviceRecord& r) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    applyPending();
+    if (format_ == nullptr) return;
+    if (!r.matched && !format_->allAdvertisements) return;
+    OutWriter out(buffer_, sizeof(buffer_), streamSink, this);
+    format_->record(out, r, FormatContext{ fields_, session_, (uint32_t)records_ });
+    ++records_;
+  }
+
+  void emitEvent(const EventRecord& e) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    applyPending();
+    if (format_ == nullptr || format_->event == nullptr) return;
+    OutWriter out(buffer_, sizeof(buffer_), streamSink, this);
+    format_->event(out, e);
+  }
+
+  // A self-delimiting binary frame (raw_capture.h) between two records,
+  // compressed with the rest of the stream. Written while the format is off
+  // too: the frames have their own switch.
+  void emitFrame(const uint8_t* data, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    applyPending();
+    streamSink(this, data, len);
+  }
+
+  // Free-form text (banners, status) on this channel's sink
+  void print(const char* text) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    streamSink(this, (const uint8_t*)text, strlen(text));
+  }
+
+  // Call periodically: closes the current compressed batch when it is due
+  void tick(uint32_t nowMs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    applyPending();
+    if (encoder_ == nullptr) return;
+    if ((uint32_t)(nowMs - lastBatchMs_) < batchMs_) return;
+    lastBatchMs_ = nowMs;
+    encoder_->flush();
+  }
+
+  // Closes the current compressed batch now, for events that should not
+  // wait for the next tick()
+  void flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) encoder_->flush();
+  }
+
+  struct Stats {
+    uint64_t records;
+    uint64_t rawBytes;          // everything written, before compression
+    uint64_t compressedBytes;   // on the wire (frames)
+    uint64_t compressMicros;
+  };
+
+  Stats stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s = { records_, rawTotal_, compTotal_, cpuTotal_ };
+    if (encoder_ != nullptr) {
+      s.compressedBytes += encoder_->compressedBytes();
+      s.compressMicros += encoder_->cpuMicros();
+    }
+    return s;
+  }
+
+private:
+  static void streamSink(void* ctx, const uint8_t* data, size_t len) {
+    OutputChannel* self = (OutputChannel*)ctx;
+    self->rawTotal_ += len;
+    if (self->encoder_ != nullptr) self->encoder_->write(data, len);
+    else if (self->sink_.write != nullptr) self->sink_.write(self->sink_.ctx, data, len);
+  }
+
+  void applyPending() {
+    const uint16_t fields = pendingFields_.exchange(0);
+    bool restart = fields != 0 && fields != fields_;
+    if (restart) fields_ = fields;
+
+    const uint8_t compression = pendingCompression_.exchange(COMPRESSION_UNCHANGED);
+    if (compression != COMPRESSION_UNCHANGED) applyCompression(compression == COMPRESSION_ON);
+
+    const FormatOps* next = pending_.exchange(nullptr);
+    if (next != nullptr) {
+      format_ = (next == &DISABLED) ? nullptr : next;
+      restart = true;
+    }
+    if (restart && format_ != nullptr) writeHeader();
+  }
+
+  // Session storage for stateful formats, kept across switches
+  bool reserveSession() {
+    if (format_->sessionSize <= sessionSize_) return true;
+    ::operator delete(session_);
+    session_ = ::operator new(format_->sessionSize, std::nothrow);
+    sessionSize_ = session_ != nullptr ? format_->sessionSize : 0;
+    return session_ != nullptr;
+  }
+
+  void applyCompression(bool on) {
+    if (on == (encoder_ != nullptr)) return;
+    if (on) {
+      encoder_ = new (std::nothrow) LzssEncoder(sink_.write, sink_.ctx, clock_);
+      if (encoder_ == nullptr) return;
+      // The decoder starts on this frame, so repeat the session header
+      if (format_ != nullptr) writeHeader();
+    } else {
+      encoder_->flush();
+      compTotal_ += encoder_->compressedBytes();
+      cpuTotal_ += encoder_->cpuMicros();
+      delete encoder_;
+      encoder_ = nullptr;
+    }
+  }
+
+  void writeHeader() {
+    if (!reserveSession()) {
+      format_ = nullptr;    // out of memory: leave the channel off
+      return;
+    }
+    OutWriter out(buffer_, sizeof(buffer_), streamSink, this);
+    format_->header(out, FormatContext{ fields_, session_, (uint32_t)records_ });
+  }
+
+  static constexpr FormatOps DISABLED = { OutputFormat::LOG, "off", false, false, nullptr, nullptr, nullptr, 0 };
+  static constexpr uint8_t COMPRESSION_UNCHANGED = 0;
+  static constexpr uint8_t COMPRESSION_OFF = 1;
+  static constexpr uint8_t COMPRESSION_ON = 2;
+
+  std::mutex mutex_;
+  const FormatOps* format_ = nullptr;
+  std::atomic<const FormatOps*> pending_{nullptr};
+  std::atomic<uint8_t> pendingCompression_{COMPRESSION_UNCHANGED};
+  std::atomic<uint16_t> pendingFields_{0};
+  uint16_t fields_ = FIELDS_ALL;
+  OutputSink sink_ = { nullptr, nullptr };
+  LzssEncoder* encoder_ = nullptr;
+  void* session_ = nullptr;
+  size_t sessionSize_ = 0;
+  ClockFn clock_ = nullptr;
+  uint32_t batchMs_ = 250;
+  uint32_t lastBatchMs_ = 0;
+  uint64_t records_ = 0;
+  uint64_t rawTotal_ = 0;
+  uint64_t compTotal_ = 0;
+  uint64_t cpuTotal_ = 0;
+  uint8_t buffer_[256];
+};
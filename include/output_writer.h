@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "crc16.h"
+
+// Streaming output writer.
+// Bytes are staged in a small caller-provided buffer and handed to the sink
+// whenever it fills up, so a record of any length is emitted completely
+// (nothing is ever truncated, unlike a fixed snprintf buffer).
+class OutWriter {
+public:
+  using SinkFn = void (*)(void* ctx, const uint8_t* data, size_t len);
+
+  OutWriter(uint8_t* buffer, size_t capacity, SinkFn sink, void* ctx)
+    : buf_(buffer), cap_(capacity), sink_(sink), ctx_(ctx) {}
+
+  ~OutWriter() { flush(); }
+
+  OutWriter(const OutWriter&) = delete;
+  OutWriter& operator=(const OutWriter&) = delete;
+
+  inline void put(char c) {
+    if (len_ == cap_) flush();
+    buf_[len_++] = (uint8_t)c;
+    ++total_;
+  }
+
+  void write(const void* data, size_t n) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (n > 0) {
+      if (len_ == cap_) flush();
+      size_t chunk = cap_ - len_;
+      if (chunk > n) chunk = n;
+      memcpy(buf_ + len_, p, chunk);
+      len_ += chunk;
+      total_ += chunk;
+      p += chunk;
+      n -= chunk;
+    }
+  }
+
+  inline void str(const char* s) { write(s, strlen(s)); }
+
+  void flush() {
+    if (crcOn_) crcValue();
+    if (len_ > 0 && sink_ != nullptr) sink_(ctx_, buf_, len_);
+    len_ = 0;
+    crcFrom_ = 0;
+  }
+
+  // CRC-16 of everything written since crcBegin(). Bytes are folded in when
+  // they leave the buffer, so put() stays as cheap as without a CRC.
+  void crcBegin() {
+    crc_ = 0xFFFF;
+    crcFrom_ = len_;
+    crcOn_ = true;
+  }
+
+  uint16_t crcValue() {
+    crc_ = crc16Update(crc_, buf_ + crcFrom_, len_ - crcFrom_);
+    crcFrom_ = len_;
+    return crc_;
+  }
+
+  // Total bytes produced since construction (used for column padding)
+  inline size_t written() const { return total_; }
+
+  // --------- Primitive field writers (no format parsing) ---------
+
+  void dec(int32_t v) {
+    if (v < 0) {
+      put('-');
+      udec((uint32_t)(-(int64_t)v));
+    } else {
+      udec((uint32_t)v);
+    }
+  }
+
+  void dec64(int64_t v) {
+    if (v < 0) {
+      put('-');
+      udec((uint64_t)0 - (uint64_t)v);
+    } else {
+      udec((uint64_t)v);
+    }
+  }
+
+  void udec(uint64_t v) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+      tmp[n++] = (char)('0' + (v % 10));
+      v /= 10;
+    } while (v != 0);
+    while (n > 0) put(tmp[--n]);
+  }
+
+  // Same as printf("%0<width>d")
+  void decZeroPad(int32_t v, size_t width) {
+    uint32_t mag = v < 0 ? (uint32_t)(-(int64_t)v) : (uint32_t)v;
+    char tmp[10];
+    size_t n = 0;
+    do {
+      tmp[n++] = (char)('0' + (mag % 10));
+      mag /= 10;
+    } while (mag != 0);
+    size_t used = n + (v < 0 ? 1 : 0);
+    if (v < 0) put('-');
+    for (; used < width; ++used) put('0');
+    while (n > 0) put(tmp[--n]);
+  }
+
+  // Fixed-width unsigned decimal with leading zeros (timestamps)
+  inline void digits(uint32_t v, size_t width) {
+    char tmp[10];
+    for (size_t i = width; i > 0; --i) {
+      tmp[i - 1] = (char)('0' + (v % 10));
+      v /= 10;
+    }
+    write(tmp, width);
+  }
+
+  // Upper-case hex, exactly `nibbles` digits
+  inline void hex(uint32_t v, size_t nibbles) {
+    for (size_t i = nibbles; i > 0; --i) put(HEX_UPPER[(v >> ((i - 1) * 4)) & 0xF]);
+  }
+
+  // Hex dump, optional separator between bytes ("4C 00 12" or "4C0012")
+  // (built 16 bytes at a time and copied in, not put() per character)
+  void hexBytes(const uint8_t* data, size_t len, char sep, const char* digits = HEX_UPPER) {
+    char tmp[48];
+    for (size_t i = 0; i < len;) {
+      size_t n = 0;
+      for (const size_t end = (len - i > 16) ? i + 16 : len; i < end; ++i) {
+        if (sep != 0 && i > 0) tmp[n++] = sep;
+        tmp[n++] = digits[(data[i] >> 4) & 0xF];
+        tmp[n++] = digits[data[i] & 0xF];
+      }
+      write(tmp, n);
+    }
+  }
+
+  void pad(size_t fromMark, size_t width, char c = ' ') {
+    for (size_t used = written() - fromMark; used < width; ++used) put(c);
+  }
+
+  static constexpr const char* HEX_UPPER = "0123456789ABCDEF";
+  static constexpr const char* HEX_LOWER = "0123456789abcdef";
+
+private:
+  uint8_t* buf_;
+  size_t cap_;
+  SinkFn sink_;
+  void* ctx_;
+  size_t len_ = 0;
+  size_t total_ = 0;
+  size_t crcFrom_ = 0;
+  uint16_t crc_ = 0xFFFF;
+  bool crcOn_ = false;
+};
+
+// Little-endian binary fields
+static inline void putLe16(OutWriter& w, uint16_t v) {
+  w.put((char)v);
+  w.put((char)(v >> 8));
+}
+
+static inline void putLe32(OutWriter& w, uint32_t v) {
+  for (int s = 0; s < 32; s += 8) w.put((char)(v >> s));
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "device_record.h"
+#include "field_mask.h"
+#include "output_writer.h"
+
+// libpcap stream of BLE link-layer packets (LINKTYPE_BLUETOOTH_LE_LL_WITH_PHDR)
+// so captures open directly in Wireshark with the btle dissector.
+//
+// Per packet: pcap record header, 10-byte pseudo-header (RSSI, reference
+// access address, flags with the PHY), then the advertising channel PDU as it
+// was on air: access address (and the coding indicator on the Coded PHY),
+// 2-byte header, AdvA, AdvData and the CRC. A record is one packet per PDU
+// it came in: a merged scan response adds a SCAN_RSP, and an extended report
+// is an AUX_ADV_IND, plus an AUX_CHAIN_IND for a long payload. All packets of
+// a record share its time and seq.
+//
+// Record checks: the link-layer CRC-24 already covers each PDU. With
+// FIELD_SEQ the low 16 bits of the record counter go in the noise power and
+// access address offenses bytes (LE16); their valid flags stay clear, so
+// Wireshark ignores them.
+
+constexpr uint32_t PCAP_MAGIC              = 0xA1B2C3D4;
+constexpr uint16_t PCAP_VERSION_MAJOR      = 2;
+constexpr uint16_t PCAP_VERSION_MINOR      = 4;
+constexpr uint32_t PCAP_SNAPLEN            = 512;
+constexpr uint32_t DLT_BLUETOOTH_LE_LL_WITH_PHDR = 256;
+
+constexpr uint32_t BLE_ADV_ACCESS_ADDRESS  = 0x8E89BED6;
+constexpr uint32_t BLE_ADV_CRC_INIT        = 0x555555;
+
+constexpr size_t PCAP_RECORD_HEADER_LEN    = 16;
+constexpr size_t BLE_PHDR_LEN              = 10;
+
+// Pseudo-header flags
+constexpr uint16_t BLE_PHDR_DEWHITENED       = 0x0001;
+constexpr uint16_t BLE_PHDR_SIGNAL_VALID     = 0x0002;
+constexpr uint16_t BLE_PHDR_REF_AA_VALID     = 0x0010;
+constexpr uint16_t BLE_PHDR_AUX_ADV          = 0x0080;   // PDU type 1: auxiliary advertising
+constexpr uint16_t BLE_PHDR_CRC_CHECKED      = 0x0400;
+constexpr uint16_t BLE_PHDR_CRC_VALID        = 0x0800;
+constexpr int      BLE_PHDR_PHY_SHIFT        = 14;       // 0 = 1M, 1 = 2M, 2 = Coded
+
+// Advertising PDU header and extended header fields
+constexpr uint8_t BLE_PDU_SCAN_RSP           = 0x4;
+constexpr uint8_t BLE_PDU_ADV_EXT            = 0x7;      // ADV_EXT_IND, AUX_ADV_IND, AUX_CHAIN_IND
+constexpr uint8_t BLE_PDU_TXADD              = 0x40;
+constexpr uint8_t BLE_EXT_ADVA               = 0x01;
+constexpr uint8_t BLE_EXT_ADI                = 0x08;
+constexpr uint8_t BLE_EXT_AUXPTR             = 0x10;
+constexpr size_t  BLE_ADV_PDU_MAX            = 255;
+constexpr size_t  BLE_AUX_ADV_DATA_MAX       = BLE_ADV_PDU_MAX - (1 + 1 + 6 + 2);
+constexpr uint8_t BLE_CI_S8                  = 0;
+
+// HCI legacy advertising report event type -> LL advertising PDU type
+static inline uint8_t llPduType(uint8_t hciAdvType) {
+  switch (hciAdvType) {
+    case 0: return 0x0;   // ADV_IND
+    case 1: return 0x1;   // ADV_DIRECT_IND
+    case 2: return 0x6;   // ADV_SCAN_IND
+    case 4: return 0x4;   // SCAN_RSP
+    default: return 0x2;  // 3: ADV_NONCONN_IND
+  }
+}
+
+// ble_ids.h BLE_PHY_* -> the PHY code of the pseudo-header and AuxPtr
+static inline uint8_t blePhyCode(uint8_t phy) {
+  return phy == BLE_PHY_2M ? 1 : (phy == BLE_PHY_CODED ? 2 : 0);
+}
+
+// BLE link-layer CRC-24 (Core spec Vol 6 Part B 3.1.1), computed on a
+// bit-reversed register so the result can be stored little endian exactly as
+// the three CRC bytes appear on air.
+static inline uint32_t bleCrc24Start(uint32_t crcInit) {
+  uint32_t state = 0;
+  for (int i = 0; i < 24; ++i) {
+    if (crcInit & (1u << i)) state |= 1u << (23 - i);
+  }
+  return state;
+}
+
+static inline uint32_t bleCrc24Update(uint32_t state, const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    uint8_t cur = data[i];
+    for (int b = 0; b < 8; ++b) {
+      const bool next = ((state ^ cur) & 1) != 0;
+      cur >>= 1;
+      state >>= 1;
+      if (next) state = (state | (1u << 23)) ^ 0x5A6000;
+    }
+  }
+  return state;
+}
+
+struct PcapFormat {
+  static void header(OutWriter& w) {
+    putLe32(w, PCAP_MAGIC);
+    putLe16(w, PCAP_VERSION_MAJOR);
+    putLe16(w, PCAP_VERSION_MINOR);
+    putLe32(w, 0);                 // thiszone
+    putLe32(w, 0);                 // sigfigs
+    putLe32(w, PCAP_SNAPLEN);
+    putLe32(w, DLT_BLUETOOTH_LE_LL_WITH_PHDR);
+  }
+
+  static void write(OutWriter& w, const DeviceRecord& r, uint16_t mask = FIELDS_RECORD, uint32_t seq = 0) {
+    const uint16_t seq16 = (mask & FIELD_SEQ) ? (uint16_t)seq : 0;
+    if (isExtended(r)) {
+      writeExtended(w, r, seq16);
+      return;
+    }
+    // A merged scan response goes out as the SCAN_RSP it came in. Records
+    // decoded from another format do not know the split; past 31 bytes the
+    // rest can only be the scan response.
+    size_t rspLen = r.scanRspLen;
+    if (rspLen == 0 || rspLen > r.payloadLen) {
+      rspLen = r.payloadLen > LEGACY_ADV_DATA_MAX ? r.payloadLen - LEGACY_ADV_DATA_MAX : 0;
+    }
+    const size_t advLen = r.payloadLen - rspLen;
+    const uint8_t txAdd = r.addrType != 0 ? BLE_PDU_TXADD : 0;
+    packet(w, r, (uint8_t)(llPduType(r.advType) | txAdd), r.addr, 6, r.payload, legacyLen(advLen), BLE_PHY_1M,
+           0, seq16);
+    if (rspLen > 0) {
+      packet(w, r, (uint8_t)(BLE_PDU_SCAN_RSP | txAdd), r.addr, 6, r.payload + advLen, legacyLen(rspLen), BLE_PHY_1M,
+             0, seq16);
+    }
+  }
+
+private:
+  static size_t legacyLen(size_t len) { return len < LEGACY_ADV_DATA_MAX ? len : LEGACY_ADV_DATA_MAX; }
+
+  // Extended advertising: the AdvData as the AUX_ADV_IND that carried it on
+  // the secondary PHY, with AdvA and the ADI (SID; the DID is not reported),
+  // and an AUX_CHAIN_IND for what does not fit. The controller reports
+  // neither the channel nor the offset of the chained packet, so its AuxPtr
+  // only carries the PHY.
+  static void writeExtended(OutWriter& w, const DeviceRecord& r, uint16_t seq16) {
+    const uint8_t phy = r.secondaryPhy != BLE_PHY_NONE ? r.secondaryPhy : r.primaryPhy;
+    const uint8_t adi[2] = { 0, (uint8_t)(r.sid << 4) };
+    const uint8_t advMode = (uint8_t)((r.isConnectable ? 0x40 : 0) | (r.isScannable ? 0x80 : 0));
+    const bool chained = r.payloadLen > BLE_AUX_ADV_DATA_MAX;
+
+    uint8_t ext[1 + 1 + 6 + 2 + 3];
+    size_t n = 0;
+    ext[n++] = 0;                                 // length and AdvMode, below
+    ext[n++] = (uint8_t)(BLE_EXT_ADVA | BLE_EXT_ADI | (chained ? BLE_EXT_AUXPTR : 0));
+    memcpy(ext + n, r.addr, 6);
+    n += 6;
+    memcpy(ext + n, adi, 2);
+    n += 2;
+    if (chained) {
+      ext[n++] = 0;                               // channel index, CA, offset units
+      ext[n++] = 0;
+      ext[n++] = (uint8_t)(blePhyCode(phy) << 5);
+    }
+    ext[0] = (uint8_t)((n - 1) | advMode);
+    const uint8_t txAdd = r.addrType != 0 ? BLE_PDU_TXADD : 0;
+    const size_t first = chained ? BLE_ADV_PDU_MAX - n : r.payloadLen;
+    packet(w, r, (uint8_t)(BLE_PDU_ADV_EXT | txAdd), ext, n, r.payload, first, phy, BLE_PHDR_AUX_ADV, seq16);
+    if (!chained) return;
+
+    const uint8_t chain[1 + 1 + 2] = { 3, BLE_EXT_ADI, adi[0], adi[1] };
+    size_t rest = r.payloadLen - first;
+    if (rest > BLE_ADV_PDU_MAX - sizeof(chain)) rest = BLE_ADV_PDU_MAX - sizeof(chain);
+    packet(w, r, BLE_PDU_ADV_EXT, chain, sizeof(chain), r.payload + first, rest, phy, BLE_PHDR_AUX_ADV, seq16);
+  }
+
+  // One pcap record: PDU header, `head` (AdvA, or the extended header), data
+  static void packet(OutWriter& w, const DeviceRecord& r, uint8_t pdu0, const uint8_t* head, size_t headLen,
+                     const uint8_t* data, size_t len, uint8_t phy, uint16_t pduFlags, uint16_t seq16) {
+    uint8_t pduHeader[2];
+    pduHeader[0] = pdu0;
+    pduHeader[1] = (uint8_t)(headLen + len);
+
+    uint32_t crc = bleCrc24Start(BLE_ADV_CRC_INIT);
+    crc = bleCrc24Update(crc, pduHeader, sizeof(pduHeader));
+    crc = bleCrc24Update(crc, head, headLen);
+    crc = bleCrc24Update(crc, data, len);
+
+    const bool coded = phy == BLE_PHY_CODED;
+    const uint32_t packetLen = (uint32_t)(BLE_PHDR_LEN + 4 + (coded ? 1 : 0) + 2 + headLen + len + 3);
+
+    // Record header
+    putLe32(w, (uint32_t)r.time.tv_sec);
+    putLe32(w, (uint32_t)r.time.tv_usec);
+    putLe32(w, packetLen);
+    putLe32(w, packetLen);
+
+    // Pseudo-header. The controller does not report the RF channel.
+    w.put((char)0);                               // rf_channel
+    w.put((char)(int8_t)r.rssi);                  // signal power (dBm)
+    putLe16(w, seq16);                            // noise power, AA offenses
+    putLe32(w, BLE_ADV_ACCESS_ADDRESS);           // reference access address
+    putLe16(w, (uint16_t)(BLE_PHDR_DEWHITENED | BLE_PHDR_SIGNAL_VALID | BLE_PHDR_REF_AA_VALID |
+                          BLE_PHDR_CRC_CHECKED | BLE_PHDR_CRC_VALID | pduFlags |
+                          (blePhyCode(phy) << BLE_PHDR_PHY_SHIFT)));
+
+    // Link-layer packet; the coding scheme is not reported, S=8 is assumed
+    putLe32(w, BLE_ADV_ACCESS_ADDRESS);
+    if (coded) w.put((char)BLE_CI_S8);
+    w.write(pduHeader, sizeof(pduHeader));
+    w.write(head, headLen);                       // AdvA, little endian like on air
+    w.write(data, len);
+    w.put((char)crc);
+    w.put((char)(crc >> 8));
+    w.put((char)(crc >> 16));
+  }
+};
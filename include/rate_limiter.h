@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "ble_ids.h"
+#include "crc16.h"
+#include "device_record.h"
+#include "keyed_lru.h"
+#include "vendor_decode.h"
+
+// Per-device rate limit in front of the load shedder.
+//
+// An AirTag advertises about every 2 s, but Fast Pair earbuds and Samsung
+// tags can advertise every 20-100 ms and crowd everything else out. Each
+// device (deviceKey(): its address, or the public key an offline finding
+// advertisement carries) gets a token bucket: `burst` tokens, refilled one
+// per `intervalMs`, with the parameters chosen by vendor. A sighting without a token is not
+// emitted but folded into the next record that is: DeviceRecord::suppressed
+// counts the sightings it stands for and rssiMin/rssiMax cover their RSSI,
+// so per-device counts and signal statistics stay unbiased.
+//
+// A device's first sighting always passes, and a payload change may run
+// the bucket one token into debt. Records dropped further down (shedding, a full queue) can be
+// folded back with fold(). The table is a KeyedLru; sightings still folded
+// into an evicted device are counted in foldLost().
+
+struct RateLimit {
+  uint32_t intervalMs;    // one token per interval; 0 = unlimited
+  uint8_t burst;          // bucket size
+};
+
+enum RateVendor : uint8_t {
+  RATE_APPLE,
+  RATE_GOOGLE,
+  RATE_SAMSUNG,
+  RATE_XIAOMI,
+  RATE_OTHER,             // unmatched reports (raw capture)
+  RATE_VENDOR_COUNT
+};
+
+static inline RateVendor rateVendor(uint16_t cid) {
+  switch (cid) {
+    case CID_APPLE:   return RATE_APPLE;
+    case CID_GOOGLE:  return RATE_GOOGLE;
+    case CID_SAMSUNG: return RATE_SAMSUNG;
+    case CID_XIAOMI:  return RATE_XIAOMI;
+    default:          return RATE_OTHER;
+  }
+}
+
+// "apple", "google", "samsung", "xiaomi", "other"; RATE_VENDOR_COUNT if unknown
+static inline RateVendor parseRateVendor(const char* name) {
+  static const char* const NAMES[RATE_VENDOR_COUNT] = { "apple", "google", "samsung", "xiaomi", "other" };
+  for (uint8_t v = 0; v < RATE_VENDOR_COUNT; ++v) {
+    if (strcmp(name, NAMES[v]) == 0) return (RateVendor)v;
+  }
+  return RATE_VENDOR_COUNT;
+}
+
+constexpr size_t RATE_TRACKED_DEVICES = 256;
+
+class RateLimiter {
+public:
+  RateLimiter(const RateLimit (&limits)[RATE_VENDOR_COUNT]) {
+    for (uint8_t v = 0; v < RATE_VENDOR_COUNT; ++v) setLimit((RateVendor)v, limits[v]);
+  }
+
+  // Runtime change from the command handler; takes effect on the next refill
+  void setLimit(RateVendor vendor, RateLimit limit) {
+    intervalMs_[vendor].store(limit.intervalMs, std::memory_order_relaxed);
+    burst_[vendor].store(limit.burst > 0 ? limit.burst : 1, std::memory_order_relaxed);
+  }
+
+  RateLimit limit(RateVendor vendor) const {
+    return { intervalMs_[vendor].load(std::memory_order_relaxed), burst_[vendor].load(std::memory_order_relaxed) };
+  }
+
+  // Called from the scan callback. On true the record carries the sightings
+  // folded since the device's previous record; on false it was folded itself.
+  bool admit(DeviceRecord& r, uint32_t nowMs) {
+    const RateLimit l = limit(rateVendor(r.manufacturer));
+    // Credit is an int32_t of ms: any interval and burst the command accepts
+    // must fit, so both are clamped instead of wrapping
+    const int32_t interval = l.intervalMs > (uint32_t)INT32_MAX ? INT32_MAX : (int32_t)l.intervalMs;
+    const uint64_t capMs = (uint64_t)l.intervalMs * l.burst;
+    const int32_t cap = capMs > (uint64_t)INT32_MAX ? INT32_MAX : (int32_t)capMs;
+    const uint16_t crc = crc16(r.data, r.dataLen);
+
+    // A full table evicts its least recently seen device to make room
+    const Bucket* lru = buckets_.size() == RATE_TRACKED_DEVICES ? buckets_.oldest() : nullptr;
+    const uint16_t lruFolded = lru != nullptr ? lru->folded : 0;
+
+    bool inserted;
+    Bucket& b = buckets_.acquire(deviceKey(r), inserted);
+    const bool changed = inserted || b.payloadCrc != crc;
+    if (inserted) {
+      if (r.matched) newDevices_.fetch_add(1, std::memory_order_relaxed);
+      if (lruFolded > 0) foldLost_.fetch_add(lruFolded, std::memory_order_relaxed);
+      b.creditMs = cap;
+    } else {
+      const int64_t credit = (int64_t)b.creditMs + (uint32_t)(nowMs - b.lastMs);
+      b.creditMs = credit > cap ? cap : (int32_t)credit;
+    }
+    b.lastMs = nowMs;
+    b.payloadCrc = crc;
+
+    // A payload change may overdraw the bucket by one token, so changes get
+    // through first while the long-run rate stays at one per interval
+    if (interval > 0) {
+      if (b.creditMs < (changed ? 0 : interval)) {
+        addSighting(b, 1, r.rssi, r.rssi);
+        folded_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      b.creditMs -= interval;
+    }
+
+    r.suppressed = b.folded;
+    r.rssiMin = (int8_t)(b.folded > 0 && b.rssiMin < r.rssi ? b.rssiMin : clampRssi(r.rssi));
+    r.rssiMax = (int8_t)(b.folded > 0 && b.rssiMax > r.rssi ? b.rssiMax : clampRssi(r.rssi));
+    b.folded = 0;
+    return true;
+  }
+
+  // A record admit() passed but that was dropped later: it and the sightings
+  // it carried go back into the device's bucket
+  void fold(const DeviceRecord& r) {
+    const uint32_t sightings = 1u + r.suppressed;
+    Bucket* b = buckets_.find(deviceKey(r));
+    if (b == nullptr) {
+      foldLost_.fetch_add(sightings, std::memory_order_relaxed);
+      return;
+    }
+    addSighting(*b, sightings, foldedRssiMin(r), foldedRssiMax(r));
+  }
+
+  uint32_t folded() const { return folded_.load(std::memory_order_relaxed); }
+  uint32_t foldLost() const { return foldLost_.load(std::memory_order_relaxed); }
+  size_t devices() const { return buckets_.size(); }
+  // Matched devices that were not in the table (first seen, or forgotten)
+  uint32_t newDevices() const { return newDevices_.load(std::memory_order_relaxed); }
+
+private:
+  struct Bucket {
+    uint32_t lastMs;
+    int32_t creditMs;       // refill time banked, -interval .. burst * interval
+    uint16_t payloadCrc;
+    uint16_t folded;        // sightings waiting for the next record
+    int8_t rssiMin;
+    int8_t rssiMax;
+  };
+
+  static int clampRssi(int rssi) { return rssi < -128 ? -128 : (rssi > 127 ? 127 : rssi); }
+
+  // The folded count saturates at 65535
+  void addSighting(Bucket& b, uint32_t count, int rssiMin, int rssiMax) {
+    if (b.folded == 0) {
+      b.rssiMin = (int8_t)clampRssi(rssiMin);
+      b.rssiMax = (int8_t)clampRssi(rssiMax);
+    } else {
+      if (rssiMin < b.rssiMin) b.rssiMin = (int8_t)clampRssi(rssiMin);
+      if (rssiMax > b.rssiMax) b.rssiMax = (int8_t)clampRssi(rssiMax);
+    }
+    const uint32_t total = b.folded + count;
+    b.folded = (uint16_t)(total > 0xFFFF ? 0xFFFF : total);
+  }
+
+  std::atomic<uint32_t> intervalMs_[RATE_VENDOR_COUNT];
+  std::atomic<uint8_t> burst_[RATE_VENDOR_COUNT];
+  KeyedLru<Bucket, RATE_TRACKED_DEVICES> buckets_;
+  std::atomic<uint32_t> folded_{0};
+  std::atomic<uint32_t> foldLost_{0};
+  std::atomic<uint32_t> newDevices_{0};
+};
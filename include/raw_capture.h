@@ -0,0 +1,272 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/time.h>
+
+#include "ble_ids.h"
+#include "crc16.h"
+
+// Raw capture of every advertising report, for RF surveys.
+//
+// The scan callback copies each report that passes a cheap prefilter (RSSI
+// floor, address types, manufacturer company IDs) into a ring of fixed-size
+// RawReports, before any classification. The ring's storage comes from the
+// caller: PSRAM on the device, so a survey can buffer thousands of reports
+// and send them later. loop() sends them as CRC-checked batch frames:
+//
+//   FA C5 | count | firstSeq (LE32) | bodyLen (LE16) | reports... | crc16
+//
+// The CRC (crc16.h) covers everything after the magic. On the wire a report
+// is its 24-byte header followed by payloadLen payload bytes:
+//
+//   seq (LE32) | time_us (LE64, epoch) | addr[6] (LSB first) | addrType |
+//   rssi | advType | flags | phy | payloadLen
+//
+// flags: bit 0 connectable, bit 1 scannable, bit 2 extended, bits 4-7 SID.
+// phy: primary PHY in bits 0-3, secondary in bits 4-7 (0 for legacy).
+//
+// Every report offered is counted exactly once: as filtered out, captured,
+// or dropped because the ring was full. Admitted reports (captured or
+// dropped) are numbered, so a gap in seq on the wire is a drop.
+
+constexpr uint8_t RAW_MAGIC0           = 0xFA;
+constexpr uint8_t RAW_MAGIC1           = 0xC5;
+constexpr size_t  RAW_HEADER_BYTES     = 24;
+constexpr size_t  RAW_FRAME_HEADER     = 9;
+constexpr size_t  RAW_FRAME_TRAILER    = 2;
+constexpr size_t  RAW_FRAME_BODY_MAX   = 2048;
+constexpr size_t  RAW_FRAME_MAX        = RAW_FRAME_HEADER + RAW_FRAME_BODY_MAX + RAW_FRAME_TRAILER;
+constexpr size_t  RAW_FILTER_MAX_CIDS  = 8;
+
+constexpr uint8_t RAW_FLAG_CONNECTABLE = 0x01;
+constexpr uint8_t RAW_FLAG_SCANNABLE   = 0x02;
+constexpr uint8_t RAW_FLAG_EXTENDED    = 0x04;
+
+template <size_t PayloadMax>
+struct RawReport {
+  uint32_t seq;
+  uint64_t timeUs;
+  uint8_t addr[6];
+  uint8_t addrType;
+  int8_t rssi;
+  uint8_t advType;
+  uint8_t flags;
+  uint8_t phy;
+  uint8_t payloadLen;
+  uint8_t payload[PayloadMax];
+};
+
+static inline uint64_t rawTimeUs(const struct timeval& tv) {
+  return (uint64_t)tv.tv_sec * 1000000u + (uint64_t)tv.tv_usec;
+}
+
+// Wire form; `out` needs RAW_HEADER_BYTES + payloadLen bytes
+template <size_t PayloadMax>
+static inline size_t encodeRawReport(const RawReport<PayloadMax>& r, uint8_t* out) {
+  for (int i = 0; i < 4; ++i) out[i] = (uint8_t)(r.seq >> (8 * i));
+  for (int i = 0; i < 8; ++i) out[4 + i] = (uint8_t)(r.timeUs >> (8 * i));
+  memcpy(out + 12, r.addr, 6);
+  out[18] = r.addrType;
+  out[19] = (uint8_t)r.rssi;
+  out[20] = r.advType;
+  out[21] = r.flags;
+  out[22] = r.phy;
+  out[23] = r.payloadLen;
+  memcpy(out + RAW_HEADER_BYTES, r.payload, r.payloadLen);
+  return RAW_HEADER_BYTES + r.payloadLen;
+}
+
+// Reverse of encodeRawReport(); 0 if `n` bytes do not hold a whole report
+template <size_t PayloadMax>
+static inline size_t decodeRawReport(const uint8_t* p, size_t n, RawReport<PayloadMax>& r) {
+  if (n < RAW_HEADER_BYTES || n < RAW_HEADER_BYTES + p[23] || p[23] > PayloadMax) return 0;
+  r.seq = 0;
+  for (int i = 3; i >= 0; --i) r.seq = (r.seq << 8) | p[i];
+  r.timeUs = 0;
+  for (int i = 7; i >= 0; --i) r.timeUs = (r.timeUs << 8) | p[4 + i];
+  memcpy(r.addr, p + 12, 6);
+  r.addrType = p[18];
+  r.rssi = (int8_t)p[19];
+  r.advType = p[20];
+  r.flags = p[21];
+  r.phy = p[22];
+  r.payloadLen = p[23];
+  memcpy(r.payload, p + RAW_HEADER_BYTES, r.payloadLen);
+  return RAW_HEADER_BYTES + r.payloadLen;
+}
+
+struct RawFilter {
+  int8_t minRssi = -128;
+  uint8_t addrTypes = 0xFF;     // bit n admits BLE address type n
+  uint8_t cidCount = 0;         // 0: any payload; else manufacturer data
+  uint16_t cids[RAW_FILTER_MAX_CIDS] = {};   // with one of these company IDs
+
+  bool admit(uint8_t addrType, int rssi, const uint8_t* payload, size_t len) const {
+    if (rssi < minRssi) return false;
+    if (addrType < 8 && (addrTypes & (1u << addrType)) == 0) return false;
+    if (cidCount == 0) return true;
+    bool found = false;
+    forEachAdStructure(payload, len, [&](uint8_t type, const uint8_t* d, size_t n) {
+      if (type != AD_TYPE_MANUFACTURER || n < 2) return true;
+      const uint16_t cid = (uint16_t)(d[0] | (d[1] << 8));
+      for (uint8_t i = 0; i < cidCount && !found; ++i) found = cids[i] == cid;
+      return !found;
+    });
+    return found;
+  }
+};
+
+// Single producer (scan callback), single consumer (loop()). One slot stays
+// empty to tell full from empty, so any capacity works.
+template <size_t PayloadMax>
+class RawCapture {
+public:
+  using Report = RawReport<PayloadMax>;
+
+  // Until begin() every admitted report is dropped
+  void begin(Report* slots, size_t capacity) {
+    slots_ = slots;
+    capacity_ = capacity;
+    head_.store(0);
+    tail_.store(0);
+  }
+
+  // Swapped in whole, so the callback never sees one half-written
+  void setFilter(const RawFilter& f) {
+    const uint8_t next = active_.load() ^ 1;
+    filters_[next] = f;
+    active_.store(next, std::memory_order_release);
+  }
+  const RawFilter& filter() const { return filters_[active_.load(std::memory_order_acquire)]; }
+
+  // Producer: the slot to fill for this report (seq set), then commit();
+  // nullptr when filtered out or dropped
+  Report* offer(uint8_t addrType, int rssi, const uint8_t* payload, size_t len) {
+    offered_.fetch_add(1, std::memory_order_relaxed);
+    if (!filter().admit(addrType, rssi, payload, len)) {
+      filtered_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    const uint32_t seq = seq_++;
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t next = head + 1 == capacity_ ? 0 : head + 1;
+    if (capacity_ < 2 || next == tail_.load(std::memory_order_acquire)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Report* r = &slots_[head];
+    r->seq = seq;
+    return r;
+  }
+
+  void commit() {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    head_.store(head + 1 == capacity_ ? 0 : head + 1, std::memory_order_release);
+    captured_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Consumer side: the oldest report, valid until pop(); nullptr when empty
+  const Report* front() const {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return nullptr;
+    return &slots_[tail];
+  }
+
+  void pop() {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    tail_.store(tail + 1 == capacity_ ? 0 : tail + 1, std::memory_order_release);
+  }
+
+  size_t size() const {
+    const size_t head = head_.load(std::memory_order_acquire), tail = tail_.load(std::memory_order_acquire);
+    return head >= tail ? head - tail : head + capacity_ - tail;
+  }
+  size_t capacity() const { return capacity_ > 0 ? capacity_ - 1 : 0; }
+  uint8_t fillPercent() const { return capacity() > 0 ? (uint8_t)(size() * 100 / capacity()) : 0; }
+
+  // offered == filtered + captured + dropped, between reports
+  uint32_t offered() const { return offered_.load(std::memory_order_relaxed); }
+  uint32_t filtered() const { return filtered_.load(std::memory_order_relaxed); }
+  uint32_t captured() const { return captured_.load(std::memory_order_relaxed); }
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  Report* slots_ = nullptr;
+  size_t capacity_ = 0;
+  RawFilter filters_[2];
+  std::atomic<uint8_t> active_{0};
+  uint32_t seq_ = 0;                  // producer only
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+  std::atomic<uint32_t> offered_{0};
+  std::atomic<uint32_t> filtered_{0};
+  std::atomic<uint32_t> captured_{0};
+  std::atomic<uint32_t> dropped_{0};
+};
+
+// Packs reports into frames and hands each finished frame to the sink
+class RawFrameWriter {
+public:
+  using SinkFn = void (*)(void* ctx, const uint8_t* data, size_t len);
+
+  RawFrameWriter(SinkFn sink, void* ctx) : sink_(sink), ctx_(ctx) {}
+
+  template <size_t PayloadMax>
+  void add(const RawReport<PayloadMax>& r) {
+    static_assert(RAW_HEADER_BYTES + PayloadMax <= RAW_FRAME_BODY_MAX, "a report must fit a frame");
+    if (count_ == 255 || bodyLen_ + RAW_HEADER_BYTES + r.payloadLen > RAW_FRAME_BODY_MAX) flush();
+    if (count_ == 0) firstSeq_ = r.seq;
+    bodyLen_ += encodeRawReport(r, frame_ + RAW_FRAME_HEADER + bodyLen_);
+    ++count_;
+  }
+
+  void flush() {
+    if (count_ == 0) return;
+    frame_[0] = RAW_MAGIC0;
+    frame_[1] = RAW_MAGIC1;
+    frame_[2] = count_;
+    for (int i = 0; i < 4; ++i) frame_[3 + i] = (uint8_t)(firstSeq_ >> (8 * i));
+    frame_[7] = (uint8_t)bodyLen_;
+    frame_[8] = (uint8_t)(bodyLen_ >> 8);
+    const size_t end = RAW_FRAME_HEADER + bodyLen_;
+    const uint16_t crc = crc16(frame_ + 2, end - 2);
+    frame_[end] = (uint8_t)crc;
+    frame_[end + 1] = (uint8_t)(crc >> 8);
+    sink_(ctx_, frame_, end + RAW_FRAME_TRAILER);
+    reports_ += count_;
+    ++frames_;
+    count_ = 0;
+    bodyLen_ = 0;
+  }
+
+  uint32_t frames() const { return frames_; }
+  uint32_t reports() const { return reports_; }
+
+private:
+  SinkFn sink_;
+  void* ctx_;
+  uint8_t frame_[RAW_FRAME_MAX];
+  size_t bodyLen_ = 0;
+  uint8_t count_ = 0;
+  uint32_t firstSeq_ = 0;
+  uint32_t frames_ = 0;
+  uint32_t reports_ = 0;
+};
+
+// A whole frame at `p`: its length, or 0 if `p` does not start a valid frame
+// (NEED_MORE when it might, given more bytes)
+constexpr size_t RAW_FRAME_NEED_MORE = (size_t)-1;
+
+static inline size_t checkRawFrame(const uint8_t* p, size_t n) {
+  if (n < RAW_FRAME_HEADER) return RAW_FRAME_NEED_MORE;
+  if (p[0] != RAW_MAGIC0 || p[1] != RAW_MAGIC1 || p[2] == 0) return 0;
+  const size_t bodyLen = p[7] | (p[8] << 8);
+  if (bodyLen > RAW_FRAME_BODY_MAX) return 0;
+  const size_t end = RAW_FRAME_HEADER + bodyLen;
+  if (n < end + RAW_FRAME_TRAILER) return RAW_FRAME_NEED_MORE;
+  if (crc16(p + 2, end - 2) != (uint16_t)(p[end] | (p[end + 1] << 8))) return 0;
+  return end + RAW_FRAME_TRAILER;
+}
@@ -0,0 +1,776 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <time.h>
+#include <type_traits>
+
+#include "ble_ids.h"
+#include "device_record.h"
+#include "event_record.h"
+#include "field_mask.h"
+#include "output_writer.h"
+#include "vendor_decode.h"
+
+// Record formatters are composed at compile time from small field writers.
+// Each field is a type with a static write(OutWriter&, const DeviceRecord&);
+// RecordFormat<...> expands to a straight sequence of calls, so there is no
+// format string to parse at runtime.
+//
+// Projectable formats group fields into Col<> parts tagged with a FieldBit.
+// A column that is not in the mask is skipped entirely, and separators are
+// only written between columns that are actually present.
+//
+// Record checks: the seq column carries the channel's record counter and the
+// crc column, always last, the CRC-16 (crc16.h) of the record's bytes from
+// its first byte up to, not including, the crc column's separator.
+
+// Per-record projection state
+struct Projection {
+  uint16_t mask;
+  bool any;       // a column was written already; the next one needs its separator
+  uint32_t seq;
+};
+
+namespace fields {
+
+template <typename P, typename = void>
+struct IsColumn : std::false_type {};
+
+template <typename P>
+struct IsColumn<P, std::void_t<decltype(P::bit)>> : std::true_type {};
+
+template <typename P>
+static inline void writePart(OutWriter& w, const DeviceRecord& r, Projection& p) {
+  if constexpr (IsColumn<P>::value) P::write(w, r, p);
+  else P::write(w, r);
+}
+
+} // namespace fields
+
+template <typename... Parts>
+struct RecordFormat {
+  static void write(OutWriter& w, const DeviceRecord& r, uint16_t mask = FIELDS_RECORD, uint32_t seq = 0) {
+    Projection p = { mask, false, seq };
+    if (mask & FIELD_CRC) w.crcBegin();
+    (fields::writePart<Parts>(w, r, p), ...);
+  }
+};
+
+namespace fields {
+
+// Column separators
+template <const char* S>
+struct Sep {
+  static void write(OutWriter& w, uint16_t) {
+    static constexpr size_t len = std::char_traits<char>::length(S);
+    w.write(S, len);
+  }
+};
+
+struct NoSep {
+  static void write(OutWriter&, uint16_t) {}
+};
+
+// `Joined` right after column Prev (e.g. "0x004C AirTag"), `Otherwise` if
+// Prev is not projected
+template <uint16_t Prev, const char* Joined, const char* Otherwise>
+struct SepAfter {
+  static void write(OutWriter& w, uint16_t mask) { w.str((mask & Prev) ? Joined : Otherwise); }
+};
+
+template <uint16_t Bit, typename Separator, typename... Fields>
+struct Col {
+  static constexpr uint16_t bit = Bit;
+
+  static void write(OutWriter& w, const DeviceRecord& r, Projection& p) {
+    if ((p.mask & Bit) == 0) return;
+    if (p.any) Separator::write(w, p.mask);
+    (Fields::write(w, r), ...);
+    p.any = true;
+  }
+};
+
+// A FIELD_FOLD column that only records with folded sightings have
+template <typename Separator, typename... Fields>
+struct FoldedCol {
+  static constexpr uint16_t bit = FIELD_FOLD;
+
+  static void write(OutWriter& w, const DeviceRecord& r, Projection& p) {
+    if ((p.mask & FIELD_FOLD) == 0 || r.suppressed == 0) return;
+    if (p.any) Separator::write(w, p.mask);
+    (Fields::write(w, r), ...);
+    p.any = true;
+  }
+};
+
+// A FIELD_PHY column that only extended advertisements have
+template <typename Separator, typename... Fields>
+struct ExtendedCol {
+  static constexpr uint16_t bit = FIELD_PHY;
+
+  static void write(OutWriter& w, const DeviceRecord& r, Projection& p) {
+    if ((p.mask & FIELD_PHY) == 0 || !isExtended(r)) return;
+    if (p.any) Separator::write(w, p.mask);
+    (Fields::write(w, r), ...);
+    p.any = true;
+  }
+};
+
+template <typename Separator, const char* Open>
+struct SeqCol {
+  static constexpr uint16_t bit = FIELD_SEQ;
+
+  static void write(OutWriter& w, const DeviceRecord&, Projection& p) {
+    if ((p.mask & FIELD_SEQ) == 0) return;
+    if (p.any) Separator::write(w, p.mask);
+    w.str(Open);
+    w.udec(p.seq);
+    p.any = true;
+  }
+};
+
+template <typename Separator, const char* Open, const char* Close>
+struct CrcCol {
+  static constexpr uint16_t bit = FIELD_CRC;
+
+  static void write(OutWriter& w, const DeviceRecord&, Projection& p) {
+    if ((p.mask & FIELD_CRC) == 0) return;
+    const uint16_t crc = w.crcValue();
+    if (p.any) Separator::write(w, p.mask);
+    w.str(Open);
+    w.hex(crc, 4);
+    w.str(Close);
+    p.any = true;
+  }
+};
+
+// Constant text. S must be a constexpr char array with static storage.
+template <const char* S>
+struct Lit {
+  static void write(OutWriter& w, const DeviceRecord&) {
+    static constexpr size_t len = std::char_traits<char>::length(S);
+    w.write(S, len);
+  }
+};
+
+// Left-aligned, space padded column (printf "%-<W>s")
+template <typename F, size_t W>
+struct PadRight {
+  static void write(OutWriter& w, const DeviceRecord& r) {
+    const size_t mark = w.written();
+    F::write(w, r);
+    w.pad(mark, W);
+  }
+};
+
+// Formato: YYYY-MM-DD HH:MM:SS.mmm (local time)
+static inline void writeLocalTime(OutWriter& w, const struct timeval& tv) {
+  // Broken-down time only changes once per second; avoid localtime_r per record
+  static time_t cachedSec = (time_t)-1;
+  static struct tm tmCache;
+  if (tv.tv_sec != cachedSec) {
+    localtime_r(&tv.tv_sec, &tmCache);
+    cachedSec = tv.tv_sec;
+  }
+  w.digits((uint32_t)(tmCache.tm_year + 1900), 4);
+  w.put('-');
+  w.digits((uint32_t)(tmCache.tm_mon + 1), 2);
+  w.put('-');
+  w.digits((uint32_t)tmCache.tm_mday, 2);
+  w.put(' ');
+  w.digits((uint32_t)tmCache.tm_hour, 2);
+  w.put(':');
+  w.digits((uint32_t)tmCache.tm_min, 2);
+  w.put(':');
+  w.digits((uint32_t)tmCache.tm_sec, 2);
+  w.put('.');
+  w.digits((uint32_t)(tv.tv_usec / 1000), 3);
+}
+
+static inline uint64_t epochMs(const struct timeval& tv) {
+  return (uint64_t)tv.tv_sec * 1000u + (uint64_t)(tv.tv_usec / 1000);
+}
+
+struct Time {
+  static void write(OutWriter& w, const DeviceRecord& r) { writeLocalTime(w, r.time); }
+};
+
+struct ManufacturerId {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.hex(r.manufacturer, 4); }
+};
+
+struct ManufacturerName {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.str(companyName(r.manufacturer)); }
+};
+
+struct DeviceType {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.str(r.deviceType); }
+};
+
+// JSON string contents: quote, backslash and control characters escaped,
+// runs of plain text copied in one write
+static inline void writeJsonText(OutWriter& w, const char* s) {
+  const char* run = s;
+  for (; *s != '\0'; ++s) {
+    const uint8_t c = (uint8_t)*s;
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    w.write(run, (size_t)(s - run));
+    w.put('\\');
+    if (c == '"' || c == '\\') {
+      w.put((char)c);
+    } else {
+      w.str("u00");
+      w.hex(c, 2);
+    }
+    run = s + 1;
+  }
+  w.write(run, (size_t)(s - run));
+}
+
+struct JsonDeviceType {
+  static void write(OutWriter& w, const DeviceRecord& r) { writeJsonText(w, r.deviceType); }
+};
+
+// Same text as NimBLEAddress::toString(): "aa:bb:cc:dd:ee:ff"
+struct Address {
+  static void write(OutWriter& w, const DeviceRecord& r) {
+    char text[17];
+    for (int i = 5, n = 0; i >= 0; --i) {
+      text[n++] = OutWriter::HEX_LOWER[(r.addr[i] >> 4) & 0xF];
+      text[n++] = OutWriter::HEX_LOWER[r.addr[i] & 0xF];
+      if (i > 0) text[n++] = ':';
+    }
+    w.write(text, sizeof(text));
+  }
+};
+
+struct Rssi {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.dec(r.rssi); }
+};
+
+struct RssiPadded {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.decZeroPad(r.rssi, 3); }
+};
+
+struct AdvTypeNum {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.udec(r.advType); }
+};
+
+struct AdvTypeName {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.str(advTypeName(r.advType)); }
+};
+
+template <bool DeviceRecord::*Flag>
+struct Bool {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.str(r.*Flag ? "true" : "false"); }
+};
+
+struct Connectivity {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.str(r.isConnectable ? "CONN" : "NONCONN"); }
+};
+
+struct ScanSuffix {
+  static void write(OutWriter& w, const DeviceRecord& r) { if (r.isScannable) w.str("/SCAN"); }
+};
+
+struct DataType {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.str(dataSourceName(r.dataType)); }
+};
+
+// Same text as toHex(): "4C 00 12 19"
+struct DataHex {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.hexBytes(r.data, r.dataLen, ' '); }
+};
+
+// Sightings folded into the record by the rate limiter, and their RSSI range
+struct Suppressed {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.udec(r.suppressed); }
+};
+
+struct RssiMin {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.dec(foldedRssiMin(r)); }
+};
+
+struct RssiMax {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.dec(foldedRssiMax(r)); }
+};
+
+// "1M", "1M/2M", "CODED": primary PHY, then the auxiliary PHY if different
+struct PhyText {
+  static void write(OutWriter& w, const DeviceRecord& r) {
+    const uint8_t primary = r.primaryPhy != BLE_PHY_NONE ? r.primaryPhy : BLE_PHY_1M;
+    w.str(phyName(primary));
+    if (r.secondaryPhy != BLE_PHY_NONE && r.secondaryPhy != primary) {
+      w.put('/');
+      w.str(phyName(r.secondaryPhy));
+    }
+  }
+};
+
+// Advertising set ID; empty for legacy advertising
+struct SidText {
+  static void write(OutWriter& w, const DeviceRecord& r) { if (isExtended(r)) w.udec(r.sid); }
+};
+
+struct Sid {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.udec(r.sid); }
+};
+
+struct PrimaryPhyNum {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.udec(r.primaryPhy); }
+};
+
+struct SecondaryPhyNum {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.udec(r.secondaryPhy); }
+};
+
+// A decoded vendor field (vendor_decode.h); empty if the decoder did not find it
+template <uint8_t Bit, auto Field>
+struct VendorNum {
+  static void write(OutWriter& w, const DeviceRecord& r) {
+    if (r.vendor.present & Bit) w.udec(r.vendor.*Field);
+  }
+};
+
+struct VendorKey {
+  uint8_t bit;
+  const char* key;
+};
+
+static inline uint32_t vendorValue(const VendorFields& f, uint8_t bit) {
+  switch (bit) {
+    case VENDOR_BATTERY:   return f.battery;
+    case VENDOR_SEPARATED: return f.separated;
+    case VENDOR_STATE:     return f.state;
+    case VENDOR_COUNTER:   return f.counter;
+    case VENDOR_HINT:      return f.hint;
+    default:               return f.keyId;
+  }
+}
+
+// The decoded vendor fields that are present, each as key and number
+template <typename Separator, const VendorKey* Keys>
+struct VendorKeyed {
+  static constexpr uint16_t bit = FIELD_DECODED;
+
+  static void write(OutWriter& w, const DeviceRecord& r, Projection& p) {
+    if ((p.mask & FIELD_DECODED) == 0) return;
+    for (const VendorKey* k = Keys; k->key != nullptr; ++k) {
+      if ((r.vendor.present & k->bit) == 0) continue;
+      if (p.any) Separator::write(w, p.mask);
+      w.str(k->key);
+      w.udec(vendorValue(r.vendor, k->bit));
+      p.any = true;
+    }
+  }
+};
+
+// Milliseconds since the Unix epoch
+struct EpochMs {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.udec(epochMs(r.time)); }
+};
+
+struct CompanyIdNum {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.udec(r.manufacturer); }
+};
+
+struct TypeIdNum {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.udec(r.typeId); }
+};
+
+// "f":3, connectable (1) and scannable (2) as one number; present if either
+// column is projected, with only the projected flags
+struct JsonFlags {
+  static constexpr uint16_t bit = FIELD_CONN | FIELD_SCAN;
+
+  static void write(OutWriter& w, const DeviceRecord& r, Projection& p) {
+    if ((p.mask & bit) == 0) return;
+    if (p.any) w.put(',');
+    w.str("\"f\":");
+    w.put((char)('0' + ((r.isConnectable && (p.mask & FIELD_CONN)) ? 1 : 0) +
+                 ((r.isScannable && (p.mask & FIELD_SCAN)) ? 2 : 0)));
+    p.any = true;
+  }
+};
+
+// Payload keyed by its source: "mfd":"4C0012..." or "svc":"110D..."
+struct JsonData {
+  static void write(OutWriter& w, const DeviceRecord& r) {
+    w.str(r.dataType == DataSource::SERVICE ? "\"svc\":\"" : "\"mfd\":\"");
+    w.hexBytes(r.data, r.dataLen, 0);
+    w.put('"');
+  }
+};
+
+// --------- Compact fields ---------
+
+// Vendor letter plus the type byte: "A12"
+struct VendorType {
+  static void write(OutWriter& w, const DeviceRecord& r) {
+    w.put(companyCode(r.manufacturer));
+    w.hex(r.typeId, 2);
+  }
+};
+
+// "aabbccddeeff"
+struct AddressPlain {
+  static void write(OutWriter& w, const DeviceRecord& r) {
+    for (int i = 5; i >= 0; --i) {
+      w.put(OutWriter::HEX_LOWER[(r.addr[i] >> 4) & 0xF]);
+      w.put(OutWriter::HEX_LOWER[r.addr[i] & 0xF]);
+    }
+  }
+};
+
+// PDU type digit plus a flag nibble (1 = connectable, 2 = scannable,
+// 4 = service data): "30" for a NONCONN manufacturer ad
+constexpr uint8_t COMPACT_FLAG_CONN    = 0x1;
+constexpr uint8_t COMPACT_FLAG_SCAN    = 0x2;
+constexpr uint8_t COMPACT_FLAG_SERVICE = 0x4;
+
+struct AdvFlags {
+  static void write(OutWriter& w, const DeviceRecord& r) {
+    w.hex(r.advType, 1);
+    w.hex((r.isConnectable ? COMPACT_FLAG_CONN : 0) |
+          (r.isScannable ? COMPACT_FLAG_SCAN : 0) |
+          (r.dataType == DataSource::SERVICE ? COMPACT_FLAG_SERVICE : 0), 1);
+  }
+};
+
+struct DataHexPlain {
+  static void write(OutWriter& w, const DeviceRecord& r) { w.hexBytes(r.data, r.dataLen, 0); }
+};
+
+// " +12:-71:-58" (folded sightings, RSSI range); nothing if none were folded
+struct CompactFold {
+  static constexpr uint16_t bit = FIELD_FOLD;
+
+  static void write(OutWriter& w, const DeviceRecord& r, Projection& p) {
+    if ((p.mask & FIELD_FOLD) == 0 || r.suppressed == 0) return;
+    w.str(" +");
+    w.udec(r.suppressed);
+    w.put(':');
+    w.dec(r.rssiMin);
+    w.put(':');
+    w.dec(r.rssiMax);
+    p.any = true;
+  }
+};
+
+// " ~13:2" (primary and secondary PHY digits, SID); extended advertising only
+struct CompactExt {
+  static constexpr uint16_t bit = FIELD_PHY;
+
+  static void write(OutWriter& w, const DeviceRecord& r, Projection& p) {
+    if ((p.mask & FIELD_PHY) == 0 || !isExtended(r)) return;
+    w.str(" ~");
+    w.hex(r.primaryPhy, 1);
+    w.hex(r.secondaryPhy, 1);
+    w.put(':');
+    w.udec(r.sid);
+    p.any = true;
+  }
+};
+
+// --------- Constant fragments ---------
+constexpr char kSep[]         = " | ";
+constexpr char kEmpty[]       = "";
+constexpr char kHexPrefix[]   = "0x";
+constexpr char kSpace[]       = " ";
+constexpr char kLogRssi[]     = "RSSI ";
+constexpr char kLogPdu[]      = "PDU ";
+constexpr char kLogHexOpen[]  = "[";
+constexpr char kLogHexClose[] = "]";
+constexpr char kComma[]       = ",";
+constexpr char kNewline[]     = "\n";
+constexpr char kYamlDevice[]  = "- device:";
+constexpr char kYamlTime[]    = "\n    time: ";
+constexpr char kYamlMfr[]     = "\n    manufacturer: ";
+constexpr char kYamlType[]    = "\n    type: ";
+constexpr char kYamlAddr[]    = "\n    address: ";
+constexpr char kYamlRssi[]    = "\n    rssi: ";
+constexpr char kYamlAdv[]     = "\n    adv_type: ";
+constexpr char kYamlConn[]    = "\n    connectable: ";
+constexpr char kYamlScan[]    = "\n    scannable: ";
+constexpr char kYamlDType[]   = "\n    data_type: ";
+constexpr char kYamlHex[]     = "\n    data_hex: ";
+constexpr char kJsonOpen[]    = "{";
+constexpr char kJsonTime[]    = "\"t\":";
+constexpr char kJsonCid[]     = "\"cid\":";
+constexpr char kJsonTid[]     = "\"tid\":";
+constexpr char kJsonType[]    = ",\"dev\":\"";
+constexpr char kJsonAddr[]    = "\"a\":\"";
+constexpr char kQuote[]       = "\"";
+constexpr char kJsonRssi[]    = "\"r\":";
+constexpr char kJsonAdv[]     = "\"adv\":";
+constexpr char kJsonEnd[]     = "}\n";
+constexpr char kLogFold[]     = "+";
+constexpr char kRange[]       = "..";
+constexpr char kYamlFold[]    = "\n    suppressed: ";
+constexpr char kYamlRssiMin[] = "\n    rssi_min: ";
+constexpr char kYamlRssiMax[] = "\n    rssi_max: ";
+constexpr char kJsonFold[]    = "\"sup\":";
+constexpr char kJsonRssiMin[] = ",\"rmin\":";
+constexpr char kJsonRssiMax[] = ",\"rmax\":";
+constexpr char kLogSid[]      = " SID ";
+constexpr char kYamlPhy[]     = "\n    phy: ";
+constexpr char kYamlSid[]     = "\n    sid: ";
+constexpr char kJsonPhy[]     = "\"phy\":";
+constexpr char kJsonPhy2[]    = ",\"phy2\":";
+constexpr char kJsonSid[]     = ",\"sid\":";
+constexpr char kSeqMark[]     = "#";
+constexpr char kCompactSeq[]  = " #";
+constexpr char kCrcMark[]     = " *";
+constexpr char kYamlSeq[]     = "\n    seq: ";
+constexpr char kYamlCrc[]     = "\n    crc: ";
+constexpr char kJsonSeq[]     = "\"seq\":";
+constexpr char kJsonCrc[]     = "\"crc\":\"";
+
+constexpr VendorKey kJsonVendor[] = {
+  { VENDOR_BATTERY, "\"bat\":" }, { VENDOR_SEPARATED, "\"sep\":" }, { VENDOR_STATE, "\"st\":" },
+  { VENDOR_COUNTER, "\"ctr\":" }, { VENDOR_HINT, "\"hint\":" }, { VENDOR_KEY_ID, "\"kid\":" },
+  { 0, nullptr },
+};
+constexpr VendorKey kYamlVendor[] = {
+  { VENDOR_BATTERY, "\n    battery: " }, { VENDOR_SEPARATED, "\n    separated: " },
+  { VENDOR_STATE, "\n    state: " }, { VENDOR_COUNTER, "\n    counter: " }, { VENDOR_HINT, "\n    hint: " },
+  { VENDOR_KEY_ID, "\n    key_id: " }, { 0, nullptr },
+};
+
+} // namespace fields
+
+// --------- Formats ---------
+
+namespace fields {
+using LogSep   = Sep<kSep>;
+using CommaSep = Sep<kComma>;
+}
+
+// "%s | 0x%04X %-18s | %s | RSSI %03d | PDU %d | %s%-2s | %-12s [%s] | +%u %d..%d | %s SID %u | #%u *%04X\n"
+// (the PHY column only for extended advertising)
+using LogFormat = RecordFormat<
+  fields::Col<FIELD_TIME,   fields::LogSep, fields::Time>,
+  fields::Col<FIELD_VENDOR, fields::LogSep, fields::Lit<fields::kHexPrefix>, fields::ManufacturerId>,
+  fields::Col<FIELD_TYPE,   fields::SepAfter<FIELD_VENDOR, fields::kSpace, fields::kSep>,
+              fields::PadRight<fields::DeviceType, 18>>,
+  fields::Col<FIELD_ADDR,   fields::LogSep, fields::Address>,
+  fields::Col<FIELD_RSSI,   fields::LogSep, fields::Lit<fields::kLogRssi>, fields::RssiPadded>,
+  fields::Col<FIELD_ADV,    fields::LogSep, fields::Lit<fields::kLogPdu>, fields::AdvTypeNum>,
+  fields::Col<FIELD_CONN,   fields::LogSep, fields::Connectivity>,
+  fields::Col<FIELD_SCAN,   fields::SepAfter<FIELD_CONN, fields::kEmpty, fields::kSep>,
+              fields::PadRight<fields::ScanSuffix, 2>>,
+  fields::Col<FIELD_SOURCE, fields::LogSep, fields::PadRight<fields::DataType, 12>>,
+  fields::Col<FIELD_DATA,   fields::SepAfter<FIELD_SOURCE, fields::kSpace, fields::kSep>,
+              fields::Lit<fields::kLogHexOpen>, fields::DataHex, fields::Lit<fields::kLogHexClose>>,
+  fields::FoldedCol<fields::LogSep, fields::Lit<fields::kLogFold>, fields::Suppressed, fields::Lit<fields::kSpace>,
+                    fields::RssiMin, fields::Lit<fields::kRange>, fields::RssiMax>,
+  fields::ExtendedCol<fields::LogSep, fields::PhyText, fields::Lit<fields::kLogSid>, fields::Sid>,
+  fields::SeqCol<fields::LogSep, fields::kSeqMark>,
+  fields::CrcCol<fields::NoSep, fields::kCrcMark, fields::kEmpty>,
+  fields::Lit<fields::kNewline>>;
+
+// "%s,%s,%s,%s,%d,%s,%s,%s,%s,%s,%u,%d,%d,%s,%s,%s,%s,%s,%s,%s,%s,%u,%04X\n" (sid empty
+// for legacy, a decoded field empty when the vendor's data does not carry it)
+using CsvFormat = RecordFormat<
+  fields::Col<FIELD_TIME,   fields::CommaSep, fields::Time>,
+  fields::Col<FIELD_VENDOR, fields::CommaSep, fields::ManufacturerName>,
+  fields::Col<FIELD_TYPE,   fields::CommaSep, fields::DeviceType>,
+  fields::Col<FIELD_ADDR,   fields::CommaSep, fields::Address>,
+  fields::Col<FIELD_RSSI,   fields::CommaSep, fields::Rssi>,
+  fields::Col<FIELD_ADV,    fields::CommaSep, fields::AdvTypeName>,
+  fields::Col<FIELD_CONN,   fields::CommaSep, fields::Bool<&DeviceRecord::isConnectable>>,
+  fields::Col<FIELD_SCAN,   fields::CommaSep, fields::Bool<&DeviceRecord::isScannable>>,
+  fields::Col<FIELD_SOURCE, fields::CommaSep, fields::DataType>,
+  fields::Col<FIELD_DATA,   fields::CommaSep, fields::DataHex>,
+  fields::Col<FIELD_FOLD,   fields::CommaSep, fields::Suppressed, fields::Lit<fields::kComma>,
+              fields::RssiMin, fields::Lit<fields::kComma>, fields::RssiMax>,
+  fields::Col<FIELD_PHY,    fields::CommaSep, fields::PhyText, fields::Lit<fields::kComma>, fields::SidText>,
+  fields::Col<FIELD_DECODED, fields::CommaSep,
+              fields::VendorNum<VENDOR_BATTERY, &VendorFields::battery>, fields::Lit<fields::kComma>,
+              fields::VendorNum<VENDOR_SEPARATED, &VendorFields::separated>, fields::Lit<fields::kComma>,
+              fields::VendorNum<VENDOR_STATE, &VendorFields::state>, fields::Lit<fields::kComma>,
+              fields::VendorNum<VENDOR_COUNTER, &VendorFields::counter>, fields::Lit<fields::kComma>,
+              fields::VendorNum<VENDOR_HINT, &VendorFields::hint>, fields::Lit<fields::kComma>,
+              fields::VendorNum<VENDOR_KEY_ID, &VendorFields::keyId>>,
+  fields::SeqCol<fields::CommaSep, fields::kEmpty>,
+  fields::CrcCol<fields::CommaSep, fields::kEmpty, fields::kEmpty>,
+  fields::Lit<fields::kNewline>>;
+
+// CSV header names, in column order
+static const FieldName CSV_COLUMNS[] = {
+  { FIELD_TIME,    "time" },
+  { FIELD_VENDOR,  "manufacturer" },
+  { FIELD_TYPE,    "deviceType" },
+  { FIELD_ADDR,    "addr" },
+  { FIELD_RSSI,    "rssi" },
+  { FIELD_ADV,     "advType" },
+  { FIELD_CONN,    "isConnectable" },
+  { FIELD_SCAN,    "isScannable" },
+  { FIELD_SOURCE,  "dataType" },
+  { FIELD_DATA,    "dataHex" },
+  { FIELD_FOLD,    "suppressed" },
+  { FIELD_FOLD,    "rssiMin" },
+  { FIELD_FOLD,    "rssiMax" },
+  { FIELD_PHY,     "phy" },
+  { FIELD_PHY,     "sid" },
+  { FIELD_DECODED, "battery" },
+  { FIELD_DECODED, "separated" },
+  { FIELD_DECODED, "state" },
+  { FIELD_DECODED, "counter" },
+  { FIELD_DECODED, "hint" },
+  { FIELD_DECODED, "keyId" },
+  { FIELD_SEQ,     "seq" },
+  { FIELD_CRC,     "crc" },
+};
+
+using YamlFormat = RecordFormat<
+  fields::Lit<fields::kYamlDevice>,
+  fields::Col<FIELD_TIME,   fields::NoSep, fields::Lit<fields::kYamlTime>, fields::Time>,
+  fields::Col<FIELD_VENDOR, fields::NoSep, fields::Lit<fields::kYamlMfr>, fields::ManufacturerName>,
+  fields::Col<FIELD_TYPE,   fields::NoSep, fields::Lit<fields::kYamlType>, fields::DeviceType>,
+  fields::Col<FIELD_ADDR,   fields::NoSep, fields::Lit<fields::kYamlAddr>, fields::Address>,
+  fields::Col<FIELD_RSSI,   fields::NoSep, fields::Lit<fields::kYamlRssi>, fields::Rssi>,
+  fields::Col<FIELD_ADV,    fields::NoSep, fields::Lit<fields::kYamlAdv>, fields::AdvTypeName>,
+  fields::Col<FIELD_CONN,   fields::NoSep, fields::Lit<fields::kYamlConn>, fields::Bool<&DeviceRecord::isConnectable>>,
+  fields::Col<FIELD_SCAN,   fields::NoSep, fields::Lit<fields::kYamlScan>, fields::Bool<&DeviceRecord::isScannable>>,
+  fields::Col<FIELD_SOURCE, fields::NoSep, fields::Lit<fields::kYamlDType>, fields::DataType>,
+  fields::Col<FIELD_DATA,   fields::NoSep, fields::Lit<fields::kYamlHex>, fields::DataHex>,
+  fields::FoldedCol<fields::NoSep, fields::Lit<fields::kYamlFold>, fields::Suppressed,
+                    fields::Lit<fields::kYamlRssiMin>, fields::RssiMin, fields::Lit<fields::kYamlRssiMax>, fields::RssiMax>,
+  fields::ExtendedCol<fields::NoSep, fields::Lit<fields::kYamlPhy>, fields::PhyText,
+                      fields::Lit<fields::kYamlSid>, fields::Sid>,
+  fields::VendorKeyed<fields::NoSep, fields::kYamlVendor>,
+  fields::SeqCol<fields::NoSep, fields::kYamlSeq>,
+  fields::CrcCol<fields::NoSep, fields::kYamlCrc, fields::kEmpty>,
+  fields::Lit<fields::kNewline>>;
+
+// JSON Lines: one object per line, fixed key order, numeric ids, short keys
+// (a short service data record stays within 1.2x its CSV line).
+// {"t":1700000000123,"cid":76,"tid":18,"dev":"FindMy/AirTag","a":"..","r":-60,
+//  "adv":3,"f":0,"mfd":"4C0012...","sup":4,"rmin":-71,"rmax":-58,"seq":7,"crc":"1A2B"}
+// "dev" is escaped, since match rules name their own labels.
+// "f" holds the connectable (1) and scannable (2) flags. The payload key names
+// its source, so FIELD_SOURCE has no column of its own. The fold keys only
+// appear when sightings were folded into the record; otherwise they would
+// repeat "r". Extended advertising adds "phy":3,"phy2":3,"sid":2 after the
+// fold, and the decoded vendor fields follow as "bat","sep","st","ctr","hint",
+// "kid", each only when the vendor's data carries it.
+using JsonlFormat = RecordFormat<
+  fields::Lit<fields::kJsonOpen>,
+  fields::Col<FIELD_TIME,   fields::CommaSep, fields::Lit<fields::kJsonTime>, fields::EpochMs>,
+  fields::Col<FIELD_VENDOR, fields::CommaSep, fields::Lit<fields::kJsonCid>, fields::CompanyIdNum>,
+  fields::Col<FIELD_TYPE,   fields::CommaSep, fields::Lit<fields::kJsonTid>, fields::TypeIdNum,
+              fields::Lit<fields::kJsonType>, fields::JsonDeviceType, fields::Lit<fields::kQuote>>,
+  fields::Col<FIELD_ADDR,   fields::CommaSep, fields::Lit<fields::kJsonAddr>, fields::Address,
+              fields::Lit<fields::kQuote>>,
+  fields::Col<FIELD_RSSI,   fields::CommaSep, fields::Lit<fields::kJsonRssi>, fields::Rssi>,
+  fields::Col<FIELD_ADV,    fields::CommaSep, fields::Lit<fields::kJsonAdv>, fields::AdvTypeNum>,
+  fields::JsonFlags,
+  fields::Col<FIELD_DATA,   fields::CommaSep, fields::JsonData>,
+  fields::FoldedCol<fields::CommaSep, fields::Lit<fields::kJsonFold>, fields::Suppressed,
+                    fields::Lit<fields::kJsonRssiMin>, fields::RssiMin, fields::Lit<fields::kJsonRssiMax>, fields::RssiMax>,
+  fields::ExtendedCol<fields::CommaSep, fields::Lit<fields::kJsonPhy>, fields::PrimaryPhyNum,
+                      fields::Lit<fields::kJsonPhy2>, fields::SecondaryPhyNum, fields::Lit<fields::kJsonSid>, fields::Sid>,
+  fields::VendorKeyed<fields::CommaSep, fields::kJsonVendor>,
+  fields::SeqCol<fields::CommaSep, fields::kJsonSeq>,
+  fields::CrcCol<fields::CommaSep, fields::kJsonCrc, fields::kQuote>,
+  fields::Lit<fields::kJsonEnd>>;
+
+// Compact text, for slow links: about half a CSV line, still greppable.
+// "1700000000123 A12 b49bc6cdb2ab -59 30 4C001219... +12:-71:-58 ~13:2 #7 *1A2B"
+// (expand with fmsdecode). The layout is fixed; only the fold, PHY, seq and
+// crc trailers follow the field mask. The fold trailer only appears when
+// sightings were folded into the record, the PHY trailer only for extended
+// advertising.
+using CompactFormat = RecordFormat<
+  fields::EpochMs, fields::Lit<fields::kSpace>,
+  fields::VendorType, fields::Lit<fields::kSpace>,
+  fields::AddressPlain, fields::Lit<fields::kSpace>,
+  fields::Rssi, fields::Lit<fields::kSpace>,
+  fields::AdvFlags, fields::Lit<fields::kSpace>,
+  fields::DataHexPlain,
+  fields::CompactFold,
+  fields::CompactExt,
+  fields::SeqCol<fields::NoSep, fields::kCompactSeq>,
+  fields::CrcCol<fields::NoSep, fields::kCrcMark, fields::kEmpty>,
+  fields::Lit<fields::kNewline>>;
+
+// --------- Events ---------
+
+static inline void writeEventValue(OutWriter& w, const EventRecord::Item& item, bool quoteText) {
+  if (item.text == nullptr) {
+    w.dec64(item.value);
+  } else if (quoteText) {
+    w.put('"');
+    fields::writeJsonText(w, item.text);
+    w.put('"');
+  } else {
+    w.str(item.text);
+  }
+}
+
+static inline void writeEventKind(OutWriter& w, const char* kind) {
+  for (const char* k = kind; *k != '\0'; ++k) {
+    w.put((*k >= 'a' && *k <= 'z') ? (char)(*k - 'a' + 'A') : *k);
+  }
+}
+
+// 2025-10-16 12:00:00.000 | STATS key=value key=value
+static void writeEventLog(OutWriter& w, const EventRecord& e) {
+  fields::writeLocalTime(w, e.time);
+  w.str(" | ");
+  writeEventKind(w, e.kind);
+  for (size_t i = 0; i < e.count; ++i) {
+    w.put(' ');
+    w.str(e.items[i].key);
+    w.put('=');
+    writeEventValue(w, e.items[i], false);
+  }
+  w.put('\n');
+}
+
+// Comment line, skipped by CSV readers that honour '#'
+static void writeEventCsv(OutWriter& w, const EventRecord& e) {
+  w.str("# ");
+  writeEventKind(w, e.kind);
+  w.str(" t=");
+  w.udec(fields::epochMs(e.time));
+  for (size_t i = 0; i < e.count; ++i) {
+    w.put(' ');
+    w.str(e.items[i].key);
+    w.put('=');
+    writeEventValue(w, e.items[i], false);
+  }
+  w.put('\n');
+}
+
+static void writeEventYaml(OutWriter& w, const EventRecord& e) {
+  w.str("- ");
+  w.str(e.kind);
+  w.str(":\n    time: ");
+  fields::writeLocalTime(w, e.time);
+  for (size_t i = 0; i < e.count; ++i) {
+    w.str("\n    ");
+    w.str(e.items[i].key);
+    w.str(": ");
+    writeEventValue(w, e.items[i], false);
+  }
+  w.put('\n');
+}
+
+// {"ev":"stats","t":1700000000123,"key":value,...}; text values are escaped
+static void writeEventJsonl(OutWriter& w, const EventRecord& e) {
+  w.str("{\"ev\":\"");
+  w.str(e.kind);
+  w.str("\",\"t\":");
+  w.udec(fields::epochMs(e.time));
+  for (size_t i = 0; i < e.count; ++i) {
+    w.str(",\"");
+    w.str(e.items[i].key);
+    w.str("\":");
+    writeEventValue(w, e.items[i], true);
+  }
+  w.str("}\n");
+}
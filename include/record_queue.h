@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "device_record.h"
+
+// Single-producer, single-consumer queue between the BLE callback and the
+// output writer. Records are copied in with their bytes, so the scan callback
+// returns without waiting on a UART, and the writer drains at whatever rate
+// the link allows. fillPercent() is what the load shedder steers by.
+//
+// Each slot holds PayloadMax bytes of payload, and as much of the matched AD
+// structure: longer records are cut and counted in truncated().
+
+constexpr size_t LEGACY_PAYLOAD_MAX   = 62;   // advertisement plus merged scan response
+constexpr size_t EXTENDED_PAYLOAD_MAX = 255;  // extended advertising
+
+template <size_t PayloadMax>
+struct QueuedRecord {
+  DeviceRecord record;                      // data/payload point into the arrays below
+  uint8_t data[PayloadMax];
+  uint8_t payload[PayloadMax];
+};
+
+template <size_t N, size_t PayloadMax = LEGACY_PAYLOAD_MAX>
+class RecordQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "RecordQueue depth must be a power of two");
+
+public:
+  static constexpr size_t CAPACITY = N;
+
+  // Producer side. Returns false (and counts an overflow) when full.
+  bool push(const DeviceRecord& r) {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    const uint32_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail >= N) {
+      overflows_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    QueuedRecord<PayloadMax>& q = slots_[head & (N - 1)];
+    q.record = r;
+    q.record.data = q.data;
+    q.record.dataLen = copyBytes(q.data, r.data, r.dataLen);
+    q.record.payload = q.payload;
+    q.record.payloadLen = copyBytes(q.payload, r.payload, r.payloadLen);
+    head_.store(head + 1, std::memory_order_release);
+
+    const uint32_t used = head + 1 - tail;
+    if (used > highWater_.load(std::memory_order_relaxed)) highWater_.store(used, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Consumer side: the oldest record, valid until pop(); nullptr when empty
+  const DeviceRecord* front() const {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return nullptr;
+    return &slots_[tail & (N - 1)].record;
+  }
+
+  void pop() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  uint8_t fillPercent() const { return (uint8_t)(size() * 100 / N); }
+  uint32_t overflows() const { return overflows_.load(std::memory_order_relaxed); }
+  uint32_t truncated() const { return truncated_.load(std::memory_order_relaxed); }
+  uint32_t highWater() const { return highWater_.load(std::memory_order_relaxed); }
+
+private:
+  size_t copyBytes(uint8_t* dst, const uint8_t* src, size_t len) {
+    if (len > PayloadMax) {
+      truncated_.fetch_add(1, std::memory_order_relaxed);
+      len = PayloadMax;
+    }
+    if (len > 0) memcpy(dst, src, len);
+    return len;
+  }
+
+  QueuedRecord<PayloadMax> slots_[N];
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  std::atomic<uint32_t> overflows_{0};
+  std::atomic<uint32_t> truncated_{0};
+  std::atomic<uint32_t> highWater_{0};
+};
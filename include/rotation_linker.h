@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "device_record.h"
+#include "keyed_lru.h"
+#include "vendor_decode.h"
+
+// Address rotation linker.
+//
+// Samsung, Google and Xiaomi tags move to a new random address every 15
+// minutes or so, and each new address counts as a new device. A new address
+// waits LINK_DECIDE_MS; then the linker looks for an address of the same
+// vendor, type and data source that went quiet at most LINK_WINDOW_MS
+// before the new one appeared, was not heard since and has no successor yet,
+// and scores each such predecessor 0-100 on:
+//
+//   gap      25  the new address shows up within about two advertising
+//                intervals of the old one's last sighting
+//   rssi     20  the signal carries on where the old one left it
+//   phase    15  the gap is a whole number of the old one's intervals, as
+//                when the advertising timer keeps running across a rotation
+//   interval 15  both advertise at the same interval
+//   fields   25  stable data: length, status byte, battery level; a decoded
+//                counter (Samsung aging) must carry on, or the score is cut
+//
+// The best one at or above the minimum confidence is linked: the new
+// address takes over its logical device id, so a chain of rotations stays
+// one device. Waiting first keeps tags that merely missed a few
+// advertisements out of the running; LINK_DECIDE_MS is three of the longest
+// intervals the Find My vendors use.
+//
+// Bounded memory: a KeyedLru of LINK_TRACKS tracks (about 60 bytes each
+// with the index), most recently seen first, so the candidate scan skips
+// everything past the first track older than the window; at most
+// LINK_MAX_PENDING new addresses wait at a time. Times are the records'
+// epoch milliseconds, so a trace can be replayed.
+
+constexpr size_t LINK_TRACKS          = 256;
+constexpr size_t LINK_MAX_PENDING     = 16;
+constexpr uint32_t LINK_WINDOW_MS     = 30000;
+constexpr uint32_t LINK_DECIDE_MS     = 6000;
+constexpr uint8_t LINK_MIN_CONFIDENCE = 60;
+
+// Key of a logical device in the per-device tables, beside deviceKey()'s
+constexpr uint64_t DEVICE_KEY_LOGICAL = 1ull << 62;
+
+static inline uint64_t logicalDeviceKey(uint32_t logical) { return DEVICE_KEY_LOGICAL | logical; }
+
+struct LinkEvent {
+  uint8_t fromAddr[6];        // LSB first, as in DeviceRecord
+  uint8_t toAddr[6];
+  uint16_t manufacturer;
+  uint8_t typeId;
+  uint8_t confidence;         // 0-100
+  uint8_t candidates;         // predecessors that were scored
+  uint32_t gapMs;
+  uint32_t logical;           // the device id both addresses now share
+  uint32_t replaced;          // the new address's id until now
+};
+
+class RotationLinker {
+public:
+  void setMinConfidence(uint8_t c) { minConfidence_ = c; }
+  uint8_t minConfidence() const { return minConfidence_; }
+
+  // One record as emitted (matched only); its folded sightings count
+  // towards the interval estimate. Returns the logical device id.
+  uint32_t observe(const DeviceRecord& r) {
+    const uint32_t t = recordMs(r);
+    const uint32_t sightings = 1u + r.suppressed;
+    bool inserted;
+    Track& tr = tracks_.acquire(deviceKey(r), inserted);
+    if (inserted) {
+      ++tracksSeen_;
+      start(tr, r, t);
+      if (pendingCount_ < LINK_MAX_PENDING) {
+        pending_[pendingCount_++] = Pending{ tracks_.slotOf(tr), tr.logical };
+      } else {
+        ++unlinked_;
+      }
+      return tr.logical;
+    }
+
+    // Interval: a much shorter one replaces the estimate, a much longer one
+    // is taken for lost advertisements
+    const uint32_t dt = t - tr.lastMs;
+    if ((int32_t)dt > 0) {
+      const uint32_t per = dt / sightings;
+      if (tr.intervalMs == 0 || per < tr.intervalMs * 2 / 3) tr.intervalMs = per;
+      else if (per < tr.intervalMs * 3 / 2) tr.intervalMs = (tr.intervalMs * 3 + per) / 4;
+      tr.lastMs = t;
+    }
+    tr.rssi = (int8_t)((tr.rssi * 3 + clampRssi(r.rssi)) / 4);
+    if (tr.sightings < 0xFF) ++tr.sightings;
+    fingerprint(tr, r);
+    return tr.logical;
+  }
+
+  // Decides the new addresses that have waited LINK_DECIDE_MS;
+  // emit(const LinkEvent&) for each one linked
+  template <typename Emit>
+  void poll(uint32_t nowMs, Emit emit) {
+    for (size_t i = 0; i < pendingCount_;) {
+      Track& to = tracks_.atSlot(pending_[i].slot);
+      if (to.logical != pending_[i].logical) {
+        // Evicted
+        pending_[i] = pending_[--pendingCount_];
+        continue;
+      }
+      if ((int32_t)(nowMs - to.firstMs) < (int32_t)LINK_DECIDE_MS) {
+        ++i;
+        continue;
+      }
+      pending_[i] = pending_[--pendingCount_];
+      uint8_t confidence, candidates;
+      Track* from = findPredecessor(to, confidence, candidates);
+      if (from == nullptr) {
+        ++unlinked_;
+        continue;
+      }
+      LinkEvent ev;
+      memcpy(ev.fromAddr, from->addr, sizeof(ev.fromAddr));
+      memcpy(ev.toAddr, to.addr, sizeof(ev.toAddr));
+      ev.manufacturer = to.manufacturer;
+      ev.typeId = to.typeId;
+      ev.confidence = confidence;
+      ev.candidates = candidates;
+      ev.gapMs = to.firstMs - from->lastMs;
+      ev.logical = from->logical;
+      ev.replaced = to.logical;
+      to.logical = from->logical;
+      from->succeeded = true;
+      ++links_;
+      emit(ev);
+    }
+  }
+
+  void clear() {
+    tracks_.clear();
+    pendingCount_ = 0;
+  }
+
+  size_t tracks() const { return tracks_.size(); }
+  size_t pending() const { return pendingCount_; }
+  uint32_t links() const { return links_; }
+  // New addresses without a predecessor scoring the minimum
+  uint32_t unlinked() const { return unlinked_; }
+  // Addresses seen, less those linked to a predecessor
+  uint32_t devices() const { return tracksSeen_ - links_; }
+  static constexpr size_t memoryBytes() { return sizeof(RotationLinker); }
+
+private:
+  struct Track {
+    uint32_t firstMs;
+    uint32_t lastMs;
+    uint32_t intervalMs;      // advertising interval estimate, 0 = unknown
+    uint32_t logical;         // device id, handed on by a link
+    uint32_t counter;         // decoded counter, if hasCounter
+    uint16_t manufacturer;
+    uint8_t addr[6];
+    uint8_t typeId;
+    uint8_t dataLen;
+    uint8_t state;
+    uint8_t battery;          // 0xFF = not decoded
+    uint8_t sightings;
+    int8_t rssi;              // smoothed
+    bool service;
+    bool hasState;
+    bool hasCounter;
+    bool succeeded;           // linked to a successor
+  };
+
+  // A new address waiting for its decision; `logical` tells whether the
+  // slot still holds it
+  struct Pending {
+    uint16_t slot;
+    uint32_t logical;
+  };
+
+  static uint32_t recordMs(const DeviceRecord& r) {
+    return (uint32_t)((uint64_t)r.time.tv_sec * 1000u + (uint64_t)(r.time.tv_usec / 1000));
+  }
+
+  static int clampRssi(int rssi) { return rssi < -128 ? -128 : (rssi > 127 ? 127 : rssi); }
+
+  static uint32_t absDiff(int a, int b) { return (uint32_t)(a > b ? a - b : b - a); }
+
+  void start(Track& tr, const DeviceRecord& r, uint32_t t) {
+    tr.firstMs = tr.lastMs = t;
+    tr.logical = nextLogical_++;
+    memcpy(tr.addr, r.addr, sizeof(tr.addr));
+    tr.manufacturer = r.manufacturer;
+    tr.typeId = r.typeId;
+    tr.service = r.dataType == DataSource::SERVICE;
+    tr.rssi = (int8_t)clampRssi(r.rssi);
+    tr.sightings = 1;
+    fingerprint(tr, r);
+  }
+
+  static void fingerprint(Track& tr, const DeviceRecord& r) {
+    tr.dataLen = (uint8_t)(r.dataLen > 0xFF ? 0xFF : r.dataLen);
+    tr.hasState = (r.vendor.present & VENDOR_STATE) != 0;
+    tr.state = r.vendor.state;
+    tr.battery = (r.vendor.present & VENDOR_BATTERY) ? r.vendor.battery : 0xFF;
+    tr.hasCounter = (r.vendor.present & VENDOR_COUNTER) != 0;
+    tr.counter = r.vendor.counter;
+  }
+
+  // 0-100; see the top of the file
+  static uint8_t score(const Track& old, const Track& now, uint32_t gap) {
+    const uint32_t interval = old.intervalMs > 0 ? old.intervalMs : 1000;
+    uint32_t s = 0;
+
+    // Gap: full marks up to two intervals, none from ten
+    if (gap <= 2 * interval) s += 25;
+    else if (gap < 10 * interval) s += 25 * (10 * interval - gap) / (8 * interval);
+
+    const uint32_t drssi = absDiff(old.rssi, now.rssi);
+    if (drssi < 20) s += 20 - drssi;
+
+    // Phase and interval need a few sightings on both sides to mean anything
+    const bool timed = old.intervalMs >= 20 && old.sightings >= 3 && now.intervalMs > 0 && now.sightings >= 3;
+    if (timed) {
+      const uint32_t e = gap % old.intervalMs;
+      const uint32_t err = e < old.intervalMs - e ? e : old.intervalMs - e;
+      if (err * 4 < old.intervalMs) s += 15 - 15 * err * 4 / old.intervalMs;
+      const uint32_t di = absDiff((int)old.intervalMs, (int)now.intervalMs);
+      if (di * 5 < old.intervalMs) s += 15 - 15 * di * 5 / old.intervalMs;
+    } else {
+      s += 15;
+    }
+
+    uint32_t checks = 1, same = old.dataLen == now.dataLen;
+    if (old.hasState && now.hasState) {
+      ++checks;
+      same += old.state == now.state;
+    }
+    if (old.battery != 0xFF && now.battery != 0xFF) {
+      ++checks;
+      same += old.battery == now.battery;
+    }
+    s += 25 * same / checks;
+
+    // A counter that does not carry on is a different device
+    if (old.hasCounter && now.hasCounter && (now.counter < old.counter || now.counter - old.counter > 2)) {
+      s = s * 3 / 10;
+    }
+    return (uint8_t)(s > 100 ? 100 : s);
+  }
+
+  // The best-scoring predecessor of `tr`, or nullptr if none scores the minimum
+  Track* findPredecessor(const Track& tr, uint8_t& bestScore, uint8_t& candidates) {
+    Track* best = nullptr;
+    bestScore = 0;
+    candidates = 0;
+    bool inWindow = true;
+    tracks_.forEach([&](uint64_t, Track& old) {
+      if (!inWindow || &old == &tr) return;
+      const uint32_t gap = tr.firstMs - old.lastMs;
+      // Heard since the new address appeared: not gone
+      if ((int32_t)gap <= 0) return;
+      // Most recently seen first: the rest are older still
+      if (gap > LINK_WINDOW_MS) {
+        inWindow = false;
+        return;
+      }
+      if (old.succeeded || old.manufacturer != tr.manufacturer || old.typeId != tr.typeId ||
+          old.service != tr.service) {
+        return;
+      }
+      if (candidates < 0xFF) ++candidates;
+      const uint8_t sc = score(old, tr, gap);
+      if (sc > bestScore) {
+        bestScore = sc;
+        best = &old;
+      }
+    });
+    return bestScore >= minConfidence_ ? best : nullptr;
+  }
+
+  KeyedLru<Track, LINK_TRACKS> tracks_;
+  Pending pending_[LINK_MAX_PENDING];
+  size_t pendingCount_ = 0;
+  uint32_t nextLogical_ = 1;
+  uint32_t tracksSeen_ = 0;
+  uint32_t links_ = 0;
+  uint32_t unlinked_ = 0;
+  uint8_t minConfidence_ = LINK_MIN_CONFIDENCE;
+};
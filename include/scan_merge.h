@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "ble_ids.h"
+#include "device_record.h"
+#include "keyed_lru.h"
+
+// Scan response merging for active scanning.
+//
+// With active scanning the controller answers a scannable advertisement
+// (ADV_IND, SCAN_IND) with a scan request, and the device's SCAN_RSP comes
+// back as a report of its own. Service data that only appears in the
+// response would otherwise go out as a second, unclassified record. A
+// scannable advertisement is held here, keyed by address, for up to
+// timeoutMs. The matching SCAN_RSP is appended to its payload and the pair
+// goes out as one record, with the advertisement's type, time and RSSI.
+//
+// An advertisement goes out alone if its response does not arrive in time,
+// or if a newer advertisement from the same address or a full table pushes
+// it out. A SCAN_RSP with nothing held also goes out alone (an orphan).
+// Used from the NimBLE host task only (the scan callback, and a periodic
+// expiry that also flushes when active scanning stops); the counters are
+// read by the stats.
+
+constexpr size_t MERGED_PAYLOAD_MAX = 2 * LEGACY_ADV_DATA_MAX;
+constexpr size_t SCAN_PENDING_DEVICES = 32;
+
+static inline bool isScanResponse(const DeviceRecord& r) { return r.advType == ADV_TYPE_SCAN_RSP; }
+
+static inline bool awaitsScanResponse(const DeviceRecord& r) {
+  return r.isScannable && (r.advType == ADV_TYPE_ADV_IND || r.advType == ADV_TYPE_SCAN_IND);
+}
+
+class ScanMerger {
+public:
+  explicit ScanMerger(uint32_t timeoutMs) : timeoutMs_(timeoutMs) {}
+
+  // Emits (emit(const DeviceRecord&)) what waited longer than timeoutMs
+  template <typename Emit>
+  void expire(uint32_t nowMs, Emit emit) {
+    for (Pending* p = pending_.oldest(); p != nullptr && nowMs - p->heldMs >= timeoutMs_; p = pending_.oldest()) {
+      pushOut(pending_.oldestKey(), *p, emit);
+    }
+  }
+
+  // Emits everything held (active scanning stopped: no response will come)
+  template <typename Emit>
+  void flush(Emit emit) {
+    while (Pending* p = pending_.oldest()) pushOut(pending_.oldestKey(), *p, emit);
+  }
+
+  // Holds a scannable advertisement; a record it pushes out goes to emit
+  template <typename Emit>
+  void hold(const DeviceRecord& r, uint32_t nowMs, Emit emit) {
+    const uint64_t key = addressKey(r.addr, r.addrType);
+    if (Pending* same = pending_.find(key)) {
+      pushOut(key, *same, emit);
+    } else if (pending_.size() == SCAN_PENDING_DEVICES) {
+      pushOut(pending_.oldestKey(), *pending_.oldest(), emit);
+    }
+
+    bool inserted;
+    Pending& p = pending_.acquire(key, inserted);
+    p.heldMs = nowMs;
+    p.record = r;
+    p.record.data = nullptr;
+    p.record.dataLen = 0;
+    p.record.payloadLen = r.payloadLen < LEGACY_ADV_DATA_MAX ? r.payloadLen : LEGACY_ADV_DATA_MAX;
+    if (p.record.payloadLen > 0) memcpy(p.payload, r.payload, p.record.payloadLen);
+    p.record.payload = p.payload;
+    held_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // On true `rsp` has become the merged record, its payload in `buf`
+  bool merge(DeviceRecord& rsp, uint8_t (&buf)[MERGED_PAYLOAD_MAX]) {
+    const uint64_t key = addressKey(rsp.addr, rsp.addrType);
+    Pending* p = pending_.find(key);
+    if (p == nullptr) {
+      orphans_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    const size_t advLen = p->record.payloadLen;
+    const size_t rspLen = rsp.payloadLen < MERGED_PAYLOAD_MAX - advLen ? rsp.payloadLen : MERGED_PAYLOAD_MAX - advLen;
+    memcpy(buf, p->payload, advLen);
+    if (rspLen > 0) memcpy(buf + advLen, rsp.payload, rspLen);
+    rsp = p->record;
+    rsp.payload = buf;
+    rsp.payloadLen = advLen + rspLen;
+    rsp.scanRspLen = (uint8_t)rspLen;
+    pending_.erase(key);
+    merged_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // NimBLE delivered the advertisement with its response already appended:
+  // whatever is held for the address is part of it
+  void mergedUpstream(const DeviceRecord& r) {
+    pending_.erase(addressKey(r.addr, r.addrType));
+    merged_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint32_t held() const { return held_.load(std::memory_order_relaxed); }
+  uint32_t merged() const { return merged_.load(std::memory_order_relaxed); }
+  uint32_t unanswered() const { return unanswered_.load(std::memory_order_relaxed); }
+  uint32_t orphans() const { return orphans_.load(std::memory_order_relaxed); }
+  // Share of scannable advertisements that went out with their response
+  uint8_t hitPercent() const {
+    const uint32_t m = merged(), total = m + unanswered();
+    return total > 0 ? (uint8_t)((uint64_t)m * 100 / total) : 0;
+  }
+  static constexpr size_t memoryBytes() { return sizeof(ScanMerger); }
+
+private:
+  struct Pending {
+    uint32_t heldMs;
+    DeviceRecord record;      // payload points at the bytes below
+    uint8_t payload[LEGACY_ADV_DATA_MAX];
+  };
+
+  template <typename Emit>
+  void pushOut(uint64_t key, const Pending& p, Emit emit) {
+    unanswered_.fetch_add(1, std::memory_order_relaxed);
+    emit(p.record);
+    pending_.erase(key);
+  }
+
+  uint32_t timeoutMs_;
+  KeyedLru<Pending, SCAN_PENDING_DEVICES> pending_;
+  std::atomic<uint32_t> held_{0};
+  std::atomic<uint32_t> merged_{0};
+  std::atomic<uint32_t> unanswered_{0};
+  std::atomic<uint32_t> orphans_{0};
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Adaptive scan duty cycle.
+//
+// planScan() is a pure function: given the previous plan and what one
+// planning period observed, it returns the next plan. The firmware applies
+// it to the radio; host tools replay recorded captures through the same
+// function.
+//
+//   - new Find My devices        -> highest level the budget allows, for a while
+//   - known devices only         -> settle at the default level
+//   - nothing matched for 30 s   -> step down one level every 10 s, but not
+//                                   below the default while something looks
+//                                   at unmatched reports (raw capture, type
+//                                   discovery, signature scan)
+//   - queue or CPU over budget   -> step down one level
+//
+// Active scanning (scan requests) runs while new devices are being found,
+// or always, as the budget says, and only while the queue has room for scan
+// responses.
+
+struct ScanLevel {
+  uint16_t interval;    // 0.625 ms units
+  uint16_t window;
+  uint8_t dutyPct;
+};
+
+// Intervals below the default are chosen so that the common advertising
+// intervals (1 s, 2 s) step through many phases of them: with an interval
+// that divides the advertising interval, a device whose phase falls between
+// windows stays unheard for minutes.
+static const ScanLevel SCAN_LEVELS[] = {
+  { 1744,  96,   5 },   // 0: 1090 ms / 60 ms, empty environment
+  {  872, 174,  20 },   // 1: 545 ms / 108.75 ms
+  {  171,  85,  50 },   // 2: 106.875 ms / 53.125 ms
+  {   80,  70,  87 },   // 3: 50 ms / 43.75 ms, the default
+  {   80,  80, 100 },   // 4: continuous
+};
+
+constexpr size_t   SCAN_LEVEL_COUNT        = sizeof(SCAN_LEVELS) / sizeof(SCAN_LEVELS[0]);
+constexpr uint8_t  SCAN_DEFAULT_LEVEL      = 3;
+constexpr uint32_t SCAN_PLAN_PERIOD_MS     = 2000;
+constexpr uint8_t  SCAN_HOT_PERIODS        = 5;     // stay up after the last new device
+constexpr uint8_t  SCAN_QUIET_PERIODS      = 15;    // no matches before stepping down
+constexpr uint8_t  SCAN_QUIET_STEP_PERIODS = 5;     // between further steps down
+constexpr uint8_t  SCAN_QUEUE_HOLD_PCT     = 75;    // no step up at this fill
+constexpr uint8_t  SCAN_QUEUE_SHED_PCT     = 90;    // step down at this fill
+constexpr uint8_t  SCAN_ACTIVE_QUEUE_PCT   = 50;    // scan requests only below this fill
+
+enum class ScanActive : uint8_t { OFF, NEW_DEVICES, ALWAYS };
+
+struct ScanBudget {
+  uint8_t maxDutyPct;       // highest level allowed
+  uint16_t maxCpuPermille;  // scan callback share of one core
+  ScanActive active;
+};
+
+// One planning period's observations
+struct ScanInputs {
+  uint32_t matches;         // matched reports
+  uint32_t newDevices;      // matched addresses not seen recently
+  uint8_t queueFillPct;
+  uint16_t cpuPermille;
+  bool unmatched;           // a consumer of unmatched reports is on
+};
+
+enum class ScanReason : uint8_t { HOLD, NEW_DEVICES, SETTLE, QUIET, QUEUE, CPU, BUDGET };
+
+static inline const char* scanReasonName(ScanReason r) {
+  switch (r) {
+    case ScanReason::NEW_DEVICES: return "new_devices";
+    case ScanReason::SETTLE:      return "settle";
+    case ScanReason::QUIET:       return "quiet";
+    case ScanReason::QUEUE:       return "queue";
+    case ScanReason::CPU:         return "cpu";
+    case ScanReason::BUDGET:      return "budget";
+    default:                      return "hold";
+  }
+}
+
+struct ScanPlan {
+  uint8_t level;
+  bool active;
+  uint8_t hot;              // periods left at the top after new devices
+  uint8_t quiet;            // periods without a match
+  ScanReason reason;        // why the last change was made
+};
+
+constexpr ScanPlan SCAN_PLAN_START = { SCAN_DEFAULT_LEVEL, false, 0, 0, ScanReason::HOLD };
+
+// Highest level whose duty cycle fits the budget (level 0 always does)
+static inline uint8_t scanLevelCap(const ScanBudget& budget) {
+  uint8_t cap = 0;
+  for (size_t i = 1; i < SCAN_LEVEL_COUNT; ++i) {
+    if (SCAN_LEVELS[i].dutyPct <= budget.maxDutyPct) cap = (uint8_t)i;
+  }
+  return cap;
+}
+
+static inline bool sameScanSettings(const ScanPlan& a, const ScanPlan& b) {
+  return a.level == b.level && a.active == b.active;
+}
+
+static inline ScanPlan planScan(const ScanPlan& prev, const ScanInputs& in, const ScanBudget& budget) {
+  ScanPlan next = prev;
+  const uint8_t cap = scanLevelCap(budget);
+  const uint8_t down = prev.level > 0 ? (uint8_t)(prev.level - 1) : 0;
+  ScanReason why = ScanReason::HOLD;
+  uint8_t level = prev.level;
+
+  next.quiet = in.matches == 0 ? (uint8_t)(prev.quiet < 255 ? prev.quiet + 1 : 255) : 0;
+  if (in.newDevices > 0) next.hot = SCAN_HOT_PERIODS;
+  else if (next.hot > 0) --next.hot;
+
+  if (in.queueFillPct >= SCAN_QUEUE_SHED_PCT) {
+    level = down;
+    why = ScanReason::QUEUE;
+  } else if (in.cpuPermille > budget.maxCpuPermille) {
+    level = down;
+    why = ScanReason::CPU;
+  } else if (in.newDevices > 0) {
+    if (in.queueFillPct < SCAN_QUEUE_HOLD_PCT) level = cap;
+    why = ScanReason::NEW_DEVICES;
+  } else if (next.quiet >= SCAN_QUIET_PERIODS && !(in.unmatched && prev.level <= SCAN_DEFAULT_LEVEL)) {
+    level = down;
+    why = ScanReason::QUIET;
+    next.quiet = SCAN_QUIET_PERIODS - SCAN_QUIET_STEP_PERIODS;
+  } else if ((in.matches > 0 || in.unmatched) && next.hot == 0) {
+    // Back to the default after a burst, or up to it once devices show again
+    // or unmatched reports are wanted
+    if (prev.level > SCAN_DEFAULT_LEVEL || in.queueFillPct < SCAN_QUEUE_HOLD_PCT) level = SCAN_DEFAULT_LEVEL;
+    why = ScanReason::SETTLE;
+  }
+
+  if (level > cap) {
+    level = cap;
+    why = ScanReason::BUDGET;
+  }
+  next.level = level;
+  const bool wantActive = budget.active == ScanActive::ALWAYS ||
+                          (budget.active == ScanActive::NEW_DEVICES && next.hot > 0);
+  next.active = wantActive && in.queueFillPct < SCAN_ACTIVE_QUEUE_PCT &&
+                why != ScanReason::CPU && why != ScanReason::QUEUE;
+  next.reason = sameScanSettings(next, prev) ? prev.reason : why;
+  return next;
+}
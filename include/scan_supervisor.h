@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+
+// Scan supervisor.
+//
+// NimBLE can stop scanning on its own: a host reset, a controller error, or
+// a scan that ends with a reason code. Nothing restarts it, and the
+// firmware keeps running with the radio idle. loop() polls the supervisor
+// with whether NimBLE reports the scan as running and the controller's
+// report count. A gap opens when
+//   - the scan is no longer running (STOPPED), or
+//   - no report has arrived for stallMs while it is (STALLED).
+// poll() then asks for a restart at once, then again with exponential
+// backoff (retryMinMs doubling up to retryMaxMs) until one works. A STOPPED
+// gap closes when a start succeeds; a STALLED gap closes with the first
+// report after a restart, and dates from the last report before it.
+//
+// Every gap counts towards downMs(), the time without scanning since begin().
+// Single-threaded: call it from loop() only.
+
+enum class ScanGapCause : uint8_t { STOPPED, STALLED };
+
+static inline const char* scanGapCauseName(ScanGapCause c) {
+  return c == ScanGapCause::STALLED ? "stalled" : "stopped";
+}
+
+struct ScanGap {
+  uint32_t startMs;
+  uint32_t durationMs;
+  uint16_t attempts;        // restarts it took
+  ScanGapCause cause;
+};
+
+class ScanSupervisor {
+public:
+  ScanSupervisor(uint32_t stallMs, uint32_t retryMinMs, uint32_t retryMaxMs)
+    : stallMs_(stallMs), retryMinMs_(retryMinMs > 0 ? retryMinMs : 1),
+      retryMaxMs_(retryMaxMs > retryMinMs ? retryMaxMs : retryMinMs) {}
+
+  // Scanning started for the first time
+  void begin(uint32_t nowMs) {
+    beginMs_ = nowMs;
+    lastReportMs_ = nowMs;
+  }
+
+  // True when the caller should (re)start the scan now and report the
+  // result with started()
+  bool poll(uint32_t nowMs, bool scanning, uint32_t reports) {
+    const bool heard = reports != lastReports_;
+    if (heard) {
+      lastReports_ = reports;
+      lastReportMs_ = nowMs;
+    }
+
+    if (!open_) {
+      if (!scanning) {
+        open(nowMs, ScanGapCause::STOPPED);
+      } else if (stallMs_ > 0 && nowMs - lastReportMs_ >= stallMs_) {
+        open(lastReportMs_, ScanGapCause::STALLED);
+        ++stalls_;
+      } else {
+        return false;
+      }
+      return true;
+    }
+
+    // Restarted elsewhere, or reports came back
+    if (scanning && (gap_.cause == ScanGapCause::STOPPED || heard)) {
+      close(nowMs);
+      return false;
+    }
+    return (int32_t)(nowMs - nextAttemptMs_) >= 0;
+  }
+
+  void started(uint32_t nowMs, bool ok) {
+    if (!open_) return;
+    ++restarts_;
+    ++gap_.attempts;
+    if (ok && gap_.cause == ScanGapCause::STOPPED) {
+      close(nowMs);
+      return;
+    }
+    nextAttemptMs_ = nowMs + backoffMs_;
+    backoffMs_ = backoffMs_ >= retryMaxMs_ / 2 ? retryMaxMs_ : backoffMs_ * 2;
+  }
+
+  // The gap that closed since the last call, once
+  bool takeClosedGap(ScanGap& gap) {
+    if (!closedPending_) return false;
+    closedPending_ = false;
+    gap = closed_;
+    return true;
+  }
+
+  bool down() const { return open_; }
+  // Total time without scanning, including a gap still open
+  uint32_t downMs(uint32_t nowMs) const { return downMs_ + (open_ ? nowMs - gap_.startMs : 0); }
+  // Share of the time since begin() spent scanning
+  uint16_t upPermille(uint32_t nowMs) const {
+    const uint32_t span = nowMs - beginMs_;
+    if (span == 0) return 1000;
+    return (uint16_t)((uint64_t)(span - downMs(nowMs)) * 1000 / span);
+  }
+  uint32_t gaps() const { return gaps_; }
+  uint32_t lastGapMs() const { return closed_.durationMs; }
+  uint32_t maxGapMs() const { return maxGapMs_; }
+  uint32_t stalls() const { return stalls_; }
+  uint32_t restarts() const { return restarts_; }
+
+private:
+  void open(uint32_t startMs, ScanGapCause cause) {
+    open_ = true;
+    gap_ = { startMs, 0, 0, cause };
+    backoffMs_ = retryMinMs_;
+    nextAttemptMs_ = startMs;
+  }
+
+  void close(uint32_t nowMs) {
+    open_ = false;
+    gap_.durationMs = nowMs - gap_.startMs;
+    downMs_ += gap_.durationMs;
+    if (gap_.durationMs > maxGapMs_) maxGapMs_ = gap_.durationMs;
+    ++gaps_;
+    closed_ = gap_;
+    closedPending_ = true;
+    lastReportMs_ = nowMs;
+  }
+
+  uint32_t stallMs_;
+  uint32_t retryMinMs_;
+  uint32_t retryMaxMs_;
+  uint32_t beginMs_ = 0;
+  uint32_t lastReports_ = 0;
+  uint32_t lastReportMs_ = 0;
+  bool open_ = false;
+  ScanGap gap_ = {};
+  uint32_t backoffMs_ = 0;
+  uint32_t nextAttemptMs_ = 0;
+  bool closedPending_ = false;
+  ScanGap closed_ = {};
+  uint32_t downMs_ = 0;
+  uint32_t maxGapMs_ = 0;
+  uint32_t gaps_ = 0;
+  uint32_t stalls_ = 0;
+  uint32_t restarts_ = 0;
+};
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/time.h>
+
+// Multi-pattern signature scan over whole advertising payloads.
+//
+// The Find My classifiers look at the first manufacturer data and the
+// service data only. In research mode every report's raw payload, AD
+// headers included, is scanned against a set of byte signatures at once, to
+// find identifiers hidden in other AD types.
+//
+// SignatureMatcher is an Aho-Corasick automaton compiled from a
+// SignatureSet, with the failure links resolved at build time: a scan takes
+// one transition per payload byte plus one step per hit, however many
+// signatures there are. The root's transitions are a dense table; every
+// other state keeps only the transitions that differ from the root's,
+// sorted, and falls back to the root's table. No heap: a state costs about
+// 13 bytes and a transition 3; a set needs about one state per signature
+// byte.
+//
+// Hits go from the scan callback to loop() through a SignatureQueue, one
+// SignatureReport per report with at least one hit.
+
+constexpr size_t SIG_MAX_SIGNATURES = 256;
+constexpr size_t SIG_MAX_LEN        = 16;
+constexpr size_t SIG_LABEL_MAX      = 15;
+constexpr size_t SIG_MAX_STATES     = 1024;
+constexpr size_t SIG_MAX_EDGES      = 2048;   // transitions that do not lead where the root's do
+constexpr size_t SIG_MAX_HITS       = 8;      // kept per report; the rest are counted
+
+struct Signature {
+  char label[SIG_LABEL_MAX + 1];
+  uint8_t bytes[SIG_MAX_LEN];
+  uint8_t len;
+};
+
+// The signatures as configured; owned by loop(). Each change bumps the
+// generation, so hits found with an older automaton can be told apart.
+class SignatureSet {
+public:
+  // nullptr on success, else why not. Labels are [A-Za-z0-9_.+-]; they
+  // become event keys and values in every output format.
+  const char* add(const char* label, const uint8_t* bytes, size_t len) {
+    const size_t labelLen = strlen(label);
+    if (labelLen == 0 || labelLen > SIG_LABEL_MAX) return "bad label";
+    for (const char* c = label; *c != '\0'; ++c) {
+      const bool ok = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+                      *c == '_' || *c == '.' || *c == '+' || *c == '-';
+      if (!ok) return "bad label";
+    }
+    if (len == 0 || len > SIG_MAX_LEN) return "bad length";
+    for (size_t i = 0; i < count_; ++i) {
+      if (strcmp(sigs_[i].label, label) == 0) return "label in use";
+      if (sigs_[i].len == len && memcmp(sigs_[i].bytes, bytes, len) == 0) return "duplicate";
+    }
+    if (count_ == SIG_MAX_SIGNATURES) return "full";
+    Signature& s = sigs_[count_++];
+    memcpy(s.label, label, labelLen + 1);
+    memcpy(s.bytes, bytes, len);
+    s.len = (uint8_t)len;
+    ++generation_;
+    return nullptr;
+  }
+
+  bool remove(const char* label) {
+    for (size_t i = 0; i < count_; ++i) {
+      if (strcmp(sigs_[i].label, label) != 0) continue;
+      memmove(&sigs_[i], &sigs_[i + 1], (count_ - i - 1) * sizeof(Signature));
+      --count_;
+      ++generation_;
+      return true;
+    }
+    return false;
+  }
+
+  void clear() {
+    count_ = 0;
+    ++generation_;
+  }
+
+  size_t size() const { return count_; }
+  const Signature& operator[](size_t i) const { return sigs_[i]; }
+  uint8_t generation() const { return generation_; }
+
+private:
+  Signature sigs_[SIG_MAX_SIGNATURES];
+  size_t count_ = 0;
+  uint8_t generation_ = 0;
+};
+
+class SignatureMatcher {
+public:
+  static constexpr uint16_t NONE = 0xFFFF;
+
+  // Compiles `set`; false (and an empty automaton) when it needs more than
+  // SIG_MAX_STATES states or SIG_MAX_EDGES transitions
+  bool build(const SignatureSet& set) {
+    generation_ = set.generation();
+    memset(rootNext_, 0, sizeof(rootNext_));
+    if (!buildTrie(set) || !buildTransitions()) {
+      states_ = 1;
+      memset(rootNext_, 0, sizeof(rootNext_));
+      out_[0] = dict_[0] = NONE;
+      nextStart_[0] = nextStart_[1] = 0;
+      return false;
+    }
+    return true;
+  }
+
+  // Calls hit(signature, offset) for every occurrence, in order of where it
+  // ends; returns the number of hits
+  template <typename Hit>
+  uint32_t scan(const uint8_t* p, size_t n, Hit hit) const {
+    uint32_t hits = 0;
+    uint16_t s = 0;
+    for (size_t i = 0; i < n; ++i) {
+      s = next(s, p[i]);
+      for (uint16_t o = out_[s] != NONE ? s : dict_[s]; o != NONE; o = dict_[o]) {
+        hit(out_[o], i + 1 - depth_[o]);
+        ++hits;
+      }
+    }
+    return hits;
+  }
+
+  size_t states() const { return states_; }
+  size_t transitions() const { return nextStart_[states_]; }
+  uint8_t generation() const { return generation_; }
+
+private:
+  // The transition from s on c: the sorted exceptions of s, else where the
+  // root goes on c. An exception is any byte on which s (or a state on its
+  // failure chain) leads somewhere other than the root does, so a scan never
+  // follows failure links.
+  uint16_t next(uint16_t s, uint8_t c) const {
+    size_t at = nextStart_[s], len = nextStart_[s + 1] - at;
+    if (len == 0) return rootNext_[c];
+    while (len > 1) {
+      const size_t half = len / 2;
+      at += nextByte_[at + half - 1] < c ? half : 0;
+      len -= half;
+    }
+    return nextByte_[at] == c ? nextState_[at] : rootNext_[c];
+  }
+
+  static bool lessThan(const Signature& a, const Signature& b) {
+    const int c = memcmp(a.bytes, b.bytes, a.len < b.len ? a.len : b.len);
+    return c < 0 || (c == 0 && a.len < b.len);
+  }
+
+  // The trie, level by level over the signatures in sorted order: a state
+  // stands for the range of signatures that share its prefix, and states are
+  // numbered breadth first. A state's children are consecutive from
+  // firstChild_, their bytes (sorted) in trieByte_ from trieStart_. While
+  // building, fail_ and dict_ hold the range.
+  bool buildTrie(const SignatureSet& set) {
+    uint8_t order[SIG_MAX_SIGNATURES];
+    const size_t count = set.size();
+    for (size_t i = 0; i < count; ++i) {
+      size_t k = i;
+      for (; k > 0 && lessThan(set[i], set[order[k - 1]]); --k) order[k] = order[k - 1];
+      order[k] = (uint8_t)i;
+    }
+
+    states_ = 1;
+    fail_[0] = 0;
+    dict_[0] = (uint16_t)count;
+    depth_[0] = 0;
+    size_t edges = 0;
+    for (size_t s = 0; s < states_; ++s) {
+      size_t k = fail_[s];
+      const size_t hi = dict_[s];
+      const uint8_t d = depth_[s];
+      out_[s] = NONE;
+      firstChild_[s] = (uint16_t)states_;
+      trieStart_[s] = (uint16_t)edges;
+      // Signatures that end here sort first
+      for (; k < hi && set[order[k]].len == d; ++k) out_[s] = order[k];
+      while (k < hi) {
+        const uint8_t b = set[order[k]].bytes[d];
+        size_t j = k + 1;
+        while (j < hi && set[order[j]].bytes[d] == b) ++j;
+        if (states_ == SIG_MAX_STATES) return false;
+        fail_[states_] = (uint16_t)k;
+        dict_[states_] = (uint16_t)j;
+        depth_[states_] = (uint8_t)(d + 1);
+        ++states_;
+        trieByte_[edges++] = b;
+        k = j;
+      }
+    }
+    trieStart_[states_] = (uint16_t)edges;
+    for (size_t e = trieStart_[0]; e < trieStart_[1]; ++e) rootNext_[trieByte_[e]] = (uint16_t)(firstChild_[0] + e);
+    return true;
+  }
+
+  // Failure links, dictionary links (the nearest state on the failure chain
+  // that completes a signature) and the transitions, breadth first: a
+  // state's failure state is shallower, so its transitions are known by then.
+  bool buildTransitions() {
+    fail_[0] = 0;
+    dict_[0] = NONE;
+    nextStart_[0] = nextStart_[1] = 0;
+    size_t edges = 0;
+    for (size_t s = 0; s < states_; ++s) {
+      const uint16_t f = fail_[s];
+      if (s > 0) {
+        // Own children merged with the failure state's transitions
+        nextStart_[s] = (uint16_t)edges;
+        size_t a = trieStart_[s], b = nextStart_[f];
+        const size_t aEnd = trieStart_[s + 1], bEnd = nextStart_[f + 1];
+        while (a < aEnd || b < bEnd) {
+          if (edges == SIG_MAX_EDGES) return false;
+          if (b == bEnd || (a < aEnd && trieByte_[a] <= nextByte_[b])) {
+            if (b < bEnd && trieByte_[a] == nextByte_[b]) ++b;
+            nextByte_[edges] = trieByte_[a];
+            nextState_[edges++] = (uint16_t)(firstChild_[s] + (a++ - trieStart_[s]));
+          } else {
+            nextByte_[edges] = nextByte_[b];
+            nextState_[edges++] = nextState_[b++];
+          }
+        }
+        nextStart_[s + 1] = (uint16_t)edges;
+      }
+      for (size_t e = trieStart_[s]; e < trieStart_[s + 1]; ++e) {
+        const uint16_t ch = (uint16_t)(firstChild_[s] + (e - trieStart_[s]));
+        const uint16_t chFail = s == 0 ? 0 : next(f, trieByte_[e]);
+        fail_[ch] = chFail;
+        dict_[ch] = out_[chFail] != NONE ? chFail : dict_[chFail];
+      }
+    }
+    return true;
+  }
+
+  uint16_t rootNext_[256];
+  uint16_t fail_[SIG_MAX_STATES];
+  uint16_t dict_[SIG_MAX_STATES];
+  uint16_t out_[SIG_MAX_STATES];
+  uint16_t firstChild_[SIG_MAX_STATES];
+  uint16_t trieStart_[SIG_MAX_STATES + 1];
+  uint16_t nextStart_[SIG_MAX_STATES + 1];
+  uint8_t trieByte_[SIG_MAX_STATES];
+  uint8_t depth_[SIG_MAX_STATES];
+  uint8_t nextByte_[SIG_MAX_EDGES];
+  uint16_t nextState_[SIG_MAX_EDGES];
+  size_t states_ = 1;
+  uint8_t generation_ = 0;
+};
+
+struct SignatureHit {
+  uint8_t signature;
+  uint8_t offset;
+};
+
+template <size_t PayloadMax>
+struct SignatureReport {
+  struct timeval time;
+  uint8_t addr[6];
+  uint8_t addrType;
+  int8_t rssi;
+  uint8_t advType;
+  uint8_t generation;       // of the automaton that found the hits
+  uint8_t hitCount;         // in hits[]
+  uint16_t totalHits;
+  SignatureHit hits[SIG_MAX_HITS];
+  uint8_t payloadLen;
+  uint8_t payload[PayloadMax];
+};
+
+// Single producer (scan callback), single consumer (loop()), like RecordQueue
+template <size_t N, size_t PayloadMax>
+class SignatureQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SignatureQueue depth must be a power of two");
+
+public:
+  using Report = SignatureReport<PayloadMax>;
+
+  // The slot to fill, or nullptr (counted) when full; publish with push()
+  Report* reserve() {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= N) {
+      overflows_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return &slots_[head & (N - 1)];
+  }
+
+  void push() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  const Report* front() const {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return nullptr;
+    return &slots_[tail & (N - 1)];
+  }
+
+  void pop() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  uint32_t overflows() const { return overflows_.load(std::memory_order_relaxed); }
+
+private:
+  Report slots_[N];
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  std::atomic<uint32_t> overflows_{0};
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#include "ble_ids.h"
+#include "find_my_match.h"
+
+// Unknown-type discovery.
+//
+// The classifiers drop whatever they do not recognise: Apple types other
+// than 0x12/0x10, unknown Google, Samsung and Xiaomi type bytes, Fast Pair
+// frame types and other service UUIDs. Here each such AD structure is
+// reduced to a tuple
+//
+//   (manufacturer data CID or service data UUID, type byte, length bucket)
+//
+// and counted in a space-saving top-K sketch: bounded memory, and every
+// tuple seen more than total/K times is guaranteed to be in the table, its
+// count overestimated by at most its error. A tuple is reported once, with a
+// sample, the first time it is seen; a bitmap of hashed tuples remembers
+// which were, so after some thousands of distinct tuples a few new ones go
+// unreported.
+//
+// "Classified" means accepted by the built-in predicates (find_my_match.h),
+// whatever classifier is in force. Only the first manufacturer data of a
+// report is looked at, as by the classifiers; every 16-bit service data is.
+
+constexpr size_t DISCOVERY_TOP_K     = 64;
+constexpr size_t DISCOVERY_SEEN_BITS = 8192;
+constexpr size_t DISCOVERY_NAME_MAX  = 24;    // "mfd.004c.07.128-255"
+
+enum DiscoveryScope : uint8_t {
+  DISCOVERY_OFF     = 0,
+  DISCOVERY_VENDORS = 1,    // manufacturer data of the Find My vendors, and service data
+  DISCOVERY_ALL     = 2,    // manufacturer data of any company, and service data
+};
+
+// Tuple key: service bit 31, has-type bit 30, length bucket bits 24-26,
+// type byte bits 16-23, CID or UUID bits 0-15
+constexpr uint32_t DISCOVERY_KEY_SERVICE = 1u << 31;
+constexpr uint32_t DISCOVERY_KEY_TYPED   = 1u << 30;
+
+// AD data length (CID or UUID included): 2-3, 4-7, 8-15, 16-23, 24-31,
+// 32-63, 64-127, 128-255
+static const uint8_t DISCOVERY_BUCKET_LOW[] = { 2, 4, 8, 16, 24, 32, 64, 128 };
+static const uint8_t DISCOVERY_BUCKET_HIGH[] = { 3, 7, 15, 23, 31, 63, 127, 255 };
+
+static inline uint8_t discoveryLengthBucket(size_t len) {
+  size_t b = 0;
+  while (b + 1 < sizeof(DISCOVERY_BUCKET_LOW) && len >= DISCOVERY_BUCKET_LOW[b + 1]) ++b;
+  return (uint8_t)b;
+}
+
+// `d` is the AD data: CID or UUID (LE), then the type byte if there is one
+static inline uint32_t discoveryKey(bool service, const uint8_t* d, size_t len) {
+  uint32_t key = (uint32_t)(d[0] | (d[1] << 8)) | ((uint32_t)discoveryLengthBucket(len) << 24);
+  if (service) key |= DISCOVERY_KEY_SERVICE;
+  if (len > 2) key |= DISCOVERY_KEY_TYPED | ((uint32_t)d[2] << 16);
+  return key;
+}
+
+// "mfd.004c.07.8-15", "svc.feed.-.2-3"
+static inline void discoveryKeyName(uint32_t key, char* out, size_t cap) {
+  const uint8_t bucket = (key >> 24) & 0x07;
+  char type[3] = "-";
+  if ((key & DISCOVERY_KEY_TYPED) != 0) snprintf(type, sizeof(type), "%02x", (unsigned)((key >> 16) & 0xFF));
+  snprintf(out, cap, "%s.%04x.%s.%u-%u", (key & DISCOVERY_KEY_SERVICE) != 0 ? "svc" : "mfd",
+           (unsigned)(key & 0xFFFF), type, DISCOVERY_BUCKET_LOW[bucket],
+           DISCOVERY_BUCKET_HIGH[bucket]);
+}
+
+// Fast Pair service data is classified with any frame type ("FastPair/Unknown")
+static inline bool isClassifiedServiceData(uint16_t uuid, const uint8_t* data, size_t len) {
+  if (!isFindMyServiceData(uuid, len)) return false;
+  return uuid != SVC_GOOGLE_FAST_PAIR || data[0] == 0x10 || data[0] == 0x11;
+}
+
+// Calls fn(service, adData, adLen) for each structure of the payload that
+// the classifiers do not recognise
+template <typename Fn>
+static inline void forEachUnclassified(const uint8_t* payload, size_t len, DiscoveryScope scope, Fn fn) {
+  if (scope == DISCOVERY_OFF) return;
+  bool manufacturerSeen = false;
+  forEachAdStructure(payload, len, [&](uint8_t type, const uint8_t* d, size_t n) {
+    if (n < 2) return true;
+    const uint16_t id = (uint16_t)(d[0] | (d[1] << 8));
+    if (type == AD_TYPE_SERVICE_DATA16) {
+      if (!isClassifiedServiceData(id, d + 2, n - 2)) fn(true, d, n);
+    } else if (type == AD_TYPE_MANUFACTURER && !manufacturerSeen) {
+      manufacturerSeen = true;
+      const bool vendor = id == CID_APPLE || id == CID_GOOGLE || id == CID_SAMSUNG || id == CID_XIAOMI;
+      if ((vendor || scope == DISCOVERY_ALL) && !isFindMyDevice(id, d, n)) fn(false, d, n);
+    }
+    return true;
+  });
+}
+
+// Metwally et al.'s space-saving: K counters; a key not in the table takes
+// over the smallest counter, inheriting its count as error. The table is
+// small enough that a linear scan beats keeping it ordered.
+template <size_t K>
+class SpaceSaving {
+public:
+  struct Entry {
+    uint32_t key;
+    uint32_t count;   // upper bound
+    uint32_t error;   // count - error is a lower bound
+  };
+
+  void observe(uint32_t key) {
+    size_t min = 0;
+    for (size_t i = 0; i < size_; ++i) {
+      if (entries_[i].key == key) {
+        ++entries_[i].count;
+        return;
+      }
+      if (entries_[i].count < entries_[min].count) min = i;
+    }
+    if (size_ < K) {
+      entries_[size_++] = Entry{ key, 1, 0 };
+      return;
+    }
+    entries_[min] = Entry{ key, entries_[min].count + 1, entries_[min].count };
+  }
+
+  // Up to n entries, highest count first
+  size_t top(Entry* out, size_t n) const {
+    if (n > size_) n = size_;
+    bool taken[K] = {};
+    for (size_t o = 0; o < n; ++o) {
+      size_t best = K;
+      for (size_t i = 0; i < size_; ++i) {
+        if (!taken[i] && (best == K || entries_[i].count > entries_[best].count)) best = i;
+      }
+      taken[best] = true;
+      out[o] = entries_[best];
+    }
+    return n;
+  }
+
+  void clear() { size_ = 0; }
+  size_t size() const { return size_; }
+
+private:
+  Entry entries_[K];
+  size_t size_ = 0;
+};
+
+// The sketch and the reported-tuples bitmap, shared by the scan callback
+// (observe) and loop() (top, reset)
+class TypeDiscovery {
+public:
+  using Entry = SpaceSaving<DISCOVERY_TOP_K>::Entry;
+
+  // True the first time `key` is seen
+  bool observe(uint32_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++observed_;
+    sketch_.observe(key);
+    const uint32_t bit = hash(key) % DISCOVERY_SEEN_BITS;
+    if ((seen_[bit / 8] & (1u << (bit % 8))) != 0) return false;
+    seen_[bit / 8] |= (uint8_t)(1u << (bit % 8));
+    ++reported_;
+    return true;
+  }
+
+  // The report of a new tuple could not be sent: report it next time
+  void forget(uint32_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint32_t bit = hash(key) % DISCOVERY_SEEN_BITS;
+    seen_[bit / 8] &= (uint8_t)~(1u << (bit % 8));
+    --reported_;
+  }
+
+  size_t top(Entry* out, size_t n) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sketch_.top(out, n);
+  }
+
+  // Counts start over; tuples already reported stay reported unless `all`
+  void reset(bool all) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sketch_.clear();
+    observed_ = 0;
+    if (all) {
+      memset(seen_, 0, sizeof(seen_));
+      reported_ = 0;
+    }
+  }
+
+  uint32_t observed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return observed_;
+  }
+  uint32_t reported() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reported_;
+  }
+
+private:
+  static uint32_t hash(uint32_t k) {
+    k ^= k >> 16;
+    k *= 0x7feb352d;
+    k ^= k >> 15;
+    k *= 0x846ca68b;
+    return k ^ (k >> 16);
+  }
+
+  mutable std::mutex mutex_;
+  SpaceSaving<DISCOVERY_TOP_K> sketch_;
+  uint8_t seen_[DISCOVERY_SEEN_BITS / 8] = {};
+  uint32_t observed_ = 0;
+  uint32_t reported_ = 0;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "ble_ids.h"
+#include "device_record.h"
+#include "keyed_lru.h"
+
+// Vendor payload decoders: the typed fields behind a classification, so
+// consumers read battery level, separation state, counters and key hints as
+// numbers instead of re-parsing the hex dump. Called once per classified
+// record, after the classifier picked the data; formatters only copy the
+// numbers out. A field the data is too short for is left out.
+//
+// Layouts:
+//   Apple offline finding, manufacturer type 0x12:
+//     4C 00 12 19 status key[22] key-bits hint   separated from its owner
+//     4C 00 12 02 status key-bits                near its owner, no hint
+//     status bits 6-7 are the battery level
+//   Samsung Find service data (FD5A), as published in reverse-engineering
+//   work and not checked against a tag here:
+//     state aging[3] privacy-id[8] ...
+//     state bits 0-2: 1 premature offline, 2 offline, 3 overmature offline
+//   Google Fast Pair service data, frame 0x11 (Find Device):
+//     frame eid[...]                             hint = the first 4 EID bytes
+//
+// Apple offline finding, separated form, also yields the advertised 28-byte
+// public key: its first 6 bytes are the random static address, whose top two
+// bits are forced to 0b11 and kept in the key-bits byte instead; the other
+// 22 follow the status byte. keyId is a hash of it, and deviceKey() makes it
+// the key of the per-device tables, so a tag is one device for as long as it
+// advertises one key, whatever address it is heard from.
+
+constexpr uint8_t VENDOR_BATTERY   = 1u << 0;
+constexpr uint8_t VENDOR_SEPARATED = 1u << 1;
+constexpr uint8_t VENDOR_STATE     = 1u << 2;
+constexpr uint8_t VENDOR_COUNTER   = 1u << 3;
+constexpr uint8_t VENDOR_HINT      = 1u << 4;
+constexpr uint8_t VENDOR_KEY_ID    = 1u << 5;
+
+static inline size_t vendorFieldCount(uint8_t present) {
+  size_t n = 0;
+  for (; present != 0; present &= (uint8_t)(present - 1)) ++n;
+  return n;
+}
+
+constexpr uint8_t APPLE_OF_SEPARATED_LEN = 0x19;
+constexpr uint8_t APPLE_OF_NEARBY_LEN    = 0x02;
+constexpr size_t APPLE_OF_KEY_LEN        = 28;
+constexpr uint64_t DEVICE_KEY_PUBLIC_KEY = 1ull << 63;   // never set in an addressKey()
+
+static inline uint32_t readBigEndian(const uint8_t* p, size_t n) {
+  uint32_t v = 0;
+  for (size_t i = 0; i < n; ++i) v = (v << 8) | p[i];
+  return v;
+}
+
+// `mfd` starts at the company id
+static inline VendorFields decodeAppleOfflineFinding(const uint8_t* mfd, size_t len) {
+  VendorFields f = {};
+  if (len < 5 || mfd[2] != 0x12) return f;
+  f.present = VENDOR_BATTERY | VENDOR_STATE;
+  f.state = mfd[4];
+  f.battery = (uint8_t)(mfd[4] >> 6);
+  if (mfd[3] == APPLE_OF_SEPARATED_LEN) {
+    f.present |= VENDOR_SEPARATED;
+    f.separated = 1;
+    // The key bits before it belong to the key, and so to keyId
+    if (len >= 29) {
+      f.present |= VENDOR_HINT;
+      f.hint = mfd[28];
+    }
+  } else if (mfd[3] == APPLE_OF_NEARBY_LEN) {
+    // Only key bits follow the status byte: no hint
+    f.present |= VENDOR_SEPARATED;
+    f.separated = 0;
+  }
+  return f;
+}
+
+// `svc` starts after the service UUID
+static inline VendorFields decodeSmartTag(const uint8_t* svc, size_t len) {
+  VendorFields f = {};
+  if (len < 1) return f;
+  const uint8_t state = svc[0] & 0x07;
+  f.present = VENDOR_STATE | VENDOR_SEPARATED;
+  f.state = svc[0];
+  f.separated = state == 2 || state == 3;
+  if (len >= 4) {
+    f.present |= VENDOR_COUNTER;
+    f.counter = readBigEndian(svc + 1, 3);
+  }
+  if (len >= 8) {
+    f.present |= VENDOR_HINT;
+    f.hint = readBigEndian(svc + 4, 4);
+  }
+  return f;
+}
+
+static inline VendorFields decodeFastPair(const uint8_t* svc, size_t len) {
+  VendorFields f = {};
+  if (len < 5 || svc[0] != 0x11) return f;
+  f.present = VENDOR_HINT;
+  f.hint = readBigEndian(svc + 1, 4);
+  return f;
+}
+
+static inline VendorFields decodeVendorFields(uint16_t manufacturer, DataSource source, const uint8_t* data,
+                                              size_t len) {
+  if (data == nullptr) return VendorFields{};
+  if (source == DataSource::MANUFACTURER) {
+    return manufacturer == CID_APPLE ? decodeAppleOfflineFinding(data, len) : VendorFields{};
+  }
+  switch (manufacturer) {
+    case CID_SAMSUNG: return decodeSmartTag(data, len);
+    case CID_GOOGLE:  return decodeFastPair(data, len);
+    default:          return VendorFields{};
+  }
+}
+
+// The public key of a separated-form offline finding advertisement; false
+// for any other data. `addr` is LSB first, as in DeviceRecord.
+static inline bool appleOfflineFindingKey(const uint8_t addr[6], const uint8_t* mfd, size_t len,
+                                          uint8_t key[APPLE_OF_KEY_LEN]) {
+  if (len < 29 || mfd[2] != 0x12 || mfd[3] != APPLE_OF_SEPARATED_LEN) return false;
+  key[0] = (uint8_t)((addr[5] & 0x3F) | (mfd[27] << 6));
+  for (size_t i = 1; i < 6; ++i) key[i] = addr[5 - i];
+  memcpy(key + 6, mfd + 5, APPLE_OF_KEY_LEN - 6);
+  return true;
+}
+
+// FNV-1a
+static inline uint32_t publicKeyId(const uint8_t* key, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; ++i) h = (h ^ key[i]) * 16777619u;
+  return h;
+}
+
+static inline void decodeVendor(DeviceRecord& r) {
+  r.vendor = decodeVendorFields(r.manufacturer, r.dataType, r.data, r.dataLen);
+  uint8_t key[APPLE_OF_KEY_LEN];
+  if (r.manufacturer == CID_APPLE && r.dataType == DataSource::MANUFACTURER &&
+      appleOfflineFindingKey(r.addr, r.data, r.dataLen, key)) {
+    r.vendor.present |= VENDOR_KEY_ID;
+    r.vendor.keyId = publicKeyId(key, sizeof(key));
+  }
+}
+
+// Key of a device in the per-device tables (rate limiter, load shedder): its
+// public key where the advertisement carries one, else its address
+static inline uint64_t deviceKey(const DeviceRecord& r) {
+  if (r.vendor.present & VENDOR_KEY_ID) return DEVICE_KEY_PUBLIC_KEY | r.vendor.keyId;
+  return addressKey(r.addr, r.addrType);
+}
@@ -16,7 +16,10 @@
 # ============================================================================
 
 SCRIPT_NAME="$(basename "$0")"
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
 LOGS_DIR="./logs"
+TOOLS_BIN_DIR="$SCRIPT_DIR/tools/bin"
+FMSDECODE_BIN="$TOOLS_BIN_DIR/fmsdecode"
 
 # Default values
 DEFAULT_FORMAT="csv"
@@ -32,6 +35,8 @@ SELECTED_FORMAT=""
 SELECTED_MIN_RSSI=""
 SELECTED_MANUFACTURERS=""
 PLATFORMIO_BIN=""
+WIRESHARK_FIFO=""
+COMPRESS_MODE=false
 COMMAND_EQUIVALENT_SHOWN=false
 
 # ============================================================================
@@ -103,7 +108,7 @@ is_integer() {
 validate_format() {
     local format="$1"
     case "$format" in
-        log|csv|yaml) return 0 ;;
+        log|csv|yaml|jsonl|cbor|pcap|delta|compact) return 0 ;;
         *) return 1 ;;
     esac
 }
@@ -122,6 +127,14 @@ validate_manufacturers() {
     return 0
 }
 
+# Check if a format is binary (needs raw capture and a host decoder)
+is_binary_format() {
+    case "$1" in
+        cbor|pcap|delta) return 0 ;;
+        *) return 1 ;;
+    esac
+}
+
 # Validate user choice against available options
 validate_choice() {
     local choice="$1"
@@ -176,6 +189,11 @@ format_to_flag() {
         log)  echo "0" ;;
         csv)  echo "1" ;;
         yaml) echo "2" ;;
+        jsonl) echo "3" ;;
+        cbor) echo "4" ;;
+        pcap) echo "5" ;;
+        delta) echo "6" ;;
+        compact) echo "7" ;;
         *)    echo "1" ;;  # Default to CSV
     esac
 }
@@ -222,10 +240,13 @@ WORKFLOW:
     4. If customizing: configure format, RSSI filter, and manufacturers
     5. Upload firmware with custom settings (if customization chosen)
     6. Start monitoring device output
+    7. On Ctrl+C, check the log with fmsdecode verify (seq/crc loss report,
+       saved as <log file>.verify; pcap captures are checked by hand)
 
 OPTIONS:
     --env ENVIRONMENT         Specify the environment to use (e.g., esp32-s3)
-    --format FORMAT           Specify output format: log, csv, or yaml
+    --format FORMAT           Specify output format: log, csv, yaml, jsonl, cbor, pcap, delta, or compact
+                             (binary formats are saved raw and shown decoded)
                              (triggers firmware customization if provided)
     --min-rssi=VALUE          Specify minimum RSSI threshold (e.g., --min-rssi=-70)
                              (triggers firmware customization if provided)
@@ -234,6 +255,11 @@ OPTIONS:
                              Examples: --manufacturer=Apple,Google
                                       --manufacturer=all (default)
                              (triggers firmware customization if provided)
+    --wireshark-fifo=PATH    With --format pcap, serve packets live on a named
+                             pipe instead of rolling pcapng files in ./logs
+                             (open with: wireshark -k -i PATH)
+    --compress               Compress the serial stream on the device (LZSS);
+                             it is expanded on the host before logging
     --no-upload              Skip firmware customization and upload, use existing firmware
     --quiet                  Save logs only to file, without terminal display
                              (if not specified, will be asked interactively)
@@ -274,6 +300,11 @@ show_format_menu() {
     echo "  1. log  (Human-readable log format)" >&2
     echo "  2. csv  (Comma-separated values)" >&2
     echo "  3. yaml (YAML format)" >&2
+    echo "  4. jsonl (JSON Lines, one object per line)" >&2
+    echo "  5. cbor (Binary CBOR records)" >&2
+    echo "  6. pcap (BLE link-layer packets for Wireshark)" >&2
+    echo "  7. delta (Binary per-device deltas, smallest)" >&2
+    echo "  8. compact (Short text lines, expanded to CSV on the host)" >&2
     echo >&2
 }
 
@@ -310,6 +341,10 @@ show_command_equivalent() {
         cmd="$cmd --quiet"
     fi
 
+    if [ "$COMPRESS_MODE" = "true" ]; then
+        cmd="$cmd --compress"
+    fi
+
     echo "  $cmd" >&2
     echo >&2
 }
@@ -395,7 +430,7 @@ select_format() {
 
     # Get user choice
     while true; do
-        local prompt="Choose output format (1-3)"
+        local prompt="Choose output format (1-8)"
         printf "%s [2]: " "$prompt" >&2
 
         read choice
@@ -405,7 +440,12 @@ select_format() {
             1) echo "log"; return ;;
             2) echo "csv"; return ;;
             3) echo "yaml"; return ;;
-            *) echo "Invalid choice. Please enter 1, 2, or 3." >&2 ;;
+            4) echo "jsonl"; return ;;
+            5) echo "cbor"; return ;;
+            6) echo "pcap"; return ;;
+            7) echo "delta"; return ;;
+            8) echo "compact"; return ;;
+            *) echo "Invalid choice. Please enter a number between 1 and 8." >&2 ;;
         esac
     done
 }
@@ -674,6 +714,9 @@ perform_upload() {
 
     # Set build flags via environment variable
     export PLATFORMIO_BUILD_FLAGS="-DOUTPUT_FORMAT_FLAG=$format_flag -DMIN_RSSI_FLAG=$min_rssi -DMANUFACTURES_FLAG=$manufacturers_flag"
+    if [ "$COMPRESS_MODE" = "true" ]; then
+        PLATFORMIO_BUILD_FLAGS="$PLATFORMIO_BUILD_FLAGS -DCOMPRESS_FLAG=1"
+    fi
 
     info "Cleaning previous builds..."
     if ! $PLATFORMIO_BIN run -e "$env" -t clean --silent; then
@@ -694,10 +737,66 @@ perform_upload() {
     fi
 }
 
+# ============================================================================
+# HOST TOOLS
+# ============================================================================
+
+# Build the host decoder (tools/fmsdecode.cpp) when missing or out of date
+build_host_tools() {
+    local src="$SCRIPT_DIR/tools/fmsdecode.cpp"
+
+    if [ -x "$FMSDECODE_BIN" ] && [ -z "$(find "$SCRIPT_DIR/tools" "$SCRIPT_DIR/include" -newer "$FMSDECODE_BIN" -name '*.[ch]*' 2>/dev/null)" ]; then
+        return 0
+    fi
+
+    command -v c++ >/dev/null 2>&1 || error_exit "A C++ compiler (c++) is required to build the host decoder"
+
+    info "Building host decoder: $FMSDECODE_BIN"
+    mkdir -p "$TOOLS_BIN_DIR"
+    c++ -std=c++17 -O2 -I"$SCRIPT_DIR/include" -o "$FMSDECODE_BIN" "$src" || error_exit "Failed to build host decoder"
+}
+
 # ============================================================================
 # MONITORING FUNCTIONS
 # ============================================================================
 
+# Serial stream from the device on stdout. "raw" keeps every byte (binary
+# formats); a compressed stream is always read raw and expanded here.
+read_device() {
+    local env="$1"
+    local mode="$2"
+
+    if [ "$COMPRESS_MODE" = "true" ]; then
+        $PLATFORMIO_BIN device monitor --no-reconnect --quiet -e "$env" --raw | "$FMSDECODE_BIN" unz
+    elif [ "$mode" = "raw" ]; then
+        $PLATFORMIO_BIN device monitor --no-reconnect --quiet -e "$env" --raw
+    else
+        $PLATFORMIO_BIN device monitor --no-reconnect --quiet -e "$env" --filter printable
+    fi
+}
+
+# Loss report for a finished capture (fmsdecode verify), saved next to it.
+# pcap goes to pcapng files, which the tool does not read back: check a raw
+# pcap stream by hand with "fmsdecode verify pcap".
+verify_capture() {
+    local format="$1"
+    local log_file="$2"
+    local report="${log_file}.verify"
+
+    [ "$format" = "pcap" ] && return 0
+    [ -s "$log_file" ] || return 0
+    if [ ! -x "$FMSDECODE_BIN" ] && ! command -v c++ >/dev/null 2>&1; then
+        info "No host decoder to check the capture; later run: tools/bin/fmsdecode verify $format < $log_file"
+        return 0
+    fi
+    build_host_tools
+
+    echo
+    echo "=== Checking capture (seq/crc) ==="
+    "$FMSDECODE_BIN" verify "$format" < "$log_file" | tee "$report"
+    info "Loss report: $report"
+}
+
 # Setup and start log monitoring
 start_monitoring() {
     local env="$1"
@@ -722,19 +821,83 @@ start_monitoring() {
     info "MIN_RSSI: $min_rssi"
     info "Manufacturers: $manufacturers"
     info "Log file: $log_file"
+    [ "$COMPRESS_MODE" = "true" ] && info "Compression: on (expanded on the host)"
     echo
 
+    [ "$COMPRESS_MODE" = "true" ] && build_host_tools
+
+    # Ctrl+C ends the capture, not the script, so the check below still runs
+    trap 'echo' INT
+    capture_to_log "$env" "$format" "$log_file" "$timestamp"
+    trap - INT
+    verify_capture "$format" "$log_file"
+}
+
+# Device output into the log file (or pcapng files), until Ctrl+C
+capture_to_log() {
+    local env="$1"
+    local format="$2"
+    local log_file="$3"
+    local timestamp="$4"
+
+    # pcap: rolling pcapng files in the logs directory, or a live pipe
+    if [ "$format" = "pcap" ]; then
+        build_host_tools
+        echo "Press Ctrl+C to stop capturing"
+        echo
+        if [ -n "$WIRESHARK_FIFO" ]; then
+            info "Serving live capture on $WIRESHARK_FIFO (wireshark -k -i $WIRESHARK_FIFO)"
+            read_device "$env" raw | "$FMSDECODE_BIN" pcap --fifo "$WIRESHARK_FIFO"
+        else
+            info "Writing rolling pcapng files: $LOGS_DIR/${env}-${timestamp}-*.pcapng"
+            read_device "$env" raw | "$FMSDECODE_BIN" pcap --out "$LOGS_DIR/${env}-${timestamp}"
+        fi
+        return
+    fi
+
+    # Binary formats: keep the raw stream in the log file, show it decoded
+    if is_binary_format "$format"; then
+        build_host_tools
+        if [ "$QUIET_MODE" = "true" ]; then
+            info "Quiet mode - raw $format saved to file only"
+            echo "Press Ctrl+C to stop monitoring"
+            echo
+            read_device "$env" raw > "$log_file"
+        else
+            info "Raw $format saved to file, decoded CSV displayed on terminal"
+            echo "Press Ctrl+C to stop monitoring"
+            echo
+            read_device "$env" raw | tee "$log_file" | "$FMSDECODE_BIN" "$format" csv
+        fi
+        return
+    fi
+
+    # Compact text: keep it in the log file, expand it to a full CSV next to it
+    if [ "$format" = "compact" ]; then
+        build_host_tools
+        local csv_file="${log_file%.compact}.csv"
+        info "Expanded CSV: $csv_file"
+        echo "Press Ctrl+C to stop monitoring"
+        echo
+        if [ "$QUIET_MODE" = "true" ]; then
+            read_device "$env" printable | tee "$log_file" | "$FMSDECODE_BIN" expand csv > "$csv_file"
+        else
+            read_device "$env" printable | tee "$log_file" | "$FMSDECODE_BIN" expand csv | tee "$csv_file"
+        fi
+        return
+    fi
+
     # Start monitoring based on quiet mode
     if [ "$QUIET_MODE" = "true" ]; then
         info "Quiet mode - logs saved to file only"
         echo "Press Ctrl+C to stop monitoring"
         echo
-        $PLATFORMIO_BIN device monitor --no-reconnect --quiet -e "$env" --filter printable > "$log_file"
+        read_device "$env" printable > "$log_file"
     else
         info "Logs displayed on terminal and saved to file"
         echo "Press Ctrl+C to stop monitoring"
         echo
-        $PLATFORMIO_BIN device monitor --no-reconnect --quiet -e "$env" --filter printable | tee "$log_file"
+        read_device "$env" printable | tee "$log_file"
     fi
 }
 
@@ -754,6 +917,15 @@ process_arguments() {
                 QUIET_MODE=true
                 shift
                 ;;
+            --compress)
+                COMPRESS_MODE=true
+                shift
+                ;;
+            --wireshark-fifo=*)
+                WIRESHARK_FIFO="${1#--wireshark-fifo=}"
+                [ -n "$WIRESHARK_FIFO" ] || error_exit "--wireshark-fifo requires a path"
+                shift
+                ;;
             --env)
                 if [ -n "${2:-}" ] && [ "${2#--}" = "$2" ]; then
                     SELECTED_ENV="$2"
@@ -768,10 +940,10 @@ process_arguments() {
                         SELECTED_FORMAT="$2"
                         shift 2
                     else
-                        error_exit "--format must be one of: log, csv, yaml"
+                        error_exit "--format must be one of: log, csv, yaml, jsonl, cbor, pcap, delta, compact"
                     fi
                 else
-                    error_exit "--format requires a value (log, csv, or yaml)"
+                    error_exit "--format requires a value (log, csv, yaml, jsonl, cbor, pcap, delta, or compact)"
                 fi
                 ;;
             --min-rssi=*)
@@ -1,27 +1,47 @@
 #include <Arduino.h>
 #include <NimBLEDevice.h>
+#include <Preferences.h>
 #include <cstdio>
 #include <cstdint>
 #include <string>
 #include <vector>
 #include <cctype>
+#include <atomic>
 #include <time.h>
 #include <esp_system.h>
+#include <esp_heap_caps.h>
+#if defined(CONFIG_NIMBLE_CPP_IDF)
+  #include "nimble/nimble_port.h"
+#else
+  #include "nimble/porting/nimble/include/nimble/nimble_port.h"
+#endif
+
+#include "ble_ids.h"
+#include "device_record.h"
+#include "find_my_match.h"
+#include "follow_detector.h"
+#include "load_shedder.h"
+#include "match_rules.h"
+#include "output_channel.h"
+#include "rate_limiter.h"
+#include "raw_capture.h"
+#include "record_queue.h"
+#include "rotation_linker.h"
+#include "scan_merge.h"
+#include "scan_scheduler.h"
+#include "scan_supervisor.h"
+#include "signature_scan.h"
+#include "type_discovery.h"
 
 #ifdef CONFIG_IDF_TARGET_ESP32S3
   #include <Adafruit_NeoPixel.h>
 #endif
 
-// Output format options:
-enum class OutputFormat {
-  LOG,   // Human-readable log format (default)
-  CSV,   // Comma-separated values
-  YAML   // YAML format
-};
-
 // Output format configuration (can be set via build flags)
+// This is the format of the primary channel (Serial) at boot; it can be
+// changed at runtime with the "format" serial command.
 #ifndef OUTPUT_FORMAT_FLAG
-  #define OUTPUT_FORMAT_FLAG 0  // Default: LOG (0=LOG, 1=CSV, 2=YAML)
+  #define OUTPUT_FORMAT_FLAG 0  // Default: LOG (0=LOG, 1=CSV, 2=YAML, 3=JSONL, 4=CBOR, 5=PCAP, 6=DELTA, 7=COMPACT)
 #endif
 
 #if OUTPUT_FORMAT_FLAG == 0
@@ -30,10 +50,74 @@ enum class OutputFormat {
   constexpr OutputFormat OUTPUT_FORMAT = OutputFormat::CSV;
 #elif OUTPUT_FORMAT_FLAG == 2
   constexpr OutputFormat OUTPUT_FORMAT = OutputFormat::YAML;
+#elif OUTPUT_FORMAT_FLAG == 3
+  constexpr OutputFormat OUTPUT_FORMAT = OutputFormat::JSONL;
+#elif OUTPUT_FORMAT_FLAG == 4
+  constexpr OutputFormat OUTPUT_FORMAT = OutputFormat::CBOR;
+#elif OUTPUT_FORMAT_FLAG == 5
+  constexpr OutputFormat OUTPUT_FORMAT = OutputFormat::PCAP;
+#elif OUTPUT_FORMAT_FLAG == 6
+  constexpr OutputFormat OUTPUT_FORMAT = OutputFormat::DELTA;
+#elif OUTPUT_FORMAT_FLAG == 7
+  constexpr OutputFormat OUTPUT_FORMAT = OutputFormat::COMPACT;
 #else
   constexpr OutputFormat OUTPUT_FORMAT = OutputFormat::LOG;
 #endif
 
+// Auxiliary output channel (second UART), e.g. a human-readable LOG on a
+// debug header while a parser reads CSV on USB. Disabled by default.
+//   -DAUX_FORMAT_FLAG=0       (0=LOG, 1=CSV, 2=YAML, 3=JSONL, 4=CBOR, 5=PCAP, 6=DELTA, 7=COMPACT, -1=disabled)
+//   -DAUX_TX_PIN_FLAG=17      (UART1 TX pin)
+//   -DAUX_BAUD_FLAG=115200
+#ifndef AUX_FORMAT_FLAG
+  #define AUX_FORMAT_FLAG -1
+#endif
+#ifndef AUX_TX_PIN_FLAG
+  #define AUX_TX_PIN_FLAG 17
+#endif
+#ifndef AUX_BAUD_FLAG
+  #define AUX_BAUD_FLAG 115200
+#endif
+constexpr int AUX_FORMAT = AUX_FORMAT_FLAG;
+
+// Field projection for LOG, CSV, YAML, JSONL and CBOR: FieldBit mask (see
+// field_mask.h), e.g. 0xC1B = time, vendor, addr, rssi, seq, crc. Default:
+// the original columns plus seq and crc (0xFFF). seq (0x400) and crc (0x800) are record checks for loss accounting
+// on the host (fmsdecode verify); every format carries them when set. fold
+// (0x1000) is the rate limiter's count of folded sightings and their RSSI range,
+// written only for records that have some. phy (0x2000) is the PHY and advertising SID of extended advertising reports.
+// decoded (0x4000) is the vendor fields decoded from the data (battery,
+// separation, state, counter, key hint) as numbers; with it, "data" can go.
+// fold, phy and decoded are opt-in: each adds CSV columns.
+// Runtime: "fields time,vendor,addr,rssi,seq,crc" / "auxfields all"
+#ifndef FIELDS_FLAG
+  #define FIELDS_FLAG 0x0FFF
+#endif
+constexpr uint16_t FIELDS = FIELDS_FLAG & FIELDS_ALL;
+
+// PCAP channels: capture every received advertisement instead of only the
+// matched Find My ones (0 = matched only, 1 = all). Runtime: "pcap all|matched"
+#ifndef PCAP_ALL_FLAG
+  #define PCAP_ALL_FLAG 0
+#endif
+
+// Stream compression on the primary channel (0 = off, 1 = on). Output is
+// batched into LZSS frames every COMPRESS_BATCH_MS_FLAG ms; decode on the host
+// with "fmsdecode unz". Runtime: "compress on|off"
+#ifndef COMPRESS_FLAG
+  #define COMPRESS_FLAG 0
+#endif
+#ifndef COMPRESS_BATCH_MS_FLAG
+  #define COMPRESS_BATCH_MS_FLAG 250
+#endif
+constexpr uint32_t COMPRESS_BATCH_MS = COMPRESS_BATCH_MS_FLAG;
+
+// Periodic stats event on every channel, in ms (0 = disabled)
+#ifndef STATS_INTERVAL_FLAG
+  #define STATS_INTERVAL_FLAG 0
+#endif
+constexpr uint32_t STATS_INTERVAL_MS = STATS_INTERVAL_FLAG;
+
 // RSSI filter (minimum signal strength to process devices)
 // Can be set via build flags, default is -200
 #ifndef MIN_RSSI_FLAG
@@ -41,6 +125,188 @@ enum class OutputFormat {
 #endif
 constexpr int MIN_RSSI = MIN_RSSI_FLAG;
 
+// Records wait in a queue between the scan callback and the serial writer.
+// When it fills up, load shedding (load_shedder.h) raises the RSSI floor and
+// samples repeat sightings; new devices and payload changes always pass.
+//   -DQUEUE_DEPTH_FLAG=64     (power of two)
+//   -DLOAD_SHEDDING_FLAG=0    (0 = off: records are only dropped when the queue is full; 1 = on)
+#ifndef QUEUE_DEPTH_FLAG
+  #define QUEUE_DEPTH_FLAG 64
+#endif
+#ifndef LOAD_SHEDDING_FLAG
+  #define LOAD_SHEDDING_FLAG 0
+#endif
+
+// Per-device rate limit (rate_limiter.h): at most one record per interval
+// per device on average, in bursts of up to RATE_BURST_FLAG. Sightings in
+// between are folded into the device's next record. Interval in ms per
+// vendor, 0 = unlimited (the default for all). Runtime: "rate google 250 [burst]", "rate all 0"
+#ifndef RATE_APPLE_MS_FLAG
+  #define RATE_APPLE_MS_FLAG 0
+#endif
+#ifndef RATE_GOOGLE_MS_FLAG
+  #define RATE_GOOGLE_MS_FLAG 0
+#endif
+#ifndef RATE_SAMSUNG_MS_FLAG
+  #define RATE_SAMSUNG_MS_FLAG 0
+#endif
+#ifndef RATE_XIAOMI_MS_FLAG
+  #define RATE_XIAOMI_MS_FLAG 0
+#endif
+#ifndef RATE_OTHER_MS_FLAG
+  #define RATE_OTHER_MS_FLAG 0     // unmatched reports for raw capture
+#endif
+#ifndef RATE_BURST_FLAG
+  #define RATE_BURST_FLAG 3
+#endif
+// Controller duplicate filter (0 = off: every report crosses HCI to the host,
+// 1 = on). The controller filters on address and advertising data, so address
+// rotations and payload changes still get through; the scan is restarted
+// every DUP_WINDOW_MS_FLAG ms to clear its cache, so a device is re-reported
+// at least that often. Runtime: "dupfilter on|off|<window ms>"
+#ifndef DUP_FILTER_FLAG
+  #define DUP_FILTER_FLAG 0
+#endif
+#ifndef DUP_WINDOW_MS_FLAG
+  #define DUP_WINDOW_MS_FLAG 10000
+#endif
+
+// Adaptive scan duty cycle (scan_scheduler.h): interval, window and active
+// scanning follow the match rate, new devices and queue pressure within a
+// budget. SCAN_ADAPTIVE_FLAG=0 (the default) keeps the fixed 50 ms / 43.75 ms
+// scan; 1 turns the plan on.
+//   -DSCAN_MAX_DUTY_FLAG=100          (highest duty cycle, %)
+//   -DSCAN_MAX_CPU_PERMILLE_FLAG=300  (scan callback share of one core)
+//   -DSCAN_ACTIVE_FLAG=0              (scan requests: 0 = never, 1 = while new devices
+//                                      show up, 2 = always)
+//   -DSCAN_RSP_TIMEOUT_MS_FLAG=100    (how long an advertisement waits for its scan response)
+#ifndef SCAN_ADAPTIVE_FLAG
+  #define SCAN_ADAPTIVE_FLAG 0
+#endif
+#ifndef SCAN_MAX_DUTY_FLAG
+  #define SCAN_MAX_DUTY_FLAG 100
+#endif
+#ifndef SCAN_MAX_CPU_PERMILLE_FLAG
+  #define SCAN_MAX_CPU_PERMILLE_FLAG 300
+#endif
+#ifndef SCAN_ACTIVE_FLAG
+  #define SCAN_ACTIVE_FLAG 0
+#endif
+#ifndef SCAN_RSP_TIMEOUT_MS_FLAG
+  #define SCAN_RSP_TIMEOUT_MS_FLAG 100
+#endif
+constexpr ScanBudget SCAN_BUDGET = { SCAN_MAX_DUTY_FLAG, SCAN_MAX_CPU_PERMILLE_FLAG, (ScanActive)SCAN_ACTIVE_FLAG };
+
+// Scan supervisor (scan_supervisor.h): restarts a scan NimBLE stopped, or one
+// with no reports for SCAN_STALL_MS_FLAG (0 = only stopped scans), retrying
+// with backoff from SCAN_RETRY_MIN_MS_FLAG up to SCAN_RETRY_MAX_MS_FLAG
+#ifndef SCAN_STALL_MS_FLAG
+  #define SCAN_STALL_MS_FLAG 30000
+#endif
+#ifndef SCAN_RETRY_MIN_MS_FLAG
+  #define SCAN_RETRY_MIN_MS_FLAG 1000
+#endif
+#ifndef SCAN_RETRY_MAX_MS_FLAG
+  #define SCAN_RETRY_MAX_MS_FLAG 60000
+#endif
+
+// Signature scan research mode (signature_scan.h): every report's whole
+// payload is searched for a set of byte signatures, and a report with hits
+// goes out as a "sig" event besides its normal record. 0 leaves it out of the
+// build; 1 builds it in, on at boot with the Find My signatures.
+// Runtime: "sig on|off|clear", "sig add <label> <hex>", "sig del <label>"
+#ifndef SIG_SCAN_FLAG
+  #define SIG_SCAN_FLAG 0
+#endif
+
+// Raw capture (raw_capture.h): every report that passes the capture's own
+// prefilter, before classification, as binary batch frames on the primary
+// channel, between its records. The reports wait in a ring of
+// RAW_CAPTURE_KB_FLAG KB in PSRAM, or of RAW_CAPTURE_INTERNAL_KB_FLAG KB in
+// internal RAM without PSRAM, taken on first use. RAW_CAPTURE_FLAG is the mode at boot: 0 = off, 1 = stream
+// (sent as they come), 2 = store (kept until "capture dump").
+// Runtime: "capture on|store|dump|off", "capture rssi -80",
+// "capture cid 004C,00E0", "capture addr 0,1" ("any" clears a filter)
+#ifndef RAW_CAPTURE_FLAG
+  #define RAW_CAPTURE_FLAG 0
+#endif
+#ifndef RAW_CAPTURE_KB_FLAG
+  #define RAW_CAPTURE_KB_FLAG 1024
+#endif
+#ifndef RAW_CAPTURE_INTERNAL_KB_FLAG
+  #define RAW_CAPTURE_INTERNAL_KB_FLAG 24
+#endif
+
+// Unknown-type discovery (type_discovery.h): AD structures the classifiers do
+// not recognise, counted by (CID or service UUID, type byte, length bucket).
+// Each new tuple goes out once as a "discover" event with a sample, and the
+// top tuples with their counts every DISCOVERY_REPORT_MS_FLAG ms as
+// "discover_top" (0 = only on "discover top"). DISCOVERY_FLAG is the scope at
+// boot: 0 = off (default), 1 = the Find My vendors' manufacturer data and all service
+// data, 2 = manufacturer data of any company too.
+// Runtime: "discover off|vendors|all|top", "discover reset" (counts),
+// "discover forget" (counts and the tuples already reported)
+#ifndef DISCOVERY_FLAG
+  #define DISCOVERY_FLAG 0
+#endif
+#ifndef DISCOVERY_REPORT_MS_FLAG
+  #define DISCOVERY_REPORT_MS_FLAG 60000
+#endif
+
+// Address rotation linking (rotation_linker.h): a matched address that
+// appears just as one of the same vendor and type goes quiet is scored as its
+// successor, and a "link" event (with the confidence, 0-100) reports a pair
+// that scores LINK_MIN_CONFIDENCE_FLAG or more. LINK_FLAG: 1 = on at boot,
+// 0 = off until "link on".
+// Runtime: "link on|off|reset", "link min 75"
+#ifndef LINK_FLAG
+  #define LINK_FLAG 0
+#endif
+#ifndef LINK_MIN_CONFIDENCE_FLAG
+  #define LINK_MIN_CONFIDENCE_FLAG 60
+#endif
+
+// Following-tracker detection (follow_detector.h): a matched tag heard for
+// FOLLOW_MIN_MINUTES_FLAG minutes, in FOLLOW_MIN_COVERAGE_FLAG percent of
+// them and never missing for more than FOLLOW_MAX_GAP_MIN_FLAG minutes,
+// raises one "follow" event (priority high). While linking is on, a tag keeps
+// its history across address rotations. FOLLOW_MIN_OTHERS_FLAG other tags
+// must have appeared meanwhile (0 = any); FOLLOW_NEAR_OWNER_FLAG 1 also
+// alerts on tags that say they are with their owner. FOLLOW_TAGS_FLAG tags
+// are tracked, about 56 bytes each. FOLLOW_FLAG: 1 = on at boot, 0 = off
+// until "follow on".
+// Runtime: "follow on|off|reset|list", "follow minutes 20", "follow coverage 80",
+// "follow gap 5", "follow others 10", "follow owner on|off"
+#ifndef FOLLOW_FLAG
+  #define FOLLOW_FLAG 0
+#endif
+#ifndef FOLLOW_TAGS_FLAG
+  #define FOLLOW_TAGS_FLAG 1024
+#endif
+#ifndef FOLLOW_MIN_MINUTES_FLAG
+  #define FOLLOW_MIN_MINUTES_FLAG 20
+#endif
+#ifndef FOLLOW_MIN_COVERAGE_FLAG
+  #define FOLLOW_MIN_COVERAGE_FLAG 80
+#endif
+#ifndef FOLLOW_MAX_GAP_MIN_FLAG
+  #define FOLLOW_MAX_GAP_MIN_FLAG 5
+#endif
+#ifndef FOLLOW_MIN_OTHERS_FLAG
+  #define FOLLOW_MIN_OTHERS_FLAG 0
+#endif
+#ifndef FOLLOW_NEAR_OWNER_FLAG
+  #define FOLLOW_NEAR_OWNER_FLAG 0
+#endif
+
+static const RateLimit RATE_LIMITS[RATE_VENDOR_COUNT] = {
+  { RATE_APPLE_MS_FLAG,   RATE_BURST_FLAG },
+  { RATE_GOOGLE_MS_FLAG,  RATE_BURST_FLAG },
+  { RATE_SAMSUNG_MS_FLAG, RATE_BURST_FLAG },
+  { RATE_XIAOMI_MS_FLAG,  RATE_BURST_FLAG },
+  { RATE_OTHER_MS_FLAG,   RATE_BURST_FLAG },
+};
+
 // Manufacturer filter configuration (can be set via build flags)
 // Bit mask for individual manufacturers:
 //   0x1 = Apple    (bit 0)
@@ -91,190 +357,12 @@ constexpr int MIN_RSSI = MIN_RSSI_FLAG;
   Adafruit_NeoPixel neoPixel(WS2812_COUNT, WS2812_PIN, NEO_GRB + NEO_KHZ800);
 #endif
 
-// Company IDs (Bluetooth SIG) — little endian in manufacturer data bytes
-constexpr uint16_t CID_APPLE   = 0x004C;
-constexpr uint16_t CID_GOOGLE  = 0x00E0;
-constexpr uint16_t CID_SAMSUNG = 0x0075;
-constexpr uint16_t CID_XIAOMI  = 0x038F;
-
-// Service UUIDs for Find My devices
-constexpr uint16_t SVC_GOOGLE_FAST_PAIR  = 0xFEF3; // Google Fast Pair
-constexpr uint16_t SVC_APPLE_FIND_MY     = 0xFD6F; // Apple Find My
-constexpr uint16_t SVC_SAMSUNG_FIND      = 0xFD5A; // Samsung Find
-
 // Filter by Manufacturer type (controlled by MANUFACTURES_FLAG):
 constexpr bool FILTER_APPLE   = (MANUFACTURES_FLAG & 0x1) != 0;  // Apple (AirTag, Find My)
 constexpr bool FILTER_GOOGLE  = (MANUFACTURES_FLAG & 0x2) != 0;  // Google (Fast Pair)
 constexpr bool FILTER_SAMSUNG = (MANUFACTURES_FLAG & 0x4) != 0;  // Samsung (SmartTag)
 constexpr bool FILTER_XIAOMI  = (MANUFACTURES_FLAG & 0x8) != 0;  // Xiaomi (Anti-Lost)
 
-// --------- Helpers ---------
-static inline const char* advTypeName(uint8_t t) {
-  switch (t) {
-    case 0: return  "ADV_IND";
-    case 1: return  "DIR_IND";
-    case 2: return  "SCAN_IND";
-    case 3: return  "NONCONN";
-    case 4: return  "SCAN_RSP";
-    default: return "UNKNOWN";
-  }
-}
-
-static std::string toHex(const uint8_t* data, size_t len) {
-  static const char* hex = "0123456789ABCDEF";
-  std::string out;
-  out.reserve(len * 3);
-  for (size_t i = 0; i < len; ++i) {
-    uint8_t b = data[i];
-    out.push_back(hex[(b >> 4) & 0xF]);
-    out.push_back(hex[b & 0xF]);
-    if (i + 1 < len) out.push_back(' ');
-  }
-  return out;
-}
-
-static uint16_t parseCompanyIdLE(const std::string& mfd) {
-  if (mfd.size() < 2) return 0xFFFF;
-  // Manufacturer specific data: First 2 bytes = CompanyID in Little Endian
-  return (uint16_t)((uint8_t)mfd[0] | ((uint16_t)(uint8_t)mfd[1] << 8));
-}
-
-static const char* companyName(uint16_t cid) {
-  switch (cid) {
-    case CID_APPLE:   return "Apple";
-    case CID_GOOGLE:  return "Google";
-    case CID_SAMSUNG: return "Samsung";
-    case CID_XIAOMI:  return "Xiaomi";
-    default:          return "Other";
-  }
-}
-
-// Converts Service UUID to Manufacturer
-static uint16_t serviceToManufacturer(uint16_t serviceUuid) {
-  switch (serviceUuid) {
-    case SVC_GOOGLE_FAST_PAIR: return CID_GOOGLE;
-    case SVC_APPLE_FIND_MY:    return CID_APPLE;
-    case SVC_SAMSUNG_FIND:     return CID_SAMSUNG;
-    default:                   return 0xFFFF;
-  }
-}
-
-// Detects "Find My" based on service data
-static bool isFindMyServiceData(uint16_t serviceUuid, const std::string& serviceData) {
-  switch (serviceUuid) {
-    case SVC_GOOGLE_FAST_PAIR:
-      // Google Fast Pair service data
-      return serviceData.size() >= 3;
-
-    case SVC_APPLE_FIND_MY:
-      // Apple Find My service data
-      return serviceData.size() >= 6;
-
-    case SVC_SAMSUNG_FIND:
-      // Samsung Find service data
-      return serviceData.size() >= 4;
-
-    default:
-      return false;
-  }
-}
-
-static const char* getServiceFindMyType(uint16_t serviceUuid, const std::string& serviceData) {
-  switch (serviceUuid) {
-    case SVC_GOOGLE_FAST_PAIR:
-      if (serviceData.size() >= 1) {
-        uint8_t type = (uint8_t)serviceData[0];
-        switch (type) {
-          case 0x11: return "FastPair/FindDevice";
-          case 0x10: return "FastPair/Generic";
-          default: return   "FastPair/Unknown";
-        }
-      }
-      return "FastPair";
-
-    case SVC_APPLE_FIND_MY:
-      return "FindMy/Service";
-
-    case SVC_SAMSUNG_FIND:
-      return "SmartTag/Service";
-
-    default:
-      return "Service/Unknown";
-  }
-}
-
-// Check if it's a manufacturer-specific "Find My" ad
-static bool isFindMyDevice(uint16_t cid, const std::string& mfd) {
-  if (mfd.size() < 4) return false;
-
-  switch (cid) {
-    case CID_APPLE:
-      // Apple Find My/AirTag: type 0x12 or 0x10
-      // Format: [CID_LOW, CID_HIGH, TYPE, ...data...]
-      return (mfd.size() >= 3 && ((uint8_t)mfd[2] == 0x12 || (uint8_t)mfd[2] == 0x10));
-
-    case CID_GOOGLE:
-      // Google Find My Device/Fast Pair
-      return (mfd.size() >= 3 && (uint8_t)mfd[2] == 0x06);
-
-    case CID_SAMSUNG:
-      // Samsung SmartTag uses specific types of manufacturer data
-      return (mfd.size() >= 4 && ((uint8_t)mfd[2] == 0x01 || (uint8_t)mfd[2] == 0x02 || (uint8_t)mfd[2] == 0x42));
-
-    case CID_XIAOMI:
-      // Xiaomi devices: multiple ad types
-      return (mfd.size() >= 3 &&
-              ((uint8_t)mfd[2] == 0x30 ||  // Anti-Lost original
-               (uint8_t)mfd[2] == 0x23 ||  // Mi-Device/Tracker
-               (uint8_t)mfd[2] == 0x20 ||  // Mi-Tag
-               (uint8_t)mfd[2] == 0x10));  // Generic Mi-Device
-
-    default:
-      return false;
-  }
-}
-
-static const char* getFindMyType(uint16_t cid, const std::string& mfd) {
-  if (mfd.size() < 3) return "Unknown";
-
-  uint8_t type = (uint8_t)mfd[2];
-
-  switch (cid) {
-    case CID_APPLE:
-      switch (type) {
-        case 0x12: return "FindMy/AirTag";
-        case 0x10: return "FindMy/Offline";
-        default: return "FindMy/Other";
-      }
-
-    case CID_GOOGLE:
-      switch (type) {
-        case 0x06: return "FastPair/FindMy";
-        default: return "FindMy/Other";
-      }
-
-    case CID_SAMSUNG:
-      switch (type) {
-        case 0x01: return "SmartTag";
-        case 0x02: return "SmartTag+";
-        case 0x42: return "SmartTag-Pro";
-        default: return "SmartTag/Other";
-      }
-
-    case CID_XIAOMI:
-      switch (type) {
-        case 0x30: return "Anti-Lost";
-        case 0x23: return "Mi-Tracker";
-        case 0x20: return "Mi-Tag";
-        case 0x10: return "Mi-Device";
-        default: return "FindMy/Other";
-      }
-
-    default:
-      return "Unknown";
-  }
-}
-
 // --------- Apply filter ---------
 static bool isManufacturerEnabled(uint16_t cid) {
   switch (cid) {
@@ -286,13 +374,21 @@ static bool isManufacturerEnabled(uint16_t cid) {
   }
 }
 
-static void printFilterStatus() {
-  Serial.println("\n=== Filter by Manufacturer ===");
-  Serial.printf("Apple:   %s\n", FILTER_APPLE ? "ENABLED" : "DISABLED");
-  Serial.printf("Google:  %s\n", FILTER_GOOGLE ? "ENABLED" : "DISABLED");
-  Serial.printf("Samsung: %s\n", FILTER_SAMSUNG ? "ENABLED" : "DISABLED");
-  Serial.printf("Xiaomi:  %s\n", FILTER_XIAOMI ? "ENABLED" : "DISABLED");
-  Serial.println("============================\n");
+// Same bytes as the Serial.println/printf banner it replaced
+static void printFilterStatus(OutputChannel& channel) {
+  char text[192];
+  snprintf(text, sizeof(text),
+           "\n=== Filter by Manufacturer ===\r\n"
+           "Apple:   %s\n"
+           "Google:  %s\n"
+           "Samsung: %s\n"
+           "Xiaomi:  %s\n"
+           "============================\n\r\n",
+           FILTER_APPLE ? "ENABLED" : "DISABLED",
+           FILTER_GOOGLE ? "ENABLED" : "DISABLED",
+           FILTER_SAMSUNG ? "ENABLED" : "DISABLED",
+           FILTER_XIAOMI ? "ENABLED" : "DISABLED");
+  channel.print(text);
 }
 
 // Feedback visual para erros usando LED built-in.
@@ -337,213 +433,912 @@ static void signalSuccess() {
 #endif
 }
 
-// Função helper para obter timestamp formatado
-static std::string getCurrentTimestamp() {
-  struct timeval tv;
-  struct tm timeinfo;
-  char timeString[32];
+// --------- Output ---------
+static void serialSink(void*, const uint8_t* data, size_t len) {
+  Serial.write(data, len);
+}
 
-  gettimeofday(&tv, nullptr);
-  localtime_r(&tv.tv_sec, &timeinfo);
+static void auxSink(void*, const uint8_t* data, size_t len) {
+  Serial1.write(data, len);
+}
+
+// Primary channel on Serial, auxiliary channel on UART1
+static OutputChannel primaryOutput;
+static OutputChannel auxOutput;
+static bool auxUartStarted = false;
+
+// UART1 starts with the first format the auxiliary channel gets, at boot
+// (AUX_FORMAT_FLAG) or from "aux <format>"
+static void selectAuxFormat(const FormatOps* format) {
+  if (auxUartStarted) {
+    auxOutput.select(format);
+    return;
+  }
+  if (format == nullptr) return;
+  Serial1.begin(AUX_BAUD_FLAG, SERIAL_8N1, -1, AUX_TX_PIN_FLAG);
+  auxUartStarted = true;
+  auxOutput.begin(format, OutputSink{ auxSink, nullptr });
+}
+
+static std::atomic<bool> captureAllAdvertisements{PCAP_ALL_FLAG != 0};
+
+// Extended advertising (CONFIG_BT_NIMBLE_EXT_ADV, the esp32-s3 env) carries
+// up to 255 bytes per report; legacy scanning up to an advertisement and its
+// scan response
+#if CONFIG_BT_NIMBLE_EXT_ADV
+constexpr size_t RECORD_PAYLOAD_MAX = EXTENDED_PAYLOAD_MAX;
+#else
+constexpr size_t RECORD_PAYLOAD_MAX = LEGACY_PAYLOAD_MAX;
+#endif
+
+// Filled by the scan callback (NimBLE host task), drained by loop()
+static RecordQueue<QUEUE_DEPTH_FLAG, RECORD_PAYLOAD_MAX> recordQueue;
+static LoadShedder loadShedder(MIN_RSSI, LOAD_SHEDDING_FLAG != 0);
+static RateLimiter rateLimiter(RATE_LIMITS);
+static ScanMerger scanMerger(SCAN_RSP_TIMEOUT_MS_FLAG);
+
+// Double-buffered tables the scan callback reads (rules, signatures): loop()
+// rebuilds the slot not in use and swaps it in. A callback that picked up
+// that slot before the last swap may still be reading it, so the host task
+// bumps scanReadEpoch on entry and exit (odd while inside), and loop() waits
+// for an odd epoch to move on before it reuses a slot.
+static std::atomic<uint32_t> scanReadEpoch{0};
+
+struct ScanReadGuard {
+  ScanReadGuard() { scanReadEpoch.fetch_add(1); }
+  ~ScanReadGuard() { scanReadEpoch.fetch_add(1); }
+};
+
+// At most one report's handling on the single host task
+static void waitForScanReaders() {
+  const uint32_t epoch = scanReadEpoch.load();
+  if ((epoch & 1) == 0) return;
+  while (scanReadEpoch.load() == epoch) delay(1);
+}
 
-  // Formato: YYYY-MM-DD HH:MM:SS.mmm
-  snprintf(timeString, sizeof(timeString), "%04d-%02d-%02d %02d:%02d:%02d.%03ld",
-           timeinfo.tm_year + 1900,
-           timeinfo.tm_mon + 1,
-           timeinfo.tm_mday,
-           timeinfo.tm_hour,
-           timeinfo.tm_min,
-           timeinfo.tm_sec,
-           tv.tv_usec / 1000);
+// Match rules (match_rules.h); nullptr = the built-in classifier. A program
+// is loaded into the slot not in use, then swapped in, so the scan callback
+// never sees one half-written.
+static RuleProgram rulePrograms[2];
+static LabelPool<RULES_LABEL_POOL> ruleLabels;
+static std::atomic<const RuleProgram*> activeRules{nullptr};
+
+// Raw capture; the ring's storage is allocated by the first "capture" mode
+enum class RawMode : uint8_t { OFF, STREAM, STORE };
+static RawCapture<RECORD_PAYLOAD_MAX> rawCapture;
+static std::atomic<bool> rawCapturing{false};
+static RawMode rawMode = RawMode::OFF;
+static bool rawDumping = false;     // sending what store mode kept
+
+#if SIG_SCAN_FLAG
+// Signature scan: loop() owns the set and compiles it into the matcher not
+// in use, then swaps it in, as for rules
+static SignatureSet signatures;
+static SignatureMatcher signatureMatchers[2];
+static std::atomic<const SignatureMatcher*> activeSignatures{nullptr};
+static std::atomic<bool> signatureScan{true};
+static SignatureQueue<8, RECORD_PAYLOAD_MAX> signatureHits;
+static std::atomic<uint32_t> signatureHitReports{0};
+#endif
 
-  return std::string(timeString);
+// Unknown-type discovery: the sketch, and a sample of each new tuple on its
+// way to loop() (data = the unclassified AD structure)
+static TypeDiscovery typeDiscovery;
+static std::atomic<uint8_t> discoveryScope{DISCOVERY_FLAG};
+static RecordQueue<4, RECORD_PAYLOAD_MAX> discoverySamples;
+
+// Rotation linker; used from loop() only
+static RotationLinker rotationLinker;
+static bool rotationLinking = LINK_FLAG != 0;
+
+// Following detection; used from loop() only
+static FollowDetector<FOLLOW_TAGS_FLAG> followDetector(FollowThresholds{
+  FOLLOW_MIN_MINUTES_FLAG, FOLLOW_MIN_COVERAGE_FLAG, FOLLOW_MAX_GAP_MIN_FLAG, FOLLOW_MIN_OTHERS_FLAG,
+  FOLLOW_NEAR_OWNER_FLAG != 0 });
+static bool followDetection = FOLLOW_FLAG != 0;
+
+// Duplicate filter state; changed by the "dupfilter" command
+static bool duplicateFilter = DUP_FILTER_FLAG != 0;
+static uint32_t duplicateWindowMs = DUP_WINDOW_MS_FLAG;
+constexpr uint8_t SCAN_DUPL_TYPE_DATA_DEVICE = 2;     // filter on address and data
+
+// Scan settings in force; loop() replans every SCAN_PLAN_PERIOD_MS
+static ScanPlan scanPlan = SCAN_PLAN_START;
+static uint32_t scanChanges = 0;
+static ScanSupervisor scanSupervisor(SCAN_STALL_MS_FLAG, SCAN_RETRY_MIN_MS_FLAG, SCAN_RETRY_MAX_MS_FLAG);
+static std::atomic<int> scanEndReason{0};   // last onScanEnd() reason from NimBLE
+
+static std::atomic<bool> activeScanning{false};   // the scan callback merges scan responses
+// Expires held advertisements on the NimBLE host task (see expireHeld())
+static struct ble_npl_callout scanRspCallout;
+
+static void applyScanPlan(NimBLEScan* scan) {
+  const ScanLevel& l = SCAN_LEVELS[scanPlan.level];
+  scan->setInterval(l.interval);
+  scan->setWindow(l.window);
+  scan->setActiveScan(scanPlan.active);
+  const bool wasActive = activeScanning.exchange(scanPlan.active, std::memory_order_relaxed);
+  // Passive from now on: send what is held without waiting for its timeout
+  if (wasActive && !scanPlan.active) ble_npl_callout_reset(&scanRspCallout, 0);
 }
 
-// --------- Callback de Scan ---------
+static uint32_t microsClock() {
+  return (uint32_t)micros();
+}
+
+// Advertising reports the controller delivered, and time spent handling them
+static std::atomic<uint32_t> hciReports{0};
+static std::atomic<uint32_t> callbackMicros{0};
+static std::atomic<uint32_t> matchedReports{0};
+
+struct CallbackMeter {
+  const uint32_t start = (uint32_t)micros();
+  ~CallbackMeter() { callbackMicros.fetch_add((uint32_t)micros() - start, std::memory_order_relaxed); }
+};
 
 // --------- Callback de Scan ---------
 class MyAdvertisedDeviceCallbacks : public NimBLEScanCallbacks {
 private:
-  void formatDeviceAsLog(uint16_t manufacturer, const std::string& deviceType,
-                        const std::string& addr, int rssi, uint8_t advType,
-                        bool isConnectable, bool isScannable, const std::string& dataType,
-                        const std::string& dataHex, const std::string& timestamp,
-                        char* buffer, size_t bufferSize) {
-    // Formatar linha de log no buffer fornecido usando timestamp fornecido
-    snprintf(buffer, bufferSize,
-             "%s | 0x%04X %-18s | %s | RSSI %03d | PDU %d | %s%-2s | %-12s [%s]\n",
-             timestamp.c_str(),
-             manufacturer,
-             deviceType.c_str(),
-             addr.c_str(),
-             rssi,
-             advType,
-             isConnectable ? "CONN" : "NONCONN",
-             isScannable ? "/SCAN" : "",
-             dataType.c_str(),
-             dataHex.c_str());
-  }
-
-  void formatDeviceAsCSV(uint16_t manufacturer, const std::string& deviceType,
-                        const std::string& addr, int rssi, uint8_t advType,
-                        bool isConnectable, bool isScannable, const std::string& dataType,
-                        const std::string& dataHex, const std::string& timestamp,
-                        char* buffer, size_t bufferSize) {
-    // Formatar linha CSV no buffer fornecido usando timestamp fornecido
-    snprintf(buffer, bufferSize,
-             "%s,%s,%s,%s,%d,%s,%s,%s,%s,%s\n",
-             timestamp.c_str(),
-             companyName(manufacturer),
-             deviceType.c_str(),
-             addr.c_str(),
-             rssi,
-             advTypeName(advType),
-             isConnectable ? "true" : "false",
-             isScannable ? "true" : "false",
-             dataType.c_str(),
-             dataHex.c_str());
-  }
-
-  void formatDeviceAsYaml(uint16_t manufacturer, const std::string& deviceType,
-                         const std::string& addr, int rssi, uint8_t advType,
-                         bool isConnectable, bool isScannable, const std::string& dataType,
-                         const std::string& dataHex, const std::string& timestamp,
-                         char* buffer, size_t bufferSize) {
-    // Formatar entrada YAML no buffer fornecido usando timestamp fornecido
-    snprintf(buffer, bufferSize,
-      "- device:\n"
-      "    time: %s\n"
-      "    manufacturer: %s\n"
-      "    type: %s\n"
-      "    address: %s\n"
-      "    rssi: %d\n"
-      "    adv_type: %s\n"
-      "    connectable: %s\n"
-      "    scannable: %s\n"
-      "    data_type: %s\n"
-      "    data_hex: %s\n",
-      timestamp.c_str(),
-      companyName(manufacturer),
-      deviceType.c_str(),
-      addr.c_str(),
-      rssi,
-      advTypeName(advType),
-      isConnectable ? "true" : "false",
-      isScannable ? "true" : "false",
-      dataType.c_str(),
-      dataHex.c_str());
-  }
-
-  void printDevice(uint16_t manufacturer, const std::string& deviceType,
-                   const std::string& addr, int rssi, uint8_t advType,
-                   bool isConnectable, bool isScannable, const std::string& dataType,
-                   const std::string& dataHex) {
-    // Obter timestamp uma única vez para consistência e eficiência
-    std::string timestamp = getCurrentTimestamp();
-    char outputBuffer[512];
-
-    switch (OUTPUT_FORMAT) {
-      case OutputFormat::LOG:
-        formatDeviceAsLog(manufacturer, deviceType, addr, rssi, advType,
-                         isConnectable, isScannable, dataType, dataHex, timestamp,
-                         outputBuffer, sizeof(outputBuffer));
-        break;
-      case OutputFormat::CSV:
-        formatDeviceAsCSV(manufacturer, deviceType, addr, rssi, advType,
-                         isConnectable, isScannable, dataType, dataHex, timestamp,
-                         outputBuffer, sizeof(outputBuffer));
-        break;
-      case OutputFormat::YAML:
-        formatDeviceAsYaml(manufacturer, deviceType, addr, rssi, advType,
-                          isConnectable, isScannable, dataType, dataHex, timestamp,
-                          outputBuffer, sizeof(outputBuffer));
-        break;
+  void queueRecord(DeviceRecord& record) {
+    if (record.matched) matchedReports.fetch_add(1, std::memory_order_relaxed);
+    if (!rateLimiter.admit(record, millis())) return;
+    // Dropped past the rate limiter: keep the sighting in the device's count
+    if (!loadShedder.admit(record, recordQueue.fillPercent()) || !recordQueue.push(record)) {
+      rateLimiter.fold(record);
     }
+  }
+
+  // Counts what the classifiers would drop; a tuple's first sighting is
+  // queued as its sample, and stays unreported if the queue is full
+  void discoverTypes(const DeviceRecord& record) {
+    const DiscoveryScope scope = (DiscoveryScope)discoveryScope.load(std::memory_order_relaxed);
+    forEachUnclassified(record.payload, record.payloadLen, scope, [&](bool service, const uint8_t* d, size_t n) {
+      const uint32_t key = discoveryKey(service, d, n);
+      if (!typeDiscovery.observe(key)) return;
+      DeviceRecord sample = record;
+      sample.matched = false;
+      sample.deviceType = "";
+      sample.manufacturer = service ? 0 : (uint16_t)(d[0] | (d[1] << 8));
+      sample.typeId = n > 2 ? d[2] : 0;
+      sample.dataType = service ? DataSource::SERVICE : DataSource::MANUFACTURER;
+      sample.data = d;
+      sample.dataLen = n;
+      if (!discoverySamples.push(sample)) typeDiscovery.forget(key);
+    });
+  }
+
+  // Unmatched reports are only kept for raw capture channels (pcap)
+  void classifyAndQueue(DeviceRecord& record) {
+    discoverTypes(record);
+    const RuleProgram* rules = activeRules.load(std::memory_order_acquire);
+    const bool foundFindMyDevice = rules != nullptr ? rules->match(record, isManufacturerEnabled)
+                                                    : matchFindMy(record, isManufacturerEnabled);
+
+    if (!foundFindMyDevice) {
+      if (!captureAllAdvertisements.load() ||
+          !(primaryOutput.wantsAllAdvertisements() || auxOutput.wantsAllAdvertisements())) {
+        return;
+      }
+      record.deviceType = "";
+      record.dataType = DataSource::MANUFACTURER;
+    }
+
+    // Written out by loop(); the callback never waits on the serial port
+    queueRecord(record);
+  }
+
+  // Every report, as the controller delivered it; before the RSSI filter and
+  // the duplicate handling of the normal path
+  void captureRaw(const NimBLEAdvertisedDevice* dev) {
+    const std::vector<uint8_t>& payload = dev->getPayload();
+    const uint8_t addrType = dev->getAddress().getType();
+    auto* r = rawCapture.offer(addrType, dev->getRSSI(), payload.data(), payload.size());
+    if (r == nullptr) return;
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    r->timeUs = rawTimeUs(now);
+    memcpy(r->addr, dev->getAddress().getVal(), sizeof(r->addr));
+    r->addrType = addrType;
+    r->rssi = (int8_t)dev->getRSSI();
+    r->advType = dev->getAdvType();
+    r->flags = (dev->isConnectable() ? RAW_FLAG_CONNECTABLE : 0) | (dev->isScannable() ? RAW_FLAG_SCANNABLE : 0);
+    r->phy = 0;
+#if CONFIG_BT_NIMBLE_EXT_ADV
+    if (!dev->isLegacyAdvertisement()) {
+      r->advType = ADV_TYPE_EXT;
+      r->flags |= RAW_FLAG_EXTENDED | (uint8_t)(dev->getSetId() << 4);
+      r->phy = (uint8_t)(dev->getPrimaryPhy() | (dev->getSecondaryPhy() << 4));
+    }
+#endif
+    r->payloadLen = payload.size() < RECORD_PAYLOAD_MAX ? (uint8_t)payload.size() : RECORD_PAYLOAD_MAX;
+    memcpy(r->payload, payload.data(), r->payloadLen);
+    rawCapture.commit();
+  }
 
-    // Único ponto de saída Serial - centralizado
-    Serial.print(outputBuffer);
-    delay(10); // Pequena pausa para evitar sobrecarga do buffer Serial
-    Serial.flush();
+#if SIG_SCAN_FLAG
+  // The whole payload, AD headers included, against every signature at once
+  void scanSignatures(const DeviceRecord& record) {
+    const SignatureMatcher* matcher = activeSignatures.load(std::memory_order_acquire);
+    if (matcher == nullptr || !signatureScan.load(std::memory_order_relaxed)) return;
+    SignatureHit hits[SIG_MAX_HITS];
+    uint8_t kept = 0;
+    const uint32_t total = matcher->scan(record.payload, record.payloadLen, [&](uint16_t signature, size_t offset) {
+      if (kept < SIG_MAX_HITS) hits[kept++] = SignatureHit{ (uint8_t)signature, (uint8_t)offset };
+    });
+    if (total == 0) return;
+    signatureHitReports.fetch_add(1, std::memory_order_relaxed);
+
+    auto* report = signatureHits.reserve();
+    if (report == nullptr) return;
+    report->time = record.time;
+    memcpy(report->addr, record.addr, sizeof(report->addr));
+    report->addrType = record.addrType;
+    report->rssi = record.rssi;
+    report->advType = record.advType;
+    report->generation = matcher->generation();
+    report->hitCount = kept;
+    report->totalHits = total < 0xFFFF ? (uint16_t)total : 0xFFFF;
+    memcpy(report->hits, hits, kept * sizeof(hits[0]));
+    report->payloadLen = record.payloadLen < RECORD_PAYLOAD_MAX ? (uint8_t)record.payloadLen : RECORD_PAYLOAD_MAX;
+    memcpy(report->payload, record.payload, report->payloadLen);
+    signatureHits.push();
   }
+#endif
 
 public:
+  // Held advertisements whose response is overdue go out alone, and all of
+  // them once active scanning is off. Runs on the NimBLE host task from
+  // scanRspCallout, so it never overlaps onResult(), which only expires
+  // when another report arrives.
+  void expireHeld() {
+    ScanReadGuard reading;
+    auto emitAlone = [this](const DeviceRecord& held) {
+      DeviceRecord alone = held;
+      classifyAndQueue(alone);
+    };
+    if (activeScanning.load(std::memory_order_relaxed)) scanMerger.expire(millis(), emitAlone);
+    else scanMerger.flush(emitAlone);
+  }
+
+  // The supervisor sees the scan stopped in loop(); keep NimBLE's reason
+  void onScanEnd(const NimBLEScanResults&, int reason) override {
+    scanEndReason.store(reason, std::memory_order_relaxed);
+  }
+
   void onResult(const NimBLEAdvertisedDevice* dev) override {
+    hciReports.fetch_add(1, std::memory_order_relaxed);
+    CallbackMeter meter;
+    ScanReadGuard reading;
+    if (rawCapturing.load(std::memory_order_relaxed)) captureRaw(dev);
+
     // Filter by RSSI - ignore devices with weak signal
     if (dev->getRSSI() < MIN_RSSI) {
       return;
     }
 
-    bool foundFindMyDevice = false;
-    uint16_t detectedManufacturer = 0xFFFF;
-    std::string dataType = "";
-    std::string deviceType = "";
-    std::string dataHex = "";
-
-  // First, check service data (as in nRF Connect log)
-    if (dev->haveServiceData()) {
-      for (int i = 0; i < dev->getServiceDataCount(); i++) {
-        NimBLEUUID serviceUuid = dev->getServiceDataUUID(i);
-        std::string serviceData = dev->getServiceData(i);
-
-        // Converts UUID to uint16_t
-        uint16_t uuid16 = 0;
-        if (serviceUuid.bitSize() == 16) {
-          const uint8_t* uuidBytes = serviceUuid.getValue();
-          uuid16 = (uuidBytes[1] << 8) | uuidBytes[0]; // Little endian
-        }
-
-        // Check if it's a known Find My service
-        if (isFindMyServiceData(uuid16, serviceData)) {
-          detectedManufacturer = serviceToManufacturer(uuid16);
-          if (detectedManufacturer != 0xFFFF && isManufacturerEnabled(detectedManufacturer)) {
-            foundFindMyDevice = true;
-            dataType = "Service";
-            deviceType = getServiceFindMyType(uuid16, serviceData);
-
-            // Convert Service Data to HEX
-            std::vector<uint8_t> buf(serviceData.begin(), serviceData.end());
-            dataHex = toHex(buf.data(), buf.size());
-            break; // Use the first service found
-          }
-        }
+    const std::vector<uint8_t>& rawPayload = dev->getPayload();
+    DeviceRecord record = {};
+    gettimeofday(&record.time, nullptr);
+    memcpy(record.addr, dev->getAddress().getVal(), sizeof(record.addr));
+    record.addrType = dev->getAddress().getType();
+    record.rssi = dev->getRSSI();
+    record.advType = dev->getAdvType();
+    record.isConnectable = dev->isConnectable();
+    record.isScannable = dev->isScannable();
+    record.payload = rawPayload.data();
+    record.payloadLen = rawPayload.size();
+#if CONFIG_BT_NIMBLE_EXT_ADV
+    if (!dev->isLegacyAdvertisement()) {
+      record.advType = ADV_TYPE_EXT;
+      record.primaryPhy = dev->getPrimaryPhy();
+      record.secondaryPhy = dev->getSecondaryPhy();
+      record.sid = dev->getSetId();
+    }
+#endif
+#if SIG_SCAN_FLAG
+    scanSignatures(record);
+#endif
+
+    // Active scanning: a scannable advertisement waits for its scan response
+    // and both go out as one record (scan_merge.h)
+    if (activeScanning.load(std::memory_order_relaxed)) {
+      const uint32_t now = millis();
+      auto emitAlone = [this](const DeviceRecord& held) {
+        DeviceRecord alone = held;
+        classifyAndQueue(alone);
+      };
+      scanMerger.expire(now, emitAlone);
+      uint8_t merged[MERGED_PAYLOAD_MAX];
+      if (rawPayload.size() > dev->getAdvLength()) {
+        record.scanRspLen = (uint8_t)(rawPayload.size() - dev->getAdvLength());
+        scanMerger.mergedUpstream(record);
+      } else if (isScanResponse(record)) {
+        scanMerger.merge(record, merged);
+      } else if (awaitsScanResponse(record)) {
+        scanMerger.hold(record, now, emitAlone);
+        return;
       }
+      classifyAndQueue(record);
+      return;
     }
+    classifyAndQueue(record);
+  }
+};
+
+// Re-armed every SCAN_RSP_TIMEOUT_MS_FLAG: a held advertisement goes out at
+// most twice its timeout after it arrived, however quiet the air gets
+static void onScanRspCallout(struct ble_npl_event* ev) {
+  static_cast<MyAdvertisedDeviceCallbacks*>(ble_npl_event_get_arg(ev))->expireHeld();
+  ble_npl_callout_reset(&scanRspCallout, ble_npl_time_ms_to_ticks32(SCAN_RSP_TIMEOUT_MS_FLAG));
+}
+
+// --------- Match rules ---------
+// Uploaded over serial as "rules begin", "rules + <hex>"..., "rules end"
+// (fmsdecode rules serial) and kept in NVS; "rules builtin" goes back to the
+// built-in classifier
+static uint8_t ruleUpload[RULES_MAX_BYTES];
+static size_t ruleUploadLen = 0;
+static bool ruleUploadOpen = false;
+
+static void emitRulesEvent(const char* source, const RuleProgram* program, const char* error) {
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "rules";
+  ev.add("source", source);
+  if (error != nullptr) {
+    ev.add("error", error);
+  } else {
+    ev.add("rules", (int64_t)(program != nullptr ? program->rules() : 0));
+    ev.add("bytes", (int64_t)(program != nullptr ? program->bytes() : 0));
+    ev.add("label_pool", (int64_t)ruleLabels.used());
+  }
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+}
+
+static bool loadRules(const uint8_t* bytes, size_t len, const char* source) {
+  RuleProgram& next = activeRules.load() == &rulePrograms[0] ? rulePrograms[1] : rulePrograms[0];
+  waitForScanReaders();
+  const char* error = nullptr;
+  if (!next.load(bytes, len, ruleLabels, error)) {
+    emitRulesEvent(source, nullptr, error);
+    return false;
+  }
+  activeRules.store(&next, std::memory_order_release);
+  emitRulesEvent(source, &next, nullptr);
+  return true;
+}
+
+static void loadStoredRules() {
+  Preferences prefs;
+  if (!prefs.begin("fms", true)) return;
+  const size_t len = prefs.getBytesLength("rules");
+  if (len > 0 && len <= sizeof(ruleUpload) && prefs.getBytes("rules", ruleUpload, len) == len) {
+    loadRules(ruleUpload, len, "nvs");
+  }
+  prefs.end();
+}
+
+static void storeRules(const uint8_t* bytes, size_t len) {
+  Preferences prefs;
+  if (!prefs.begin("fms", false)) return;
+  if (len > 0) prefs.putBytes("rules", bytes, len);
+  else prefs.remove("rules");
+  prefs.end();
+}
 
-    // If not found via Service Data, check Manufacturer Data
-    if (!foundFindMyDevice && dev->haveManufacturerData()) {
-      const std::string& mfd = dev->getManufacturerData();
-      if (mfd.size() >= 3) { // Needs at least CID (2 bytes) + type (1 byte)
-        const uint16_t cid = parseCompanyIdLE(mfd);
-
-        // Filter only manufacturers of interest
-        if ((cid == CID_APPLE || cid == CID_GOOGLE || cid == CID_SAMSUNG || cid == CID_XIAOMI) &&
-            isManufacturerEnabled(cid) && isFindMyDevice(cid, mfd)) {
-          foundFindMyDevice = true;
-          detectedManufacturer = cid;
-          dataType = "Manufacturer";
-          deviceType = getFindMyType(cid, mfd);
-
-          // Convert MFD to HEX
-          std::vector<uint8_t> buf(mfd.begin(), mfd.end());
-          dataHex = toHex(buf.data(), buf.size());
-        }
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static void handleRulesCommand(const char* arg) {
+  if (strcmp(arg, "begin") == 0) {
+    ruleUploadLen = 0;
+    ruleUploadOpen = true;
+  } else if (arg[0] == '+' && ruleUploadOpen) {
+    for (const char* p = arg + 1; *p != '\0'; ++p) {
+      if (*p == ' ') continue;
+      const int hi = hexDigit(p[0]), lo = hi >= 0 ? hexDigit(p[1]) : -1;
+      if (lo < 0 || ruleUploadLen == sizeof(ruleUpload)) {
+        ruleUploadOpen = false;
+        emitRulesEvent("serial", nullptr, lo < 0 ? "bad hex" : "too large");
+        return;
       }
+      ruleUpload[ruleUploadLen++] = (uint8_t)((hi << 4) | lo);
+      ++p;
     }
+  } else if (strcmp(arg, "end") == 0 && ruleUploadOpen) {
+    ruleUploadOpen = false;
+    if (loadRules(ruleUpload, ruleUploadLen, "serial")) storeRules(ruleUpload, ruleUploadLen);
+  } else if (strcmp(arg, "builtin") == 0) {
+    activeRules.store(nullptr, std::memory_order_release);
+    storeRules(nullptr, 0);
+    emitRulesEvent("builtin", nullptr, nullptr);
+  }
+}
+
+// --------- Raw capture ---------
+// Frames go through the primary channel, so they land between records and
+// are compressed with them
+static void rawFrameSink(void*, const uint8_t* data, size_t len) {
+  primaryOutput.emitFrame(data, len);
+}
+
+static RawFrameWriter rawFrames(rawFrameSink, nullptr);
+constexpr size_t RAW_DRAIN_REPORTS = 64;    // per loop() pass
+
+static const char* rawModeName(RawMode m) {
+  switch (m) {
+    case RawMode::STREAM: return "stream";
+    case RawMode::STORE:  return "store";
+    default:              return "off";
+  }
+}
+
+// PSRAM if there is any, else a small ring in internal RAM; once
+static bool allocateRawCapture() {
+  static bool tried = false;
+  if (tried) return rawCapture.capacity() > 0;
+  tried = true;
+  using Report = RawCapture<RECORD_PAYLOAD_MAX>::Report;
+  size_t bytes = (size_t)RAW_CAPTURE_KB_FLAG * 1024;
+  void* slots = psramFound() ? heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM) : nullptr;
+  if (slots == nullptr) {
+    bytes = (size_t)RAW_CAPTURE_INTERNAL_KB_FLAG * 1024;
+    slots = heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  }
+  if (slots == nullptr) return false;
+  rawCapture.begin((Report*)slots, bytes / sizeof(Report));
+  return true;
+}
+
+// Mode and counters: offered = filtered + captured + dropped; "sent" have
+// left in frames, "stored" wait in the ring
+static void emitRawCaptureEvent(const char* error) {
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "capture";
+  ev.add("mode", rawModeName(rawMode));
+  if (error != nullptr) ev.add("error", error);
+  ev.add("offered", (int64_t)rawCapture.offered());
+  ev.add("filtered", (int64_t)rawCapture.filtered());
+  ev.add("captured", (int64_t)rawCapture.captured());
+  ev.add("dropped", (int64_t)rawCapture.dropped());
+  ev.add("sent", (int64_t)rawFrames.reports());
+  ev.add("frames", (int64_t)rawFrames.frames());
+  ev.add("stored", (int64_t)rawCapture.size());
+  ev.add("capacity", (int64_t)rawCapture.capacity());
+  ev.add("fill_pct", rawCapture.fillPercent());
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+}
 
-    // If found a Find My device, display the information
-    if (foundFindMyDevice) {
-      const std::string addr = dev->getAddress().toString();
-      const int rssi = dev->getRSSI();
-      const uint8_t advType = dev->getAdvType();
-      const bool isConnectable = dev->isConnectable();
+static void setRawCapture(RawMode mode) {
+  if (mode != RawMode::OFF && !allocateRawCapture()) {
+    emitRawCaptureEvent("no memory");
+    return;
+  }
+  rawMode = mode;
+  rawCapturing.store(mode != RawMode::OFF, std::memory_order_relaxed);
+  emitRawCaptureEvent(nullptr);
+}
 
-      // Use the configured output format
-      printDevice(detectedManufacturer, deviceType, addr, rssi, advType,
-                  isConnectable, dev->isScannable(), dataType, dataHex);
+static void handleRawCaptureCommand(char* arg) {
+  char* rest = strchr(arg, ' ');
+  if (rest != nullptr) *rest++ = '\0';
+
+  if (strcmp(arg, "on") == 0) {
+    setRawCapture(RawMode::STREAM);
+  } else if (strcmp(arg, "store") == 0) {
+    setRawCapture(RawMode::STORE);
+  } else if (strcmp(arg, "off") == 0) {
+    setRawCapture(RawMode::OFF);
+  } else if (strcmp(arg, "dump") == 0) {
+    rawDumping = true;
+  } else if (rest != nullptr) {
+    RawFilter f = rawCapture.filter();
+    const bool any = strcmp(rest, "any") == 0;
+    if (strcmp(arg, "rssi") == 0) {
+      const long rssi = strtol(rest, nullptr, 10);
+      f.minRssi = (int8_t)(rssi < -128 ? -128 : rssi > 0 ? 0 : rssi);
+    } else if (strcmp(arg, "cid") == 0) {
+      // "004C,00E0"
+      f.cidCount = 0;
+      for (char* p = rest; !any && *p != '\0' && f.cidCount < RAW_FILTER_MAX_CIDS; p += *p == ',') {
+        char* end;
+        f.cids[f.cidCount++] = (uint16_t)strtoul(p, &end, 16);
+        if (end == p) return;
+        p = end;
+      }
+    } else if (strcmp(arg, "addr") == 0) {
+      // "0,1": public and random
+      f.addrTypes = any ? 0xFF : 0;
+      for (const char* p = rest; !any && *p != '\0'; ++p) {
+        if (*p >= '0' && *p <= '7') f.addrTypes |= (uint8_t)(1u << (*p - '0'));
       }
+    } else {
+      return;
     }
+    rawCapture.setFilter(f);
+  }
+}
+
+// Sends stored reports as frames: continuously when streaming, until the
+// ring is empty for a dump
+static void drainRawCapture() {
+  if (rawMode != RawMode::STREAM && !rawDumping) return;
+  for (size_t i = 0; i < RAW_DRAIN_REPORTS; ++i) {
+    const auto* r = rawCapture.front();
+    if (r == nullptr) {
+      if (rawDumping) {
+        rawDumping = false;
+        rawFrames.flush();
+        emitRawCaptureEvent(nullptr);
+      }
+      break;
+    }
+    rawFrames.add(*r);
+    rawCapture.pop();
+  }
+  rawFrames.flush();
+}
+
+#if SIG_SCAN_FLAG
+// --------- Signature scan ---------
+// The boot set: the identifiers the Find My classifiers look for, with their
+// AD type byte in front, wherever they sit in the payload
+static const struct {
+  const char* label;
+  uint8_t bytes[4];
+  uint8_t len;
+} DEFAULT_SIGNATURES[] = {
+  { "svc_apple",      { AD_TYPE_SERVICE_DATA16, SVC_APPLE_FIND_MY & 0xFF, SVC_APPLE_FIND_MY >> 8 }, 3 },
+  { "svc_google",     { AD_TYPE_SERVICE_DATA16, SVC_GOOGLE_FAST_PAIR & 0xFF, SVC_GOOGLE_FAST_PAIR >> 8 }, 3 },
+  { "svc_samsung",    { AD_TYPE_SERVICE_DATA16, SVC_SAMSUNG_FIND & 0xFF, SVC_SAMSUNG_FIND >> 8 }, 3 },
+  { "mfd_apple_of",   { AD_TYPE_MANUFACTURER, CID_APPLE & 0xFF, CID_APPLE >> 8, 0x12 }, 4 },
+  { "mfd_google",     { AD_TYPE_MANUFACTURER, CID_GOOGLE & 0xFF, CID_GOOGLE >> 8 }, 3 },
+  { "mfd_samsung",    { AD_TYPE_MANUFACTURER, CID_SAMSUNG & 0xFF, CID_SAMSUNG >> 8 }, 3 },
+  { "mfd_xiaomi",     { AD_TYPE_MANUFACTURER, CID_XIAOMI & 0xFF, CID_XIAOMI >> 8 }, 3 },
 };
 
+// Compiles the set and swaps it in; false (nothing changed) if it does not fit
+static bool applySignatures() {
+  SignatureMatcher& next =
+    activeSignatures.load() == &signatureMatchers[0] ? signatureMatchers[1] : signatureMatchers[0];
+  // Two changes in a row would otherwise rebuild the automaton a scan began
+  // with before the first swap
+  waitForScanReaders();
+  if (!next.build(signatures)) return false;
+  activeSignatures.store(&next, std::memory_order_release);
+  return true;
+}
+
+static void emitSignatureSet(const char* error) {
+  const SignatureMatcher* matcher = activeSignatures.load();
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "sig_set";
+  ev.add("scan", signatureScan.load() ? "on" : "off");
+  if (error != nullptr) ev.add("error", error);
+  ev.add("signatures", (int64_t)signatures.size());
+  ev.add("states", (int64_t)(matcher != nullptr ? matcher->states() : 0));
+  ev.add("transitions", (int64_t)(matcher != nullptr ? matcher->transitions() : 0));
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+}
+
+static void loadDefaultSignatures() {
+  for (const auto& s : DEFAULT_SIGNATURES) signatures.add(s.label, s.bytes, s.len);
+  applySignatures();
+  emitSignatureSet(nullptr);
+}
+
+static void handleSignatureCommand(char* arg) {
+  char* rest = strchr(arg, ' ');
+  if (rest != nullptr) *rest++ = '\0';
+  const char* error = nullptr;
+
+  if (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0) {
+    signatureScan.store(arg[1] == 'n');
+  } else if (strcmp(arg, "clear") == 0) {
+    signatures.clear();
+    applySignatures();
+  } else if (strcmp(arg, "del") == 0 && rest != nullptr) {
+    if (!signatures.remove(rest)) error = "unknown label";
+    else applySignatures();
+  } else if (strcmp(arg, "add") == 0 && rest != nullptr) {
+    // "sig add <label> <hex>"
+    char* hex = strchr(rest, ' ');
+    if (hex != nullptr) *hex++ = '\0';
+    uint8_t bytes[SIG_MAX_LEN];
+    size_t len = 0;
+    for (const char* p = hex; p != nullptr && *p != '\0' && error == nullptr; p += 2) {
+      const int hi = hexDigit(p[0]), lo = hi >= 0 ? hexDigit(p[1]) : -1;
+      if (lo < 0) error = "bad hex";
+      else if (len == sizeof(bytes)) error = "bad length";
+      else bytes[len++] = (uint8_t)((hi << 4) | lo);
+    }
+    if (error == nullptr) error = signatures.add(rest, bytes, len);
+    if (error == nullptr && !applySignatures()) {
+      signatures.remove(rest);
+      applySignatures();
+      error = "too many states";
+    }
+  } else {
+    return;
+  }
+  emitSignatureSet(error);
+}
+
+// One "sig" event per report with hits: where each signature matched (byte
+// offset in the payload) and the payload itself
+static void drainSignatureHits() {
+  static char addrText[18];
+  static char hitsText[SIG_MAX_HITS * (SIG_LABEL_MAX + 6)];   // ",label@255"
+  static char payloadHex[2 * RECORD_PAYLOAD_MAX + 1];
+  for (const auto* r = signatureHits.front(); r != nullptr; signatureHits.pop(), r = signatureHits.front()) {
+    // Found before the set last changed: the ids may name other signatures
+    if (r->generation != signatures.generation()) continue;
+
+    snprintf(addrText, sizeof(addrText), "%02x:%02x:%02x:%02x:%02x:%02x",
+             r->addr[5], r->addr[4], r->addr[3], r->addr[2], r->addr[1], r->addr[0]);
+    size_t at = 0;
+    hitsText[0] = '\0';
+    for (uint8_t i = 0; i < r->hitCount; ++i) {
+      at += snprintf(hitsText + at, sizeof(hitsText) - at, "%s%s@%u", i > 0 ? "," : "",
+                     signatures[r->hits[i].signature].label, r->hits[i].offset);
+    }
+    for (size_t i = 0; i < r->payloadLen; ++i) snprintf(payloadHex + 2 * i, 3, "%02x", r->payload[i]);
+    payloadHex[2 * r->payloadLen] = '\0';
+
+    EventRecord ev;
+    ev.time = r->time;
+    ev.kind = "sig";
+    ev.add("addr", addrText);
+    ev.add("addr_type", r->addrType);
+    ev.add("rssi", r->rssi);
+    ev.add("adv", advTypeName(r->advType));
+    ev.add("hits", hitsText);
+    ev.add("hit_count", r->totalHits);
+    ev.add("payload", payloadHex);
+    primaryOutput.emitEvent(ev);
+    auxOutput.emitEvent(ev);
+  }
+}
+#endif
+
+// --------- Type discovery ---------
+constexpr size_t DISCOVERY_REPORT_TOP = 32;   // of the DISCOVERY_TOP_K counted
+
+static const char* discoveryScopeName(uint8_t scope) {
+  switch (scope) {
+    case DISCOVERY_VENDORS: return "vendors";
+    case DISCOVERY_ALL:     return "all";
+    default:                return "off";
+  }
+}
+
+// One "discover" event per new tuple, with the structure and the payload it
+// came in
+static void drainDiscoverySamples() {
+  static char name[DISCOVERY_NAME_MAX];
+  static char addrText[18];
+  static char dataHex[2 * RECORD_PAYLOAD_MAX + 1];
+  static char payloadHex[2 * RECORD_PAYLOAD_MAX + 1];
+  for (const DeviceRecord* r = discoverySamples.front(); r != nullptr; discoverySamples.pop(), r = discoverySamples.front()) {
+    const bool service = r->dataType == DataSource::SERVICE;
+    const uint16_t id = (uint16_t)(r->data[0] | (r->data[1] << 8));
+    discoveryKeyName(discoveryKey(service, r->data, r->dataLen), name, sizeof(name));
+    snprintf(addrText, sizeof(addrText), "%02x:%02x:%02x:%02x:%02x:%02x",
+             r->addr[5], r->addr[4], r->addr[3], r->addr[2], r->addr[1], r->addr[0]);
+    for (size_t i = 0; i < r->dataLen; ++i) snprintf(dataHex + 2 * i, 3, "%02x", r->data[i]);
+    dataHex[2 * r->dataLen] = '\0';
+    for (size_t i = 0; i < r->payloadLen; ++i) snprintf(payloadHex + 2 * i, 3, "%02x", r->payload[i]);
+    payloadHex[2 * r->payloadLen] = '\0';
+
+    EventRecord ev;
+    ev.time = r->time;
+    ev.kind = "discover";
+    ev.add("tuple", name);
+    ev.add("source", dataSourceName(r->dataType));
+    ev.add("vendor", companyName(service ? serviceToManufacturer(id) : id));
+    ev.add("len", (int64_t)r->dataLen);
+    ev.add("addr", addrText);
+    ev.add("addr_type", r->addrType);
+    ev.add("rssi", r->rssi);
+    ev.add("adv", advTypeName(r->advType));
+    ev.add("data", dataHex);
+    ev.add("payload", payloadHex);
+    primaryOutput.emitEvent(ev);
+    auxOutput.emitEvent(ev);
+  }
+}
+
+// The most frequent tuples as "<tuple>=<count>"; a count is at most
+// max_error over the truth
+static void emitDiscoveryTop() {
+  static char names[DISCOVERY_REPORT_TOP][DISCOVERY_NAME_MAX];
+  TypeDiscovery::Entry top[DISCOVERY_REPORT_TOP];
+  const size_t n = typeDiscovery.top(top, DISCOVERY_REPORT_TOP);
+  uint32_t maxError = 0;
+  for (size_t i = 0; i < n; ++i) maxError = top[i].error > maxError ? top[i].error : maxError;
+
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "discover_top";
+  ev.add("scope", discoveryScopeName(discoveryScope.load()));
+  ev.add("observed", (int64_t)typeDiscovery.observed());
+  ev.add("reported", (int64_t)typeDiscovery.reported());
+  ev.add("dropped", (int64_t)discoverySamples.overflows());
+  ev.add("max_error", (int64_t)maxError);
+  for (size_t i = 0; i < n; ++i) {
+    discoveryKeyName(top[i].key, names[i], sizeof(names[i]));
+    ev.add(names[i], (int64_t)top[i].count);
+  }
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+}
+
+static void handleDiscoveryCommand(const char* arg) {
+  if (strcmp(arg, "off") == 0) discoveryScope.store(DISCOVERY_OFF);
+  else if (strcmp(arg, "vendors") == 0) discoveryScope.store(DISCOVERY_VENDORS);
+  else if (strcmp(arg, "all") == 0) discoveryScope.store(DISCOVERY_ALL);
+  else if (strcmp(arg, "reset") == 0 || strcmp(arg, "forget") == 0) typeDiscovery.reset(arg[0] == 'f');
+  else if (strcmp(arg, "top") != 0) return;
+  emitDiscoveryTop();
+}
+
+// --------- Rotation linking ---------
+static uint32_t epochMillis() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return (uint32_t)((uint64_t)tv.tv_sec * 1000u + (uint64_t)(tv.tv_usec / 1000));
+}
+
+static void emitLink(const LinkEvent& link) {
+  static char fromText[18];
+  static char toText[18];
+  snprintf(fromText, sizeof(fromText), "%02x:%02x:%02x:%02x:%02x:%02x", link.fromAddr[5], link.fromAddr[4],
+           link.fromAddr[3], link.fromAddr[2], link.fromAddr[1], link.fromAddr[0]);
+  snprintf(toText, sizeof(toText), "%02x:%02x:%02x:%02x:%02x:%02x", link.toAddr[5], link.toAddr[4],
+           link.toAddr[3], link.toAddr[2], link.toAddr[1], link.toAddr[0]);
+
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "link";
+  ev.add("from", fromText);
+  ev.add("to", toText);
+  ev.add("vendor", companyName(link.manufacturer));
+  ev.add("type", (int64_t)link.typeId);
+  ev.add("gap_ms", (int64_t)link.gapMs);
+  ev.add("confidence", (int64_t)link.confidence);
+  ev.add("candidates", (int64_t)link.candidates);
+  ev.add("device", (int64_t)link.logical);
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+}
+
+// The linker's counters, after each stats event while linking is on
+static void emitLinkerStats() {
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "linker";
+  ev.add("min_confidence", (int64_t)rotationLinker.minConfidence());
+  ev.add("tracks", (int64_t)rotationLinker.tracks());
+  ev.add("pending", (int64_t)rotationLinker.pending());
+  ev.add("links", (int64_t)rotationLinker.links());
+  ev.add("unlinked", (int64_t)rotationLinker.unlinked());
+  ev.add("devices", (int64_t)rotationLinker.devices());
+  ev.add("mem_bytes", (int64_t)RotationLinker::memoryBytes());
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+}
+
+static void handleLinkCommand(const char* arg) {
+  if (strcmp(arg, "on") == 0) {
+    rotationLinking = true;
+  } else if (strcmp(arg, "off") == 0) {
+    rotationLinking = false;
+    rotationLinker.clear();
+  } else if (strcmp(arg, "reset") == 0) {
+    rotationLinker.clear();
+  } else if (strncmp(arg, "min ", 4) == 0) {
+    const unsigned long min = strtoul(arg + 4, nullptr, 10);
+    if (min <= 100) rotationLinker.setMinConfidence((uint8_t)min);
+  }
+}
+
+// --------- Following detection ---------
+// High priority: sent at once, not held for the next compressed batch
+static void emitFollowAlert(const FollowAlert& alert) {
+  static char deviceText[17];
+  static char addrText[18];
+  snprintf(deviceText, sizeof(deviceText), "%016llx", (unsigned long long)alert.key);
+  snprintf(addrText, sizeof(addrText), "%02x:%02x:%02x:%02x:%02x:%02x", alert.addr[5], alert.addr[4],
+           alert.addr[3], alert.addr[2], alert.addr[1], alert.addr[0]);
+
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "follow";
+  ev.add("priority", "high");
+  ev.add("device", deviceText);
+  ev.add("addr", addrText);
+  ev.add("addr_type", alert.addrType);
+  ev.add("vendor", companyName(alert.manufacturer));
+  ev.add("type", (int64_t)alert.typeId);
+  ev.add("minutes", (int64_t)alert.minutes);
+  ev.add("coverage_pct", (int64_t)alert.coveragePct);
+  ev.add("sightings", (int64_t)alert.sightings);
+  ev.add("rssi_min", alert.rssiMin);
+  ev.add("rssi_max", alert.rssiMax);
+  ev.add("others", (int64_t)alert.others);
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+  primaryOutput.flush();
+  auxOutput.flush();
+}
+
+// The detector's counters, after each stats event while detection is on
+static void emitFollowerStats() {
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "follower";
+  ev.add("min_minutes", (int64_t)followDetector.thresholds().minMinutes);
+  ev.add("min_coverage_pct", (int64_t)followDetector.thresholds().minCoveragePct);
+  ev.add("tags", (int64_t)followDetector.tags());
+  ev.add("alerts", (int64_t)followDetector.alerts());
+  ev.add("evictions", (int64_t)followDetector.evictions());
+  ev.add("mem_bytes", (int64_t)decltype(followDetector)::memoryBytes());
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+}
+
+static void handleFollowCommand(const char* arg) {
+  FollowThresholds t = followDetector.thresholds();
+  unsigned long v;
+  if (strcmp(arg, "on") == 0) {
+    followDetection = true;
+  } else if (strcmp(arg, "off") == 0) {
+    followDetection = false;
+    followDetector.clear();
+  } else if (strcmp(arg, "reset") == 0) {
+    followDetector.clear();
+  } else if (strcmp(arg, "list") == 0) {
+    followDetector.forEachFollowing(emitFollowAlert);
+  } else {
+    // Thresholds; anything else is ignored
+    if (strcmp(arg, "owner on") == 0 || strcmp(arg, "owner off") == 0) {
+      t.nearOwner = arg[7] == 'n';
+    } else if (sscanf(arg, "minutes %lu", &v) == 1 && v > 0 && v <= 0xFFFF) {
+      t.minMinutes = (uint16_t)v;
+    } else if (sscanf(arg, "coverage %lu", &v) == 1 && v <= 100) {
+      t.minCoveragePct = (uint8_t)v;
+    } else if (sscanf(arg, "gap %lu", &v) == 1 && v <= 0xFF) {
+      t.maxGapMinutes = (uint8_t)v;
+    } else if (sscanf(arg, "others %lu", &v) == 1 && v <= 0xFFFF) {
+      t.minOthers = (uint16_t)v;
+    } else {
+      return;
+    }
+    followDetector.setThresholds(t);
+  }
+}
+
+// Rotation linking, then following detection under the linked device id
+static void trackDevice(const DeviceRecord& r) {
+  uint64_t key = deviceKey(r);
+  if (rotationLinking) key = logicalDeviceKey(rotationLinker.observe(r));
+  if (followDetection) followDetector.observe(key, r, emitFollowAlert);
+}
+
+static void onLink(const LinkEvent& link) {
+  followDetector.merge(logicalDeviceKey(link.replaced), logicalDeviceKey(link.logical));
+  emitLink(link);
+}
+
 void setup() {
   // Get reset reason
   esp_reset_reason_t reset_reason = esp_reset_reason();
@@ -571,38 +1366,53 @@ void setup() {
   Serial.begin(115200);
   while (!Serial) { delay(10); } // USB CDC (S3) — waits for connection to see logs
 
-  // Initialize NimBLE
+  // Initialize NimBLE. The duplicate filter mode is fixed at controller init.
+#if defined(CONFIG_BTDM_BLE_SCAN_DUPL) || defined(CONFIG_BT_LE_SCAN_DUPL)
+  NimBLEDevice::setScanFilterMode(SCAN_DUPL_TYPE_DATA_DEVICE);
+#endif
   NimBLEDevice::init("FindMyScanner"); // Scanner device name
   NimBLEDevice::setSecurityAuth(false, false, false);
   // TX power only affects active ads/connections; it doesn't change RX gain.
   // We maintain the default setting to avoid "polluting" the environment with our own ads.
 
   NimBLEScan* scan = NimBLEDevice::getScan();
-  scan->setScanCallbacks(new MyAdvertisedDeviceCallbacks(), /*wantDuplicates=*/true);
-
-  // Passive is more "quiet" and sufficient for mfd — change to true if you need scan response
-  scan->setActiveScan(false);
-
-  // Interval and window (units of 0.625 ms). Ex.: 80 => 50 ms; 70 => ~43.75 ms
-  scan->setInterval(80);
-  scan->setWindow(70);
-
-  // Avoid repeating the same advertisement (controlled by controller). true = filter duplicates
-  // We set false here because we want to capture ID rotations more easily.
-  scan->setDuplicateFilter(false);
+  MyAdvertisedDeviceCallbacks* scanCallbacks = new MyAdvertisedDeviceCallbacks();
+  scan->setScanCallbacks(scanCallbacks, /*wantDuplicates=*/true);
+  ble_npl_callout_init(&scanRspCallout, nimble_port_get_dflt_eventq(), onScanRspCallout, scanCallbacks);
+  ble_npl_callout_reset(&scanRspCallout, ble_npl_time_ms_to_ticks32(SCAN_RSP_TIMEOUT_MS_FLAG));
+
+  // Interval, window (units of 0.625 ms) and active scanning come from the
+  // scan plan; it starts at 50 ms / 43.75 ms, passive unless always active
+  scanPlan.active = SCAN_BUDGET.active == ScanActive::ALWAYS;
+  applyScanPlan(scan);
+
+  // Duplicate filtering in the controller (see DUP_FILTER_FLAG). Off by
+  // default: every report reaches the callback.
+  scan->setDuplicateFilter(duplicateFilter ? 1 : 0);
   scan->setLimitedOnly(false);
+#if CONFIG_BT_NIMBLE_EXT_ADV
+  // Extended scanning on the 1M and Coded PHYs (long range); 2M only
+  // carries secondary channels, which the controller follows on its own
+  scan->setPhy(NimBLEScan::SCAN_ALL);
+#endif
 
-  switch (OUTPUT_FORMAT) {
-    case OutputFormat::LOG:
-      printFilterStatus();
-      break;
-    case OutputFormat::CSV:
-      Serial.println("time,manufacturer,deviceType,addr,rssi,advType,isConnectable,isScannable,dataType,dataHex");
-      break;
-    case OutputFormat::YAML:
-      Serial.println("---");
-      break;
+  primaryOutput.setFields(FIELDS);
+  primaryOutput.begin(findFormat(OUTPUT_FORMAT), OutputSink{ serialSink, nullptr });
+  if (primaryOutput.format()->human) printFilterStatus(primaryOutput);
+
+  // An "auxfields" sent before the UART starts replaces these
+  auxOutput.setFields(FIELDS);
+  if (AUX_FORMAT >= 0) {
+    selectAuxFormat(findFormat((OutputFormat)AUX_FORMAT));
+    if (auxOutput.enabled() && auxOutput.format()->human) printFilterStatus(auxOutput);
   }
+  if (COMPRESS_FLAG != 0) primaryOutput.setCompression(true, COMPRESS_BATCH_MS, microsClock);
+  loadStoredRules();
+  if (RAW_CAPTURE_FLAG != 0) setRawCapture((RawMode)RAW_CAPTURE_FLAG);
+  rotationLinker.setMinConfidence(LINK_MIN_CONFIDENCE_FLAG);
+#if SIG_SCAN_FLAG
+  loadDefaultSignatures();
+#endif
   Serial.flush();
   delay(5000);
 
@@ -610,10 +1420,380 @@ void setup() {
   if (!scan->start(0, false)) {
     signalError();
   } else {
+    scanSupervisor.begin(millis());
     signalSuccess();
   }
 }
 
+// --------- Scan control ---------
+// Re-enabling the scan applies new parameters and clears the controller's
+// duplicate cache
+static bool startScan() {
+  NimBLEScan* scan = NimBLEDevice::getScan();
+  applyScanPlan(scan);
+  scan->setDuplicateFilter(duplicateFilter ? 1 : 0);
+  return scan->start(0, false, true);
+}
+
+// Parameter changes; while the scan is down the supervisor's retries apply them
+static void restartScan() {
+  if (!scanSupervisor.down()) startScan();
+}
+
+static void emitScanGap(const ScanGap& gap) {
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "scan_gap";
+  ev.add("start_ms", (int64_t)gap.startMs);
+  ev.add("duration_ms", (int64_t)gap.durationMs);
+  ev.add("cause", scanGapCauseName(gap.cause));
+  if (gap.cause == ScanGapCause::STOPPED) ev.add("nimble_reason", scanEndReason.load(std::memory_order_relaxed));
+  ev.add("attempts", gap.attempts);
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+}
+
+static void superviseScan(uint32_t now) {
+  const bool scanning = NimBLEDevice::getScan()->isScanning();
+  if (scanSupervisor.poll(now, scanning, hciReports.load(std::memory_order_relaxed))) {
+    scanSupervisor.started(now, startScan());
+  }
+  ScanGap gap;
+  if (scanSupervisor.takeClosedGap(gap)) emitScanGap(gap);
+}
+
+// One scan event per change, with the period's observations behind it
+static void emitScanChange(const ScanInputs& in) {
+  const ScanLevel& l = SCAN_LEVELS[scanPlan.level];
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "scan";
+  ev.add("level", scanPlan.level);
+  ev.add("interval_us", (int64_t)l.interval * 625);
+  ev.add("window_us", (int64_t)l.window * 625);
+  ev.add("active", scanPlan.active ? "on" : "off");
+  ev.add("reason", scanReasonName(scanPlan.reason));
+  ev.add("matches", (int64_t)in.matches);
+  ev.add("new_devices", (int64_t)in.newDevices);
+  ev.add("queue_fill_pct", in.queueFillPct);
+  ev.add("cb_cpu_permille", in.cpuPermille);
+  ev.add("unmatched", in.unmatched ? "on" : "off");
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+}
+
+// Raw capture, type discovery and signature scan look at reports that never
+// match; the plan must not scan less for a lack of matches while they run
+static bool wantsUnmatched() {
+  if (rawCapturing.load(std::memory_order_relaxed)) return true;
+  if (discoveryScope.load(std::memory_order_relaxed) != DISCOVERY_OFF) return true;
+#if SIG_SCAN_FLAG
+  if (signatureScan.load(std::memory_order_relaxed) && activeSignatures.load(std::memory_order_relaxed) != nullptr) {
+    return true;
+  }
+#endif
+  return false;
+}
+
+static void updateScanPlan(uint32_t now) {
+  static uint32_t lastPlan = now;
+  static uint32_t lastMatches = 0, lastNew = 0, lastMicros = 0;
+  if (SCAN_ADAPTIVE_FLAG == 0 || now - lastPlan < SCAN_PLAN_PERIOD_MS) return;
+
+  const uint32_t spanMs = now - lastPlan;
+  const uint32_t matches = matchedReports.load(std::memory_order_relaxed);
+  const uint32_t fresh = rateLimiter.newDevices();
+  const uint32_t busyUs = callbackMicros.load(std::memory_order_relaxed);
+  const uint32_t cpu = (busyUs - lastMicros) / spanMs;
+  const ScanInputs in = { matches - lastMatches, fresh - lastNew, recordQueue.fillPercent(),
+                          (uint16_t)(cpu > 1000 ? 1000 : cpu), wantsUnmatched() };
+  lastPlan = now;
+  lastMatches = matches;
+  lastNew = fresh;
+  lastMicros = busyUs;
+
+  const ScanPlan next = planScan(scanPlan, in, SCAN_BUDGET);
+  const bool changed = !sameScanSettings(next, scanPlan);
+  scanPlan = next;
+  if (!changed) return;
+  ++scanChanges;
+  restartScan();
+  emitScanChange(in);
+}
+
+static void refreshDuplicateFilter(uint32_t now) {
+  static uint32_t lastRestart = now;
+  if (!duplicateFilter || duplicateWindowMs == 0 || now - lastRestart < duplicateWindowMs) return;
+  lastRestart = now;
+  restartScan();
+}
+
+// --------- Serial commands ---------
+// Line based, e.g. "format csv", "aux log", "aux off", "pcap all", "compress on",
+// "fields time,vendor,addr,rssi", "auxfields all", "rate google 250 2",
+// "dupfilter on", "rules builtin", "capture on", "sig add tile 16EDFE",
+// "discover all", "link min 75", "follow minutes 30"
+static void handleCommand(char* line) {
+  char* arg = strchr(line, ' ');
+  if (arg != nullptr) *arg++ = '\0';
+
+  if (strcmp(line, "pcap") == 0 && arg != nullptr) {
+    if (strcmp(arg, "all") == 0) captureAllAdvertisements.store(true);
+    else if (strcmp(arg, "matched") == 0) captureAllAdvertisements.store(false);
+    return;
+  }
+
+  if (strcmp(line, "rules") == 0 && arg != nullptr) {
+    handleRulesCommand(arg);
+    return;
+  }
+
+  if (strcmp(line, "capture") == 0 && arg != nullptr) {
+    handleRawCaptureCommand(arg);
+    return;
+  }
+
+#if SIG_SCAN_FLAG
+  if (strcmp(line, "sig") == 0 && arg != nullptr) {
+    handleSignatureCommand(arg);
+    return;
+  }
+#endif
+
+  if (strcmp(line, "discover") == 0 && arg != nullptr) {
+    handleDiscoveryCommand(arg);
+    return;
+  }
+
+  if (strcmp(line, "link") == 0 && arg != nullptr) {
+    handleLinkCommand(arg);
+    return;
+  }
+
+  if (strcmp(line, "follow") == 0 && arg != nullptr) {
+    handleFollowCommand(arg);
+    return;
+  }
+
+  if (strcmp(line, "compress") == 0 && arg != nullptr) {
+    if (strcmp(arg, "on") == 0) primaryOutput.setCompression(true, COMPRESS_BATCH_MS, microsClock);
+    else if (strcmp(arg, "off") == 0) primaryOutput.setCompression(false);
+    return;
+  }
+
+  if (strcmp(line, "dupfilter") == 0 && arg != nullptr) {
+    if (strcmp(arg, "off") == 0) {
+      duplicateFilter = false;
+    } else if (strcmp(arg, "on") == 0) {
+      duplicateFilter = true;
+    } else if (isdigit((unsigned char)arg[0])) {
+      duplicateFilter = true;
+      duplicateWindowMs = (uint32_t)strtoul(arg, nullptr, 10);
+    } else {
+      return;
+    }
+    restartScan();
+    return;
+  }
+
+  if (strcmp(line, "rate") == 0 && arg != nullptr) {
+    // "rate <vendor|all> <interval ms> [burst]"
+    char vendor[16];
+    unsigned long intervalMs, burst = RATE_BURST_FLAG;
+    if (sscanf(arg, "%15s %lu %lu", vendor, &intervalMs, &burst) < 2 || burst == 0 || burst > 255) return;
+    const RateLimit limit = { (uint32_t)intervalMs, (uint8_t)burst };
+    if (strcmp(vendor, "all") == 0) {
+      for (uint8_t v = 0; v < RATE_VENDOR_COUNT; ++v) rateLimiter.setLimit((RateVendor)v, limit);
+    } else if (parseRateVendor(vendor) != RATE_VENDOR_COUNT) {
+      rateLimiter.setLimit(parseRateVendor(vendor), limit);
+    }
+    return;
+  }
+
+  if (arg != nullptr && (strcmp(line, "fields") == 0 || strcmp(line, "auxfields") == 0)) {
+    OutputChannel& target = line[0] == 'a' ? auxOutput : primaryOutput;
+    target.setFields(parseFieldList(arg));   // unknown names (mask 0) are ignored
+    return;
+  }
+
+  OutputChannel* channel = nullptr;
+  if (strcmp(line, "format") == 0) channel = &primaryOutput;
+  else if (strcmp(line, "aux") == 0) channel = &auxOutput;
+  if (channel == nullptr || arg == nullptr) return;
+
+  if (strcmp(arg, "off") == 0) {
+    channel->select(nullptr);
+  } else if (const FormatOps* format = findFormat(arg)) {
+    if (channel == &auxOutput) selectAuxFormat(format);
+    else channel->select(format);
+  }
+}
+
+static void readCommands() {
+  static char line[64];
+  static size_t len = 0;
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c == '\r' || c == '\n') {
+      if (len > 0) {
+        line[len] = '\0';
+        handleCommand(line);
+        len = 0;
+      }
+    } else if (len + 1 < sizeof(line)) {
+      line[len++] = (char)c;
+    }
+  }
+}
+
+// --------- Output writer ---------
+// Emits queued records; returns after one queue's worth so commands and stats
+// still get their turn
+static void drainRecords() {
+  for (size_t i = 0; i < recordQueue.CAPACITY; ++i) {
+    const DeviceRecord* record = recordQueue.front();
+    if (record == nullptr) return;
+    // Each channel formats with the encoder chosen for its session
+    primaryOutput.emit(*record);
+    auxOutput.emit(*record);
+    if (record->matched) trackDevice(*record);
+    recordQueue.pop();
+  }
+}
+
+// --------- Stats ---------
+static void addChannelStats(EventRecord& ev, OutputChannel& channel, const char* const keys[7]) {
+  const OutputChannel::Stats s = channel.stats();
+  ev.add(keys[0], (int64_t)s.records);
+  ev.add(keys[6], s.records > 0 ? (int64_t)(s.rawBytes / s.records) : 0);
+  ev.add(keys[1], (int64_t)s.rawBytes);
+  ev.add(keys[2], (int64_t)s.compressedBytes);
+  // Ratio of wire bytes to raw bytes, and encoder cost per KB of raw output
+  ev.add(keys[3], s.rawBytes > 0 ? (int64_t)(s.compressedBytes * 100 / s.rawBytes) : 0);
+  ev.add(keys[4], s.rawBytes > 0 ? (int64_t)(s.compressMicros * 1024 / s.rawBytes) : 0);
+  ev.add(keys[5], channel.compressed() ? "on" : "off");
+}
+
+static void emitStats() {
+  static const char* const PRIMARY_KEYS[7] = {
+    "records", "comp_in", "comp_out", "comp_ratio_pct", "comp_us_per_kb", "compress", "bytes_per_record"
+  };
+  static const char* const AUX_KEYS[7] = {
+    "aux_records", "aux_comp_in", "aux_comp_out", "aux_comp_ratio_pct", "aux_comp_us_per_kb", "aux_compress",
+    "aux_bytes_per_record"
+  };
+
+  EventRecord ev;
+  gettimeofday(&ev.time, nullptr);
+  ev.kind = "stats";
+  ev.add("uptime_ms", (int64_t)millis());
+  // Load shedding: current and peak level, effective RSSI floor, repeats shed
+  ev.add("shed_level", loadShedder.level());
+  ev.add("shed_max_level", loadShedder.takeMaxLevel());
+  ev.add("shed_rssi_floor", loadShedder.rssiFloor());
+  ev.add("shed_rssi", (int64_t)loadShedder.shedRssi());
+  ev.add("shed_sampled", (int64_t)loadShedder.shedSampled());
+  ev.add("queue_fill_pct", recordQueue.fillPercent());
+  ev.add("queue_max", (int64_t)recordQueue.highWater());
+  ev.add("queue_overflow", (int64_t)recordQueue.overflows());
+  ev.add("queue_truncated", (int64_t)recordQueue.truncated());
+  // Rate limiting: sightings folded into later records, folds lost to eviction
+  ev.add("rate_folded", (int64_t)rateLimiter.folded());
+  ev.add("rate_fold_lost", (int64_t)rateLimiter.foldLost());
+  ev.add("rate_devices", (int64_t)rateLimiter.devices());
+  // Scanning uptime: time without a running scan, gaps, restarts it took
+  ev.add("scan_state", scanSupervisor.down() ? "down" : "up");
+  ev.add("scan_up_permille", scanSupervisor.upPermille(millis()));
+  ev.add("scan_down_ms", (int64_t)scanSupervisor.downMs(millis()));
+  ev.add("scan_gaps", (int64_t)scanSupervisor.gaps());
+  ev.add("scan_gap_last_ms", (int64_t)scanSupervisor.lastGapMs());
+  ev.add("scan_gap_max_ms", (int64_t)scanSupervisor.maxGapMs());
+  ev.add("scan_stalls", (int64_t)scanSupervisor.stalls());
+  ev.add("scan_restarts", (int64_t)scanSupervisor.restarts());
+  // Scan plan in force and how often it changed
+  ev.add("scan_level", scanPlan.level);
+  ev.add("scan_duty_pct", SCAN_LEVELS[scanPlan.level].dutyPct);
+  ev.add("scan_active", scanPlan.active ? "on" : "off");
+  ev.add("scan_reason", scanReasonName(scanPlan.reason));
+  ev.add("scan_changes", (int64_t)scanChanges);
+  // Active scanning: advertisements held for a scan response, merged with
+  // one, sent alone; responses with nothing held; the table's RAM
+  ev.add("rsp_held", (int64_t)scanMerger.held());
+  ev.add("rsp_merged", (int64_t)scanMerger.merged());
+  ev.add("rsp_unanswered", (int64_t)scanMerger.unanswered());
+  ev.add("rsp_orphans", (int64_t)scanMerger.orphans());
+  ev.add("rsp_hit_pct", scanMerger.hitPercent());
+  ev.add("rsp_mem_bytes", (int64_t)ScanMerger::memoryBytes());
+  // Match rules in force; 0 = built-in classifier
+  const RuleProgram* rules = activeRules.load();
+  ev.add("match_rules", (int64_t)(rules != nullptr ? rules->rules() : 0));
+#if SIG_SCAN_FLAG
+  // Signature scan: set size, automaton states, reports with hits, and
+  // those lost to a full hit queue
+  const SignatureMatcher* matcher = activeSignatures.load();
+  ev.add("sig_scan", signatureScan.load() ? "on" : "off");
+  ev.add("sig_count", (int64_t)signatures.size());
+  ev.add("sig_states", (int64_t)(matcher != nullptr ? matcher->states() : 0));
+  ev.add("sig_hit_reports", (int64_t)signatureHitReports.load(std::memory_order_relaxed));
+  ev.add("sig_dropped", (int64_t)signatureHits.overflows());
+#endif
+  // Scan callback load since the previous stats event, to compare duplicate
+  // filter modes: reports per second, handling time, share of one core
+  static uint32_t lastMs = 0, lastReports = 0, lastMicros = 0;
+  const uint32_t nowMs = millis();
+  const uint32_t reports = hciReports.load(std::memory_order_relaxed);
+  const uint32_t busyUs = callbackMicros.load(std::memory_order_relaxed);
+  const uint32_t spanMs = nowMs - lastMs;
+  ev.add("dup_filter", duplicateFilter ? "on" : "off");
+  ev.add("dup_window_ms", (int64_t)duplicateWindowMs);
+  ev.add("hci_reports", (int64_t)reports);
+  ev.add("hci_reports_per_s", spanMs > 0 ? (int64_t)(reports - lastReports) * 1000 / spanMs : 0);
+  ev.add("cb_us_per_report", reports != lastReports ? (int64_t)((busyUs - lastMicros) / (reports - lastReports)) : 0);
+  ev.add("cb_cpu_permille", spanMs > 0 ? (int64_t)(busyUs - lastMicros) / spanMs : 0);
+  lastMs = nowMs;
+  lastReports = reports;
+  lastMicros = busyUs;
+  addChannelStats(ev, primaryOutput, PRIMARY_KEYS);
+  if (auxOutput.enabled()) addChannelStats(ev, auxOutput, AUX_KEYS);
+
+  primaryOutput.emitEvent(ev);
+  auxOutput.emitEvent(ev);
+  // Raw capture counters in their own event, once it has been used
+  if (rawCapture.capacity() > 0) emitRawCaptureEvent(nullptr);
+  if (rotationLinking) emitLinkerStats();
+  if (followDetection) emitFollowerStats();
+}
+
 void loop() {
-  delay(100);
+  readCommands();
+  drainRecords();
+  drainRawCapture();
+#if SIG_SCAN_FLAG
+  drainSignatureHits();
+#endif
+  drainDiscoverySamples();
+
+  const uint32_t now = millis();
+  static uint32_t lastStats = now;
+  if (STATS_INTERVAL_MS > 0 && now - lastStats >= STATS_INTERVAL_MS) {
+    lastStats = now;
+    emitStats();
+  }
+  static uint32_t lastDiscoveryTop = now;
+  if (DISCOVERY_REPORT_MS_FLAG > 0 && discoveryScope.load() != DISCOVERY_OFF &&
+      now - lastDiscoveryTop >= DISCOVERY_REPORT_MS_FLAG) {
+    lastDiscoveryTop = now;
+    emitDiscoveryTop();
+  }
+
+  if (rotationLinking) rotationLinker.poll(epochMillis(), onLink);
+
+  refreshDuplicateFilter(now);
+  updateScanPlan(now);
+  superviseScan(now);
+
+  // Close compressed batches that are due
+  primaryOutput.tick(now);
+  auxOutput.tick(now);
+  if (recordQueue.front() == nullptr && (rawMode != RawMode::STREAM || rawCapture.front() == nullptr)) delay(5);
 }
@@ -0,0 +1,2745 @@
+// FindMyScanner host decoder.
+//
+// Turns the binary output formats back into the text shapes the firmware
+// writes, so existing CSV/JSON tooling keeps working.
+//
+// Build:  c++ -std=c++17 -O2 -Iinclude -o tools/bin/fmsdecode tools/fmsdecode.cpp
+// Usage:  fmsdecode cbor [csv|jsonl] < capture.cbor
+//         fmsdecode delta [csv|jsonl] < capture.delta
+//         fmsdecode expand [csv|jsonl] < capture.compact
+//         fmsdecode unz < serial > capture          (compressed stream)
+//         fmsdecode verify FORMAT < capture        (seq/crc loss report; skips raw frames)
+//         fmsdecode pcap --out PREFIX [--rotate-mb N] [--rotate-sec N] < serial
+//         fmsdecode pcap --fifo PATH < serial     (wireshark -k -i PATH)
+//         fmsdecode schedule [--duty N] [--cpu N] [--active] [--unmatched] < capture.csv|compact
+//         fmsdecode synth FORMAT|raw [N] > capture  (synthetic extended reports)
+//         fmsdecode rules compile|serial|check FILE  (match rules, match_rules.h)
+//         fmsdecode sig check [N]       (signature scan against a naive search, signature_scan.h)
+//         fmsdecode raw < serial > capture.csv        (raw capture frames, raw_capture.h)
+//         fmsdecode link-bench [DEVICES] [MINUTES] [SEED]  (rotation linker, rotation_linker.h)
+//         fmsdecode format check [N]    (record formats against the snprintf originals, record_formats.h)
+//         fmsdecode format parse [N]    (CSV against JSON Lines parse speed)
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cbor_record.h"
+#include "find_my_match.h"
+#include "lzss_stream.h"
+#include "match_rules.h"
+#include "output_channel.h"
+#include "rate_limiter.h"
+#include "raw_capture.h"
+#include "record_queue.h"
+#include "rotation_linker.h"
+#include "scan_scheduler.h"
+#include "signature_scan.h"
+
+static void stdoutSink(void*, const uint8_t* data, size_t len) {
+  fwrite(data, 1, len, stdout);
+}
+
+// Raw capture frames (raw_capture.h) share the primary channel with the
+// records. Readers that only want the records set this, and every whole,
+// CRC-checked frame is then cut out of stdin before they see it.
+static bool dropRawFrames = false;
+static unsigned long droppedRawFrames = 0;
+
+static size_t readStdin(uint8_t* out, size_t cap) {
+  if (!dropRawFrames) return fread(out, 1, cap, stdin);
+  static std::vector<uint8_t> held;   // read, not yet handed out
+  static bool eof = false;
+  size_t n = 0;
+  while (n == 0) {
+    if (!eof && held.size() < RAW_FRAME_MAX + cap) {
+      uint8_t chunk[4096];
+      const size_t got = fread(chunk, 1, sizeof(chunk), stdin);
+      if (got == 0) eof = true;
+      held.insert(held.end(), chunk, chunk + got);
+    }
+    if (held.empty()) return 0;
+    size_t i = 0;
+    while (i < held.size() && n < cap) {
+      if (held[i] == RAW_MAGIC0) {
+        size_t len = checkRawFrame(held.data() + i, held.size() - i);
+        if (len == RAW_FRAME_NEED_MORE) {
+          if (!eof) break;              // might be a frame: wait for the rest
+          len = 0;
+        }
+        if (len > 0) {
+          i += len;
+          ++droppedRawFrames;
+          continue;
+        }
+      }
+      out[n++] = held[i++];
+    }
+    held.erase(held.begin(), held.begin() + i);
+  }
+  return n;
+}
+
+// Buffered stdin; decoders consume from the front and ask for more
+class InputBuffer {
+public:
+  // Ensures at least `want` bytes are buffered unless stdin is exhausted
+  size_t fill(size_t want) {
+    if (pos_ > 0 && pos_ >= buf_.size() / 2) {
+      buf_.erase(buf_.begin(), buf_.begin() + pos_);
+      pos_ = 0;
+    }
+    uint8_t chunk[4096];
+    while (!eof_ && available() < want) {
+      size_t n = readStdin(chunk, sizeof(chunk));
+      if (n == 0) { eof_ = true; break; }
+      buf_.insert(buf_.end(), chunk, chunk + n);
+    }
+    return available();
+  }
+
+  const uint8_t* data() const { return buf_.data() + pos_; }
+  size_t available() const { return buf_.size() - pos_; }
+  void consume(size_t n) { pos_ += n; }
+  bool eof() const { return eof_; }
+
+private:
+  std::vector<uint8_t> buf_;
+  size_t pos_ = 0;
+  bool eof_ = false;
+};
+
+struct DecodeStats {
+  unsigned long records = 0;
+  unsigned long skippedBytes = 0;
+};
+
+// Largest encoded record we expect; below this we wait for more input before
+// declaring a decode failure
+constexpr size_t MAX_RECORD_BYTES = 1024;
+
+static int decodeCbor(const FormatOps* out) {
+  InputBuffer in;
+  DecodeStats stats;
+  uint8_t outBuf[512];
+  char typeBuf[64];
+  char eventStrings[1024];
+
+  {
+    OutWriter w(outBuf, sizeof(outBuf), stdoutSink, nullptr);
+    out->header(w, FULL_RECORD);
+  }
+
+  while (in.fill(MAX_RECORD_BYTES) > 0) {
+    const uint8_t* p = in.data();
+    const size_t n = in.available();
+
+    // Self-describe tag at (re)start of a session
+    if (n >= 3 && p[0] == 0xD9 && p[1] == 0xD9 && p[2] == 0xF7) {
+      in.consume(3);
+      continue;
+    }
+
+    cbor::Reader rd = { p, p + n };
+    cbor::Reader erd = rd;
+    DeviceRecord r;
+    EventRecord ev;
+    if (decodeCborRecord(rd, r, typeBuf, sizeof(typeBuf))) {
+      OutWriter w(outBuf, sizeof(outBuf), stdoutSink, nullptr);
+      out->record(w, r, FULL_RECORD);
+      in.consume((size_t)(rd.p - p));
+      ++stats.records;
+    } else if (decodeCborEvent(erd, ev, eventStrings, sizeof(eventStrings))) {
+      OutWriter w(outBuf, sizeof(outBuf), stdoutSink, nullptr);
+      if (out->event != nullptr) out->event(w, ev);
+      in.consume((size_t)(erd.p - p));
+    } else {
+      // Garbage (boot messages, line noise): resync one byte further
+      in.consume(1);
+      ++stats.skippedBytes;
+    }
+  }
+
+  fprintf(stderr, "fmsdecode: %lu records, %lu bytes skipped\n", stats.records, stats.skippedBytes);
+  return 0;
+}
+
+// --------- Delta ---------
+
+static int decodeDelta(const FormatOps* out) {
+  InputBuffer in;
+  DeltaDecoder decoder;
+  unsigned long skippedBytes = 0;
+  uint64_t bytes = 0;
+  uint8_t outBuf[512];
+
+  {
+    OutWriter w(outBuf, sizeof(outBuf), stdoutSink, nullptr);
+    out->header(w, FULL_RECORD);
+  }
+
+  while (in.fill(MAX_RECORD_BYTES) > 0) {
+    size_t used = 0;
+    const DeltaDecoder::Result res = decoder.feed(in.data(), in.available(), used);
+    if (res == DeltaDecoder::Result::NEED_MORE) {
+      if (!in.eof()) continue;
+      skippedBytes += in.available();   // truncated tail
+      break;
+    }
+
+    OutWriter w(outBuf, sizeof(outBuf), stdoutSink, nullptr);
+    if (res == DeltaDecoder::Result::RECORD) {
+      out->record(w, decoder.record(), FULL_RECORD);
+      bytes += used;
+    } else if (res == DeltaDecoder::Result::EVENT) {
+      if (out->event != nullptr) out->event(w, decoder.event());
+    } else if (res == DeltaDecoder::Result::BAD) {
+      skippedBytes += used;
+    }
+    in.consume(used);
+  }
+
+  const DeltaDecoder::Stats& st = decoder.stats();
+  const unsigned long records = st.defines + st.deltas;
+  fprintf(stderr, "fmsdecode: %lu records (%lu define, %lu delta), %.1f bytes/record, "
+                  "%lu events, %lu unknown id, %lu bytes skipped\n",
+          records, st.defines, st.deltas, records > 0 ? (double)bytes / records : 0.0,
+          st.events, st.unknownId, skippedBytes);
+  return 0;
+}
+
+// --------- Compact text ---------
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static bool parseHex(const char* s, size_t digits, uint8_t* out) {
+  for (size_t i = 0; i < digits; i += 2) {
+    int hi = hexValue(s[i]), lo = hexValue(s[i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    out[i / 2] = (uint8_t)((hi << 4) | lo);
+  }
+  return true;
+}
+
+// "1700000000123 A12 b49bc6cdb2ab -59 30 4C001219... +12:-71:-58 ~33:4 #7 *1A2B"
+// -> DeviceRecord (the trailers are optional; seq and crc are not checked here)
+static bool parseCompactLine(char* line, DeviceRecord& r, uint8_t* data, size_t dataCap) {
+  char* tok[6] = {};
+  char* fold = nullptr;
+  char* ext = nullptr;
+  size_t n = 0;
+  for (char* save = nullptr, *t = strtok_r(line, " \r\n", &save); t != nullptr;
+       t = strtok_r(nullptr, " \r\n", &save)) {
+    if (n >= 5 && (t[0] == '#' || t[0] == '*' || t[0] == '+' || t[0] == '~')) {
+      if (t[0] == '+') fold = t + 1;
+      if (t[0] == '~') ext = t + 1;
+      n = 6;
+    } else if (n < 6) {
+      tok[n++] = t;
+    }
+  }
+  if (n < 5) return false;
+
+  char* end;
+  const unsigned long long ms = strtoull(tok[0], &end, 10);
+  if (*end != '\0' || strlen(tok[1]) != 3 || strlen(tok[2]) != 12 || strlen(tok[4]) != 2) return false;
+  const long rssi = strtol(tok[3], &end, 10);
+  if (*end != '\0') return false;
+
+  uint8_t typeId, addr[6], af;
+  if (!parseHex(tok[1] + 1, 2, &typeId) || !parseHex(tok[2], 12, addr) || !parseHex(tok[4], 2, &af)) return false;
+  const size_t hexLen = tok[5] != nullptr ? strlen(tok[5]) : 0;
+  if (hexLen % 2 != 0 || hexLen / 2 > dataCap || !parseHex(tok[5], hexLen, data)) return false;
+
+  r = DeviceRecord{};
+  r.matched = true;
+  r.time.tv_sec = (time_t)(ms / 1000);
+  r.time.tv_usec = (suseconds_t)((ms % 1000) * 1000);
+  r.manufacturer = companyFromCode(tok[1][0]);
+  r.typeId = typeId;
+  for (int b = 0; b < 6; ++b) r.addr[b] = addr[5 - b];
+  r.rssi = (int)rssi;
+  r.advType = (uint8_t)(af >> 4);
+  r.isConnectable = (af & fields::COMPACT_FLAG_CONN) != 0;
+  r.isScannable = (af & fields::COMPACT_FLAG_SCAN) != 0;
+  r.dataType = (af & fields::COMPACT_FLAG_SERVICE) ? DataSource::SERVICE : DataSource::MANUFACTURER;
+  r.data = data;
+  r.dataLen = hexLen / 2;
+  if (fold != nullptr) {
+    long count, lo, hi;
+    if (sscanf(fold, "%ld:%ld:%ld", &count, &lo, &hi) != 3 || count <= 0 || count > 0xFFFF) return false;
+    r.suppressed = (uint16_t)count;
+    r.rssiMin = (int8_t)lo;
+    r.rssiMax = (int8_t)hi;
+  }
+  if (ext != nullptr) {
+    unsigned long sid;
+    if (hexValue(ext[0]) < 0 || hexValue(ext[1]) < 0 || ext[2] != ':' ||
+        (sid = strtoul(ext + 3, &end, 10)) > 0xFF || *end != '\0') return false;
+    r.advType = ADV_TYPE_EXT;
+    r.primaryPhy = (uint8_t)hexValue(ext[0]);
+    r.secondaryPhy = (uint8_t)hexValue(ext[1]);
+    r.sid = (uint8_t)sid;
+  }
+  // The type string is not on the wire; classify the payload again
+  r.deviceType = r.dataType == DataSource::SERVICE
+                   ? serviceFindMyType(manufacturerToService(r.manufacturer), data, r.dataLen)
+                   : findMyType(r.manufacturer, data, r.dataLen);
+  decodeVendor(r);
+  return true;
+}
+
+static int expandCompact(const FormatOps* out) {
+  unsigned long records = 0, comments = 0, rejected = 0;
+  uint8_t outBuf[512];
+  uint8_t data[255];
+  char* line = nullptr;
+  size_t lineCap = 0;
+
+  {
+    OutWriter w(outBuf, sizeof(outBuf), stdoutSink, nullptr);
+    out->header(w, FULL_RECORD);
+  }
+
+  while (getline(&line, &lineCap, stdin) > 0) {
+    // Events are CSV comment lines already
+    if (line[0] == '#') {
+      if (out->id == OutputFormat::CSV) fputs(line, stdout);
+      ++comments;
+      continue;
+    }
+    DeviceRecord r;
+    if (!parseCompactLine(line, r, data, sizeof(data))) {
+      ++rejected;
+      continue;
+    }
+    OutWriter w(outBuf, sizeof(outBuf), stdoutSink, nullptr);
+    out->record(w, r, FULL_RECORD);
+    ++records;
+  }
+  free(line);
+
+  fprintf(stderr, "fmsdecode: %lu records, %lu comment lines, %lu other lines dropped\n",
+          records, comments, rejected);
+  return 0;
+}
+
+// --------- Compressed stream ---------
+
+// Expands LZSS frames; bytes outside frames (boot banner, text written before
+// compression was switched on) are passed through unchanged. Raw capture
+// frames sent uncompressed are passed through whole, without looking for
+// LZSS frames inside them.
+static int decodeLzss() {
+  InputBuffer in;
+  LzssDecoder decoder;
+  unsigned long ok = 0, bad = 0, skipped = 0, rawFrames = 0;
+  uint64_t rawBytes = 0, wireBytes = 0;
+
+  while (in.fill(std::max(LZSS_MAX_FRAME, RAW_FRAME_MAX)) > 0) {
+    const uint8_t* p = in.data();
+    const size_t n = in.available();
+
+    if (n >= 2 && p[0] == RAW_MAGIC0 && p[1] == RAW_MAGIC1) {
+      const size_t len = checkRawFrame(p, n);
+      if (len != 0 && len != RAW_FRAME_NEED_MORE) {
+        fwrite(p, 1, len, stdout);
+        in.consume(len);
+        ++rawFrames;
+        continue;
+      }
+    }
+    if (!(n >= 2 && p[0] == LZSS_MAGIC0 && p[1] == LZSS_MAGIC1)) {
+      // Pass through everything up to the next possible frame start
+      const uint8_t* next = (const uint8_t*)memchr(p + 1, LZSS_MAGIC0, n - 1);
+      size_t run = next != nullptr ? (size_t)(next - p) : n;
+      if (run == n && p[n - 1] == LZSS_MAGIC0 && !in.eof()) --run;
+      if (run == 0) run = 1;
+      fwrite(p, 1, run, stdout);
+      in.consume(run);
+      continue;
+    }
+
+    size_t used = 0;
+    switch (decoder.decode(p, n, used)) {
+      case LzssDecoder::Result::OK:
+        fwrite(decoder.out(), 1, decoder.outLen(), stdout);
+        rawBytes += decoder.outLen();
+        wireBytes += used;
+        ++ok;
+        break;
+      case LzssDecoder::Result::SKIPPED:
+        ++skipped;
+        break;
+      case LzssDecoder::Result::BAD_FRAME:
+        ++bad;
+        break;
+      case LzssDecoder::Result::NEED_MORE:
+        if (!in.eof()) continue;
+        used = n;   // truncated tail
+        ++bad;
+        break;
+    }
+    in.consume(used);
+  }
+  fflush(stdout);
+
+  fprintf(stderr, "fmsdecode: %lu frames ok, %lu bad, %lu skipped (waiting for reset); "
+                  "%llu wire bytes -> %llu bytes; %lu raw capture frames passed through\n",
+          ok, bad, skipped, (unsigned long long)wireBytes, (unsigned long long)rawBytes, rawFrames);
+  return 0;
+}
+
+// --------- Raw capture ---------
+
+// Raw capture frames -> CSV, one line per report. Bytes outside frames
+// (text records and events on the same port) are skipped. Sequence numbers
+// number every report the firmware admitted, so a gap is a report it
+// dropped (ring full) or one lost with a damaged frame; a sequence that
+// starts over is a reboot.
+static int decodeRaw() {
+  InputBuffer in;
+  RawReport<EXTENDED_PAYLOAD_MAX> r;
+  unsigned long frames = 0, bad = 0, reports = 0, missing = 0, restarts = 0, skipped = 0;
+  bool first = true;
+  uint32_t expected = 0;
+
+  printf("seq,time_us,addr,addr_type,rssi,adv,connectable,scannable,extended,phy,phy2,sid,payload\n");
+  while (in.fill(RAW_FRAME_MAX) > 0) {
+    const uint8_t* p = in.data();
+    const size_t n = in.available();
+    size_t frameLen = checkRawFrame(p, n);
+    if (frameLen == RAW_FRAME_NEED_MORE) {
+      if (!in.eof()) continue;
+      frameLen = 0;
+    }
+    if (frameLen == 0) {
+      if (n >= 2 && p[0] == RAW_MAGIC0 && p[1] == RAW_MAGIC1) ++bad;
+      const uint8_t* next = (const uint8_t*)memchr(p + 1, RAW_MAGIC0, n - 1);
+      const size_t run = next != nullptr ? (size_t)(next - p) : n;
+      skipped += run;
+      in.consume(run);
+      continue;
+    }
+
+    ++frames;
+    for (size_t at = RAW_FRAME_HEADER, i = 0; i < p[2]; ++i) {
+      const size_t used = decodeRawReport(p + at, frameLen - RAW_FRAME_TRAILER - at, r);
+      if (used == 0) break;
+      at += used;
+      ++reports;
+      if (!first && r.seq > expected) missing += r.seq - expected;
+      if (!first && r.seq < expected) ++restarts;
+      first = false;
+      expected = r.seq + 1;
+
+      printf("%u,%llu,%02x:%02x:%02x:%02x:%02x:%02x,%u,%d,%s,%d,%d,%d,%s,%s,", r.seq,
+             (unsigned long long)r.timeUs, r.addr[5], r.addr[4], r.addr[3], r.addr[2], r.addr[1], r.addr[0],
+             r.addrType, r.rssi, advTypeName(r.advType), (r.flags & RAW_FLAG_CONNECTABLE) != 0,
+             (r.flags & RAW_FLAG_SCANNABLE) != 0, (r.flags & RAW_FLAG_EXTENDED) != 0,
+             (r.flags & RAW_FLAG_EXTENDED) != 0 ? phyName(r.phy & 0x0F) : "1M",
+             (r.flags & RAW_FLAG_EXTENDED) != 0 ? phyName(r.phy >> 4) : "");
+      if ((r.flags & RAW_FLAG_EXTENDED) != 0) printf("%u", r.flags >> 4);
+      putchar(',');
+      for (size_t b = 0; b < r.payloadLen; ++b) printf("%02X", r.payload[b]);
+      putchar('\n');
+    }
+    in.consume(frameLen);
+  }
+  fflush(stdout);
+
+  fprintf(stderr, "fmsdecode: %lu frames ok, %lu bad, %lu bytes skipped; %lu reports, %lu missing, "
+                  "%lu restarts\n",
+          frames, bad, skipped, reports, missing, restarts);
+  return 0;
+}
+
+// --------- pcap -> pcapng ---------
+
+// pcapng writer for one BLE link-layer interface. Output goes either to
+// rolling files (PREFIX-YYYYmmdd-HHMMSS.pcapng) or to a named pipe that
+// Wireshark reads live; a reader that goes away is waited for again.
+class PcapngWriter {
+public:
+  bool openFiles(const char* prefix, uint64_t rotateBytes, uint32_t rotateSec) {
+    prefix_ = prefix;
+    rotateBytes_ = rotateBytes;
+    rotateSec_ = rotateSec;
+    return rotate();
+  }
+
+  bool openFifo(const char* path) {
+    fifo_ = path;
+    struct stat st;
+    if (stat(path, &st) != 0 && mkfifo(path, 0644) != 0) {
+      fprintf(stderr, "fmsdecode: cannot create fifo %s: %s\n", path, strerror(errno));
+      return false;
+    }
+    return reopenFifo();
+  }
+
+  bool packet(uint32_t tsSec, uint32_t tsUsec, const uint8_t* data, uint32_t len) {
+    if (!fifo_.empty() && fd_ < 0 && !reopenFifo()) return false;
+    if (fifo_.empty() && needsRotation(tsSec) && !rotate()) return false;
+    if (fileStart_ == 0) fileStart_ = tsSec;
+
+    const uint32_t padded = (len + 3) & ~3u;
+    const uint32_t total = 32 + padded;
+    const uint64_t ts = (uint64_t)tsSec * 1000000u + tsUsec;
+    uint8_t head[28];
+    le32(head + 0, 6);                           // Enhanced Packet Block
+    le32(head + 4, total);
+    le32(head + 8, 0);                           // interface id
+    le32(head + 12, (uint32_t)(ts >> 32));
+    le32(head + 16, (uint32_t)ts);
+    le32(head + 20, len);
+    le32(head + 24, len);
+    const uint8_t pad[4] = { 0, 0, 0, 0 };
+    uint8_t tail[4];
+    le32(tail, total);
+    return put(head, sizeof(head)) && put(data, len) && put(pad, padded - len) && put(tail, sizeof(tail));
+  }
+
+  void close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+  }
+
+private:
+  static void le16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+  static void le32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; ++i) p[i] = (uint8_t)(v >> (8 * i)); }
+
+  bool needsRotation(uint32_t tsSec) const {
+    if (fd_ < 0) return true;
+    if (rotateBytes_ > 0 && written_ >= rotateBytes_) return true;
+    if (rotateSec_ > 0 && fileStart_ != 0 && tsSec >= fileStart_ + rotateSec_) return true;
+    return false;
+  }
+
+  bool rotate() {
+    close();
+    char stamp[32];
+    const time_t now = time(nullptr);
+    struct tm tmNow;
+    localtime_r(&now, &tmNow);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tmNow);
+    std::string name = prefix_ + "-" + stamp;
+    if (name == lastName_) name += "-" + std::to_string(++sameSecond_);
+    else { lastName_ = name; sameSecond_ = 0; }
+    name += ".pcapng";
+
+    fd_ = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+      fprintf(stderr, "fmsdecode: cannot open %s: %s\n", name.c_str(), strerror(errno));
+      return false;
+    }
+    fprintf(stderr, "fmsdecode: writing %s\n", name.c_str());
+    written_ = 0;
+    fileStart_ = 0;
+    return writeSectionHeader();
+  }
+
+  bool reopenFifo() {
+    close();
+    fprintf(stderr, "fmsdecode: waiting for a reader on %s\n", fifo_.c_str());
+    fd_ = ::open(fifo_.c_str(), O_WRONLY);
+    if (fd_ < 0) return false;
+    return writeSectionHeader();
+  }
+
+  bool writeSectionHeader() {
+    uint8_t shb[28];
+    le32(shb + 0, 0x0A0D0D0A);                   // Section Header Block
+    le32(shb + 4, sizeof(shb));
+    le32(shb + 8, 0x1A2B3C4D);                   // byte-order magic
+    le16(shb + 12, 1);
+    le16(shb + 14, 0);
+    le32(shb + 16, 0xFFFFFFFF);                  // section length unknown
+    le32(shb + 20, 0xFFFFFFFF);
+    le32(shb + 24, sizeof(shb));
+
+    uint8_t idb[20];
+    le32(idb + 0, 1);                            // Interface Description Block
+    le32(idb + 4, sizeof(idb));
+    le16(idb + 8, (uint16_t)DLT_BLUETOOTH_LE_LL_WITH_PHDR);
+    le16(idb + 10, 0);
+    le32(idb + 12, PCAP_SNAPLEN);
+    le32(idb + 16, sizeof(idb));
+    return put(shb, sizeof(shb)) && put(idb, sizeof(idb));
+  }
+
+  bool put(const uint8_t* p, size_t n) {
+    while (n > 0) {
+      ssize_t w = ::write(fd_, p, n);
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) {
+        // Wireshark closed the pipe: drop this packet, wait for a new reader
+        if (!fifo_.empty() && errno == EPIPE) { close(); return true; }
+        fprintf(stderr, "fmsdecode: write failed: %s\n", strerror(errno));
+        return false;
+      }
+      p += w;
+      n -= (size_t)w;
+      written_ += (uint64_t)w;
+    }
+    return true;
+  }
+
+  std::string prefix_, fifo_, lastName_;
+  int sameSecond_ = 0;
+  uint64_t rotateBytes_ = 0;
+  uint32_t rotateSec_ = 0;
+  uint32_t fileStart_ = 0;
+  uint64_t written_ = 0;
+  int fd_ = -1;
+};
+
+static uint32_t rdLe32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// A pcap record from the firmware is recognised by its lengths, the advertising
+// access address in both the pseudo-header and the packet, and the LL CRC.
+// Returns the record size, or 0 if `p` does not start a valid record.
+static size_t checkPcapRecord(const uint8_t* p, size_t n) {
+  constexpr size_t minPacket = BLE_PHDR_LEN + 4 + 2 + 6 + 3;
+  if (n < PCAP_RECORD_HEADER_LEN + minPacket) return 0;
+  const uint32_t inclLen = rdLe32(p + 8);
+  if (inclLen != rdLe32(p + 12) || inclLen < minPacket || inclLen > PCAP_SNAPLEN) return 0;
+  if (n < PCAP_RECORD_HEADER_LEN + inclLen) return 0;
+
+  const uint8_t* pkt = p + PCAP_RECORD_HEADER_LEN;
+  if (rdLe32(pkt + 4) != BLE_ADV_ACCESS_ADDRESS) return 0;
+  const uint8_t* ll = pkt + BLE_PHDR_LEN;
+  if (rdLe32(ll) != BLE_ADV_ACCESS_ADDRESS) return 0;
+  // The Coded PHY has a coding indicator after the access address
+  const uint16_t flags = (uint16_t)(pkt[8] | (pkt[9] << 8));
+  const uint8_t* pdu = ll + 4 + ((flags >> BLE_PHDR_PHY_SHIFT) == 2 ? 1 : 0);
+  const size_t pduLen = 2 + (size_t)pdu[1];
+  if ((size_t)(pdu - pkt) + pduLen + 3 != inclLen) return 0;
+
+  const uint32_t crc = bleCrc24Update(bleCrc24Start(BLE_ADV_CRC_INIT), pdu, pduLen);
+  const uint8_t* wire = pdu + pduLen;
+  if (((uint32_t)wire[0] | ((uint32_t)wire[1] << 8) | ((uint32_t)wire[2] << 16)) != crc) return 0;
+  return PCAP_RECORD_HEADER_LEN + inclLen;
+}
+
+static int decodePcap(int argc, char** argv) {
+  const char* prefix = nullptr;
+  const char* fifo = nullptr;
+  uint64_t rotateBytes = 64ull << 20;
+  uint32_t rotateSec = 0;
+  for (int i = 0; i < argc; ++i) {
+    const bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--out") == 0 && hasValue) prefix = argv[++i];
+    else if (strcmp(argv[i], "--fifo") == 0 && hasValue) fifo = argv[++i];
+    else if (strcmp(argv[i], "--rotate-mb") == 0 && hasValue) rotateBytes = strtoull(argv[++i], nullptr, 10) << 20;
+    else if (strcmp(argv[i], "--rotate-sec") == 0 && hasValue) rotateSec = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else return -1;
+  }
+  if ((prefix == nullptr) == (fifo == nullptr)) return -1;
+
+  signal(SIGPIPE, SIG_IGN);
+  PcapngWriter out;
+  if (fifo != nullptr ? !out.openFifo(fifo) : !out.openFiles(prefix, rotateBytes, rotateSec)) return 1;
+
+  InputBuffer in;
+  DecodeStats stats;
+  while (in.fill(PCAP_RECORD_HEADER_LEN + PCAP_SNAPLEN) > 0) {
+    const uint8_t* p = in.data();
+    const size_t n = in.available();
+
+    // Global header at the start of each firmware session
+    if (n >= 24 && rdLe32(p) == PCAP_MAGIC && rdLe32(p + 20) == DLT_BLUETOOTH_LE_LL_WITH_PHDR) {
+      in.consume(24);
+      continue;
+    }
+
+    const size_t len = checkPcapRecord(p, n);
+    if (len > 0) {
+      if (!out.packet(rdLe32(p), rdLe32(p + 4), p + PCAP_RECORD_HEADER_LEN, (uint32_t)(len - PCAP_RECORD_HEADER_LEN))) return 1;
+      in.consume(len);
+      ++stats.records;
+    } else {
+      in.consume(1);
+      ++stats.skippedBytes;
+    }
+  }
+  out.close();
+
+  fprintf(stderr, "fmsdecode: %lu packets, %lu bytes skipped\n", stats.records, stats.skippedBytes);
+  return 0;
+}
+
+// --------- Record checks ---------
+
+// Loss and corruption accounting from the seq and crc columns, per session
+// (a format header, or the sequence starting over after a reboot) and per
+// minute of record time. "missing" counts sequence numbers that never arrived
+// intact; those that left no damaged record behind are "without trace".
+class LossReport {
+public:
+  // A record that arrived intact. Binary formats carry the low 16 bits of
+  // seq, so their gaps are unwrapped against the previous record.
+  void intact(const RecordCheck& c, bool seq16, const std::string& minute) {
+    if (!minute.empty()) minute_ = minute;
+    if (sessions_.empty()) sessions_.emplace_back();
+    if (c.hasSeq && !seq16 && sessions_.back().haveSeq && c.seq <= sessions_.back().last) {
+      sessions_.emplace_back();   // sequence started over: the device restarted
+      damagedSince_ = 0;
+    }
+    // Once records carry a CRC, one without it had its crc column damaged
+    if (c.hasCrc) crcSeen_ = true;
+    else if (crcSeen_) {
+      damaged();
+      return;
+    }
+    Session& s = sessions_.back();
+    Counts& m = minutes_[minute_];
+    ++s.counts.intact;
+    ++m.intact;
+    if (!c.hasSeq) {
+      ++s.unnumbered;
+      return;
+    }
+
+    uint64_t seq = c.seq;
+    if (!s.haveSeq) {
+      s.first = seq;
+    } else {
+      if (seq16) seq = s.last + (uint16_t)(c.seq - (uint16_t)s.last);
+      if (seq > s.last + 1) {
+        const uint64_t missing = seq - s.last - 1;
+        s.counts.missing += missing;
+        m.missing += missing;
+        s.untraced += missing > damagedSince_ ? missing - damagedSince_ : 0;
+      }
+    }
+    if (!s.haveSeq || seq > s.last) s.last = seq;
+    s.haveSeq = true;
+    damagedSince_ = 0;
+  }
+
+  // A record that arrived but failed its CRC or could not be parsed
+  void damaged() {
+    if (sessions_.empty()) sessions_.emplace_back();
+    ++sessions_.back().counts.corrupt;
+    ++minutes_[minute_].corrupt;
+    ++damagedSince_;
+  }
+
+  // A format header; starts a new session unless nothing was seen yet
+  void restart() {
+    if (!sessions_.empty() && sessions_.back().counts.intact + sessions_.back().counts.corrupt == 0) return;
+    sessions_.emplace_back();
+    damagedSince_ = 0;
+    crcSeen_ = false;
+  }
+
+  void other() { ++other_; }
+  bool expectsCrc() const { return crcSeen_; }
+
+  void print() const {
+    unsigned long n = 0;
+    for (const Session& s : sessions_) {
+      const uint64_t expected = s.counts.intact + s.counts.missing;
+      printf("session %lu: ", ++n);
+      if (s.haveSeq) printf("seq %llu-%llu, ", (unsigned long long)s.first, (unsigned long long)s.last);
+      printf("%llu intact, %llu corrupt, %llu missing (%llu without trace), loss %.3f%%\n",
+             (unsigned long long)s.counts.intact, (unsigned long long)s.counts.corrupt,
+             (unsigned long long)s.counts.missing, (unsigned long long)s.untraced,
+             expected > 0 ? 100.0 * (double)s.counts.missing / (double)expected : 0.0);
+      if (s.unnumbered > 0) {
+        printf("  %llu records without seq (loss not measurable)\n", (unsigned long long)s.unnumbered);
+      }
+    }
+    printf("%-16s %8s %8s %8s\n", "minute", "intact", "corrupt", "missing");
+    for (const auto& m : minutes_) {
+      printf("%-16s %8llu %8llu %8llu\n", m.first.c_str(), (unsigned long long)m.second.intact,
+             (unsigned long long)m.second.corrupt, (unsigned long long)m.second.missing);
+    }
+    if (other_ > 0) printf("%lu lines or byte runs were not records\n", other_);
+  }
+
+private:
+  struct Counts {
+    uint64_t intact = 0;
+    uint64_t corrupt = 0;
+    uint64_t missing = 0;
+  };
+
+  struct Session {
+    Counts counts;
+    uint64_t untraced = 0;
+    uint64_t unnumbered = 0;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    bool haveSeq = false;
+  };
+
+  std::vector<Session> sessions_;
+  std::map<std::string, Counts> minutes_;
+  std::string minute_ = "-";
+  uint64_t damagedSince_ = 0;
+  bool crcSeen_ = false;
+  unsigned long other_ = 0;
+};
+
+static bool parseCrcHex(const char* s, uint16_t& v) {
+  uint8_t b[2];
+  if (strlen(s) < 4 || !parseHex(s, 4, b)) return false;
+  v = (uint16_t)((b[0] << 8) | b[1]);
+  return true;
+}
+
+// "YYYY-MM-DD HH:MM" from a local time column, "" if `s` is not one
+static std::string localMinute(const std::string& s) {
+  static const char shape[] = "DDDD-DD-DD DD:DD";
+  if (s.size() < sizeof(shape) - 1) return "";
+  for (size_t i = 0; i < sizeof(shape) - 1; ++i) {
+    if (shape[i] == 'D' ? (s[i] < '0' || s[i] > '9') : s[i] != shape[i]) return "";
+  }
+  return s.substr(0, sizeof(shape) - 1);
+}
+
+static std::string epochMinute(uint64_t ms) {
+  const time_t sec = (time_t)(ms / 1000);
+  struct tm tmRec;
+  gmtime_r(&sec, &tmRec);
+  char buf[32];
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &tmRec);
+  return buf;
+}
+
+static bool readLine(std::string& out) {
+  static InputBuffer in;
+  size_t scanned = 0, len = 0;
+  for (;;) {
+    const size_t n = in.fill(scanned + 1);
+    const void* nl = n > scanned ? memchr(in.data() + scanned, '\n', n - scanned) : nullptr;
+    if (nl != nullptr || in.eof()) {
+      len = nl != nullptr ? (size_t)((const uint8_t*)nl - in.data()) + 1 : n;
+      break;
+    }
+    scanned = n;
+  }
+  out.assign((const char*)in.data(), len);
+  in.consume(len);
+  while (!out.empty() && (out.back() == '\n' || out.back() == '\r')) out.pop_back();
+  return len > 0;
+}
+
+// CRC column value at `hexAt`, covering line[0, coveredEnd)
+static void checkCrc(const std::string& line, size_t coveredEnd, size_t hexAt, RecordCheck& c) {
+  uint16_t crc;
+  c.hasCrc = true;
+  c.crcOk = hexAt <= line.size() && parseCrcHex(line.c_str() + hexAt, crc) &&
+            crc16((const uint8_t*)line.data(), coveredEnd) == crc;
+}
+
+static bool parseSeq(const char* s, RecordCheck& c) {
+  char* end;
+  if (*s < '0' || *s > '9') return false;
+  const unsigned long v = strtoul(s, &end, 10);
+  c.hasSeq = true;
+  c.seq = (uint32_t)v;
+  return true;
+}
+
+// LOG and compact lines end in "#7 *1A2B"; false if the line carries neither
+static bool checkMarkedLine(const std::string& line, RecordCheck& c) {
+  c = RecordCheck{};
+  size_t end = line.size();
+  const size_t star = line.rfind(" *");
+  if (star != std::string::npos && star + 6 == line.size()) {
+    checkCrc(line, star, star + 2, c);
+    end = star;
+  }
+  const size_t hash = end > 0 ? line.rfind('#', end - 1) : std::string::npos;
+  if (hash != std::string::npos && hash + 1 < end &&
+      line.find_first_not_of("0123456789", hash + 1) >= end) {
+    parseSeq(line.c_str() + hash + 1, c);
+  }
+  return c.hasCrc || c.hasSeq;
+}
+
+static void verifyLog(LossReport& report, bool compact) {
+  std::string line;
+  while (readLine(line)) {
+    if (line.empty()) continue;
+    if (line[0] == '#') {               // compact events
+      report.other();
+      continue;
+    }
+    RecordCheck c;
+    if (!checkMarkedLine(line, c)) {
+      // Events are key=value; anything else here is a record that lost its trailer
+      if (report.expectsCrc() && line.find('=') == std::string::npos) report.damaged();
+      else report.other();
+      continue;
+    }
+    if (c.hasCrc && !c.crcOk) {
+      report.damaged();
+      continue;
+    }
+    report.intact(c, false, compact ? epochMinute(strtoull(line.c_str(), nullptr, 10)) : localMinute(line));
+  }
+}
+
+static std::vector<std::string> splitCsv(const std::string& line) {
+  std::vector<std::string> out;
+  size_t start = 0;
+  for (;;) {
+    const size_t comma = line.find(',', start);
+    out.push_back(line.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+    if (comma == std::string::npos) return out;
+    start = comma + 1;
+  }
+}
+
+static void verifyCsv(LossReport& report) {
+  // Until a header arrives, assume every column
+  std::vector<uint16_t> columns;
+  for (const FieldName& c : CSV_COLUMNS) columns.push_back(c.bit);
+
+  std::string line;
+  while (readLine(line)) {
+    if (line.empty() || line[0] == '#') continue;
+    const std::vector<std::string> cells = splitCsv(line);
+
+    std::vector<uint16_t> header;
+    for (const std::string& cell : cells) {
+      for (const FieldName& c : CSV_COLUMNS) {
+        if (cell == c.name) header.push_back(c.bit);
+      }
+    }
+    if (header.size() == cells.size()) {
+      columns = header;
+      report.restart();
+      continue;
+    }
+
+    if (cells.size() != columns.size()) {
+      report.damaged();
+      continue;
+    }
+    RecordCheck c = {};
+    std::string minute;
+    size_t offset = 0;
+    for (size_t i = 0; i < cells.size(); ++i) {
+      if (columns[i] == FIELD_TIME) minute = localMinute(cells[i]);
+      if (columns[i] == FIELD_SEQ) parseSeq(cells[i].c_str(), c);
+      if (columns[i] == FIELD_CRC) checkCrc(line, offset > 0 ? offset - 1 : 0, offset, c);
+      offset += cells[i].size() + 1;
+    }
+    if (c.hasCrc && !c.crcOk) report.damaged();
+    else report.intact(c, false, minute);
+  }
+}
+
+static void verifyJsonl(LossReport& report) {
+  static const char crcKey[] = "\"crc\":\"";
+  std::string line;
+  while (readLine(line)) {
+    if (line.empty()) continue;
+    if (line.compare(0, 6, "{\"ev\":") == 0 || line[0] != '{') {
+      report.other();
+      continue;
+    }
+    RecordCheck c = {};
+    const size_t k = line.rfind(crcKey);
+    if (k != std::string::npos) checkCrc(line, line[k - 1] == ',' ? k - 1 : k, k + sizeof(crcKey) - 1, c);
+    const size_t seqAt = line.find("\"seq\":");
+    if (seqAt != std::string::npos) parseSeq(line.c_str() + seqAt + 6, c);
+    if (c.hasCrc && !c.crcOk) {
+      report.damaged();
+      continue;
+    }
+    std::string minute;
+    if (line.compare(0, 5, "{\"t\":") == 0) minute = epochMinute(strtoull(line.c_str() + 5, nullptr, 10));
+    report.intact(c, false, minute);
+  }
+}
+
+// YAML records span lines: "- device:" up to the next "- " entry
+static void verifyYamlBlock(LossReport& report, const std::vector<std::string>& block) {
+  RecordCheck c = {};
+  std::string covered, minute;
+  for (const std::string& line : block) {
+    if (line.compare(0, 9, "    crc: ") == 0) {
+      uint16_t crc;
+      c.hasCrc = true;
+      c.crcOk = parseCrcHex(line.c_str() + 9, crc) &&
+                crc16((const uint8_t*)covered.data(), covered.size()) == crc;
+      break;
+    }
+    if (!covered.empty()) covered += '\n';
+    covered += line;
+    if (line.compare(0, 9, "    seq: ") == 0) parseSeq(line.c_str() + 9, c);
+    if (line.compare(0, 10, "    time: ") == 0) minute = localMinute(line.substr(10));
+  }
+  if (!c.hasCrc && !c.hasSeq) report.other();
+  else if (c.hasCrc && !c.crcOk) report.damaged();
+  else report.intact(c, false, minute);
+}
+
+static void verifyYaml(LossReport& report) {
+  std::vector<std::string> block;
+  bool device = false;
+  std::string line;
+  while (readLine(line)) {
+    if (line.compare(0, 2, "- ") == 0 || line == "---") {
+      if (device) verifyYamlBlock(report, block);
+      block.clear();
+      device = line == "- device:";
+      if (line == "---") report.restart();
+    }
+    if (device) block.push_back(line);
+  }
+  if (device) verifyYamlBlock(report, block);
+}
+
+static void verifyCbor(LossReport& report) {
+  InputBuffer in;
+  char typeBuf[64];
+  char eventStrings[1024];
+  bool skipping = false;
+
+  while (in.fill(MAX_RECORD_BYTES) > 0) {
+    const uint8_t* p = in.data();
+    const size_t n = in.available();
+    if (n >= 3 && p[0] == 0xD9 && p[1] == 0xD9 && p[2] == 0xF7) {
+      report.restart();
+      in.consume(3);
+      skipping = false;
+      continue;
+    }
+
+    cbor::Reader rd = { p, p + n };
+    cbor::Reader erd = rd;
+    DeviceRecord r;
+    EventRecord ev;
+    RecordCheck c;
+    if (decodeCborRecord(rd, r, typeBuf, sizeof(typeBuf), &c)) {
+      if (c.hasCrc && !c.crcOk) report.damaged();
+      else report.intact(c, false, r.time.tv_sec != 0 ? epochMinute((uint64_t)r.time.tv_sec * 1000u) : "");
+      in.consume((size_t)(rd.p - p));
+      skipping = false;
+    } else if (decodeCborEvent(erd, ev, eventStrings, sizeof(eventStrings))) {
+      in.consume((size_t)(erd.p - p));
+      skipping = false;
+    } else {
+      // One damaged stretch counts once
+      if (!skipping) report.damaged();
+      skipping = true;
+      in.consume(1);
+    }
+  }
+}
+
+static void verifyDelta(LossReport& report) {
+  InputBuffer in;
+  DeltaDecoder decoder;
+  bool skipping = false;
+
+  while (in.fill(MAX_RECORD_BYTES) > 0) {
+    size_t used = 0;
+    const DeltaDecoder::Result res = decoder.feed(in.data(), in.available(), used);
+    if (res == DeltaDecoder::Result::NEED_MORE) {
+      if (!in.eof()) continue;
+      break;
+    }
+    if (res == DeltaDecoder::Result::BAD) {
+      if (!skipping) report.damaged();
+      skipping = true;
+    } else {
+      skipping = false;
+      if (res == DeltaDecoder::Result::SESSION) report.restart();
+      if (res == DeltaDecoder::Result::RECORD) {
+        report.intact(decoder.check(), true, epochMinute((uint64_t)decoder.record().time.tv_sec * 1000u));
+      } else if (res == DeltaDecoder::Result::SKIPPED) {
+        report.intact(decoder.check(), true, "");
+      }
+    }
+    in.consume(used);
+  }
+}
+
+// The LL CRC-24 is the record check; seq sits in the pseudo-header, outside
+// the CRC, so a seq that breaks the sequence is only believed once the next
+// packet continues from it. A record's further packets (a scan response, a
+// chained extended PDU) repeat its time and seq and are not counted again.
+static void verifyPcap(LossReport& report) {
+  InputBuffer in;
+  bool skipping = false;
+  bool haveLast = false, held = false;
+  uint16_t last = 0;
+  bool haveStamp = false;
+  uint8_t lastStamp[8 + 2];        // time and seq of the previous packet
+  RecordCheck heldCheck = {};
+  std::string heldMinute;
+
+  auto accept = [&](const RecordCheck& c, const std::string& minute) {
+    report.intact(c, true, minute);
+    last = (uint16_t)c.seq;
+    haveLast = true;
+  };
+  auto release = [&]() {
+    if (held) accept(heldCheck, heldMinute);
+    held = false;
+  };
+
+  while (in.fill(PCAP_RECORD_HEADER_LEN + PCAP_SNAPLEN) > 0) {
+    const uint8_t* p = in.data();
+    const size_t n = in.available();
+    if (n >= 24 && rdLe32(p) == PCAP_MAGIC && rdLe32(p + 20) == DLT_BLUETOOTH_LE_LL_WITH_PHDR) {
+      release();
+      report.restart();
+      haveLast = false;
+      haveStamp = false;
+      in.consume(24);
+      skipping = false;
+      continue;
+    }
+    const size_t len = checkPcapRecord(p, n);
+    if (len == 0) {
+      if (!skipping) report.damaged();
+      skipping = true;
+      in.consume(1);
+      continue;
+    }
+    const uint8_t* phdr = p + PCAP_RECORD_HEADER_LEN;
+    uint8_t stamp[sizeof(lastStamp)];
+    memcpy(stamp, p, 8);
+    memcpy(stamp + 8, phdr + 2, 2);
+    const bool sameRecord = haveStamp && memcmp(stamp, lastStamp, sizeof(stamp)) == 0;
+    memcpy(lastStamp, stamp, sizeof(stamp));
+    haveStamp = true;
+    if (sameRecord) {
+      in.consume(len);
+      skipping = false;
+      continue;
+    }
+    RecordCheck c = {};
+    c.hasSeq = true;
+    c.seq = (uint32_t)(phdr[2] | (phdr[3] << 8));
+    c.hasCrc = true;
+    c.crcOk = true;
+    const std::string minute = epochMinute((uint64_t)rdLe32(p) * 1000u);
+    in.consume(len);
+    skipping = false;
+
+    if (held) {
+      if (c.seq == (uint16_t)(heldCheck.seq + 1)) accept(heldCheck, heldMinute);
+      else report.damaged();
+      held = false;
+    }
+    if (haveLast && c.seq == last) {
+      c.hasSeq = false;                 // built without seq: every packet says 0
+      report.intact(c, true, minute);
+    } else if (!haveLast || c.seq == (uint16_t)(last + 1)) {
+      accept(c, minute);
+    } else {
+      held = true;
+      heldCheck = c;
+      heldMinute = minute;
+    }
+  }
+  release();
+}
+
+static int verifyCapture(const char* format) {
+  LossReport report;
+  dropRawFrames = true;
+  if (strcmp(format, "log") == 0) verifyLog(report, false);
+  else if (strcmp(format, "compact") == 0) verifyLog(report, true);
+  else if (strcmp(format, "csv") == 0) verifyCsv(report);
+  else if (strcmp(format, "yaml") == 0) verifyYaml(report);
+  else if (strcmp(format, "jsonl") == 0) verifyJsonl(report);
+  else if (strcmp(format, "cbor") == 0) verifyCbor(report);
+  else if (strcmp(format, "delta") == 0) verifyDelta(report);
+  else if (strcmp(format, "pcap") == 0) verifyPcap(report);
+  else return -1;
+  report.print();
+  if (droppedRawFrames > 0) printf("%lu raw capture frames skipped\n", droppedRawFrames);
+  return 0;
+}
+
+// --------- Scan schedule replay ---------
+
+// Replays a CSV or compact capture through planScan() (scan_scheduler.h).
+// A sighting counts as heard if it falls inside a scan window of the plan in
+// force at its time; only heard sightings feed the next plan, as on the
+// device. New devices are tracked in a table of the rate limiter's size.
+// Queue fill and CPU are not in a capture and replay as zero. The capture
+// itself was recorded at some duty cycle, so this compares schedules against
+// each other rather than against the radio environment.
+
+struct Sighting {
+  uint64_t ms;
+  uint64_t key;
+};
+
+// "2025-10-16 12:00:00.123" (UTC, like the firmware's clock)
+static bool parseLocalTimeMs(const std::string& s, uint64_t& ms) {
+  struct tm tmRec = {};
+  unsigned msPart = 0;
+  if (sscanf(s.c_str(), "%d-%d-%d %d:%d:%d.%u", &tmRec.tm_year, &tmRec.tm_mon, &tmRec.tm_mday,
+             &tmRec.tm_hour, &tmRec.tm_min, &tmRec.tm_sec, &msPart) != 7) return false;
+  tmRec.tm_year -= 1900;
+  tmRec.tm_mon -= 1;
+  ms = (uint64_t)timegm(&tmRec) * 1000u + msPart;
+  return true;
+}
+
+static bool parseColonAddress(const std::string& s, uint8_t addr[6]) {
+  unsigned b[6];
+  if (sscanf(s.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x", &b[5], &b[4], &b[3], &b[2], &b[1], &b[0]) != 6) return false;
+  for (int i = 0; i < 6; ++i) addr[i] = (uint8_t)b[i];
+  return true;
+}
+
+static std::vector<Sighting> readSightings() {
+  std::vector<Sighting> out;
+  int timeCol = -1, addrCol = -1;
+  std::string line;
+  while (readLine(line)) {
+    if (line.empty() || line[0] == '#') continue;
+    uint8_t addr[6];
+    uint64_t ms;
+    if (line.find(',') != std::string::npos) {
+      const std::vector<std::string> cells = splitCsv(line);
+      if (cells[0] == "time") {
+        timeCol = addrCol = -1;
+        for (size_t i = 0; i < cells.size(); ++i) {
+          if (cells[i] == "time") timeCol = (int)i;
+          if (cells[i] == "addr") addrCol = (int)i;
+        }
+        continue;
+      }
+      if (timeCol < 0 || addrCol < 0 || (int)cells.size() <= std::max(timeCol, addrCol) ||
+          !parseLocalTimeMs(cells[timeCol], ms) || !parseColonAddress(cells[addrCol], addr)) continue;
+    } else {
+      DeviceRecord r;
+      uint8_t data[255];
+      std::vector<char> buf(line.begin(), line.end());
+      buf.push_back('\0');
+      if (!parseCompactLine(buf.data(), r, data, sizeof(data))) continue;
+      ms = fields::epochMs(r.time);
+      memcpy(addr, r.addr, 6);
+    }
+    out.push_back({ ms, addressKey(addr, 0) });
+  }
+  std::stable_sort(out.begin(), out.end(), [](const Sighting& a, const Sighting& b) { return a.ms < b.ms; });
+  return out;
+}
+
+static bool heardAt(const ScanPlan& plan, uint64_t ms) {
+  const ScanLevel& l = SCAN_LEVELS[plan.level];
+  return (ms * 1000u) % (l.interval * 625u) < l.window * 625u;
+}
+
+static int replaySchedule(int argc, char** argv) {
+  ScanBudget budget = { 100, 1000, ScanActive::OFF };
+  bool unmatched = false;   // as with raw capture, discovery or signature scan on
+  for (int i = 0; i < argc; ++i) {
+    if (strcmp(argv[i], "--duty") == 0 && i + 1 < argc) budget.maxDutyPct = (uint8_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) budget.maxCpuPermille = (uint16_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "--active") == 0) budget.active = ScanActive::NEW_DEVICES;
+    else if (strcmp(argv[i], "--unmatched") == 0) unmatched = true;
+    else return -1;
+  }
+
+  const std::vector<Sighting> sightings = readSightings();
+  if (sightings.empty()) {
+    fprintf(stderr, "fmsdecode: no sightings with time and address\n");
+    return 1;
+  }
+
+  ScanPlan plan = SCAN_PLAN_START;
+  ScanInputs in = {};
+  in.unmatched = unmatched;
+  KeyedLru<uint8_t, RATE_TRACKED_DEVICES> known;
+  std::map<uint64_t, uint64_t> firstSeen, firstHeard;
+  uint64_t periodStart = sightings.front().ms;
+  uint64_t dutyWeighted = 0, periods = 0;
+  unsigned long heard = 0, changes = 0;
+
+  auto closePeriod = [&]() {
+    const ScanPlan next = planScan(plan, in, budget);
+    periodStart += SCAN_PLAN_PERIOD_MS;
+    if (!sameScanSettings(next, plan)) {
+      ++changes;
+      const time_t sec = (time_t)(periodStart / 1000);
+      struct tm tmRec;
+      gmtime_r(&sec, &tmRec);
+      char when[32];
+      strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tmRec);
+      printf("%s  level %u  duty %3u%%  %s  %s\n", when, next.level, SCAN_LEVELS[next.level].dutyPct,
+             next.active ? "active " : "passive", scanReasonName(next.reason));
+    }
+    plan = next;
+    in = {};
+    in.unmatched = unmatched;
+    dutyWeighted += SCAN_LEVELS[plan.level].dutyPct;
+    ++periods;
+  };
+
+  for (const Sighting& s : sightings) {
+    while (s.ms >= periodStart + SCAN_PLAN_PERIOD_MS) closePeriod();
+    firstSeen.emplace(s.key, s.ms);
+    if (!heardAt(plan, s.ms)) continue;
+    ++heard;
+    ++in.matches;
+    bool inserted;
+    known.acquire(s.key, inserted);
+    if (inserted) ++in.newDevices;
+    firstHeard.emplace(s.key, s.ms);
+  }
+  closePeriod();
+
+  std::vector<uint64_t> delays;
+  for (const auto& d : firstHeard) delays.push_back(d.second - firstSeen[d.first]);
+  std::sort(delays.begin(), delays.end());
+  printf("%lu of %zu sightings heard (%.1f%%), %zu of %zu devices heard, "
+         "first heard after median %llu ms, max %llu ms\n",
+         heard, sightings.size(), 100.0 * (double)heard / (double)sightings.size(),
+         firstHeard.size(), firstSeen.size(),
+         delays.empty() ? 0ull : (unsigned long long)delays[delays.size() / 2],
+         delays.empty() ? 0ull : (unsigned long long)delays.back());
+  printf("mean duty %llu%% over %llu periods of %u ms (fixed default %u%%), %lu changes\n",
+         (unsigned long long)(dutyWeighted / periods), (unsigned long long)periods,
+         (unsigned)SCAN_PLAN_PERIOD_MS, SCAN_LEVELS[SCAN_DEFAULT_LEVEL].dutyPct, changes);
+  return 0;
+}
+
+// --------- Synthetic extended reports ---------
+
+// Writes N synthetic advertising reports in any output format, through the
+// firmware's classification (find_my_match.h), record queue and output
+// channel, so the long-payload paths can be exercised without a BLE 5 radio:
+//   fmsdecode synth cbor 1000 | fmsdecode cbor csv
+// Most reports are extended ones on the 1M or Coded PHY, with a Find My AD
+// structure of up to 250 data bytes (all an extended payload leaves room
+// for after the flags); the rest are legacy AirTag reports and extended
+// reports that match nothing (pcap only). The sequence is fixed.
+
+struct SynthRandom {
+  uint32_t state = 0x2545F491;
+  uint32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+  uint32_t below(uint32_t n) { return next() % n; }
+};
+
+// Appends [len, type, head..., random...] with `dataLen` bytes after the type
+static size_t synthAd(uint8_t* p, uint8_t type, const uint8_t* head, size_t headLen, size_t dataLen,
+                      SynthRandom& rnd) {
+  p[0] = (uint8_t)(dataLen + 1);
+  p[1] = type;
+  memcpy(p + 2, head, headLen);
+  for (size_t i = headLen; i < dataLen; ++i) p[2 + i] = (uint8_t)rnd.next();
+  return dataLen + 2;
+}
+
+static size_t synthPayload(DeviceRecord& r, uint8_t* p, SynthRandom& rnd) {
+  static const uint8_t FLAGS[] = { 0x06 };
+  static const uint8_t APPLE[] = { 0x4C, 0x00, 0x12, 0x19 };
+  static const uint8_t GOOGLE[] = { 0xF3, 0xFE, 0x00 };
+  static const uint8_t SAMSUNG[] = { 0x5A, 0xFD, 0x02 };
+  static const uint8_t OTHER[] = { 0xFF, 0xFF };
+  const uint32_t kind = rnd.below(8);
+
+  if (kind == 0) {
+    // Legacy AirTag, separated; half of them scannable, with the scan
+    // response merged in as on an active scan
+    static const uint8_t NAME[] = { 'T', 'a', 'g' };
+    r.advType = 3;
+    const size_t n = synthAd(p, AD_TYPE_MANUFACTURER, APPLE, sizeof(APPLE), 27, rnd);
+    if (rnd.below(2) != 0) return n;
+    r.advType = ADV_TYPE_SCAN_IND;
+    r.isScannable = true;
+    r.scanRspLen = (uint8_t)synthAd(p + n, 0x09, NAME, sizeof(NAME), 3 + rnd.below(20), rnd);
+    return n + r.scanRspLen;
+  }
+
+  r.advType = ADV_TYPE_EXT;
+  r.primaryPhy = rnd.below(2) == 0 ? BLE_PHY_CODED : BLE_PHY_1M;
+  r.secondaryPhy = r.primaryPhy == BLE_PHY_CODED ? BLE_PHY_CODED : (rnd.below(2) == 0 ? BLE_PHY_2M : BLE_PHY_1M);
+  r.sid = (uint8_t)rnd.below(16);
+  size_t n = synthAd(p, 0x01, FLAGS, sizeof(FLAGS), 1, rnd);
+  const size_t room = EXTENDED_PAYLOAD_MAX - n - 2;
+  // Half of them as long as the payload allows
+  const size_t len = rnd.below(2) == 0 ? room : 8 + rnd.below((uint32_t)(room - 8));
+  switch (kind) {
+    case 1: case 2: n += synthAd(p + n, AD_TYPE_MANUFACTURER, APPLE, sizeof(APPLE), len, rnd); break;
+    case 3: case 4: n += synthAd(p + n, AD_TYPE_SERVICE_DATA16, GOOGLE, sizeof(GOOGLE), len, rnd); break;
+    case 5: case 6: n += synthAd(p + n, AD_TYPE_SERVICE_DATA16, SAMSUNG, sizeof(SAMSUNG), len, rnd); break;
+    default:        n += synthAd(p + n, AD_TYPE_MANUFACTURER, OTHER, sizeof(OTHER), len, rnd); break;
+  }
+  return n;
+}
+
+// "synth raw": the same reports as raw capture frames, through the capture
+// ring and frame writer
+static int writeSyntheticRaw(unsigned long count) {
+  static RawReport<EXTENDED_PAYLOAD_MAX> slots[64];
+  static RawCapture<EXTENDED_PAYLOAD_MAX> capture;
+  capture.begin(slots, 64);
+  RawFrameWriter writer(stdoutSink, nullptr);
+
+  SynthRandom rnd;
+  for (unsigned long i = 0; i < count; ++i) {
+    uint8_t payload[EXTENDED_PAYLOAD_MAX];
+    DeviceRecord d = {};
+    d.rssi = -40 - (int)rnd.below(60);
+    const size_t len = synthPayload(d, payload, rnd);
+    auto* r = capture.offer(1, d.rssi, payload, len);
+    if (r == nullptr) continue;
+    r->timeUs = 1760616000000000ULL + i * 100000;
+    const uint8_t addr[6] = { (uint8_t)rnd.below(16), 0x5A, 0x17, 0x3C, 0x00, 0xC0 };
+    memcpy(r->addr, addr, sizeof(addr));
+    r->addrType = 1;
+    r->rssi = d.rssi;
+    r->advType = d.advType;
+    r->flags = d.advType == ADV_TYPE_EXT ? (uint8_t)(RAW_FLAG_EXTENDED | (d.sid << 4)) : 0;
+    r->phy = (uint8_t)(d.primaryPhy | (d.secondaryPhy << 4));
+    r->payloadLen = (uint8_t)len;
+    memcpy(r->payload, payload, len);
+    capture.commit();
+    // Drained in bursts, as loop() does
+    if (capture.size() >= 32) {
+      for (const auto* q = capture.front(); q != nullptr; q = capture.front()) {
+        writer.add(*q);
+        capture.pop();
+      }
+    }
+  }
+  for (const auto* q = capture.front(); q != nullptr; q = capture.front()) {
+    writer.add(*q);
+    capture.pop();
+  }
+  writer.flush();
+  fflush(stdout);
+
+  fprintf(stderr, "fmsdecode: %lu reports offered, %lu captured, %lu dropped; %lu frames\n",
+          (unsigned long)capture.offered(), (unsigned long)capture.captured(), (unsigned long)capture.dropped(),
+          (unsigned long)writer.frames());
+  return 0;
+}
+
+static int writeSynthetic(int argc, char** argv) {
+  if (argc >= 1 && strcmp(argv[0], "raw") == 0) return writeSyntheticRaw(argc >= 2 ? strtoul(argv[1], nullptr, 10) : 1000);
+  const FormatOps* format = argc >= 1 ? findFormat(argv[0]) : nullptr;
+  if (format == nullptr) return -1;
+  const unsigned long count = argc >= 2 ? strtoul(argv[1], nullptr, 10) : 1000;
+
+  static RecordQueue<64, EXTENDED_PAYLOAD_MAX> queue;
+  OutputChannel channel;
+  channel.begin(format, OutputSink{ stdoutSink, nullptr });
+
+  SynthRandom rnd;
+  unsigned long matched = 0, extended = 0, coded = 0;
+  size_t longestData = 0;
+  for (unsigned long i = 0; i < count; ++i) {
+    uint8_t payload[EXTENDED_PAYLOAD_MAX];
+    DeviceRecord r = {};
+    const uint64_t ms = 1760616000000ULL + i * 100;
+    r.time.tv_sec = (time_t)(ms / 1000);
+    r.time.tv_usec = (suseconds_t)(ms % 1000 * 1000);
+    const uint8_t device = (uint8_t)rnd.below(16);
+    const uint8_t addr[6] = { device, 0x5A, 0x17, 0x3C, 0x00, 0xC0 };   // random static
+    memcpy(r.addr, addr, sizeof(addr));
+    r.addrType = 1;
+    r.rssi = -40 - (int)rnd.below(60);
+    r.payload = payload;
+    r.payloadLen = synthPayload(r, payload, rnd);
+
+    if (matchFindMy(r, [](uint16_t) { return true; })) ++matched;
+    else r.deviceType = "";
+    if (isExtended(r)) ++extended;
+    if (r.primaryPhy == BLE_PHY_CODED) ++coded;
+    if (r.matched && r.dataLen > longestData) longestData = r.dataLen;
+
+    // As on the device: through the queue, written out from the copy
+    queue.push(r);
+    channel.emit(*queue.front());
+    queue.pop();
+  }
+  fflush(stdout);
+
+  fprintf(stderr, "fmsdecode: %lu reports (%lu matched, %lu extended, %lu coded), "
+                  "longest data %zu bytes, %lu truncated\n",
+          count, matched, extended, coded, longestData, (unsigned long)queue.truncated());
+  return 0;
+}
+
+// --------- Rotation linking benchmark ---------
+
+// Runs the rotation linker over a generated trace whose ground truth is
+// known, and reports how many of its links are right (precision), how many
+// rotations it found (recall) and its throughput. DEVICES tags are around at
+// any time, a mix of Samsung SmartTags (service data with an aging counter),
+// Fast Pair trackers, Xiaomi tags and separated AirTags. Each advertises
+// every 500-2000 ms (plus the 0-10 ms advertising delay), of which 20% are
+// lost; its RSSI follows a random walk with noise, and it moves to a new
+// address (new hint, key, Samsung counter + 1) every 13-17 minutes without
+// its advertising timer missing a beat. Tags also leave, on average after
+// 30 minutes, and are replaced by a new one within 20 s: the hard cases.
+
+struct BenchTag {
+  uint32_t id;                // ground truth
+  uint8_t kind;               // 0 Samsung, 1 Google, 2 Xiaomi, 3 Apple
+  uint8_t addr[6];
+  uint8_t state;              // Samsung state, Apple status byte
+  uint8_t secret[24];         // hint, key: changes on rotation
+  uint32_t counter;
+  uint32_t intervalMs;
+  uint64_t nextRotationMs;
+  uint64_t leaveMs;
+  double rssi;
+};
+
+struct BenchAddress {
+  uint32_t id;
+  bool heard;
+  uint64_t predecessor;       // address the tag rotated from, 0 = none
+};
+
+static size_t benchPayload(const BenchTag& t, uint8_t* p) {
+  uint8_t* d = p + 2;
+  size_t n = 0;
+  switch (t.kind) {
+    case 0:   // FD5A: state, counter (3, BE), hint (4), then more
+      p[1] = AD_TYPE_SERVICE_DATA16;
+      d[n++] = 0x5A; d[n++] = 0xFD; d[n++] = t.state;
+      d[n++] = (uint8_t)(t.counter >> 16); d[n++] = (uint8_t)(t.counter >> 8); d[n++] = (uint8_t)t.counter;
+      for (size_t i = 0; i < 14; ++i) d[n++] = t.secret[i];
+      break;
+    case 1:   // FEF3 frame 0x11: hint, account filter
+      p[1] = AD_TYPE_SERVICE_DATA16;
+      d[n++] = 0xF3; d[n++] = 0xFE; d[n++] = 0x11;
+      for (size_t i = 0; i < 20; ++i) d[n++] = t.secret[i];
+      break;
+    case 2:   // Xiaomi anti-lost
+      p[1] = AD_TYPE_MANUFACTURER;
+      d[n++] = (uint8_t)CID_XIAOMI; d[n++] = (uint8_t)(CID_XIAOMI >> 8); d[n++] = 0x30;
+      for (size_t i = 0; i < 10; ++i) d[n++] = t.secret[i];
+      break;
+    default:  // Separated offline finding: status, key, key bits, hint
+      p[1] = AD_TYPE_MANUFACTURER;
+      d[n++] = 0x4C; d[n++] = 0x00; d[n++] = 0x12; d[n++] = 0x19; d[n++] = t.state;
+      for (size_t i = 0; i < 24; ++i) d[n++] = t.secret[i];
+      break;
+  }
+  p[0] = (uint8_t)(n + 1);
+  return n + 2;
+}
+
+static int linkBench(int argc, char** argv) {
+  const unsigned long devices = argc >= 1 ? strtoul(argv[0], nullptr, 10) : 100;
+  const unsigned long minutes = argc >= 2 ? strtoul(argv[1], nullptr, 10) : 60;
+  SynthRandom rnd;
+  if (argc >= 3) rnd.state = (uint32_t)strtoul(argv[2], nullptr, 10) | 1;
+  if (devices == 0 || minutes == 0) return -1;
+
+  const uint64_t baseMs = 1760616000000ULL;
+  const uint64_t endMs = minutes * 60000ULL;
+  std::vector<BenchTag> tags(devices);
+  std::map<uint64_t, BenchAddress> addresses;
+  uint32_t nextId = 0;
+
+  auto newAddress = [&](BenchTag& t, uint64_t predecessor) {
+    for (uint8_t& b : t.addr) b = (uint8_t)rnd.next();
+    t.addr[5] |= 0xC0;                                   // random static
+    for (uint8_t& b : t.secret) b = (uint8_t)rnd.next();
+    addresses[addressKey(t.addr, 1)] = BenchAddress{ t.id, false, predecessor };
+  };
+  auto newTag = [&](BenchTag& t, uint64_t nowMs) {
+    t.id = nextId++;
+    t.kind = (uint8_t)rnd.below(4);
+    t.state = t.kind == 0 ? (uint8_t)(0x10 | (1 + rnd.below(3))) : (uint8_t)(0x10 | (rnd.below(4) << 6));
+    t.counter = rnd.below(0x10000);
+    t.intervalMs = 500 + rnd.below(1501);
+    t.nextRotationMs = nowMs + rnd.below(15 * 60000);   // anywhere in its period
+    t.leaveMs = nowMs + 60000 + (uint64_t)(-log(1.0 - rnd.below(1000) / 1000.0) * 30 * 60000);
+    t.rssi = -50.0 - rnd.below(45);
+    newAddress(t, 0);
+  };
+
+  // Next advertisement of each tag, earliest first
+  using Due = std::pair<uint64_t, size_t>;
+  std::priority_queue<Due, std::vector<Due>, std::greater<Due>> due;
+  for (size_t i = 0; i < devices; ++i) {
+    newTag(tags[i], 0);
+    due.push(Due{ rnd.below(tags[i].intervalMs), i });
+  }
+
+  static RotationLinker linker;
+  unsigned long records = 0, links = 0, correct = 0;
+  uint8_t payload[LEGACY_PAYLOAD_MAX];
+  const clock_t start = clock();
+  while (!due.empty() && due.top().first < endMs) {
+    const uint64_t t = due.top().first;
+    BenchTag& tag = tags[due.top().second];
+    const size_t slot = due.top().second;
+    due.pop();
+
+    if (t >= tag.leaveMs) {
+      // Gone; a new tag takes its place within 20 s
+      const uint64_t arrive = t + rnd.below(20000);
+      newTag(tag, arrive);
+      due.push(Due{ arrive, slot });
+      continue;
+    }
+    if (t >= tag.nextRotationMs) {
+      if (tag.kind == 0) ++tag.counter;
+      newAddress(tag, addressKey(tag.addr, 1));
+      tag.nextRotationMs = t + 13 * 60000 + rnd.below(4 * 60000);
+    }
+    tag.rssi += ((int)rnd.below(5) - 2) * 0.5;
+    tag.rssi = tag.rssi < -100 ? -100 : (tag.rssi > -40 ? -40 : tag.rssi);
+    due.push(Due{ t + tag.intervalMs + rnd.below(11), slot });
+    if (rnd.below(5) == 0) continue;   // lost
+
+    DeviceRecord r = {};
+    const uint64_t ms = baseMs + t;
+    r.time.tv_sec = (time_t)(ms / 1000);
+    r.time.tv_usec = (suseconds_t)(ms % 1000 * 1000);
+    memcpy(r.addr, tag.addr, sizeof(r.addr));
+    r.addrType = 1;
+    r.rssi = (int)tag.rssi + (int)rnd.below(9) - 4;
+    r.advType = 3;
+    r.payload = payload;
+    r.payloadLen = benchPayload(tag, payload);
+    if (!matchFindMy(r, [](uint16_t) { return true; })) continue;
+    ++records;
+    addresses[addressKey(tag.addr, 1)].heard = true;
+
+    linker.observe(r);
+    linker.poll((uint32_t)ms, [&](const LinkEvent& link) {
+      ++links;
+      const BenchAddress& from = addresses[addressKey(link.fromAddr, 1)];
+      const BenchAddress& to = addresses[addressKey(link.toAddr, 1)];
+      if (from.id == to.id) ++correct;
+    });
+  }
+  const double sec = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  // Rotations the linker could have seen: both addresses heard
+  unsigned long rotations = 0;
+  std::vector<bool> heardTag(nextId);
+  for (const auto& a : addresses) {
+    if (!a.second.heard) continue;
+    heardTag[a.second.id] = true;
+    if (a.second.predecessor != 0 && addresses[a.second.predecessor].heard) ++rotations;
+  }
+  const unsigned long tagsHeard = (unsigned long)std::count(heardTag.begin(), heardTag.end(), true);
+  unsigned long addressesHeard = 0;
+  for (const auto& a : addresses) addressesHeard += a.second.heard;
+
+  printf("%lu records from %lu tags (%lu addresses) over %lu min, %lu rotations\n", records, tagsHeard,
+         addressesHeard, minutes, rotations);
+  printf("%lu links, %lu right: precision %.1f%%, recall %.1f%%; %lu unlinked\n", links, correct,
+         links > 0 ? 100.0 * (double)correct / (double)links : 0.0,
+         rotations > 0 ? 100.0 * (double)correct / (double)rotations : 0.0, (unsigned long)linker.unlinked());
+  printf("devices counted %lu (%lu without linking, %lu true); %.2f M records/s with classification, %zu bytes\n",
+         (unsigned long)linker.devices(), addressesHeard, tagsHeard, (double)records / sec / 1e6,
+         RotationLinker::memoryBytes());
+  return 0;
+}
+
+// --------- Record formats ---------
+
+// Golden check of the compiled record formats against the snprintf code they
+// replaced, and the speed of both. The reference keeps the original format
+// strings and its per-record work: a localtime_r timestamp, the address and
+// hex dump built as strings, one snprintf into a 512-byte buffer. Records are
+// legacy advertisements only and the formats get the original columns
+// (FIELDS_ORIGINAL), so the output has to be byte for byte the same.
+
+constexpr uint16_t FIELDS_ORIGINAL = 0x03FF;
+
+static std::string refTimestamp(const struct timeval& tv) {
+  struct tm timeinfo;
+  char timeString[96];   // 32 in the original; room for what -Wformat-truncation assumes
+  localtime_r(&tv.tv_sec, &timeinfo);
+  snprintf(timeString, sizeof(timeString), "%04d-%02d-%02d %02d:%02d:%02d.%03ld", timeinfo.tm_year + 1900,
+           timeinfo.tm_mon + 1, timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+           (long)(tv.tv_usec / 1000));
+  return std::string(timeString);
+}
+
+static std::string refHex(const uint8_t* data, size_t len) {
+  static const char* hex = "0123456789ABCDEF";
+  std::string out;
+  out.reserve(len * 3);
+  for (size_t i = 0; i < len; ++i) {
+    out.push_back(hex[(data[i] >> 4) & 0xF]);
+    out.push_back(hex[data[i] & 0xF]);
+    if (i + 1 < len) out.push_back(' ');
+  }
+  return out;
+}
+
+// NimBLEAddress::toString()
+static std::string refAddress(const uint8_t a[6]) {
+  char text[18];
+  snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x", a[5], a[4], a[3], a[2], a[1], a[0]);
+  return std::string(text);
+}
+
+static int refFormat(OutputFormat format, const DeviceRecord& r, char* buffer, size_t bufferSize) {
+  const std::string timestamp = refTimestamp(r.time);
+  const std::string addr = refAddress(r.addr);
+  const std::string dataHex = refHex(r.data, r.dataLen);
+  const char* dataType = dataSourceName(r.dataType);
+  switch (format) {
+    case OutputFormat::LOG:
+      return snprintf(buffer, bufferSize, "%s | 0x%04X %-18s | %s | RSSI %03d | PDU %d | %s%-2s | %-12s [%s]\n",
+                      timestamp.c_str(), r.manufacturer, r.deviceType, addr.c_str(), r.rssi, r.advType,
+                      r.isConnectable ? "CONN" : "NONCONN", r.isScannable ? "/SCAN" : "", dataType, dataHex.c_str());
+    case OutputFormat::CSV:
+      return snprintf(buffer, bufferSize, "%s,%s,%s,%s,%d,%s,%s,%s,%s,%s\n", timestamp.c_str(),
+                      companyName(r.manufacturer), r.deviceType, addr.c_str(), r.rssi, advTypeName(r.advType),
+                      r.isConnectable ? "true" : "false", r.isScannable ? "true" : "false", dataType, dataHex.c_str());
+    default:
+      return snprintf(buffer, bufferSize,
+                      "- device:\n"
+                      "    time: %s\n"
+                      "    manufacturer: %s\n"
+                      "    type: %s\n"
+                      "    address: %s\n"
+                      "    rssi: %d\n"
+                      "    adv_type: %s\n"
+                      "    connectable: %s\n"
+                      "    scannable: %s\n"
+                      "    data_type: %s\n"
+                      "    data_hex: %s\n",
+                      timestamp.c_str(), companyName(r.manufacturer), r.deviceType, addr.c_str(), r.rssi,
+                      advTypeName(r.advType), r.isConnectable ? "true" : "false", r.isScannable ? "true" : "false",
+                      dataType, dataHex.c_str());
+  }
+}
+
+static void appendSink(void* ctx, const uint8_t* data, size_t len) {
+  static_cast<std::string*>(ctx)->append((const char*)data, len);
+}
+
+static void countSink(void* ctx, const uint8_t*, size_t len) {
+  *static_cast<size_t*>(ctx) += len;
+}
+
+static void writeFormat(OutputFormat format, OutWriter& w, const DeviceRecord& r) {
+  switch (format) {
+    case OutputFormat::LOG: LogFormat::write(w, r, FIELDS_ORIGINAL); break;
+    case OutputFormat::CSV: CsvFormat::write(w, r, FIELDS_ORIGINAL); break;
+    default:                YamlFormat::write(w, r, FIELDS_ORIGINAL); break;
+  }
+}
+
+// Random legacy records, a few a second with the odd jump in time; a quarter
+// of them with folded sightings. Data bytes live in `data`.
+static std::vector<DeviceRecord> randomRecords(unsigned long count, std::vector<uint8_t>& data) {
+  static const char* TYPES[] = { "FindMy/AirTag", "FindMy/Offline", "FastPair/FindDevice", "SmartTag+",
+                                 "Anti-Lost", "FindMy/Service", "custom-label" };
+  static const uint16_t COMPANIES[] = { CID_APPLE, CID_GOOGLE, CID_SAMSUNG, CID_XIAOMI, 0x0006 };
+  SynthRandom rnd;
+  data.assign(count * LEGACY_PAYLOAD_MAX, 0);
+  std::vector<DeviceRecord> records(count);
+  struct timeval tv = { 1760616000, 0 };
+  for (unsigned long i = 0; i < count; ++i) {
+    DeviceRecord& r = records[i];
+    r = DeviceRecord{};
+    tv.tv_usec += (long)rnd.below(400000);
+    if (tv.tv_usec >= 1000000) {
+      tv.tv_sec += tv.tv_usec / 1000000;
+      tv.tv_usec %= 1000000;
+    }
+    if (rnd.below(1000) == 0) tv.tv_sec += rnd.below(400000000);
+    r.time = tv;
+    r.matched = true;
+    r.manufacturer = COMPANIES[rnd.below(5)];
+    r.typeId = (uint8_t)rnd.next();
+    r.deviceType = TYPES[rnd.below(7)];
+    for (uint8_t& b : r.addr) b = (uint8_t)rnd.next();
+    r.rssi = -(int)rnd.below(110) + (rnd.below(50) == 0 ? 20 : 0);
+    r.advType = (uint8_t)rnd.below(5);
+    r.isConnectable = rnd.below(2) == 0;
+    r.isScannable = rnd.below(2) == 0;
+    r.dataType = rnd.below(2) == 0 ? DataSource::SERVICE : DataSource::MANUFACTURER;
+    r.dataLen = rnd.below(LEGACY_PAYLOAD_MAX - 1);
+    r.data = &data[i * LEGACY_PAYLOAD_MAX];
+    for (size_t k = 0; k < r.dataLen; ++k) data[i * LEGACY_PAYLOAD_MAX + k] = (uint8_t)rnd.next();
+    if (rnd.below(4) == 0) {
+      r.suppressed = (uint16_t)(1 + rnd.below(30));
+      r.rssiMin = (int8_t)std::max(-128, r.rssi - (int)rnd.below(10));
+      r.rssiMax = (int8_t)std::min(127, r.rssi + (int)rnd.below(10));
+    }
+  }
+  return records;
+}
+
+static int checkFormats(unsigned long count) {
+  std::vector<uint8_t> data;
+  const std::vector<DeviceRecord> records = randomRecords(count, data);
+
+  static const OutputFormat FORMATS[] = { OutputFormat::LOG, OutputFormat::CSV, OutputFormat::YAML };
+  static const char* NAMES[] = { "log", "csv", "yaml" };
+  unsigned long mismatches = 0;
+  uint8_t staging[256];   // as OutputChannel
+  char reference[512];
+  for (size_t f = 0; f < 3; ++f) {
+    unsigned long formatMismatches = 0;
+    for (unsigned long i = 0; i < count; ++i) {
+      std::string line;
+      {
+        OutWriter w(staging, sizeof(staging), appendSink, &line);
+        writeFormat(FORMATS[f], w, records[i]);
+      }
+      const int n = refFormat(FORMATS[f], records[i], reference, sizeof(reference));
+      if (line.size() == (size_t)n && memcmp(line.data(), reference, line.size()) == 0) continue;
+      if (formatMismatches++ < 5) {
+        fprintf(stderr, "mismatch %s %lu:\n  snprintf: %s  compiled: %s", NAMES[f], i, reference, line.c_str());
+      }
+    }
+    mismatches += formatMismatches;
+
+    // Throughput of both, each record as the firmware hands it on; rounds
+    // alternate and the best of each counts, so load on the machine does not
+    // favour one side
+    double refSec = 1e9, sec = 1e9;
+    size_t refBytes = 0, bytes = 0;
+    for (int round = 0; round < 5; ++round) {
+      refBytes = bytes = 0;
+      clock_t start = clock();
+      for (unsigned long i = 0; i < count; ++i) {
+        refBytes += (size_t)refFormat(FORMATS[f], records[i], reference, sizeof(reference));
+      }
+      refSec = std::min(refSec, (double)(clock() - start) / CLOCKS_PER_SEC);
+      start = clock();
+      for (unsigned long i = 0; i < count; ++i) {
+        OutWriter w(staging, sizeof(staging), countSink, &bytes);
+        writeFormat(FORMATS[f], w, records[i]);
+      }
+      sec = std::min(sec, (double)(clock() - start) / CLOCKS_PER_SEC);
+    }
+    printf("%-4s %lu records, %lu mismatches; snprintf %.2f M records/s, compiled %.2f M records/s: %.1fx (%zu bytes)\n",
+           NAMES[f], count, formatMismatches, (double)count / refSec / 1e6, (double)count / sec / 1e6, refSec / sec,
+           bytes);
+    if (bytes != refBytes) ++mismatches;
+  }
+  return mismatches == 0 ? 0 : 1;
+}
+
+
+// Parse speed of CSV against JSON Lines: the same random records written in
+// both at the default columns, then read back by a hand-written parser for
+// each, into the same fields. Both parsers are checked against each other
+// first. Extended advertising, decoded fields, seq and crc are left out: they
+// are either empty in CSV or absent in JSON Lines.
+
+struct ParsedRecord {
+  uint64_t ms;
+  uint16_t cid;
+  char type[32];
+  uint8_t addr[6];
+  int rssi;
+  uint8_t adv;
+  bool conn;
+  bool scan;
+  bool service;
+  uint8_t data[LEGACY_PAYLOAD_MAX];
+  size_t dataLen;
+  uint32_t suppressed;
+  int rssiMin;
+  int rssiMax;
+};
+
+static bool parseUnsigned(const char*& p, uint64_t& v) {
+  if (*p < '0' || *p > '9') return false;
+  v = 0;
+  while (*p >= '0' && *p <= '9') v = v * 10 + (uint64_t)(*p++ - '0');
+  return true;
+}
+
+static bool parseSigned(const char*& p, int& v) {
+  const bool negative = *p == '-';
+  if (negative) ++p;
+  uint64_t mag;
+  if (!parseUnsigned(p, mag)) return false;
+  v = negative ? -(int)mag : (int)mag;
+  return true;
+}
+
+// Hex pairs, optionally separated by `sep`, up to `end`
+static bool parseHexRun(const char*& p, const char* end, char sep, uint8_t* out, size_t cap, size_t& n) {
+  n = 0;
+  while (p < end) {
+    if (n > 0 && sep != 0) {
+      if (*p != sep) return false;
+      ++p;
+    }
+    const int hi = hexValue(p[0]), lo = hexValue(p[1]);
+    if (hi < 0 || lo < 0 || n == cap) return false;
+    out[n++] = (uint8_t)((hi << 4) | lo);
+    p += 2;
+  }
+  return true;
+}
+
+static bool parseAddress(const char*& p, uint8_t addr[6]) {
+  for (int i = 5; i >= 0; --i) {
+    const int hi = hexValue(p[0]), lo = hexValue(p[1]);
+    if (hi < 0 || lo < 0 || (i > 0 && p[2] != ':')) return false;
+    addr[i] = (uint8_t)((hi << 4) | lo);
+    p += i > 0 ? 3 : 2;
+  }
+  return true;
+}
+
+static void copyText(const char* from, const char* to, char* out, size_t cap) {
+  const size_t n = std::min((size_t)(to - from), cap - 1);
+  memcpy(out, from, n);
+  out[n] = '\0';
+}
+
+static bool cellIs(const char* from, const char* to, const char* text) {
+  const size_t n = strlen(text);
+  return (size_t)(to - from) == n && memcmp(from, text, n) == 0;
+}
+
+// Days from 1970-01-01 to a civil date (proleptic Gregorian)
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+// One CSV record line (no newline), columns as in CSV_COLUMNS for FIELDS_RECORD
+static bool parseCsvRecord(const char* p, const char* end, ParsedRecord& out) {
+  const char* cells[24];
+  size_t n = 0;
+  cells[n++] = p;
+  for (const char* c = p; c < end; ++c) {
+    if (*c == ',') {
+      if (n == 23) return false;
+      cells[n++] = c + 1;
+    }
+  }
+  if (n != 21) return false;
+  cells[n] = end + 1;
+  auto cellEnd = [&](size_t i) { return cells[i + 1] - 1; };
+
+  // "YYYY-MM-DD HH:MM:SS.mmm", local time (UTC here and on the device)
+  const char* t = cells[0];
+  if (cellEnd(0) - t != 23) return false;
+  unsigned v[7];
+  static const uint8_t AT[7] = { 0, 5, 8, 11, 14, 17, 20 };
+  static const uint8_t WIDTH[7] = { 4, 2, 2, 2, 2, 2, 3 };
+  for (int f = 0; f < 7; ++f) {
+    v[f] = 0;
+    for (int k = 0; k < WIDTH[f]; ++k) {
+      const char c = t[AT[f] + k];
+      if (c < '0' || c > '9') return false;
+      v[f] = v[f] * 10 + (unsigned)(c - '0');
+    }
+  }
+  const int64_t days = daysFromCivil(v[0], v[1], v[2]);
+  out.ms = (uint64_t)((days * 86400 + v[3] * 3600 + v[4] * 60 + v[5]) * 1000 + v[6]);
+
+  static const uint16_t CIDS[] = { CID_APPLE, CID_GOOGLE, CID_SAMSUNG, CID_XIAOMI };
+  out.cid = 0xFFFF;
+  for (uint16_t cid : CIDS) {
+    if (cellIs(cells[1], cellEnd(1), companyName(cid))) out.cid = cid;
+  }
+  copyText(cells[2], cellEnd(2), out.type, sizeof(out.type));
+  const char* c = cells[3];
+  if (!parseAddress(c, out.addr) || c != cellEnd(3)) return false;
+  c = cells[4];
+  if (!parseSigned(c, out.rssi) || c != cellEnd(4)) return false;
+  out.adv = 0xFF;
+  for (uint8_t a = 0; a <= ADV_TYPE_EXT; ++a) {
+    if (cellIs(cells[5], cellEnd(5), advTypeName(a))) out.adv = a;
+  }
+  out.conn = cellIs(cells[6], cellEnd(6), "true");
+  out.scan = cellIs(cells[7], cellEnd(7), "true");
+  out.service = cellIs(cells[8], cellEnd(8), "Service");
+  c = cells[9];
+  if (!parseHexRun(c, cellEnd(9), ' ', out.data, sizeof(out.data), out.dataLen)) return false;
+  uint64_t sup;
+  c = cells[10];
+  if (!parseUnsigned(c, sup)) return false;
+  out.suppressed = (uint32_t)sup;
+  c = cells[11];
+  if (!parseSigned(c, out.rssiMin)) return false;
+  c = cells[12];
+  return parseSigned(c, out.rssiMax);
+}
+
+// Closing quote of the JSON string opening at p, or nullptr
+static const char* jsonStringEnd(const char* p) {
+  if (*p++ != '"') return nullptr;
+  for (; *p != '\0'; ++p) {
+    if (*p == '"') return p;
+    if (*p == '\\' && *++p == '\0') return nullptr;
+  }
+  return nullptr;
+}
+
+// Unescapes a JSON string body (writeJsonText: \" \\ and \u00XX)
+static bool copyJsonText(const char* from, const char* to, char* out, size_t cap) {
+  size_t n = 0;
+  while (from < to) {
+    char c = *from++;
+    if (c == '\\') {
+      if (from == to) return false;
+      c = *from++;
+      if (c == 'u') {
+        uint8_t byte;
+        if (to - from < 4 || from[0] != '0' || from[1] != '0' || !parseHex(from + 2, 2, &byte)) return false;
+        c = (char)byte;
+        from += 4;
+      } else if (c != '"' && c != '\\' && c != '/') {
+        return false;
+      }
+    }
+    if (n + 1 < cap) out[n++] = c;
+  }
+  out[n] = '\0';
+  return true;
+}
+
+// Skips a JSON number or string value
+static bool skipJsonValue(const char*& p) {
+  if (*p != '"') {
+    while (*p != ',' && *p != '}' && *p != '\0') ++p;
+    return true;
+  }
+  const char* close = jsonStringEnd(p);
+  if (close == nullptr) return false;
+  p = close + 1;
+  return true;
+}
+
+// One JSON Lines record, as JsonlFormat writes it (flat; only "dev" is escaped)
+static bool parseJsonlRecord(const char* p, ParsedRecord& out) {
+  if (*p++ != '{') return false;
+  out.suppressed = 0;
+  bool folded = false;
+  while (*p == '"') {
+    const char* key = ++p;
+    while (*p != '"' && *p != '\0') ++p;
+    const size_t keyLen = (size_t)(p - key);
+    if (p[0] != '"' || p[1] != ':') return false;
+    p += 2;
+    uint64_t u;
+    const char* close;
+    switch (keyLen) {
+      case 1:
+        if (key[0] == 't') {
+          if (!parseUnsigned(p, out.ms)) return false;
+        } else if (key[0] == 'a') {
+          if (*p++ != '"' || !parseAddress(p, out.addr) || *p++ != '"') return false;
+        } else if (key[0] == 'r') {
+          if (!parseSigned(p, out.rssi)) return false;
+        } else if (key[0] == 'f') {
+          if (!parseUnsigned(p, u)) return false;
+          out.conn = (u & 1) != 0;
+          out.scan = (u & 2) != 0;
+        } else if (!skipJsonValue(p)) {
+          return false;
+        }
+        break;
+      case 3:
+        if (memcmp(key, "cid", 3) == 0) {
+          if (!parseUnsigned(p, u)) return false;
+          out.cid = (uint16_t)u;
+        } else if (memcmp(key, "dev", 3) == 0) {
+          close = jsonStringEnd(p);
+          if (close == nullptr || !copyJsonText(p + 1, close, out.type, sizeof(out.type))) return false;
+          p = close + 1;
+        } else if (memcmp(key, "adv", 3) == 0) {
+          if (!parseUnsigned(p, u)) return false;
+          out.adv = (uint8_t)u;
+        } else if (memcmp(key, "mfd", 3) == 0 || memcmp(key, "svc", 3) == 0) {
+          out.service = key[0] == 's';
+          close = *p == '"' ? strchr(p + 1, '"') : nullptr;
+          ++p;
+          if (close == nullptr || !parseHexRun(p, close, 0, out.data, sizeof(out.data), out.dataLen)) return false;
+          p = close + 1;
+        } else if (memcmp(key, "sup", 3) == 0) {
+          if (!parseUnsigned(p, u)) return false;
+          out.suppressed = (uint32_t)u;
+          folded = true;
+        } else if (!skipJsonValue(p)) {
+          return false;
+        }
+        break;
+      case 4:
+        if (memcmp(key, "rmin", 4) == 0) {
+          if (!parseSigned(p, out.rssiMin)) return false;
+        } else if (memcmp(key, "rmax", 4) == 0) {
+          if (!parseSigned(p, out.rssiMax)) return false;
+        } else if (!skipJsonValue(p)) {
+          return false;
+        }
+        break;
+      default:
+        if (!skipJsonValue(p)) return false;
+        break;
+    }
+    if (*p == ',') ++p;
+  }
+  if (*p != '}') return false;
+  if (!folded) out.rssiMin = out.rssiMax = out.rssi;
+  return true;
+}
+
+static bool sameParse(const ParsedRecord& a, const ParsedRecord& b) {
+  return a.ms == b.ms && strcmp(companyName(a.cid), companyName(b.cid)) == 0 && strcmp(a.type, b.type) == 0 &&
+         memcmp(a.addr, b.addr, 6) == 0 && a.rssi == b.rssi && a.adv == b.adv && a.conn == b.conn &&
+         a.scan == b.scan && a.service == b.service && a.dataLen == b.dataLen &&
+         memcmp(a.data, b.data, a.dataLen) == 0 && a.suppressed == b.suppressed && a.rssiMin == b.rssiMin &&
+         a.rssiMax == b.rssiMax;
+}
+
+// Record lines of a format, one per record, newline included
+static std::string writeAll(const FormatOps& format, const std::vector<DeviceRecord>& records,
+                            std::vector<size_t>& starts) {
+  std::string text;
+  uint8_t staging[256];
+  starts.clear();
+  for (const DeviceRecord& r : records) {
+    starts.push_back(text.size());
+    OutWriter w(staging, sizeof(staging), appendSink, &text);
+    format.record(w, r, FULL_RECORD);
+  }
+  starts.push_back(text.size());
+  return text;
+}
+
+static int parseFormats(unsigned long count) {
+  std::vector<uint8_t> data;
+  const std::vector<DeviceRecord> records = randomRecords(count, data);
+  std::vector<size_t> csvAt, jsonAt;
+  const std::string csv = writeAll(*findFormat(OutputFormat::CSV), records, csvAt);
+  const std::string jsonl = writeAll(*findFormat(OutputFormat::JSONL), records, jsonAt);
+
+  unsigned long mismatches = 0;
+  for (unsigned long i = 0; i < count; ++i) {
+    ParsedRecord a = {}, b = {};
+    const bool csvOk = parseCsvRecord(csv.c_str() + csvAt[i], csv.c_str() + csvAt[i + 1] - 1, a);
+    const bool jsonOk = parseJsonlRecord(jsonl.c_str() + jsonAt[i], b);
+    if (csvOk && jsonOk && sameParse(a, b)) continue;
+    if (mismatches++ < 5) {
+      fprintf(stderr, "mismatch %lu (csv %s, jsonl %s):\n  %.*s  %.*s", i, csvOk ? "ok" : "bad", jsonOk ? "ok" : "bad",
+              (int)(csvAt[i + 1] - csvAt[i]), csv.c_str() + csvAt[i], (int)(jsonAt[i + 1] - jsonAt[i]),
+              jsonl.c_str() + jsonAt[i]);
+    }
+  }
+
+  // Best of alternating rounds, as in format check
+  double csvSec = 1e9, jsonSec = 1e9;
+  uint64_t sum = 0;
+  ParsedRecord pr;
+  for (int round = 0; round < 5; ++round) {
+    clock_t start = clock();
+    for (unsigned long i = 0; i < count; ++i) {
+      if (parseCsvRecord(csv.c_str() + csvAt[i], csv.c_str() + csvAt[i + 1] - 1, pr)) sum += pr.ms + pr.dataLen;
+    }
+    csvSec = std::min(csvSec, (double)(clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (unsigned long i = 0; i < count; ++i) {
+      if (parseJsonlRecord(jsonl.c_str() + jsonAt[i], pr)) sum += pr.ms + pr.dataLen;
+    }
+    jsonSec = std::min(jsonSec, (double)(clock() - start) / CLOCKS_PER_SEC);
+  }
+
+  printf("%lu records, %lu mismatches; csv %zu bytes, jsonl %zu bytes (%.2fx)\n", count, mismatches, csv.size(),
+         jsonl.size(), (double)jsonl.size() / (double)csv.size());
+  printf("csv   %.2f M records/s, %.0f MB/s\njsonl %.2f M records/s, %.0f MB/s: %.1fx csv (%llu)\n",
+         (double)count / csvSec / 1e6, (double)csv.size() / csvSec / 1e6, (double)count / jsonSec / 1e6,
+         (double)jsonl.size() / jsonSec / 1e6, csvSec / jsonSec, (unsigned long long)(sum & 0xFF));
+  return mismatches == 0 ? 0 : 1;
+}
+
+static int runFormat(int argc, char** argv) {
+  if (argc < 1) return -1;
+  const unsigned long count = argc >= 2 ? strtoul(argv[1], nullptr, 10) : 200000;
+  if (strcmp(argv[0], "check") == 0) return checkFormats(count);
+  if (strcmp(argv[0], "parse") == 0) return parseFormats(count);
+  return -1;
+}
+
+// --------- Match rules ---------
+
+// Compiles a rules file (see tools/rules/findmy.rules) into the bytecode of
+// match_rules.h. Errors name the line.
+
+struct RuleSource {
+  std::vector<std::string> labels;
+  std::vector<uint8_t> rules;       // encoded rule records
+  unsigned count = 0;
+};
+
+static bool parseRuleNumber(const char*& s, unsigned long max, unsigned long& v) {
+  char* end;
+  v = strtoul(s, &end, 0);
+  if (end == s || v > max) return false;
+  s = end;
+  return true;
+}
+
+static bool parseRuleHex(const char*& s, size_t n, std::vector<uint8_t>& out) {
+  for (size_t i = 0; i < n; ++i) {
+    uint8_t b;
+    if (!parseHex(s, 2, &b)) return false;
+    out.push_back(b);
+    s += 2;
+  }
+  return true;
+}
+
+// One predicate token -> opcode and operands
+static bool compilePredicate(const char* s, std::vector<uint8_t>& code) {
+  unsigned long a, b;
+  if (strncmp(s, "len>=", 5) == 0 || strncmp(s, "len<=", 5) == 0) {
+    const uint8_t op = s[3] == '>' ? RULE_LEN_GE : RULE_LEN_LE;
+    s += 5;
+    if (!parseRuleNumber(s, 255, a) || *s != '\0') return false;
+    code.insert(code.end(), { op, (uint8_t)a });
+    return true;
+  }
+
+  if (*s++ != '[' || !parseRuleNumber(s, 254, a)) return false;
+  unsigned long n = 0;
+  if (*s == ':' && !parseRuleNumber(++s, 255 - a, n)) return false;
+  if (*s++ != ']') return false;
+
+  if (n == 0) {
+    if (strncmp(s, "in{", 3) == 0) {
+      std::vector<uint8_t> values;
+      s += 3;
+      while (parseRuleNumber(s, 255, b)) {
+        values.push_back((uint8_t)b);
+        if (*s == ',') ++s;
+      }
+      if (strcmp(s, "}") != 0 || values.empty() || values.size() > 255) return false;
+      code.insert(code.end(), { RULE_IN, (uint8_t)a, (uint8_t)values.size() });
+      code.insert(code.end(), values.begin(), values.end());
+      return true;
+    }
+    unsigned long mask = 0xFF;
+    if (*s == '&' && !parseRuleNumber(++s, 255, mask)) return false;
+    if (*s++ != '=' || !parseRuleNumber(s, 255, b) || *s != '\0') return false;
+    if (mask == 0xFF) code.insert(code.end(), { RULE_EQ, (uint8_t)a, (uint8_t)b });
+    else code.insert(code.end(), { RULE_MASK, (uint8_t)a, (uint8_t)mask, (uint8_t)b });
+    return true;
+  }
+
+  std::vector<uint8_t> mask, value;
+  if (*s == '&' && !parseRuleHex(++s, n, mask)) return false;
+  if (*s++ != '=' || !parseRuleHex(s, n, value) || *s != '\0') return false;
+  code.insert(code.end(), { mask.empty() ? RULE_BYTES : RULE_BYTES_MASK, (uint8_t)a, (uint8_t)n });
+  code.insert(code.end(), mask.begin(), mask.end());
+  code.insert(code.end(), value.begin(), value.end());
+  return true;
+}
+
+static bool compileRuleLine(const std::string& line, RuleSource& src, std::string& error) {
+  const size_t arrow = line.find("->");
+  if (arrow == std::string::npos) {
+    error = "missing -> label";
+    return false;
+  }
+  std::string label = line.substr(arrow + 2);
+  label.erase(0, label.find_first_not_of(" \t"));
+  label.erase(label.find_last_not_of(" \t\r\n") + 1);
+  if (label.empty() || label.size() > 63) {
+    error = "label must be 1-63 characters";
+    return false;
+  }
+  for (char c : label) {
+    if (!ruleLabelChar((uint8_t)c)) {
+      error = "label must be printable ASCII without , \" or \\";
+      return false;
+    }
+  }
+
+  std::vector<std::string> tok;
+  std::string head = line.substr(0, arrow);
+  for (char* save = nullptr, *t = strtok_r(&head[0], " \t", &save); t != nullptr; t = strtok_r(nullptr, " \t", &save)) {
+    tok.push_back(t);
+  }
+  if (tok.size() < 2 || (tok[0] != "svc" && tok[0] != "mfd")) {
+    error = "expected svc <uuid> or mfd <cid>";
+    return false;
+  }
+  const uint8_t scope = tok[0] == "svc" ? RULE_SCOPE_SVC16 : RULE_SCOPE_MFD;
+  char* end;
+  const unsigned long key = strtoul(tok[1].c_str(), &end, 16);
+  if (*end != '\0' || key > 0xFFFF) {
+    error = "bad uuid/cid " + tok[1];
+    return false;
+  }
+  unsigned long vendor = scope == RULE_SCOPE_MFD ? key : serviceToManufacturer((uint16_t)key);
+  size_t t = 2;
+  if (t + 1 < tok.size() && tok[t] == "vendor") {
+    vendor = strtoul(tok[t + 1].c_str(), &end, 16);
+    if (*end != '\0' || vendor > 0xFFFF) {
+      error = "bad vendor " + tok[t + 1];
+      return false;
+    }
+    t += 2;
+  }
+  if (vendor == 0xFFFF) {
+    error = "service needs a vendor";
+    return false;
+  }
+
+  std::vector<uint8_t> code;
+  for (; t < tok.size(); ++t) {
+    if (!compilePredicate(tok[t].c_str(), code)) {
+      error = "bad predicate " + tok[t];
+      return false;
+    }
+  }
+  if (code.size() > 255) {
+    error = "too many predicates";
+    return false;
+  }
+
+  size_t labelIndex = std::find(src.labels.begin(), src.labels.end(), label) - src.labels.begin();
+  if (labelIndex == src.labels.size()) src.labels.push_back(label);
+  src.rules.insert(src.rules.end(), { scope, (uint8_t)key, (uint8_t)(key >> 8), (uint8_t)vendor,
+                                      (uint8_t)(vendor >> 8), (uint8_t)labelIndex, (uint8_t)code.size() });
+  src.rules.insert(src.rules.end(), code.begin(), code.end());
+  ++src.count;
+  return true;
+}
+
+static bool compileRules(const char* path, std::vector<uint8_t>& out) {
+  FILE* f = fopen(path, "r");
+  if (f == nullptr) {
+    fprintf(stderr, "fmsdecode: %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  RuleSource src;
+  char* line = nullptr;
+  size_t lineCap = 0;
+  unsigned lineNo = 0;
+  bool ok = true;
+  while (ok && getline(&line, &lineCap, f) > 0) {
+    ++lineNo;
+    const char* p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+    std::string error;
+    ok = compileRuleLine(p, src, error);
+    if (!ok) fprintf(stderr, "fmsdecode: %s:%u: %s\n", path, lineNo, error.c_str());
+  }
+  free(line);
+  fclose(f);
+  if (!ok) return false;
+
+  out.assign(RULES_MAGIC, RULES_MAGIC + sizeof(RULES_MAGIC));
+  out.insert(out.end(), { RULES_VERSION, (uint8_t)src.count, (uint8_t)src.labels.size() });
+  for (const std::string& l : src.labels) {
+    out.push_back((uint8_t)l.size());
+    out.insert(out.end(), l.begin(), l.end());
+  }
+  out.insert(out.end(), src.rules.begin(), src.rules.end());
+  const uint16_t crc = crc16(out.data(), out.size());
+  out.insert(out.end(), { (uint8_t)crc, (uint8_t)(crc >> 8) });
+
+  // The firmware's own check
+  static RuleProgram program;
+  LabelPool<RULES_LABEL_POOL> labels;
+  const char* error = nullptr;
+  if (!program.load(out.data(), out.size(), labels, error)) {
+    fprintf(stderr, "fmsdecode: %s: %u rules, %zu bytes: %s\n", path, src.count, out.size(), error);
+    return false;
+  }
+  fprintf(stderr, "fmsdecode: %s: %u rules, %zu labels, %zu bytes\n", path, src.count, src.labels.size(), out.size());
+  return true;
+}
+
+// Random advertising payload: the AD structures the classifiers look at,
+// with lengths and type bytes around their thresholds, and noise
+static size_t randomPayload(uint8_t* p, SynthRandom& rnd) {
+  static const uint16_t SERVICES[] = { SVC_GOOGLE_FAST_PAIR, SVC_APPLE_FIND_MY, SVC_SAMSUNG_FIND, 0x180F };
+  static const uint16_t COMPANIES[] = { CID_APPLE, CID_GOOGLE, CID_SAMSUNG, CID_XIAOMI, 0x0006 };
+  static const uint8_t TYPES[] = { 0x01, 0x02, 0x06, 0x10, 0x11, 0x12, 0x19, 0x20, 0x23, 0x30, 0x42, 0x07 };
+  size_t n = 0;
+  const uint32_t count = 1 + rnd.below(3);
+  for (uint32_t s = 0; s < count; ++s) {
+    const uint32_t kind = rnd.below(4);
+    const size_t len = rnd.below(8) == 0 ? rnd.below(3) : 2 + rnd.below(20);   // after the type
+    if (n + 2 + len > LEGACY_PAYLOAD_MAX) break;
+    p[n] = (uint8_t)(len + 1);
+    p[n + 1] = kind == 0 ? AD_TYPE_SERVICE_DATA16 : (kind == 1 ? AD_TYPE_MANUFACTURER : (uint8_t)(kind == 2 ? 0x01 : 0x09));
+    uint8_t* d = p + n + 2;
+    for (size_t i = 0; i < len; ++i) d[i] = (uint8_t)rnd.next();
+    const uint16_t id = kind == 0 ? SERVICES[rnd.below(4)] : COMPANIES[rnd.below(5)];
+    if (len >= 1) d[0] = (uint8_t)id;
+    if (len >= 2) d[1] = (uint8_t)(id >> 8);
+    if (len >= 3) d[2] = TYPES[rnd.below(sizeof(TYPES))];   // after the UUID or CID
+    n += 2 + len;
+  }
+  return n;
+}
+
+// Differential check of a rules file against the built-in classifier, and
+// the interpreter's throughput
+static int checkRules(const char* path, unsigned long count) {
+  std::vector<uint8_t> bytes;
+  if (!compileRules(path, bytes)) return 1;
+  static RuleProgram program;
+  static LabelPool<RULES_LABEL_POOL> labels;
+  const char* error = nullptr;
+  program.load(bytes.data(), bytes.size(), labels, error);
+
+  SynthRandom rnd;
+  std::vector<uint8_t> payloads(count * LEGACY_PAYLOAD_MAX);
+  std::vector<size_t> lengths(count);
+  std::vector<uint8_t> enabled(count);
+  for (unsigned long i = 0; i < count; ++i) {
+    lengths[i] = randomPayload(&payloads[i * LEGACY_PAYLOAD_MAX], rnd);
+    enabled[i] = rnd.below(4) == 0 ? (uint8_t)rnd.below(16) : 0xF;   // vendor filter bits
+  }
+
+  unsigned long matched = 0, mismatches = 0;
+  for (unsigned long i = 0; i < count; ++i) {
+    const uint8_t mask = enabled[i];
+    auto isEnabled = [mask](uint16_t cid) {
+      return (cid == CID_APPLE && (mask & 1)) || (cid == CID_GOOGLE && (mask & 2)) ||
+             (cid == CID_SAMSUNG && (mask & 4)) || (cid == CID_XIAOMI && (mask & 8));
+    };
+    DeviceRecord a = {}, b = {};
+    a.payload = b.payload = &payloads[i * LEGACY_PAYLOAD_MAX];
+    a.payloadLen = b.payloadLen = lengths[i];
+    a.deviceType = b.deviceType = "";
+    const bool builtIn = matchFindMy(a, isEnabled);
+    const bool rules = program.match(b, isEnabled);
+    if (builtIn) ++matched;
+    // Unmatched records differ only in the manufacturer the built-in
+    // classifier leaves behind (a disabled vendor's); only raw capture keeps those
+    if (builtIn != rules || strcmp(a.deviceType, b.deviceType) != 0 ||
+        (builtIn && (a.manufacturer != b.manufacturer || a.typeId != b.typeId || a.dataType != b.dataType ||
+                     a.data != b.data || a.dataLen != b.dataLen))) {
+      if (mismatches++ < 5) {
+        fprintf(stderr, "mismatch %lu: built-in %s/%04X/%s, rules %s/%04X/%s, payload", i, builtIn ? "match" : "none",
+                a.manufacturer, a.deviceType, rules ? "match" : "none", b.manufacturer, b.deviceType);
+        for (size_t k = 0; k < lengths[i]; ++k) fprintf(stderr, " %02X", payloads[i * LEGACY_PAYLOAD_MAX + k]);
+        fprintf(stderr, "\n");
+      }
+    }
+  }
+
+  // Throughput, all vendors enabled
+  const clock_t start = clock();
+  unsigned long hits = 0;
+  const int rounds = 20;
+  for (int r = 0; r < rounds; ++r) {
+    for (unsigned long i = 0; i < count; ++i) {
+      DeviceRecord d = {};
+      d.payload = &payloads[i * LEGACY_PAYLOAD_MAX];
+      d.payloadLen = lengths[i];
+      hits += program.match(d, [](uint16_t) { return true; });
+    }
+  }
+  const double sec = (double)(clock() - start) / CLOCKS_PER_SEC;
+  const double advs = (double)count * rounds;
+
+  printf("%lu reports, %lu matched by the built-in classifier, %lu mismatches\n", count, matched, mismatches);
+  printf("%.1f M advs/s x %zu rules = %.0f M rules*advs/s (%lu hits)\n",
+         advs / sec / 1e6, program.rules(), advs * program.rules() / sec / 1e6, hits);
+  return mismatches == 0 ? 0 : 1;
+}
+
+static int runRules(int argc, char** argv) {
+  if (argc < 2) return -1;
+  if (strcmp(argv[0], "check") == 0) return checkRules(argv[1], argc >= 3 ? strtoul(argv[2], nullptr, 10) : 200000);
+
+  std::vector<uint8_t> bytes;
+  if (strcmp(argv[0], "compile") == 0) {
+    if (!compileRules(argv[1], bytes)) return 1;
+    fwrite(bytes.data(), 1, bytes.size(), stdout);
+    return 0;
+  }
+  // Serial commands for the firmware; lines fit its 64-byte command buffer
+  if (strcmp(argv[0], "serial") == 0) {
+    if (!compileRules(argv[1], bytes)) return 1;
+    printf("rules begin\n");
+    for (size_t i = 0; i < bytes.size(); i += 24) {
+      printf("rules +");
+      for (size_t k = i; k < bytes.size() && k < i + 24; ++k) printf("%s%02X", k == i ? " " : "", bytes[k]);
+      printf("\n");
+    }
+    printf("rules end\n");
+    return 0;
+  }
+  return -1;
+}
+
+// --------- Signature scan ---------
+
+// Random signature set shaped like the built-in one: an AD type byte, then
+// a UUID or company ID and a few more bytes. About a third extend an
+// earlier signature and a third are a suffix of one, so the trie shares
+// prefixes and the dictionary links get used.
+static void randomSignatures(SignatureSet& set, size_t count, SynthRandom& rnd) {
+  static const uint8_t AD_TYPES[] = { AD_TYPE_MANUFACTURER, AD_TYPE_SERVICE_DATA16, 0x03, 0x09 };
+  set.clear();
+  char label[SIG_LABEL_MAX + 1];
+  while (set.size() < count) {
+    uint8_t bytes[SIG_MAX_LEN];
+    size_t len;
+    const uint32_t kind = set.size() == 0 ? 0 : rnd.below(3);
+    if (kind == 0) {
+      bytes[0] = AD_TYPES[rnd.below(sizeof(AD_TYPES))];
+      len = 2 + rnd.below(4);
+      for (size_t i = 1; i < len; ++i) bytes[i] = (uint8_t)rnd.next();
+    } else {
+      const Signature& from = set[rnd.below((uint32_t)set.size())];
+      if (kind == 1) {
+        if ((size_t)from.len + 1 > SIG_MAX_LEN) continue;
+        len = from.len + 1 + rnd.below(2);
+        if (len > SIG_MAX_LEN) len = SIG_MAX_LEN;
+        memcpy(bytes, from.bytes, from.len);
+        for (size_t i = from.len; i < len; ++i) bytes[i] = (uint8_t)rnd.next();
+      } else {
+        if (from.len < 2) continue;
+        const size_t skip = 1 + rnd.below(from.len - 1);
+        len = from.len - skip;
+        memcpy(bytes, from.bytes + skip, len);
+      }
+    }
+    snprintf(label, sizeof(label), "s%u", (unsigned)set.size());
+    set.add(label, bytes, len);   // a duplicate is simply drawn again
+  }
+}
+
+// Random payload with a signature of the set planted in half of them
+static size_t sigPayload(uint8_t* p, const SignatureSet& set, SynthRandom& rnd) {
+  const size_t n = randomPayload(p, rnd);
+  if (set.size() == 0 || n == 0 || rnd.below(2) == 0) return n;
+  const Signature& s = set[rnd.below((uint32_t)set.size())];
+  if (s.len > n) return n;
+  memcpy(p + rnd.below((uint32_t)(n - s.len + 1)), s.bytes, s.len);
+  return n;
+}
+
+// Every signature at every offset, as (end, signature)
+static void naiveScan(const SignatureSet& set, const uint8_t* p, size_t n,
+                      std::vector<std::pair<size_t, uint16_t>>& hits) {
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t k = 0; k < set.size(); ++k) {
+      const Signature& s = set[k];
+      if (s.len <= n - i && memcmp(p + i, s.bytes, s.len) == 0) hits.push_back({ i + s.len, (uint16_t)k });
+    }
+  }
+}
+
+// Differential check of the automaton against a naive search, and a timing
+// sweep over the number of signatures
+static int checkSignatures(unsigned long count) {
+  static const size_t SIZES[] = { 1, 4, 16, 64, 128, 192, 256 };
+  static SignatureSet set;
+  static SignatureMatcher matcher;
+  SynthRandom rnd;
+  std::vector<uint8_t> payloads(count * LEGACY_PAYLOAD_MAX);
+  std::vector<size_t> lengths(count);
+  std::vector<std::pair<size_t, uint16_t>> expected, found;
+  unsigned long mismatches = 0, bytes = 0;
+
+  printf("%8s %7s %11s %12s %12s %9s\n", "sigs", "states", "transitions", "ns/report", "naive ns", "hits");
+  for (const size_t size : SIZES) {
+    randomSignatures(set, size, rnd);
+    if (!matcher.build(set)) {
+      printf("%8zu: does not fit the automaton\n", size);
+      ++mismatches;
+      continue;
+    }
+    for (unsigned long i = 0; i < count; ++i) {
+      lengths[i] = sigPayload(&payloads[i * LEGACY_PAYLOAD_MAX], set, rnd);
+      bytes += lengths[i];
+    }
+
+    // The automaton reports hits by where they end, longest first; compare
+    // as sorted lists
+    unsigned long hits = 0;
+    for (unsigned long i = 0; i < count; ++i) {
+      const uint8_t* p = &payloads[i * LEGACY_PAYLOAD_MAX];
+      expected.clear();
+      found.clear();
+      naiveScan(set, p, lengths[i], expected);
+      matcher.scan(p, lengths[i], [&](uint16_t sig, size_t offset) {
+        found.push_back({ offset + set[sig].len, sig });
+      });
+      hits += expected.size();
+      std::sort(expected.begin(), expected.end());
+      std::sort(found.begin(), found.end());
+      if (expected != found && mismatches++ < 5) {
+        fprintf(stderr, "mismatch: %zu signatures, %zu hits against %zu naive, payload", size, found.size(),
+                expected.size());
+        for (size_t k = 0; k < lengths[i]; ++k) fprintf(stderr, " %02X", p[k]);
+        fprintf(stderr, "\n");
+      }
+    }
+
+    // Best of three rounds each; both count the hits, so neither is optimised away
+    double scanSec = 1e9, naiveSec = 1e9;
+    unsigned long scanHits = 0, naiveHits = 0;
+    for (int round = 0; round < 3; ++round) {
+      clock_t start = clock();
+      for (unsigned long i = 0; i < count; ++i) {
+        scanHits += matcher.scan(&payloads[i * LEGACY_PAYLOAD_MAX], lengths[i], [](uint16_t, size_t) {});
+      }
+      scanSec = std::min(scanSec, (double)(clock() - start) / CLOCKS_PER_SEC);
+      start = clock();
+      for (unsigned long i = 0; i < count; ++i) {
+        const uint8_t* p = &payloads[i * LEGACY_PAYLOAD_MAX];
+        for (size_t at = 0; at < lengths[i]; ++at) {
+          for (size_t k = 0; k < set.size(); ++k) {
+            const Signature& s = set[k];
+            naiveHits += s.len <= lengths[i] - at && memcmp(p + at, s.bytes, s.len) == 0;
+          }
+        }
+      }
+      naiveSec = std::min(naiveSec, (double)(clock() - start) / CLOCKS_PER_SEC);
+    }
+    if (scanHits != naiveHits) ++mismatches;
+    printf("%8zu %7zu %11zu %12.0f %12.0f %9lu\n", size, matcher.states(), matcher.transitions(),
+           scanSec / count * 1e9, naiveSec / count * 1e9, hits);
+  }
+  printf("%lu reports per size, %.1f bytes on average, %lu mismatches\n", count,
+         (double)bytes / count / (sizeof(SIZES) / sizeof(SIZES[0])), mismatches);
+  return mismatches == 0 ? 0 : 1;
+}
+
+static int runSignatures(int argc, char** argv) {
+  if (argc < 1 || strcmp(argv[0], "check") != 0) return -1;
+  return checkSignatures(argc >= 2 ? strtoul(argv[1], nullptr, 10) : 20000);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: fmsdecode cbor [csv|jsonl] < capture\n"
+          "       fmsdecode delta [csv|jsonl] < capture\n"
+          "       fmsdecode expand [csv|jsonl] < capture\n"
+          "       fmsdecode unz < capture\n"
+          "       fmsdecode verify log|csv|yaml|jsonl|cbor|delta|pcap|compact < capture\n"
+          "       fmsdecode pcap --out PREFIX [--rotate-mb N] [--rotate-sec N] < capture\n"
+          "       fmsdecode pcap --fifo PATH < capture\n"
+          "       fmsdecode schedule [--duty N] [--cpu N] [--active] [--unmatched] < capture.csv|compact\n"
+          "       fmsdecode synth FORMAT|raw [N] > capture\n"
+          "       fmsdecode rules compile FILE > rules.fmr\n"
+          "       fmsdecode rules serial FILE > /dev/ttyUSB0\n"
+          "       fmsdecode rules check FILE [N]\n"
+          "       fmsdecode sig check [N]\n"
+          "       fmsdecode raw < capture > capture.csv\n"
+          "       fmsdecode link-bench [DEVICES] [MINUTES] [SEED]\n"
+          "       fmsdecode format check|parse [N]\n");
+}
+
+int main(int argc, char** argv) {
+  // The firmware has no timezone configured; print the same wall clock
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  if (argc < 2) {
+    usage();
+    return 2;
+  }
+
+  if (strcmp(argv[1], "unz") == 0) return decodeLzss();
+  if (strcmp(argv[1], "raw") == 0) return decodeRaw();
+
+  if (strcmp(argv[1], "verify") == 0) {
+    const int rc = verifyCapture(argc >= 3 ? argv[2] : "");
+    if (rc < 0) usage();
+    return rc < 0 ? 2 : rc;
+  }
+
+  if (strcmp(argv[1], "pcap") == 0) {
+    const int rc = decodePcap(argc - 2, argv + 2);
+    if (rc < 0) usage();
+    return rc < 0 ? 2 : rc;
+  }
+
+  if (strcmp(argv[1], "schedule") == 0) {
+    const int rc = replaySchedule(argc - 2, argv + 2);
+    if (rc < 0) usage();
+    return rc < 0 ? 2 : rc;
+  }
+
+  if (strcmp(argv[1], "rules") == 0) {
+    const int rc = runRules(argc - 2, argv + 2);
+    if (rc < 0) usage();
+    return rc < 0 ? 2 : rc;
+  }
+
+  if (strcmp(argv[1], "sig") == 0) {
+    const int rc = runSignatures(argc - 2, argv + 2);
+    if (rc < 0) usage();
+    return rc < 0 ? 2 : rc;
+  }
+
+  if (strcmp(argv[1], "link-bench") == 0) {
+    const int rc = linkBench(argc - 2, argv + 2);
+    if (rc < 0) usage();
+    return rc < 0 ? 2 : rc;
+  }
+
+  if (strcmp(argv[1], "format") == 0) {
+    const int rc = runFormat(argc - 2, argv + 2);
+    if (rc < 0) usage();
+    return rc < 0 ? 2 : rc;
+  }
+
+  if (strcmp(argv[1], "synth") == 0) {
+    const int rc = writeSynthetic(argc - 2, argv + 2);
+    if (rc < 0) usage();
+    return rc < 0 ? 2 : rc;
+  }
+
+  const FormatOps* out = findFormat(argc >= 3 ? argv[2] : "csv");
+  // Text formats only
+  if (out == nullptr || out->id == OutputFormat::CBOR || out->id == OutputFormat::PCAP ||
+      out->id == OutputFormat::DELTA || out->id == OutputFormat::COMPACT) {
+    usage();
+    return 2;
+  }
+
+  if (strcmp(argv[1], "cbor") == 0) return decodeCbor(out);
+  if (strcmp(argv[1], "delta") == 0) return decodeDelta(out);
+  if (strcmp(argv[1], "expand") == 0) return expandCompact(out);
+
+  usage();
+  return 2;
+}